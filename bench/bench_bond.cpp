@@ -0,0 +1,98 @@
+// Host benchmark: boot to driving, with and without a bonded peer.
+// A receiver BugComm is switched on, then a controller up to MAX_START_GAP_US later; the time is from
+// the controller's begin() until it has paired, which is when a controller starts driving. Each
+// trial is a fresh pair of objects, a power cycle, keeping the same addresses and bond files.
+//   first boot:   no bonds; both scan (NOWCOMM_CHANNEL_AUTO)
+//   restart:      both have the bond saved by the last pairing
+//   stale bond:   the receiver has forgotten; the controller tries its bond, then scans
+// Exits non-zero if any trial fails to pair within PAIR_LIMIT_MS, or a restart doesn't resume.
+//
+// pio run -e native_bond && .pio/build/native_bond/program
+
+#include <algorithm>
+#include <vector>
+#include <BugComm.h>
+
+#define TRIALS              40
+#define PAIR_LIMIT_MS       3000
+#define MAX_START_GAP_US    300000UL      // The controller is switched on up to this long after the receiver
+#define CONTROLLER_BOND     "/tmp/nowcomm_bench_controller.bond"
+#define RECEIVER_BOND       "/tmp/nowcomm_bench_receiver.bond"
+
+
+typedef BasicBugComm<LoopbackTransport> Comm;
+
+enum Scenario { FIRST_BOOT, RESTART, STALE_BOND };
+
+static const uint8_t        controller_mac[6] = { 0x02, 0x42, 0x4F, 0x4E, 0x44, 0x01 };
+static const uint8_t        receiver_mac[6]   = { 0x02, 0x42, 0x4F, 0x4E, 0x44, 0x02 };
+static NowCommFileBondStore controller_store(CONTROLLER_BOND);
+static NowCommFileBondStore receiver_store(RECEIVER_BOND);
+
+
+// Returns microseconds from the controller's begin() until it has paired, or 0 on timeout.
+// resumed is set if both sides paired through their bond.
+//
+static unsigned long trial(Scenario scenario, bool& resumed) {
+  Comm          controller;
+  Comm          receiver;
+  unsigned long gap   = nowcomm_random() % MAX_START_GAP_US;
+  unsigned long start = micros();
+  unsigned long controller_us = 0;
+  if(FIRST_BOOT == scenario) {
+    controller_store.clear();
+    receiver_store.clear();
+  }
+  if(STALE_BOND == scenario) receiver_store.clear();
+  controller.get_transport().set_mac_address(controller_mac);
+  receiver.get_transport().set_mac_address(receiver_mac);
+  controller.set_bond_store(&controller_store);
+  receiver.set_bond_store(&receiver_store);
+  receiver.begin(NOWCOMM_MODE_RECEIVER, NOWCOMM_CHANNEL_AUTO);
+  while(micros() - start < gap + PAIR_LIMIT_MS * 1000UL) {
+    if(!controller_us && micros() - start >= gap) {
+      controller.begin(NOWCOMM_MODE_CONTROLLER, NOWCOMM_CHANNEL_AUTO);
+      controller_us = micros();
+    }
+    bool done = receiver.service_pairing();
+    if(controller_us && controller.service_pairing() && done) {
+      resumed = controller.is_resumed() && receiver.is_resumed();
+      return std::max(1UL, controller.get_time_to_pair());
+    }
+  }
+  return 0;
+}
+
+
+static bool run(const char* name, Scenario scenario) {
+  std::vector<unsigned long> times;
+  int       failed      = 0;
+  int       resumed     = 0;
+  for(int i = 0; i < TRIALS; i++) {
+    bool          r = false;
+    unsigned long t = trial(scenario, r);
+    if(t) times.push_back(t);
+    else  failed++;
+    resumed += r;
+  }
+  std::sort(times.begin(), times.end());
+  double sum = 0;
+  for(unsigned long t : times) sum += t;
+  printf("%-12s %d trials, %d failed, %d resumed; boot to driving mean %.1f ms, p50 %.1f ms, max %.1f ms\n",
+         name, TRIALS, failed, resumed, times.empty() ? 0 : sum / times.size() / 1000.0,
+         times.empty() ? 0 : times[times.size() / 2] / 1000.0, times.empty() ? 0 : times.back() / 1000.0);
+  return 0 == failed && (RESTART != scenario || TRIALS == resumed) && (RESTART == scenario || 0 == resumed);
+}
+
+
+int main() {
+  printf("controller tries its bond for %lu ms; receiver holds its bonded channel for %lu ms\n",
+         NOWCOMM_BOND_TRY_US / 1000, NOWCOMM_BOND_HOLD_US / 1000);
+  bool ok = run("first boot", FIRST_BOOT);
+  ok &= run("restart", RESTART);
+  ok &= run("stale bond", STALE_BOND);
+  controller_store.clear();
+  receiver_store.clear();
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,287 @@
+// Host benchmark: packet capture, and replaying a capture through the receiver.
+//   cost:     ns per capture record, then BugComm round trips with capture off, into the ring, and into the
+//             ring and a file
+//   session:  a loopback controller sends SESSION_COMMANDS commands, a few of them invalid, to a receiver
+//             while capture writes to a file; what the receiver made of each is kept as the golden values.
+//             The file is then replayed through a new receiver twice, as the receiver's trace and as the
+//             controller's (only what it sent), and must decode to the same values. The ring's dump() must
+//             be the file's last NOWCOMM_CAPTURE_DEPTH records, byte for byte.
+//   copies:   a controller sends three commands with copies of the earlier ones, and the frame carrying
+//             the second is cut from its trace; the replay must still get the second, from the third
+//   replay:   frames per second decoded as fast as possible, over REPLAY_PASSES passes, and the time a
+//             replay at recorded speed takes against the session's
+// Exits non-zero if a replay disagrees with the session, misses the copied command, or the dump
+// disagrees with the file.
+//
+// pio run -e native_capture && .pio/build/native_capture/program
+
+#include <chrono>
+#include <vector>
+#include <BugComm.h>
+#include <BugReplay.h>
+
+#define CAPTURE_RECORDS     2000000
+#define ROUND_TRIPS         20000
+#define SESSION_COMMANDS    2000
+#define SESSION_GAP_US      200           // Between commands, so recorded speed is worth timing
+#define INVALID_EVERY       97            // Every this many commands, one with a speed out of range
+#define REPLAY_PASSES       200
+#define TRACE               "/tmp/nowcomm_bench.cap"
+#define COPIES_TRACE        "/tmp/nowcomm_bench_copies.cap"
+
+
+typedef BasicBugComm<LoopbackTransport>               Comm;
+typedef BugNowComm<LoopbackTransport>                 Raw;
+
+static const uint8_t  stick_mac[6]  = { 0x02, 0x53, 0x54, 0x49, 0x43, 0x4B };
+static const uint8_t  robot_mac[6]  = { 0x02, 0x52, 0x4F, 0x42, 0x4F, 0x54 };
+
+
+struct MemoryOut {
+  std::vector<uint8_t> bytes;
+  void    write(const uint8_t* data, size_t len) { bytes.insert(bytes.end(), data, data + len); }
+};
+
+
+static double ns_since(std::chrono::steady_clock::time_point start, long count) {
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+}
+
+
+static bool pair(Comm& controller, Comm& receiver) {
+  controller.get_transport().set_mac_address(stick_mac);
+  receiver.get_transport().set_mac_address(robot_mac);
+  controller.begin(NOWCOMM_MODE_CONTROLLER, 1);
+  receiver.begin(NOWCOMM_MODE_RECEIVER, 1);
+  for(int i = 0; i < 1000; i++) {
+    bool done = controller.service_pairing();
+    if(receiver.service_pairing() && done) return true;
+    delay(1);
+  }
+  return false;
+}
+
+
+static BugReplayOutput output_of(Comm& receiver, uint16_t seq) {
+  BugReplayOutput output;
+  output.seq          = seq;
+  for(uint8_t i = 0; i < 4; i++) output.speeds[i] = (int8_t)receiver.get_motor_speed(i);
+  output.color_left   = receiver.get_light_color(0);
+  output.color_right  = receiver.get_light_color(1);
+  output.button       = receiver.get_button();
+  return output;
+}
+
+
+static bool same(const BugReplayOutput& a, const BugReplayOutput& b) {
+  return a.seq == b.seq && 0 == memcmp(a.speeds, b.speeds, 4) && a.color_left == b.color_left &&
+         a.color_right == b.color_right && a.button == b.button;
+}
+
+
+static long round_trips(Comm& controller, Comm& receiver) {
+  BugCommand command;
+  auto start = std::chrono::steady_clock::now();
+  for(int i = 0; i < ROUND_TRIPS; i++) {
+    command.speed_0 = (int8_t)(i % 100);
+    controller.Raw::send_command(&command);
+    receiver.update();
+    while(receiver.is_data_ready()) receiver.clear_data_ready();
+    controller.update();
+    while(controller.is_data_ready()) controller.clear_data_ready();
+  }
+  return (long)ns_since(start, ROUND_TRIPS);
+}
+
+
+static void cost() {
+  static const uint8_t frame[8] = { 0x41, 0x07, 0x00, 10, 20, 30, 40, 0x03 };
+  nowcomm_capture().enable(true);
+  auto start = std::chrono::steady_clock::now();
+  for(int i = 0; i < CAPTURE_RECORDS; i++) nowcomm_capture().add(NOWCOMM_CAPTURE_TX, 1, stick_mac, frame, sizeof(frame));
+  printf("capture: %.1f ns per record into the ring\n", ns_since(start, CAPTURE_RECORDS));
+  nowcomm_capture().enable(false);
+
+  Comm controller, receiver;
+  if(!pair(controller, receiver)) { printf("cost: pairing failed\n"); return; }
+  long off  = round_trips(controller, receiver);
+  nowcomm_capture().enable(true);
+  long ring = round_trips(controller, receiver);
+  nowcomm_capture().open(TRACE);
+  long file = round_trips(controller, receiver);
+  nowcomm_capture().close();
+  nowcomm_capture().enable(false);
+  printf("round trip, %d: capture off %ld ns, ring %ld ns (+%ld), ring and file %ld ns (+%ld)\n",
+         ROUND_TRIPS, off, ring, ring - off, file, file - off);
+}
+
+
+// Run a session with capture on, and keep what the receiver decoded. Returns its length in us.
+//
+static unsigned long session(std::vector<BugReplayOutput>& golden, uint32_t& rejected) {
+  Comm          controller, receiver;
+  BugCommand    command;
+  nowcomm_capture().open(TRACE);
+  nowcomm_capture().enable(true);
+  if(!pair(controller, receiver)) { printf("session: pairing failed\n"); return 0; }
+  unsigned long start = micros();
+  for(int i = 0; i < SESSION_COMMANDS; i++) {
+    command.speed_0     = (int8_t)(i % 201 - 100);
+    command.speed_1     = (int8_t)(100 - i % 201);
+    command.speed_2     = (int8_t)(i % 21 * 10 - 100);
+    command.speed_3     = (0 == i % INVALID_EVERY) ? 120 : (int8_t)(i % 7);
+    command.color_left  = i % 8;
+    command.color_right = (i / 8) % 8;
+    command.button      = 0 == i % 5;
+    controller.Raw::send_command(&command);
+    receiver.update();
+    while(receiver.is_data_ready()) {
+      if(NOWCOMM_KIND_COMMAND == receiver.get_msg_kind()) golden.push_back(output_of(receiver, (uint16_t)(golden.size() + rejected)));
+      receiver.clear_data_ready();
+    }
+    rejected = receiver.get_rx_rejected();
+    controller.update();
+    while(controller.is_data_ready()) controller.clear_data_ready();
+    unsigned long until = start + (i + 1) * SESSION_GAP_US;
+    while((long)(micros() - until) < 0) {}
+  }
+  unsigned long took = micros() - start;
+  nowcomm_capture().enable(false);
+  nowcomm_capture().close();
+  return took;
+}
+
+
+static bool load(BugReplay<>& replay, bool sent_only) {
+  NowCommCaptureReader reader;
+  FILE*   in = fopen(TRACE, "rb");
+  uint8_t buffer[4096];
+  size_t  got;
+  if(nullptr == in) return false;
+  while(0 < (got = fread(buffer, 1, sizeof(buffer), in))) {
+    reader.put(buffer, got, [&](const NowComm_CaptureRecord& record) {
+      if(!sent_only || (record.flags & (NOWCOMM_CAPTURE_TX | NOWCOMM_CAPTURE_BEGIN))) replay.add(record);
+    });
+  }
+  fclose(in);
+  return 0 == reader.get_skipped();
+}
+
+
+// The seqs in golden count commands; a replay's are the frames'. Compare everything but.
+//
+static bool replay_matches(const char* name, bool sent_only, const std::vector<BugReplayOutput>& golden, uint32_t rejected) {
+  BugReplay<>     replay;
+  BugReplayStats  stats;
+  uint32_t        index       = 0;
+  uint32_t        mismatches  = 0;
+  if(!load(replay, sent_only)) { printf("%s: the trace has bytes that aren't records\n", name); return false; }
+  replay.run(false, 1, [&](const BugReplayOutput& output) {
+    BugReplayOutput want = index < golden.size() ? golden[index] : BugReplayOutput();
+    want.seq = output.seq;
+    if(!same(output, want)) mismatches++;
+    index++;
+  }, stats);
+  bool ok = 0 == mismatches && golden.size() == stats.commands && rejected == stats.rejected;
+  printf("  %-22s %u frames, %u commands decoded, %u rejected (session %u, %u), %u mismatched%s\n", name, stats.frames,
+         stats.commands, stats.rejected, (uint32_t)golden.size(), rejected, mismatches, ok ? "" : "  FAILED");
+  return ok;
+}
+
+
+static bool dump_matches() {
+  MemoryOut dump;
+  uint32_t  count = nowcomm_capture().dump(dump);
+  FILE*     in    = fopen(TRACE, "rb");
+  std::vector<uint8_t> file;
+  uint8_t   buffer[4096];
+  size_t    got;
+  if(nullptr == in) return false;
+  while(0 < (got = fread(buffer, 1, sizeof(buffer), in))) file.insert(file.end(), buffer, buffer + got);
+  fclose(in);
+  bool ok = dump.bytes.size() <= file.size() && std::equal(dump.bytes.begin(), dump.bytes.end(), file.end() - dump.bytes.size());
+  printf("  ring dump: %u records, %zu bytes; %s the end of the file (%zu bytes)\n", count, dump.bytes.size(), ok ? "same as" : "DIFFERENT FROM", file.size());
+  return ok && NOWCOMM_CAPTURE_DEPTH == count;
+}
+
+
+// Three different commands sent with two copies each, captured to COPIES_TRACE. The controller's trace
+// is replayed without the frame that first carried the second, which the third frame holds a copy of.
+//
+static bool copies() {
+  Comm          controller, receiver;
+  BugCommand    commands[3];
+  std::vector<BugReplayOutput> golden;
+  for(int i = 0; i < 3; i++) commands[i].speed_0 = (int8_t)(10 * (i + 1));
+  nowcomm_capture().open(COPIES_TRACE);
+  nowcomm_capture().enable(true);
+  bool paired = pair(controller, receiver);
+  controller.set_redundancy(2);
+  for(BugCommand& command : commands) {
+    controller.Raw::send_command(&command);
+    receiver.update();
+    while(receiver.is_data_ready()) {
+      if(NOWCOMM_KIND_COMMAND == receiver.get_msg_kind()) golden.push_back(output_of(receiver, receiver.get_msg_seq()));
+      receiver.clear_data_ready();
+    }
+  }
+  nowcomm_capture().enable(false);
+  nowcomm_capture().close();
+  if(!paired) { printf("copies: pairing failed\n"); return false; }
+
+  NowCommCaptureReader reader;
+  BugReplay<>          replay;
+  BugReplayStats       stats;
+  FILE*                in       = fopen(COPIES_TRACE, "rb");
+  uint8_t              buffer[4096];
+  size_t               got;
+  int                  redundant = 0;
+  if(nullptr == in) return false;
+  while(0 < (got = fread(buffer, 1, sizeof(buffer), in))) {
+    reader.put(buffer, got, [&](const NowComm_CaptureRecord& record) {
+      if(!(record.flags & (NOWCOMM_CAPTURE_TX | NOWCOMM_CAPTURE_BEGIN))) return;
+      if(0 < record.captured && NOWCOMM_KIND_REDUNDANT == nowcomm_header_kind(record.data[0]) && 2 == ++redundant) return;
+      replay.add(record);
+    });
+  }
+  fclose(in);
+  uint32_t index      = 0;
+  uint32_t mismatches = 0;
+  replay.run(false, 1, [&](const BugReplayOutput& output) {
+    if(index >= golden.size() || !same(output, golden[index])) mismatches++;
+    index++;
+  }, stats);
+  bool ok = 3 == golden.size() && 2 == stats.frames && 3 == stats.commands && 0 == mismatches;
+  printf("copies: %u frames of 3 replayed, %u commands decoded of %zu sent, %u mismatched%s\n", stats.frames, stats.commands,
+         golden.size(), mismatches, ok ? "" : "  FAILED");
+  return ok;
+}
+
+
+static void throughput(unsigned long recorded_us) {
+  BugReplay<>     replay;
+  BugReplayStats  stats;
+  load(replay, false);
+  replay.run(false, REPLAY_PASSES, [](const BugReplayOutput&) {}, stats);
+  printf("replay, as fast as possible: %u frames in %.1f ms, %.0f frames/s, %.0f commands/s\n", stats.frames, stats.us / 1000.0,
+         stats.frames / (stats.us / 1e6), stats.commands / (stats.us / 1e6));
+  replay.run(true, 1, [](const BugReplayOutput&) {}, stats);
+  printf("replay, at recorded speed: %u frames in %.1f ms; the session took %.1f ms\n", stats.frames, stats.us / 1000.0, recorded_us / 1000.0);
+}
+
+
+int main() {
+  std::vector<BugReplayOutput>  golden;
+  uint32_t                      rejected = 0;
+  cost();
+  unsigned long took = session(golden, rejected);
+  printf("session: %d commands in %.1f ms, %u captured\n", SESSION_COMMANDS, took / 1000.0, nowcomm_capture().get_captured());
+  bool ok = 0 < took;
+  ok &= replay_matches("as the receiver", false, golden, rejected);
+  ok &= replay_matches("as the controller sent", true, golden, rejected);
+  ok &= dump_matches();
+  ok &= copies();
+  throughput(took);
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
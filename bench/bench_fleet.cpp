@@ -0,0 +1,140 @@
+// Host benchmark: one controller driving a fleet of receivers.
+// A controller BugComm pairs with FLEET_SIZE receiving BugComms on the loopback transport, then
+// updates the fleet FLEET_UPDATES times, first with one unicast command per robot and then with one
+// multiplexed frame. Reports frames on the air per update, delivery to each robot and its link stats.
+// Then asks for a peer past the end of the table, which must be refused rather than read past it.
+// Exits non-zero if any robot misses an update or receives another robot's command.
+//
+// pio run -e native_fleet && .pio/build/native_fleet/program
+
+#include <chrono>
+#include <BugComm.h>
+
+#define FLEET_SIZE        6             // LOOPBACK_MAX_ENDPOINTS less the controller, less one spare
+#define FLEET_UPDATES     10000
+
+
+typedef BasicBugComm<LoopbackTransport> Comm;
+
+
+static int8_t peer_of(Comm& controller, Comm& robot) {
+  uint8_t mac[6];
+  robot.get_transport().get_mac_address(mac);
+  return controller.find_peer(mac);
+}
+
+
+static void pump(Comm& controller, Comm* robots, uint32_t* received, int8_t* speeds) {
+  Comm::Message msg;
+  for(int r = 0; r < FLEET_SIZE; r++) {
+    robots[r].update();
+    while(robots[r].receive(msg)) {
+      if(NOWCOMM_KIND_COMMAND != msg.kind) continue;
+      received[r]++;
+      speeds[r] = msg.get<BugCommand>()->speed_0;
+    }
+  }
+  controller.update();
+  while(controller.receive(msg)) {}
+}
+
+
+// Pair the whole fleet: the controller's discovery stays open until FLEET_SIZE robots have answered.
+//
+static bool pair(Comm& controller, Comm* robots) {
+  controller.set_discovery_limit(FLEET_SIZE);
+  controller.begin(NOWCOMM_MODE_CONTROLLER, 1);
+  for(int r = 0; r < FLEET_SIZE; r++) robots[r].begin(NOWCOMM_MODE_RECEIVER, 1);
+  for(int round = 0; round < 100 && controller.is_discovery_open(); round++) {
+    controller.send_discovery();
+    for(int i = 0; i < 10; i++) {
+      for(int r = 0; r < FLEET_SIZE; r++) {
+        robots[r].update();
+        while(robots[r].is_data_ready()) {
+          if(NOWCOMM_KIND_DISCOVERY == robots[r].get_msg_kind()) robots[r].process_discovery_response();
+          else                                                   robots[r].clear_data_ready();
+        }
+      }
+      controller.update();
+      while(controller.is_data_ready()) {
+        if(NOWCOMM_KIND_DISCOVERY == controller.get_msg_kind()) controller.process_discovery_response();
+        else                                                    controller.clear_data_ready();
+      }
+    }
+  }
+  return FLEET_SIZE == controller.get_peer_count();
+}
+
+
+// Each robot gets its own speed, so a robot that takes another's slot is caught.
+//
+static bool run(Comm& controller, Comm* robots, bool multiplexed) {
+  uint32_t    received[FLEET_SIZE]  = { 0 };
+  int8_t      speeds[FLEET_SIZE]    = { 0 };
+  uint32_t    wrong                 = 0;
+  BugCommand  commands[FLEET_SIZE];
+  uint32_t    frames_before         = controller.get_transport().get_frames_sent();
+  controller.reset_link_stats();
+  auto start = std::chrono::steady_clock::now();
+  for(int u = 0; u < FLEET_UPDATES; u++) {
+    for(int r = 0; r < FLEET_SIZE; r++) {
+      commands[r].speed_0 = (int8_t)(r * 10 + (u & 7));
+      commands[r].speed_1 = (int8_t)-r;
+      if(!multiplexed) controller.send_command(&commands[r], peer_of(controller, robots[r]));
+    }
+    if(multiplexed) {
+      // Slots follow the controller's peer table, which is in pairing order.
+      BugCommand ordered[FLEET_SIZE];
+      for(int r = 0; r < FLEET_SIZE; r++) ordered[peer_of(controller, robots[r])] = commands[r];
+      controller.send_multiplexed(ordered);
+    }
+    pump(controller, robots, received, speeds);
+    for(int r = 0; r < FLEET_SIZE; r++) if(speeds[r] != commands[r].speed_0) wrong++;
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  uint32_t frames = controller.get_transport().get_frames_sent() - frames_before;
+  printf("%s: %.2f frames on the air per fleet update, %.0f updates/s, %u wrong\n", multiplexed ? "multiplexed" : "unicast",
+         (double)frames / FLEET_UPDATES, FLEET_UPDATES / seconds, wrong);
+  bool ok = 0 == wrong;
+  for(int r = 0; r < FLEET_SIZE; r++) {
+    NowComm_LinkStats stats;
+    uint8_t           peer = peer_of(controller, robots[r]);
+    controller.get_link_stats(stats, peer);
+    printf("  robot %d (peer %u): received %u, acked %u of %u, lost %u, rtt p50 %u us\n",
+           r, peer, received[r], stats.acked, stats.sent, stats.lost, stats.rtt_p50_us);
+    ok &= FLEET_UPDATES == received[r];
+  }
+  return ok;
+}
+
+
+// A peer index past the paired ones: nothing is sent, and there is no address or stats.
+//
+static bool out_of_range(Comm& controller) {
+  BugCommand        command;
+  NowComm_LinkStats stats;
+  uint8_t           peer    = controller.get_peer_count();
+  uint32_t          before  = controller.get_transport().get_frames_sent();
+  bool              sent    = controller.send_command(&command, peer);
+  bool              counted = controller.get_link_stats(stats, peer);
+  bool              ok      = !sent && !counted && 0 == stats.sent && nullptr == controller.get_peer_address(peer) &&
+                              before == controller.get_transport().get_frames_sent();
+  printf("peer %u with %u paired: %s\n", peer, peer, ok ? "refused" : "NOT REFUSED");
+  return ok;
+}
+
+
+int main() {
+  static Comm controller;
+  static Comm robots[FLEET_SIZE];
+  if(!pair(controller, robots)) {
+    printf("paired %u of %d robots => FAILED\n", controller.get_peer_count(), FLEET_SIZE);
+    return 1;
+  }
+  printf("paired %d robots\n", FLEET_SIZE);
+  bool ok = run(controller, robots, false);
+  ok &= run(controller, robots, true);
+  ok &= out_of_range(controller);
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
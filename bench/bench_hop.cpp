@@ -0,0 +1,136 @@
+// Host benchmark: adaptive channel hopping.
+// A controller and a receiver BugComm pair on channel 6 of the loopback transport, with hopping on, and
+// the controller sends a command every COMMAND_PERIOD_US. At NOISE_AT_MS channel 6 starts losing
+// NOISY_LOSS% of its frames. Channel 7, the first the controller will try, is almost as bad, so a
+// good run hops twice and settles on a clean channel. Prints a timeline of channel and delivery,
+// then each hop's latency, outage and post-hop loss. Both sides keep a bond, which must end up on the
+// channel they hopped to, so a restart resumes there.
+// Exits non-zero if the pair ends up apart, on a lossy channel, still losing frames, or bonded to another
+// channel.
+//
+// pio run -e native_hop && .pio/build/native_hop/program
+
+#include <BugComm.h>
+
+#define RUN_MS              12000
+#define WINDOW_MS           500
+#define NOISE_AT_MS         3000
+#define NOISY_LOSS          40
+#define START_CHANNEL       6
+#define COMMAND_PERIOD_US   20000UL       // 50 Hz, SEND_RATE_HZ
+#define FINAL_LOSS_PCT      5             // Over the last two windows
+#define CONTROLLER_BOND     "/tmp/nowcomm_bench_hop_controller.bond"
+#define RECEIVER_BOND       "/tmp/nowcomm_bench_hop_receiver.bond"
+
+
+typedef BasicBugComm<LoopbackTransport> Comm;
+
+
+static void pump(Comm& controller, Comm& receiver, uint32_t& received) {
+  Comm::Message msg;
+  receiver.update();
+  while(receiver.receive(msg)) {
+    if(NOWCOMM_KIND_COMMAND == msg.kind) received++;
+  }
+  controller.update();
+  while(controller.receive(msg)) {}
+}
+
+
+static void print_hop(Comm& comm, const char* who) {
+  NowComm_HopStats stats;
+  comm.get_hop_stats(stats);
+  printf("  %-10s hop %u: channel %u -> %u, latency %.1f ms, outage %.1f ms, post-hop loss %.1f%%; %u aborted, %u reverted\n",
+         who, stats.hops, stats.from_channel, stats.to_channel, stats.latency_us / 1000.0, stats.outage_us / 1000.0,
+         stats.post_hop_loss_permille / 10.0, stats.aborted, stats.reverted);
+}
+
+
+int main() {
+  Comm      controller;
+  Comm      receiver;
+  uint32_t  received      = 0;
+  uint32_t  sent          = 0;
+  uint32_t  window_rx     = 0;
+  uint32_t  window_tx     = 0;
+  uint32_t  tail_rx       = 0;
+  uint32_t  tail_tx       = 0;
+  uint32_t  hops_seen     = 0;
+  unsigned long report_at = 0;
+  NowCommFileBondStore controller_store(CONTROLLER_BOND);
+  NowCommFileBondStore receiver_store(RECEIVER_BOND);
+  controller_store.clear();
+  receiver_store.clear();
+  controller.set_bond_store(&controller_store);
+  receiver.set_bond_store(&receiver_store);
+  LoopbackTransport::set_channel_loss(7, NOISY_LOSS - 5);
+  controller.begin(NOWCOMM_MODE_CONTROLLER, START_CHANNEL);
+  receiver.begin(NOWCOMM_MODE_RECEIVER, START_CHANNEL);
+  while(!controller.service_pairing() | !receiver.service_pairing()) {}
+  controller.set_hopping(true);
+
+  printf("hop at %.0f%% loss or %lu ms RTT, after %d frames; %lu ms lead, %lu ms holdoff\n",
+         NOWCOMM_HOP_LOSS_Q16 * 100.0 / 65536, NOWCOMM_HOP_RTT_US / 1000, NOWCOMM_HOP_MIN_SAMPLES,
+         NOWCOMM_HOP_LEAD_US / 1000, NOWCOMM_HOP_HOLDOFF_US / 1000);
+  BugCommand    command;
+  unsigned long start       = micros();
+  unsigned long next_send   = start;
+  unsigned long next_window = start + WINDOW_MS * 1000UL;
+  bool          noisy       = false;
+  while(micros() - start < RUN_MS * 1000UL) {
+    unsigned long now = micros();
+    if(!noisy && now - start >= NOISE_AT_MS * 1000UL) {
+      LoopbackTransport::set_channel_loss(START_CHANNEL, NOISY_LOSS);
+      printf("%5lu ms  channel %d starts losing %d%%\n", (now - start) / 1000, START_CHANNEL, NOISY_LOSS);
+      noisy = true;
+    }
+    if((long)(now - next_send) >= 0) {
+      controller.BugNowComm<LoopbackTransport>::send_command(&command);
+      next_send += COMMAND_PERIOD_US;
+      sent++;
+    }
+    pump(controller, receiver, received);
+    NowComm_HopStats stats;
+    controller.get_hop_stats(stats);
+    if(stats.hops != hops_seen) {
+      hops_seen = stats.hops;
+      report_at = now + (NOWCOMM_HOP_SETTLE + 10) * COMMAND_PERIOD_US;
+    }
+    if(report_at && (long)(now - report_at) >= 0) {
+      print_hop(controller, "controller");
+      print_hop(receiver, "receiver");
+      report_at = 0;
+    }
+    if((long)(now - next_window) >= 0) {
+      NowComm_ChannelQuality quality;
+      controller.get_channel_quality(controller.get_channel(), quality);
+      uint32_t rx = received - window_rx;
+      uint32_t tx = sent - window_tx;
+      printf("%5lu ms  channel %2u/%2u  delivered %3u of %3u  estimate: loss %4.1f%%, rtt %u us\n", (now - start) / 1000,
+             controller.get_channel(), receiver.get_channel(), rx, tx, quality.loss_permille / 10.0, quality.rtt_us);
+      if(now - start >= (RUN_MS - 2 * WINDOW_MS) * 1000UL) {
+        tail_rx += rx;
+        tail_tx += tx;
+      }
+      window_rx    = received;
+      window_tx    = sent;
+      next_window += WINDOW_MS * 1000UL;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+
+  NowComm_LinkStats link;
+  controller.get_link_stats(link);
+  printf("link: sent %u, acked %u, lost %u; rtt p50 %u us, p99 %u us\n", link.sent, link.acked, link.lost, link.rtt_p50_us, link.rtt_p99_us);
+  NowComm_Bond  controller_bond = {};
+  NowComm_Bond  receiver_bond   = {};
+  controller_store.load(controller_bond);
+  receiver_store.load(receiver_bond);
+  uint8_t chan  = controller.get_channel();
+  printf("bonds: controller on channel %u, receiver on channel %u\n", controller_bond.channel, receiver_bond.channel);
+  bool    ok    = chan == receiver.get_channel() && chan != START_CHANNEL && chan != 7 && 0 < hops_seen &&
+                  tail_tx && (tail_tx - tail_rx) * 100 <= tail_tx * FINAL_LOSS_PCT &&
+                  chan == controller_bond.channel && chan == receiver_bond.channel;
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
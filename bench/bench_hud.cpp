@@ -0,0 +1,114 @@
+// Host benchmark: the controller's HUD, redrawn three ways on a HostPanel.
+// RUN_FRAMES loop() passes, LOOP_PERIOD_US apart, with the stick moving some of the time, the link
+// dropping out twice and the channel changing once; the fields are laid out as src/main.cpp does.
+//   every field:  each field redrawn and pushed on every pass, as the controller used to
+//   whole sprite: everything redrawn into the sprite and all of it pushed on every pass
+//   dirty fields: the Hud as it is meant to be used, only changed fields redrawn and pushed
+// For each, pixels pushed per pass, the SPI time that would take at LCD_SPI_HZ, and host time per pass.
+// Exits non-zero if the dirty-field screen ever differs from a full redraw of the same values.
+//
+// pio run -e native_hud && .pio/build/native_hud/program
+
+#include <chrono>
+#include <initializer_list>
+#include <math.h>
+#include <Hud.h>
+#include <HostPanel.h>
+
+#define RUN_FRAMES      6000          // 30 s of loop()
+#define LOOP_PERIOD_US  5000          // src/main.cpp's LOOP_DELAY_MS
+#define LCD_SPI_HZ      27000000      // The M5StickC's ST7735S
+#define GREEN           0x07E0
+#define RED             0xF800
+#define LIGHTGREY       0xC618
+#define BLACK           0x0000
+
+
+enum Mode { EVERY_FIELD, WHOLE_SPRITE, DIRTY_FIELDS };
+
+
+typedef struct Fields {
+  HudText*  title;
+  HudText*  own_mac;
+  HudText*  peer_mac;
+  HudText*  channel;
+  HudText*  readout;
+  HudText*  link;
+} Fields;
+
+
+static Fields layout(Hud<HostPanel>& hud) {
+  Fields f;
+  hud.begin(BLACK);
+  f.title     = hud.add({   0,  0, 160, 16 }, 2, HUD_CENTRE, LIGHTGREY);
+  f.own_mac   = hud.add({   0, 18, 160, 16 }, 2, HUD_CENTRE, GREEN);
+  f.peer_mac  = hud.add({   0, 36, 160, 16 }, 2, HUD_CENTRE, GREEN);
+  f.channel   = hud.add({   0, 60,  52, 16 }, 2, HUD_LEFT,   LIGHTGREY);
+  f.readout   = hud.add({  52, 60,  56, 16 }, 2, HUD_CENTRE, GREEN);
+  f.link      = hud.add({ 108, 60,  52, 16 }, 2, HUD_RIGHT,  GREEN);
+  f.title->set("BugNow Controller");
+  f.own_mac->set("C 24 0A C4 12 34 56");
+  f.peer_mac->set("R 24 0A C4 65 43 21");
+  return f;
+}
+
+
+// What the controller would show on pass i.
+//
+static void update(Fields& f, int i) {
+  double  t       = i * LOOP_PERIOD_US / 1e6;
+  bool    moving  = fmod(t, 10.0) < 3.0;                    // Three seconds of driving in every ten
+  int     x       = moving ? (int)(100 * sin(t * 3)) : 0;
+  int     y       = moving ? (int)(100 * cos(t * 2)) : 0;
+  bool    linked  = !(fmod(t, 15.0) > 12.0 && fmod(t, 15.0) < 12.5);
+  f.channel->printf("Chan %d", t < 20 ? 6 : 11);
+  f.readout->printf("%d/%d", x, y);
+  f.readout->set_color(0 <= x ? GREEN : RED);
+  f.link->set(linked ? "LINK" : "LOST");
+  f.link->set_color(linked ? GREEN : RED);
+}
+
+
+static bool run(const char* name, Mode mode) {
+  HostPanel       panel;
+  HostPanel       reference_panel;
+  Hud<HostPanel>  hud(panel);
+  Hud<HostPanel>  reference(reference_panel);
+  Fields          f       = layout(hud);
+  Fields          r       = layout(reference);
+  int             differ  = 0;
+  double          host_ns = 0;
+  for(int i = 0; i < RUN_FRAMES; i++) {
+    auto start = std::chrono::steady_clock::now();
+    update(f, i);
+    if(EVERY_FIELD == mode) {
+      for(HudText* field : { f.title, f.own_mac, f.peer_mac, f.channel, f.readout, f.link }) field->invalidate();
+    }
+    if(WHOLE_SPRITE == mode) hud.invalidate();
+    hud.render();
+    host_ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    if(DIRTY_FIELDS == mode && 0 == i % 10) {               // Every tenth pass, against a full redraw
+      update(r, i);
+      reference.invalidate();
+      reference.render();
+      differ += 0 != memcmp(panel.get_screen(), reference_panel.get_screen(), panel.get_size() * sizeof(uint16_t));
+    }
+  }
+  HudStats stats;
+  hud.get_stats(stats);
+  double pixels = (double)panel.pixels_pushed / RUN_FRAMES;
+  printf("  %-13s %7.0f px/pass  %6.1f pushes/pass  SPI %7.1f us/pass  host %6.2f us/pass  %u of %d passes drew%s\n",
+         name, pixels, (double)panel.pushes / RUN_FRAMES, pixels * 16 * 1e6 / LCD_SPI_HZ, host_ns / RUN_FRAMES / 1000,
+         stats.frames_drawn, RUN_FRAMES, differ ? "  SCREEN DIFFERS" : "");
+  return 0 == differ;
+}
+
+
+int main() {
+  printf("%d passes of loop(), %d us apart; %dx%d panel\n", RUN_FRAMES, LOOP_PERIOD_US, HUD_WIDTH, HUD_HEIGHT);
+  bool ok = run("every field", EVERY_FIELD);
+  ok &= run("whole sprite", WHOLE_SPRITE);
+  ok &= run("dirty fields", DIRTY_FIELDS);
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
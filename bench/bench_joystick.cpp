@@ -0,0 +1,199 @@
+// Host benchmark: joystick sampling and filtering.
+// JoySampler is driven by ScriptedJoystick on a simulated clock, and each filter setting is measured for
+//   - step latency: a full-scale stick move until loop() sees 90% of it, over many step phases
+//   - noise: spurious motion at rest, and output spread while held, with noisy and glitching reads
+// and, for comparison, the single read per loop() that the controller used to do. Then a sampler thread
+// runs in real time against a reading loop to measure the sampling period's jitter and check that
+// get_latest() never returns a torn sample. Exits non-zero if it does.
+//
+// pio run -e native_joystick && .pio/build/native_joystick/program
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <JoySampler.h>
+#include <ScriptedJoystick.h>
+
+#define SAMPLE_PERIOD_US    (1000000UL / JOY_SAMPLE_HZ)
+#define LOOP_PERIOD_US      5000UL        // src/main.cpp's LOOP_DELAY_MS
+#define STEP_TRIALS         200
+#define STEP_AT_US          100000UL
+#define NOISE_RUN_US        2000000UL
+#define REALTIME_RUN_MS     1000
+
+
+typedef struct Setting {
+  const char*       name;
+  JoyFilterConfig   config;
+} Setting;
+
+
+static const Setting settings[] = {
+  { "raw",              { 1, 256, 0 } },
+  { "default",          { 3, 128, 4 } },
+  { "median 5, slow",   { 5,  48, 4 } },
+};
+
+
+// Time from the step until loop(), polling every LOOP_PERIOD_US, first sees x >= 90% of the target.
+// The phase between the step, the sampler and the loop varies from trial to trial.
+//
+static unsigned long step_latency(const JoyFilterConfig& config, unsigned long phase_us, unsigned long loop_phase_us) {
+  JoyKeyframe           script[] = { { 0, 0, 0, false }, { STEP_AT_US + phase_us, 100, 0, false } };
+  ScriptedJoystick      stick(script, 2);
+  JoySampler<ScriptedJoystick> sampler(stick);
+  sampler.configure(config);
+  unsigned long next_loop = loop_phase_us;
+  for(unsigned long t = 0; t < STEP_AT_US + phase_us + 500000UL; t += SAMPLE_PERIOD_US) {
+    for(; next_loop < t; next_loop += LOOP_PERIOD_US) {
+      JoySample sample;
+      if(next_loop > STEP_AT_US + phase_us && sampler.get_latest(sample) && 90 <= sample.x) {
+        return next_loop - (STEP_AT_US + phase_us);
+      }
+    }
+    stick.set_time(t);
+    sampler.sample();
+  }
+  return 0;
+}
+
+
+// The old way: one read at the top of every loop(), no filter.
+//
+static unsigned long legacy_latency(unsigned long phase_us) {
+  unsigned long step = STEP_AT_US + phase_us;
+  return ((step + LOOP_PERIOD_US - 1) / LOOP_PERIOD_US) * LOOP_PERIOD_US - step;
+}
+
+
+static void print_latency(const char* name, std::vector<unsigned long>& latency) {
+  std::sort(latency.begin(), latency.end());
+  double sum = 0;
+  for(unsigned long l : latency) sum += l;
+  printf("  %-16s step latency mean %5.1f ms, p99 %5.1f ms\n", name, sum / latency.size() / 1000.0,
+         latency[latency.size() * 99 / 100] / 1000.0);
+}
+
+
+// Run the sampler over a held stick with noisy reads; report how often loop() would see motion at rest
+// and the spread of x while held at 60.
+//
+static void noise(const Setting& setting, uint8_t amplitude, uint16_t glitch_one_in) {
+  JoyKeyframe           script[] = { { 0, 0, 0, false }, { NOISE_RUN_US / 2, 60, 0, false } };
+  ScriptedJoystick      stick(script, 2);
+  JoySampler<ScriptedJoystick> sampler(stick);
+  sampler.configure(setting.config);
+  stick.set_noise(amplitude);
+  stick.set_glitch_rate(glitch_one_in);
+  uint32_t  rest = 0, moving = 0, held = 0;
+  double    sum = 0, sum_sq = 0;
+  int       worst = 0;
+  for(unsigned long t = 0; t < NOISE_RUN_US; t += SAMPLE_PERIOD_US) {
+    stick.set_time(t);
+    sampler.sample();
+    if(0 != t % LOOP_PERIOD_US) continue;
+    JoySample sample;
+    sampler.get_latest(sample);
+    if(t < 100000UL) continue;                // Let the filters settle
+    if(t < NOISE_RUN_US / 2) {
+      rest++;
+      if(sample.x || sample.y) moving++;
+      worst = std::max(worst, abs(sample.x));
+    }
+    else if(t > NOISE_RUN_US / 2 + 100000UL) {
+      held++;
+      sum    += sample.x;
+      sum_sq += sample.x * sample.x;
+    }
+  }
+  double mean = sum / held;
+  printf("  %-16s at rest: %4.1f%% of loops see motion (worst %3d); held at 60: mean %5.1f, sd %4.2f\n",
+         setting.name, 100.0 * moving / rest, worst, mean, sqrt(sum_sq / held - mean * mean));
+}
+
+
+// A real sampler thread at JOY_SAMPLE_HZ and a reader spinning on get_latest(). The script ramps both
+// axes together, so any sample with x != y was torn.
+//
+static bool realtime() {
+  static JoyKeyframe script[256];
+  for(int i = 0; i < 256; i++) script[i] = { (unsigned long)i * 4000UL, (int8_t)(i - 128), (int8_t)(i - 128), 0 != (i & 1) };
+  ScriptedJoystick      stick(script, 256);
+  JoySampler<ScriptedJoystick> sampler(stick);
+  JoyFilterConfig       config;
+  config.median     = 1;
+  config.ema_alpha  = 256;
+  config.deadband   = 0;
+  sampler.configure(config);
+  std::atomic<bool>     done{false};
+  std::vector<double>   periods;
+  periods.reserve(JOY_SAMPLE_HZ * REALTIME_RUN_MS / 1000 + 16);
+
+  std::thread thread([&]() {
+    auto start  = std::chrono::steady_clock::now();
+    auto wake   = start;
+    auto last   = start;
+    while(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(REALTIME_RUN_MS)) {
+      auto now = std::chrono::steady_clock::now();
+      stick.set_time(std::chrono::duration_cast<std::chrono::microseconds>(now - start).count());
+      sampler.sample();
+      if(now != start) periods.push_back(std::chrono::duration<double, std::micro>(now - last).count());
+      last  = now;
+      wake += std::chrono::microseconds(SAMPLE_PERIOD_US);
+      std::this_thread::sleep_until(wake);
+    }
+    done = true;
+  });
+
+  uint32_t  reads = 0, torn = 0;
+  while(!done) {
+    JoySample sample;
+    if(sampler.get_latest(sample)) {
+      reads++;
+      if(sample.x != sample.y) torn++;
+    }
+    std::this_thread::yield();
+  }
+  thread.join();
+
+  std::sort(periods.begin(), periods.end());
+  printf("realtime: %u samples, period p50 %.0f us, p99 %.0f us, max %.0f us (target %lu); %u reads, %u torn\n",
+         sampler.get_samples(), periods[periods.size() / 2], periods[periods.size() * 99 / 100], periods.back(),
+         SAMPLE_PERIOD_US, reads, torn);
+  return 0 == torn;
+}
+
+
+int main() {
+  printf("step response (sampler %d Hz, loop every %lu ms):\n", JOY_SAMPLE_HZ, LOOP_PERIOD_US / 1000);
+  for(const Setting& setting : settings) {
+    std::vector<unsigned long> latency;
+    for(int i = 0; i < STEP_TRIALS; i++) {
+      latency.push_back(step_latency(setting.config, (i * 7919UL) % SAMPLE_PERIOD_US + i * 13, (i * 104729UL) % LOOP_PERIOD_US));
+    }
+    print_latency(setting.name, latency);
+  }
+  std::vector<unsigned long> latency;
+  for(int i = 0; i < STEP_TRIALS; i++) latency.push_back(legacy_latency((i * 7919UL) % LOOP_PERIOD_US));
+  print_latency("read in loop()", latency);
+
+  printf("noise +/-6 on every read, a full-scale glitch 1 read in 100:\n");
+  for(const Setting& setting : settings) noise(setting, 6, 100);
+
+  JoyKeyframe                   script[] = { { 0, 40, -40, false } };
+  ScriptedJoystick              stick(script, 1);
+  JoySampler<ScriptedJoystick>  sampler(stick);
+  stick.set_noise(6);
+  auto start = std::chrono::steady_clock::now();
+  for(int i = 0; i < 1000000; i++) sampler.sample();
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / 1000000;
+  printf("sample() with the default filter: %.1f ns\n", ns);
+
+  bool ok = realtime();
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
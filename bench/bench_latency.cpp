@@ -0,0 +1,165 @@
+// Host benchmark: BugComm command round-trip latency, sustained packet rate, and the send scheduler.
+// A controller BugComm drives a receiving BugComm over each host transport. Results go to stdout;
+// NowComm's own diagnostics go to stderr.
+//
+// pio run -e native && .pio/build/native/program
+
+#include <algorithm>
+#include <chrono>
+#include <BugComm.h>
+
+#define ROUND_TRIPS       10000
+#define ROUND_TRIP_LIMIT  100000000   // Nanoseconds before a round trip is counted as lost
+#define THROUGHPUT_MS     1000
+#define SCHEDULE_MS       1000
+#define STICK_PERIOD_US   1000        // How often the simulated stick moves during the schedule run
+
+
+static uint32_t samples[ROUND_TRIPS];
+
+
+// micros() is too coarse for the loopback transport.
+//
+static uint32_t nanos() {
+  static const auto start = std::chrono::steady_clock::now();
+  return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+template <class Transport> void process_discovery(BasicBugComm<Transport>& comm) {
+  while(!comm.is_connected() && comm.is_data_ready()) {
+    if(NOWCOMM_KIND_DISCOVERY == comm.get_msg_kind()) comm.process_discovery_response();
+    else                                              comm.clear_data_ready();
+  }
+}
+
+
+// Both sides broadcast discovery until each has processed the other's. Returns microseconds taken.
+//
+template <class Transport> unsigned long pair(BasicBugComm<Transport>& controller, BasicBugComm<Transport>& receiver) {
+  unsigned long start = micros();
+  controller.begin(NOWCOMM_MODE_CONTROLLER, 1);
+  receiver.begin(NOWCOMM_MODE_RECEIVER, 1);
+  while(!controller.is_connected() || !receiver.is_connected()) {
+    if(!controller.is_connected()) controller.send_discovery();
+    for(int i = 0; i < 100; i++) {
+      receiver.update();
+      process_discovery(receiver);
+      controller.update();
+      process_discovery(controller);
+    }
+  }
+  return micros() - start;
+}
+
+
+template <class Transport> void print_link_stats(BasicBugComm<Transport>& controller) {
+  NowComm_LinkStats stats;
+  controller.get_link_stats(stats);
+  printf("  link              sent=%u acked=%u lost=%u pending=%u duplicated=%u  rtt p50=%u us p99=%u us max=%u us\n",
+         stats.sent, stats.acked, stats.lost, stats.pending, stats.duplicated, stats.rtt_p50_us, stats.rtt_p99_us, stats.rtt_max_us);
+  controller.reset_link_stats();
+}
+
+
+// Send one command at a time and wait for its response.
+//
+template <class Transport> void round_trips(BasicBugComm<Transport>& controller, BasicBugComm<Transport>& receiver) {
+  int count = 0;
+  int lost  = 0;
+  typename BasicBugComm<Transport>::Message msg;
+  while(controller.receive(msg)) {}                   // Start with nothing queued
+  for(int i = 0; i < ROUND_TRIPS; i++) {
+    uint32_t start = nanos();
+    controller.send_command((i & 1) ? 64 : -64, 0, false);
+    while(true) {
+      receiver.update();
+      while(receiver.receive(msg)) {}
+      controller.update();
+      if(controller.receive(msg) && NOWCOMM_KIND_RESPONSE == msg.kind) {
+        samples[count++] = nanos() - start;
+        break;
+      }
+      if(ROUND_TRIP_LIMIT < nanos() - start) {
+        lost++;
+        break;
+      }
+    }
+  }
+  std::sort(samples, samples + count);
+  printf("  round trip (ns)   n=%d lost=%d  min=%u p50=%u p99=%u max=%u\n", count, lost,
+         count ? samples[0] : 0, count ? samples[count / 2] : 0,
+         count ? samples[count * 99 / 100] : 0, count ? samples[count - 1] : 0);
+}
+
+
+// Send commands back to back, without waiting for responses, for THROUGHPUT_MS.
+//
+template <class Transport> void throughput(BasicBugComm<Transport>& controller, BasicBugComm<Transport>& receiver) {
+  uint32_t      sent_before     = controller.get_transport().get_frames_sent();
+  uint32_t      received_before = receiver.get_transport().get_frames_received();
+  unsigned long start           = micros();
+  typename BasicBugComm<Transport>::Message msg;
+  for(int i = 0; THROUGHPUT_MS * 1000UL > micros() - start; i++) {
+    controller.send_command((i & 1) ? 64 : -64, 0, false);
+    receiver.update();
+    while(receiver.receive(msg)) {}
+    controller.update();
+    while(controller.receive(msg)) {}
+  }
+  float         seconds         = (micros() - start) / 1000000.0f;
+  uint32_t      sent            = controller.get_transport().get_frames_sent() - sent_before;
+  uint32_t      received        = receiver.get_transport().get_frames_received() - received_before;
+  printf("  sustained         %.0f commands/s sent, %.0f commands/s received\n", sent / seconds, received / seconds);
+}
+
+
+// Move the stick every STICK_PERIOD_US and let the scheduler decide what goes on the air.
+//
+template <class Transport> void schedule(BasicBugComm<Transport>& controller, BasicBugComm<Transport>& receiver) {
+  SendStats     stats;
+  typename BasicBugComm<Transport>::Message msg;
+  unsigned long start       = micros();
+  unsigned long next_move   = start;
+  int           moves       = 0;
+  controller.set_send_rate(SEND_RATE_HZ, SEND_KEEPALIVE_HZ);
+  controller.reset_send_stats();
+  while(SCHEDULE_MS * 1000UL > micros() - start) {
+    if(micros() >= next_move && micros() - start < SCHEDULE_MS * 500UL) {   // Move for the first half, then hold still
+      controller.set_input((moves & 1) ? 64 : -64, moves % 100, false);
+      next_move += STICK_PERIOD_US;
+      moves++;
+    }
+    controller.service();
+    receiver.update();
+    while(receiver.receive(msg)) {}
+    controller.update();
+    while(controller.receive(msg)) {}
+  }
+  controller.get_send_stats(stats);
+  printf("  scheduled %d/%d Hz %d stick moves: %u frames (%u keepalives), %u coalesced, %.1f frames/s\n",
+         SEND_RATE_HZ, SEND_KEEPALIVE_HZ, moves, stats.frames_sent, stats.keepalives, stats.frames_coalesced, stats.update_hz);
+}
+
+
+template <class Transport> void run(const char* name) {
+  BasicBugComm<Transport> controller;
+  BasicBugComm<Transport> receiver;
+  printf("%s\n", name);
+  printf("  pairing           %lu us\n", pair(controller, receiver));
+  controller.set_send_rate(0, 0);                     // Unscheduled: every change goes out at once
+  controller.reset_link_stats();
+  round_trips(controller, receiver);
+  print_link_stats(controller);
+  throughput(controller, receiver);
+  print_link_stats(controller);
+  schedule(controller, receiver);
+  print_link_stats(controller);
+}
+
+
+int main() {
+  run<LoopbackTransport>("LoopbackTransport");
+  run<UdpTransport>("UdpTransport");
+  return 0;
+}
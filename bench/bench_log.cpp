@@ -0,0 +1,211 @@
+// Host benchmark: what the binary log costs, and that it loses nothing it says it kept.
+//   cost:    ns per NOWCOMM_TRACE, against a hex dump of the same frame to a file (the old DEBUG_DUMP_PACKET);
+//            then BugComm round trips with logging off and on, a thread draining the log to a file meanwhile,
+//            as the M5StickC's low-priority task drains it to Serial.
+//   stress:  PRODUCERS threads log numbered records as fast as they can while one drains them, with text
+//            written between drains; the capture is decoded and every record checked, in order, per producer.
+// Exits non-zero if the decoder disagrees with the log, or logging adds more than ROUND_TRIP_SLACK_NS.
+//
+// pio run -e native_log && .pio/build/native_log/program
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <BugComm.h>
+
+#define TRACE_EVENTS        2000000
+#define ROUND_TRIPS         20000
+#define ROUND_TRIP_SLACK_NS 1000          // p50 with logging on, over p50 with it off
+#define PRODUCERS           4
+#define STRESS_RECORDS      200000        // Per producer
+#define CAPTURE             "/tmp/nowcomm_bench.log"
+
+
+typedef BasicBugComm<LoopbackTransport> Comm;
+
+
+// What drain() writes to: a FILE, or memory.
+//
+struct FileOut {
+  FILE*   file;
+  void    write(const uint8_t* data, size_t len) { fwrite(data, 1, len, file); }
+};
+
+
+struct MemoryOut {
+  std::vector<uint8_t> bytes;
+  void    write(const uint8_t* data, size_t len) { bytes.insert(bytes.end(), data, data + len); }
+};
+
+
+static double ns_since(std::chrono::steady_clock::time_point start, long count) {
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+}
+
+
+// Drains the log to a file until stopped, like NowCommLog::start() on the M5StickC but more often: the
+// loopback round trip is a thousand times faster than the radio's.
+//
+class Drainer {
+  public:
+    Drainer(FILE* file) : out { file }, thread([this] { while(!stop) { nowcomm_log().drain(out); std::this_thread::sleep_for(std::chrono::microseconds(100)); } nowcomm_log().drain(out); }) {}
+    ~Drainer()    { stop = true; thread.join(); }
+  private:
+    FileOut             out;
+    std::atomic<bool>   stop { false };
+    std::thread         thread;
+};
+
+
+// Records go in half a ring at a time, drained between batches, so every one timed is kept.
+//
+static void trace_cost(FILE* capture) {
+  uint8_t   frame[BugCommand::wire_size] = { 0x41, 0x07, 0x00, 0x40, 0xC0, 0x01, 0x00, 0x00 };
+  uint8_t   mac[6]  = { 0x02, 0x42, 0x55, 0x47, 0x43, 0x31 };
+  FILE*     null    = fopen("/dev/null", "w");
+  FileOut   out     { capture };
+  double    on_ns   = 0;
+  uint32_t  dropped = nowcomm_log().get_dropped();
+  nowcomm_log().enable(true);
+  for(long done = 0; done < TRACE_EVENTS; done += NOWCOMM_LOG_DEPTH / 2) {
+    auto start = std::chrono::steady_clock::now();
+    for(long i = 0; i < NOWCOMM_LOG_DEPTH / 2; i++) NOWCOMM_TRACE(NOWCOMM_LOG_RX, NOWCOMM_KIND_COMMAND, (uint16_t)i, nowcomm_log_peer(mac, sizeof(frame)));
+    on_ns += ns_since(start, 1);
+    nowcomm_log().drain(out);
+  }
+  on_ns /= TRACE_EVENTS;
+  nowcomm_log().enable(false);
+  auto start = std::chrono::steady_clock::now();
+  for(long i = 0; i < TRACE_EVENTS; i++) NOWCOMM_TRACE(NOWCOMM_LOG_RX, NOWCOMM_KIND_COMMAND, (uint16_t)i, nowcomm_log_peer(mac, sizeof(frame)));
+  double off_ns = ns_since(start, TRACE_EVENTS);
+  start = std::chrono::steady_clock::now();
+  for(long i = 0; i < TRACE_EVENTS / 10; i++) {
+    for(int j = 0; j < 6; j++) fprintf(null, "%02X", mac[j]);
+    fprintf(null, " REC ");
+    for(size_t j = 0; j < sizeof(frame); j++) fprintf(null, "%02X ", frame[j]);
+    fprintf(null, "\n");
+  }
+  double dump_ns = ns_since(start, TRACE_EVENTS / 10);
+  fclose(null);
+  printf("per event: NOWCOMM_TRACE %.1f ns (%.1f ns off), hex dump to a file %.1f ns; %u dropped\n",
+         on_ns, off_ns, dump_ns, nowcomm_log().get_dropped() - dropped);
+}
+
+
+// p50 of ROUND_TRIPS command round trips, in ns.
+//
+static double round_trips(Comm& controller, Comm& receiver) {
+  static uint32_t samples[ROUND_TRIPS];
+  Comm::Message   msg;
+  BugCommand      command;
+  for(int i = 0; i < ROUND_TRIPS; i++) {
+    auto start = std::chrono::steady_clock::now();
+    controller.BugNowComm<LoopbackTransport>::send_command(&command);
+    for(bool answered = false; !answered; ) {
+      receiver.update();
+      while(receiver.receive(msg)) {}
+      controller.update();
+      while(controller.receive(msg)) answered |= NOWCOMM_KIND_RESPONSE == msg.kind;
+    }
+    samples[i] = (uint32_t)ns_since(start, 1);
+  }
+  std::sort(samples, samples + ROUND_TRIPS);
+  return samples[ROUND_TRIPS / 2];
+}
+
+
+static bool round_trip_cost(FILE* capture) {
+  Comm controller;
+  Comm receiver;
+  controller.begin(NOWCOMM_MODE_CONTROLLER, 1);
+  receiver.begin(NOWCOMM_MODE_RECEIVER, 1);
+  while(!controller.service_pairing() | !receiver.service_pairing()) {}
+  uint32_t before  = nowcomm_log().get_logged();
+  uint32_t dropped = nowcomm_log().get_dropped();
+  double   off    = round_trips(controller, receiver);
+  nowcomm_log().enable(true);
+  double   on;
+  {
+    Drainer drainer(capture);
+    on = round_trips(controller, receiver);
+  }
+  nowcomm_log().enable(false);
+  uint32_t events = nowcomm_log().get_logged() - before;
+  printf("round trip p50: %.0f ns logging off, %.0f ns on (%+.0f ns, %.1f events a round trip, %u dropped)\n",
+         off, on, on - off, (double)events / ROUND_TRIPS, nowcomm_log().get_dropped() - dropped);
+  return on - off <= ROUND_TRIP_SLACK_NS;
+}
+
+
+// Producers log (event USER + producer, b and c the count); the consumer drains into memory and writes
+// a line of text between drains. Every record that was logged must decode, in order for its producer.
+//
+static bool stress() {
+  MemoryOut           capture;
+  std::atomic<int>    running { PRODUCERS };
+  std::vector<std::thread> producers;
+  uint32_t            logged_before   = nowcomm_log().get_logged();
+  uint32_t            dropped_before  = nowcomm_log().get_dropped();
+  nowcomm_log().enable(true);
+  for(int p = 0; p < PRODUCERS; p++) {
+    producers.emplace_back([p, &running] {
+      for(uint32_t i = 0; i < STRESS_RECORDS; i++) {
+        NOWCOMM_TRACE(NOWCOMM_LOG_USER + p, 0, (uint16_t)i, i);
+        if(0 == i % 64) std::this_thread::yield();          // Give the drain a chance, so the ring laps many times
+      }
+      running--;
+    });
+  }
+  int lines = 0;
+  while(running) {
+    if(0 == nowcomm_log().drain(capture)) continue;
+    char text[32];
+    int  len = snprintf(text, sizeof(text), "Z\xA5 text line %d\n", lines++);   // Starts like a frame on purpose
+    capture.write((const uint8_t*)text, len);
+  }
+  for(std::thread& t : producers) t.join();
+  nowcomm_log().drain(capture);
+  nowcomm_log().enable(false);
+  uint32_t logged  = nowcomm_log().get_logged() - logged_before;
+  uint32_t dropped = nowcomm_log().get_dropped() - dropped_before;
+
+  NowCommLogDecoder decoder;
+  int64_t   next[PRODUCERS]   = { 0 };
+  uint32_t  decoded           = 0;
+  uint32_t  reported_dropped  = 0;
+  uint32_t  disorder          = 0;
+  int       newlines          = 0;
+  decoder.put(capture.bytes.data(), capture.bytes.size(), [&](const NowComm_LogRecord& r) {
+    if(NOWCOMM_LOG_DROPPED == r.event) {
+      reported_dropped += r.c;
+      return;
+    }
+    int p = r.event - NOWCOMM_LOG_USER;
+    if(0 > p || PRODUCERS <= p || r.c < next[p] || r.b != (uint16_t)r.c) disorder++;
+    else next[p] = r.c + 1;
+    decoded++;
+  }, [&](uint8_t c) { newlines += '\n' == c; });
+  decoder.finish([&](uint8_t c) { newlines += '\n' == c; });
+  printf("stress: %d producers x %d records: %u logged, %u dropped (%u reported), %u decoded, %u out of order; %d of %d text lines intact\n",
+         PRODUCERS, STRESS_RECORDS, logged, dropped, reported_dropped, decoded, disorder, newlines, lines);
+  return PRODUCERS * STRESS_RECORDS == logged + dropped && decoded == logged && reported_dropped == dropped &&
+         0 == disorder && newlines == lines;
+}
+
+
+int main() {
+  FILE* capture = fopen(CAPTURE, "wb");
+  if(nullptr == capture) {
+    printf("can't write %s\n", CAPTURE);
+    return 1;
+  }
+  printf("log: %d records of %d bytes, %d a frame\n", NOWCOMM_LOG_DEPTH, (int)sizeof(NowComm_LogRecord), NOWCOMM_LOG_FRAME_SIZE);
+  trace_cost(capture);
+  bool ok = round_trip_cost(capture);
+  fclose(capture);
+  printf("capture in %s; tools/nowcomm_logdecode reads it\n", CAPTURE);
+  ok &= stress();
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+// Host benchmark: BugC mixer policies.
+// Every policy is checked against a plain floating-point reference over all 65,536 joystick (x, y)
+// inputs, then timed. The default policy is also compared with the float mixer BugComm used before,
+// for information. Exits non-zero if any policy disagrees with its reference.
+//
+// pio run -e native_mixer && .pio/build/native_mixer/program
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <BugMixer.h>
+
+#define TIMING_PASSES     200
+
+
+// References: the same rules, written the obvious way.
+//
+static void reference_differential(int x, int y, int out[4]) {
+  int trimmed = (int)trunc(x * (100.0 - abs(y)) / 100.0);
+  out[0] = out[2] = (0 > y) ? trimmed : x;
+  out[1] = out[3] = (0 < y) ? -trimmed : -x;
+}
+
+
+static void reference_tank(int x, int y, int out[4]) {
+  out[0] = out[2] = x;
+  out[1] = out[3] = -y;
+}
+
+
+static void reference_normalize(int& a, int& b) {
+  double m = fmax(fabs(a), fabs(b));
+  if(100 >= m) return;
+  a = (int)trunc(a * 100.0 / m);
+  b = (int)trunc(b * 100.0 / m);
+}
+
+
+static void reference_arcade(int x, int y, int out[4]) {
+  int left  = x + y;
+  int right = x - y;
+  reference_normalize(left, right);
+  out[0] = out[2] = left;
+  out[1] = out[3] = -right;
+}
+
+
+static void reference_mecanum(int x, int y, int out[4]) {
+  int a = x + y;
+  int b = x - y;
+  reference_normalize(a, b);
+  out[0] = a;
+  out[1] = -b;
+  out[2] = b;
+  out[3] = -a;
+}
+
+
+// The mixer in BugComm::send_command before it became a policy.
+//
+static void legacy_float(int8_t x, int8_t y, int out[4]) {
+  float delta = y / 100.0;
+  if(0 > delta) delta = 1.0 + delta;
+  else if(0 < delta) delta = -(1.0 - delta);
+  uint8_t scaled_value = (int)((float)x * delta);
+  out[0] = out[2] = 0 >= delta ?  x : (int8_t)scaled_value;
+  out[1] = out[3] = 0 <= delta ? -x : (int8_t)scaled_value;
+}
+
+
+static void scale(int raw_x, int raw_y, int8_t& x, int8_t& y) {
+  x =  bug_scale_axis((int8_t)raw_x);
+  y = -bug_scale_axis((int8_t)raw_y);
+}
+
+
+template <class Mixer> bool run(const char* name, void (*reference)(int, int, int[4])) {
+  int     mismatches  = 0;
+  int8_t  speeds[4];
+  int     expected[4];
+  for(int raw_x = -128; raw_x < 128; raw_x++) {
+    for(int raw_y = -128; raw_y < 128; raw_y++) {
+      int8_t x, y;
+      scale(raw_x, raw_y, x, y);
+      Mixer::mix(x, y, speeds);
+      reference(x, y, expected);
+      for(int i = 0; i < 4; i++) {
+        if(expected[i] != speeds[i] || 100 < abs(speeds[i])) {
+          if(0 == mismatches) printf("  first mismatch: x=%d y=%d motor %d: %d, expected %d\n", x, y, i, speeds[i], expected[i]);
+          mismatches++;
+          break;
+        }
+      }
+    }
+  }
+  volatile int8_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for(int pass = 0; pass < TIMING_PASSES; pass++) {
+    for(int x = -100; x <= 100; x++) {
+      for(int y = -100; y <= 100; y++) {
+        Mixer::mix(x, y, speeds);
+        sink = sink + speeds[pass & 3];
+      }
+    }
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (TIMING_PASSES * 201.0 * 201.0);
+  printf("%-22s 65536 inputs, %d mismatches, %.2f ns/mix\n", name, mismatches, ns);
+  return 0 == mismatches;
+}
+
+
+int main() {
+  bool ok = true;
+  ok &= run<BugDifferentialMixer>("BugDifferentialMixer", reference_differential);
+  ok &= run<BugTankMixer>("BugTankMixer", reference_tank);
+  ok &= run<BugArcadeMixer>("BugArcadeMixer", reference_arcade);
+  ok &= run<BugMecanumMixer>("BugMecanumMixer", reference_mecanum);
+
+  int     differ = 0;
+  int8_t  speeds[4];
+  int     legacy[4];
+  for(int raw_x = -128; raw_x < 128; raw_x++) {
+    for(int raw_y = -128; raw_y < 128; raw_y++) {
+      int8_t x, y;
+      scale(raw_x, raw_y, x, y);
+      BugDifferentialMixer::mix(x, y, speeds);
+      legacy_float(x, y, legacy);
+      for(int i = 0; i < 4; i++) if(legacy[i] != speeds[i]) { differ++; break; }
+    }
+  }
+  volatile int8_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for(int pass = 0; pass < TIMING_PASSES; pass++) {
+    for(int x = -100; x <= 100; x++) {
+      for(int y = -100; y <= 100; y++) {
+        legacy_float(x, y, legacy);
+        sink = sink + legacy[pass & 3];
+      }
+    }
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (TIMING_PASSES * 201.0 * 201.0);
+  printf("legacy float mixer     %.2f ns/mix; differs from BugDifferentialMixer on %d of 65536 inputs\n", ns, differ);
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
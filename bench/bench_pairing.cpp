@@ -0,0 +1,159 @@
+// Host benchmark: time to pair.
+// A controller and a receiver BugComm start on random channels with NOWCOMM_CHANNEL_AUTO and run
+// service_pairing() until both have paired; the receiver is switched on a random time after the
+// controller. For comparison, the same is done the old way: both on channel 1, the controller
+// broadcasting discovery every 500 ms. Times are from the later of the two begin() calls.
+// Then again with radios that refuse one channel, as one outside the country's would be: the scan
+// must step over it and each side must report the channel it is really tuned to.
+// Exits non-zero if any trial fails to pair within PAIR_LIMIT_MS.
+//
+// pio run -e native_pairing && .pio/build/native_pairing/program
+
+#include <algorithm>
+#include <vector>
+#include <BugComm.h>
+
+#define TRIALS              40
+#define PAIR_LIMIT_MS       3000
+#define MAX_START_GAP_US    300000UL      // The receiver is switched on up to this long after the controller
+#define LEGACY_INTERVAL_MS  500           // src/main.cpp's pair_with_receiver() before automatic pairing
+#define REFUSED_CHANNEL     6
+
+
+typedef BasicBugComm<LoopbackTransport> Comm;
+
+
+// A radio that won't tune to REFUSED_CHANNEL, and remembers where it really is.
+//
+class RegionTransport : public LoopbackTransport {
+  public:
+    bool                  init(uint8_t chan, NowComm_Session& session) { tuned = chan; return LoopbackTransport::init(chan, session); }
+    bool                  set_channel(uint8_t chan) {
+      if(REFUSED_CHANNEL == chan) {
+        refused++;
+        return false;
+      }
+      tuned = chan;
+      return LoopbackTransport::set_channel(chan);
+    }
+    uint8_t               tuned   = 0;
+    uint32_t              refused = 0;
+};
+
+
+// Drain a legacy-style pairing queue, as pair_with_receiver() did.
+//
+static void process_discovery(Comm& comm) {
+  while(comm.is_discovery_open() && comm.is_data_ready()) {
+    if(NOWCOMM_KIND_DISCOVERY == comm.get_msg_kind()) comm.process_discovery_response();
+    else                                              comm.clear_data_ready();
+  }
+}
+
+
+// Returns microseconds from the receiver's begin() until both sides have paired, or 0 on timeout.
+//
+static unsigned long trial(bool automatic, uint32_t& discoveries, uint32_t& hops) {
+  Comm          controller;
+  Comm          receiver;
+  unsigned long gap   = nowcomm_random() % MAX_START_GAP_US;
+  unsigned long start = micros();
+  unsigned long last_discovery = 0;
+  bool          receiver_on = false;
+  controller.begin(NOWCOMM_MODE_CONTROLLER, automatic ? NOWCOMM_CHANNEL_AUTO : 1);
+  if(!automatic) {
+    controller.send_discovery();
+    last_discovery = micros();
+  }
+  while(micros() - start < gap + PAIR_LIMIT_MS * 1000UL) {
+    if(!receiver_on && micros() - start >= gap) {
+      receiver.begin(NOWCOMM_MODE_RECEIVER, automatic ? NOWCOMM_CHANNEL_AUTO : 1);
+      receiver_on = true;
+    }
+    bool done;
+    if(automatic) {
+      done = controller.service_pairing();
+      if(receiver_on) done = receiver.service_pairing() && done;
+    }
+    else {
+      if(controller.is_discovery_open() && micros() - last_discovery >= LEGACY_INTERVAL_MS * 1000UL) {
+        controller.send_discovery();
+        last_discovery = micros();
+      }
+      controller.update();
+      process_discovery(controller);
+      if(receiver_on) {
+        receiver.update();
+        process_discovery(receiver);
+      }
+      done = !controller.is_discovery_open() && !receiver.is_discovery_open();
+    }
+    if(done && receiver_on) {
+      discoveries += controller.get_discoveries_sent();
+      hops        += controller.get_channel_hops() + receiver.get_channel_hops();
+      return std::max(1UL, micros() - start - gap);
+    }
+  }
+  return 0;
+}
+
+
+static bool run(const char* name, bool automatic) {
+  std::vector<unsigned long> times;
+  uint32_t  discoveries = 0;
+  uint32_t  hops        = 0;
+  int       failed      = 0;
+  for(int i = 0; i < TRIALS; i++) {
+    unsigned long t = trial(automatic, discoveries, hops);
+    if(t) times.push_back(t);
+    else  failed++;
+  }
+  std::sort(times.begin(), times.end());
+  double sum = 0;
+  for(unsigned long t : times) sum += t;
+  printf("%-28s %d trials, %d failed; time to pair mean %.1f ms, p50 %.1f ms, max %.1f ms; %.0f discovery frames and %.1f hops per pairing\n",
+         name, TRIALS, failed, times.empty() ? 0 : sum / times.size() / 1000.0,
+         times.empty() ? 0 : times[times.size() / 2] / 1000.0, times.empty() ? 0 : times.back() / 1000.0,
+         times.empty() ? 0 : (double)discoveries / times.size(), times.empty() ? 0 : (double)hops / times.size());
+  return 0 == failed;
+}
+
+
+// Both sides scan with radios that refuse REFUSED_CHANNEL. Each must pair, and agree with its radio about the channel.
+//
+static bool refused_channel() {
+  int       failed  = 0;
+  int       wrong   = 0;
+  uint32_t  refused = 0;
+  for(int i = 0; i < TRIALS; i++) {
+    BugNowComm<RegionTransport>   controller;
+    BugNowComm<RegionTransport>   receiver;
+    unsigned long start = micros();
+    controller.begin(NOWCOMM_MODE_CONTROLLER, NOWCOMM_CHANNEL_AUTO);
+    receiver.begin(NOWCOMM_MODE_RECEIVER, NOWCOMM_CHANNEL_AUTO);
+    bool done   = false;
+    bool agreed = true;
+    while(!done && micros() - start < PAIR_LIMIT_MS * 1000UL) {
+      done    = controller.service_pairing();
+      done    = receiver.service_pairing() && done;
+      agreed &= controller.get_channel() == controller.get_transport().tuned && receiver.get_channel() == receiver.get_transport().tuned;
+    }
+    if(!done)   failed++;
+    if(!agreed) wrong++;
+    refused += controller.get_transport().refused + receiver.get_transport().refused;
+  }
+  printf("%-28s %d trials, %d failed, %d ever on a channel other than the radio's; %.1f refusals per pairing\n",
+         "automatic, channel refused", TRIALS, failed, wrong, (double)refused / TRIALS);
+  return 0 == failed && 0 == wrong && 0 < refused;
+}
+
+
+int main() {
+  printf("channels %d - %d, %lu us slots, %d bursts per slot; receiver dwell %lu ms\n", NOWCOMM_SCAN_FIRST, NOWCOMM_SCAN_LAST,
+         NOWCOMM_SCAN_SLOT_US, NOWCOMM_SCAN_BURSTS, NOWCOMM_SCAN_DWELL_US / 1000);
+  bool ok = run("automatic, random channels", true);
+  ok &= run("legacy, both on channel 1", false);
+  ok &= refused_channel();
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,274 @@
+// Host benchmark: stick-to-packet latency, one loop() against the task pipeline.
+// The stick is a ScriptedJoystick moving all the time, behind an I2C read that takes READ_US; the
+// display takes DRAW_US a frame, and a full redraw (every FULL_REDRAW_EVERY frames) takes REDRAW_US.
+// Both are waits, as they are on the M5StickC, where the bus does the work. Each run drives a loopback
+// controller paired to a receiver for RUN_MS, then parks the stick and checks the receiver got the last
+// command, and that its telemetry reached the display side.
+//   loop:      the controller as it was: a sampler task, then loop() takes the newest sample, services
+//              BugComm, draws, and waits LOOP_DELAY_MS
+//   pipeline:  BugPipeline: sampler, mixer and radio tasks, the display in a task of its own
+// Latency runs from the start of the first read that saw the position a frame carries, to the end of its
+// send. Both run at the default send rate, where the scheduler's tick dominates, then with no rate limit,
+// where the rest shows.
+// Exits non-zero if either run fails to deliver, or the pipeline loses samples or commands, or if a
+// controller counts frames sent before it has a receiver.
+//
+// pio run -e native_pipeline && .pio/build/native_pipeline/program
+
+#include <atomic>
+#include <BugComm.h>
+#include <BugPipeline.h>
+#include <ScriptedJoystick.h>
+
+#define RUN_MS              2000
+#define MOVE_EVERY_US       7000UL        // Keyframe spacing: the stick never rests for long
+#define READ_US             400           // Joystick Hat, 100 kHz I2C
+#define DRAW_US             1500
+#define REDRAW_US           8000          // The whole 160 x 80 sprite over SPI
+#define FULL_REDRAW_EVERY   10
+#define DISPLAY_HZ          20
+#define LOOP_DELAY_MS       5             // src/main.cpp's, before the pipeline
+#define KEYFRAMES           ((RUN_MS * 1000UL) / MOVE_EVERY_US + 2)
+#define START_TIMES         64            // Power of two; read starts kept by seq for the loop run
+#define BATTERY_MV          3900          // What the receiver reports
+
+
+typedef BasicBugComm<LoopbackTransport>   Control;
+
+static JoyKeyframe    script[KEYFRAMES];
+static unsigned long  script_start = 0;
+
+
+// ScriptedJoystick on the real clock, as slow as the hat. For the loop run, it also notes, by sample
+// seq, when the read that first saw the current position started; with the filter off that is the
+// position the sample carries. It is stored before JoySampler publishes the sample.
+//
+class SlowHat {
+  public:
+    SlowHat() : stick(script, KEYFRAMES) {}
+    bool read(int8_t& x, int8_t& y, bool& button) {
+      unsigned long start = micros();
+      std::this_thread::sleep_for(std::chrono::microseconds(READ_US));
+      stick.set_time(micros() - script_start);
+      stick.read(x, y, button);
+      if(x != was_x || y != was_y || button != was_b) since = start;
+      was_x = x;
+      was_y = y;
+      was_b = button;
+      reads++;
+      if(position_since) position_since[reads & JOY_SEQ_MASK & (START_TIMES - 1)].store(since, std::memory_order_relaxed);
+      return true;
+    }
+    std::atomic<unsigned long>* position_since = nullptr;
+  private:
+    ScriptedJoystick  stick;
+    uint32_t          reads     = 0;
+    unsigned long     since     = 0;
+    int8_t            was_x     = 0;
+    int8_t            was_y     = 0;
+    bool              was_b     = false;
+};
+
+
+// The controller, and the receiver on the same thread, so the loopback medium is never shared between
+// threads: whoever services the controller drains the receiver too.
+//
+class BenchComm : public Control {
+  public:
+    BenchComm() {
+      receiver.set_telemetry_source([](void*, BugTelemetry& telemetry) { telemetry.millivolts = BATTERY_MV; return true; });
+    }
+    void update() {
+      Control::update();
+      BugNowComm<LoopbackTransport>::Message msg;
+      receiver.update();
+      while(receiver.receive(msg)) received++;
+    }
+    bool pair() {
+      begin(NOWCOMM_MODE_CONTROLLER, 1);
+      receiver.begin(NOWCOMM_MODE_RECEIVER, 1);
+      for(int i = 0; i < 1000; i++) {
+        bool done = service_pairing();
+        if(receiver.service_pairing() && done) return true;
+        delay(1);
+      }
+      return false;
+    }
+    BugNowComm<LoopbackTransport>   receiver;
+    uint32_t                                      received  = 0;
+};
+
+
+static void make_script() {
+  for(unsigned long i = 0; i < KEYFRAMES; i++) {
+    int x = (int)(i * 37 % 201) - 100;
+    script[i] = { i * MOVE_EVERY_US, (int8_t)x, (int8_t)(x / 2), 0 == i % 16 };
+  }
+  script[KEYFRAMES - 1] = { RUN_MS * 1000UL, 0, 0, false };        // Parked
+}
+
+
+static void draw(void* context) {
+  uint32_t* frames = (uint32_t*)context;
+  std::this_thread::sleep_for(std::chrono::microseconds(0 == (*frames)++ % FULL_REDRAW_EVERY ? REDRAW_US : DRAW_US));
+}
+
+
+// The receiver's current command is the one the parked stick mixes to.
+//
+static bool delivered(BenchComm& comm, const char* name) {
+  BugCommand  expected;
+  uint8_t     got[BugCommand::wire_size];
+  uint8_t     want[BugCommand::wire_size];
+  Control::make_command(0, 0, false, expected);
+  comm.receiver.get_data()->encode(got);
+  expected.encode(want);
+  bool ok = 0 < comm.received && 0 == memcmp(got + NOWCOMM_HEADER_SIZE, want + NOWCOMM_HEADER_SIZE, sizeof(want) - NOWCOMM_HEADER_SIZE);
+  if(!ok) printf("%s: the receiver didn't end on the parked stick (%u commands)\n", name, comm.received);
+  return ok;
+}
+
+
+static void print_stage(const char* name, const BugStageStats& s) {
+  printf("  %-10s %6u  p50 %6u us  p99 %6u us  max %6u us   budget %6u us, over %u\n",
+         name, s.count, s.p50_us, s.p99_us, s.max_us, s.budget_us, s.over_budget);
+}
+
+
+// Before pairing, service() has no peer to send to: it reports nothing sent and the scheduler counts
+// nothing. Once paired, the change that waited goes out on the next call.
+//
+static bool unpaired() {
+  BenchComm comm;
+  SendStats before, after;
+  comm.begin(NOWCOMM_MODE_CONTROLLER, 1);
+  comm.set_input(64, 0, false);
+  bool sent_unpaired = false;
+  for(int i = 0; i < 10; i++) sent_unpaired |= comm.service();
+  comm.get_send_stats(before);
+  if(!comm.pair()) { printf("unpaired: pairing failed\n"); return false; }
+  bool sent_paired = comm.service();
+  comm.get_send_stats(after);
+  printf("unpaired: %u frames counted before pairing, %u after\n", before.frames_sent, after.frames_sent);
+  return !sent_unpaired && 0 == before.frames_sent && sent_paired && 1 == after.frames_sent;
+}
+
+
+static bool run_loop(uint16_t send_hz, BugStageStats& total) {
+  BenchComm                 comm;
+  SlowHat                   hat;
+  JoySampler<SlowHat>       sampler(hat);
+  NowCommTask               sampler_task;
+  NowCommRttHistogram       latency;
+  uint32_t                  over        = 0;
+  uint32_t                  frames      = 0;
+  std::atomic<unsigned long> position_since[START_TIMES];
+  if(!comm.pair()) { printf("loop: pairing failed\n"); return false; }
+  comm.set_send_rate(send_hz, SEND_KEEPALIVE_HZ);
+  hat.position_since = position_since;
+  sampler.configure({ 1, 256, 0 });
+  script_start = micros();
+  sampler_task.start("joystick", [](NowCommTask& task, void* s) {       // JoySampler::start(), on a host
+    while(task.running()) {
+      ((JoySampler<SlowHat>*)s)->sample();
+      task.sleep_period(1000000UL / JOY_SAMPLE_HZ);
+    }
+  }, &sampler, 2, 0);
+  unsigned long next_draw   = script_start;
+  unsigned long change_read = 0;
+  bool          pending     = false;
+  uint16_t      last_seq    = 0xFFFF;
+  BugCommand    last_mixed;
+  while(micros() - script_start < (RUN_MS + 200) * 1000UL) {
+    JoySample sample;
+    comm.update();
+    while(comm.is_data_ready()) comm.clear_data_ready();
+    if(sampler.get_latest(sample) && sample.seq != last_seq) {
+      BugCommand mixed;
+      last_seq = sample.seq;
+      comm.set_input(sample.x, sample.y, sample.button);
+      Control::make_command(sample.x, sample.y, sample.button, mixed);
+      if(0 != memcmp(&mixed, &last_mixed, sizeof(mixed))) {          // What set_input() marks as a change
+        last_mixed  = mixed;
+        change_read = position_since[sample.seq & (START_TIMES - 1)].load(std::memory_order_relaxed);
+        pending     = true;
+      }
+    }
+    if(comm.service() && pending) {
+      uint32_t us = micros() - change_read;
+      latency.add(us);
+      if(bug_stage_budgets_us[BUG_STAGE_TOTAL] < us) over++;
+      pending = false;
+    }
+    if((long)(micros() - next_draw) >= 0) {
+      draw(&frames);
+      next_draw += 1000000UL / DISPLAY_HZ;
+    }
+    delay(LOOP_DELAY_MS);
+  }
+  sampler_task.stop();
+  comm.update();
+  total = { latency.get_count(), latency.percentile(50), latency.percentile(99), latency.get_max(),
+            bug_stage_budgets_us[BUG_STAGE_TOTAL], over };
+  printf("loop, %d ms, %u display frames:\n", RUN_MS, frames);
+  print_stage(bug_stage_names[BUG_STAGE_TOTAL], total);
+  return delivered(comm, "loop");
+}
+
+
+static bool run_pipeline(uint16_t send_hz, BugStageStats& total) {
+  BenchComm                 comm;
+  SlowHat                   hat;
+  JoySampler<SlowHat>       sampler(hat);
+  BugPipeline<BenchComm, SlowHat> pipeline(comm, sampler);
+  uint32_t                  frames      = 0;
+  BugPipelineReport         report;
+  if(!comm.pair()) { printf("pipeline: pairing failed\n"); return false; }
+  comm.set_send_rate(send_hz, SEND_KEEPALIVE_HZ);
+  if(0 == send_hz) pipeline.set_budget(BUG_STAGE_SCHEDULE, 1000);
+  sampler.configure({ 1, 256, 0 });
+  pipeline.set_display(draw, &frames, DISPLAY_HZ);
+  script_start = micros();
+  if(!pipeline.start()) { printf("pipeline: start failed\n"); return false; }
+  delay(RUN_MS + 200);
+  BugTelemetry  telemetry;
+  unsigned long age_us    = 0;
+  bool          reported  = pipeline.get_telemetry(telemetry, age_us) && BATTERY_MV == telemetry.millivolts;
+  pipeline.request_report();
+  while(!pipeline.get_report(report)) delay(1);
+  pipeline.stop();
+  comm.update();
+  printf("pipeline, %d ms, %u display frames (slowest %u us):\n", RUN_MS, report.display_frames, report.display_max_us);
+  for(uint8_t i = 0; i < BUG_STAGES; i++) print_stage(bug_stage_names[i], report.stages[i]);
+  printf("  %u samples (%u overruns), %u commands (%u overruns), %u frames sent (%u keepalives), %u acked of %u\n",
+         report.samples, report.sample_overruns, report.commands, report.command_overruns,
+         report.send.frames_sent, report.send.keepalives, report.link.acked, report.link.sent);
+  printf("  telemetry: %s, %lu us old\n", reported ? "published" : "MISSING", age_us);
+  total = report.stages[BUG_STAGE_TOTAL];
+  bool ok = delivered(comm, "pipeline") && reported;
+  ok &= 0 == report.sample_overruns + report.command_overruns;
+  ok &= 0 < report.send.frames_sent;
+  return ok;
+}
+
+
+int main() {
+  static const uint16_t rates[] = { SEND_RATE_HZ, 0 };
+  BugStageStats         loop_total[2], pipeline_total[2];
+  bool                  ok = true;
+  make_script();
+  ok &= unpaired();
+  for(int i = 0; i < 2; i++) {
+    printf("--- send rate %s\n", rates[i] ? "50 Hz" : "unlimited");
+    ok &= run_loop(rates[i], loop_total[i]);
+    ok &= run_pipeline(rates[i], pipeline_total[i]);
+  }
+  printf("stick to packet:\n");
+  for(int i = 0; i < 2; i++) {
+    printf("  %-10s loop p50 %5u us, p99 %5u us, max %5u us;  pipeline p50 %5u us, p99 %5u us, max %5u us\n",
+           rates[i] ? "50 Hz" : "unlimited", loop_total[i].p50_us, loop_total[i].p99_us, loop_total[i].max_us,
+           pipeline_total[i].p50_us, pipeline_total[i].p99_us, pipeline_total[i].max_us);
+  }
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
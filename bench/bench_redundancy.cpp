@@ -0,0 +1,273 @@
+// Host benchmark: loss-tolerant commands. A controller and a BugC on the simulated air (SimTransport),
+// on simulated time: the controller moves its stick every CHANGE_MS or so for DRIVE_MS, sending on the
+// SendScheduler's schedule, and the BugC takes what comes. Every run is made with 0, 1 and 2 copies of
+// the commands before in each frame (set_redundancy()), with the air losing 0 - 30% of frames, and with
+// the MAC retrying each unicast as ESP-NOW does, then not at all, as for a broadcast.
+// For each stick change sent: did it reach the BugC in its own frame, in a copy carried by a later one
+// (recovered), or never (lost: only a newer command got there). The recovery rate is recovered over
+// recovered and lost; the latency is set_command() to the BugC having it, p50, p99 and max. Then the bytes
+// and air time of a command frame, and every frame the two sent, per change.
+// Last, on the loopback medium, a command sent again unchanged, as a keepalive is: it must carry the
+// copies it did the first time, and no copy of itself, whatever is on the stack when it's sent.
+// Exits non-zero if anything goes missing without loss, the BugC ever takes a copy of a command it had,
+// or, with copies and no retries, the recovery rate falls more than SLACK_PCT short of what independent
+// losses allow: a change is only lost if its own frame and the next copies frames all are; or a repeated
+// command's frame isn't as it should be.
+//
+// pio run -e native_redundancy && .pio/build/native_redundancy/program
+
+#include <cmath>
+#include <memory>
+#include <BugComm.h>
+
+#define LOOP_US             1000UL
+#define PAIR_MS             2000          // Pairing, then driving from here...
+#define DRIVE_MS            20000         // ...for this long
+#define CHANGE_MS           40            // Stick changes every CHANGE_MS / 2 to CHANGE_MS * 3 / 2
+#define CHANGES             4096          // Changes kept track of (power of two), more than a run makes
+#define CHANNEL             6
+#define JITTER_US           200
+#define SLACK_PCT           10
+#define SEED                2022
+
+
+typedef BasicBugComm<SimTransport>   Comm;
+
+
+// The loopback medium, keeping the last frame sent.
+//
+class SpyTransport : public LoopbackTransport {
+  public:
+    bool      send(const uint8_t* mac, const uint8_t* data, int len) { memcpy(last, data, len); last_len = len; return LoopbackTransport::send(mac, data, len); }
+    uint8_t   last[NOWCOMM_MAX_FRAME];
+    int       last_len  = 0;
+};
+
+typedef BugNowComm<SpyTransport>     Spied;
+
+static const uint8_t  stick_mac[6]  = { 0x02, 0x53, 0x54, 0x49, 0x43, 0x4B };
+static const uint8_t  robot_mac[6]  = { 0x02, 0x52, 0x4F, 0x42, 0x4F, 0x54 };
+
+enum Fate : uint8_t { FATE_UNSENT, FATE_SENT, FATE_DIRECT, FATE_RECOVERED };
+
+
+struct Run {
+  Comm                  controller;
+  Comm                  receiver;
+  bool                  paired[2]     = { false, false };
+  uint16_t              counter       = 0;
+  unsigned long         next_change   = 0;
+  unsigned long         changed_at[CHANGES];
+  Fate                  fate[CHANGES] = {};
+  uint32_t              again         = 0;          // Copies taken of a change the BugC had
+  NowCommRttHistogram   latency_us;
+};
+
+
+struct Result {
+  uint32_t              sent;
+  uint32_t              direct;
+  uint32_t              recovered;
+  uint32_t              lost;
+  uint32_t              again;
+  uint32_t              link_recovered;             // The BugC's link stats
+  uint32_t              frames;                     // On the air, retries included
+  NowCommRttHistogram   latency_us;
+  bool                  paired;
+};
+
+
+static bool in_drive(unsigned long us) {
+  return us >= PAIR_MS * 1000UL && us < (PAIR_MS + DRIVE_MS) * 1000UL;
+}
+
+
+static void make_command(uint16_t counter, BugCommand& command) {
+  command.speed_0 = (int8_t)(counter % 100);
+  command.speed_1 = (int8_t)(counter / 100 % 100);
+}
+
+
+static uint16_t counter_of(const BugCommand& command) {
+  return (uint16_t)(command.speed_0 + command.speed_1 * 100);
+}
+
+
+static unsigned long controller_loop(void* context) {
+  Run&  r = *(Run*)context;
+  Comm& c = r.controller;
+  if(!r.paired[0]) {
+    r.paired[0] = c.service_pairing();
+    return LOOP_US;
+  }
+  unsigned long now = NowCommSim::now();
+  if(in_drive(now) && (long)(now - r.next_change) >= 0) {
+    BugCommand command;
+    make_command(++r.counter, command);
+    c.set_command(command);
+    r.changed_at[r.counter & (CHANGES - 1)] = now;
+    r.next_change = now + (CHANGE_MS / 2 + nowcomm_random() % CHANGE_MS) * 1000UL;
+  }
+  if(c.service()) {
+    uint16_t counter = counter_of(*c.get_data());
+    if(counter && FATE_UNSENT == r.fate[counter & (CHANGES - 1)]) r.fate[counter & (CHANGES - 1)] = FATE_SENT;
+  }
+  c.update();
+  while(c.is_data_ready()) c.clear_data_ready();
+  return LOOP_US;
+}
+
+
+static unsigned long receiver_loop(void* context) {
+  Run&  r   = *(Run*)context;
+  Comm& bug = r.receiver;
+  if(!r.paired[1]) {
+    r.paired[1] = bug.service_pairing();
+    return LOOP_US;
+  }
+  bug.update();
+  while(bug.is_data_ready()) {
+    uint16_t counter = NOWCOMM_KIND_COMMAND == bug.get_msg_kind() ? counter_of(*bug.get_data()) : 0;
+    Fate&    fate    = r.fate[counter & (CHANGES - 1)];
+    if(counter && bug.get_msg_recovered() && FATE_DIRECT <= fate) r.again++;
+    else if(counter && FATE_DIRECT > fate) {
+      fate = bug.get_msg_recovered() ? FATE_RECOVERED : FATE_DIRECT;
+      r.latency_us.add(bug.get_msg_rx_us() - r.changed_at[counter & (CHANGES - 1)]);
+    }
+    bug.clear_data_ready();
+  }
+  return LOOP_US;
+}
+
+
+static unsigned long start(void* context) {
+  Run& r = *(Run*)context;
+  r.controller.begin(NOWCOMM_MODE_CONTROLLER, CHANNEL);
+  r.receiver.begin(NOWCOMM_MODE_RECEIVER, CHANNEL);
+  NowCommSim::start_task(controller_loop, &r);
+  NowCommSim::start_task(receiver_loop, &r, LOOP_US / 2);
+  return 0;
+}
+
+
+static void drive(uint8_t loss, uint8_t retries, uint8_t copies, Result& result) {
+  SimConfig         config;
+  SimStats          air;
+  NowComm_LinkStats link;
+  config.loss_pct   = loss;
+  config.retries    = retries;
+  config.jitter_us  = JITTER_US;
+  config.seed       = SEED;
+  NowCommSim::reset(config);
+  std::unique_ptr<Run> r(new Run());
+  r->controller.set_redundancy(copies);
+  NowCommSim::start_task(start, r.get());
+  NowCommSim::run_until((PAIR_MS + DRIVE_MS + 1000) * 1000UL);        // Time for the last changes to land
+  NowCommSim::get_stats(air);
+  r->receiver.get_link_stats(link);
+  result                = Result();
+  result.paired         = r->paired[0] && r->paired[1];
+  result.again          = r->again;
+  result.link_recovered = link.recovered;
+  result.frames         = (uint32_t)air.frames;
+  result.latency_us     = r->latency_us;
+  for(uint32_t i = 1; i <= r->counter; i++) {
+    switch(r->fate[i & (CHANGES - 1)]) {
+      case FATE_UNSENT:     continue;                 // Overtaken by a newer change before its frame went
+      case FATE_SENT:       result.lost++;      break;
+      case FATE_DIRECT:     result.direct++;    break;
+      case FATE_RECOVERED:  result.recovered++; break;
+    }
+    result.sent++;
+  }
+  NowCommSim::stop();
+}
+
+
+static bool report(uint8_t loss, uint8_t retries, uint8_t copies, Result& r) {
+  uint32_t missed = r.recovered + r.lost;
+  int      bytes  = copies ? NOWCOMM_REDUNDANT_SIZE + Comm::command_payload + copies * (1 + Comm::command_payload) : BugCommand::wire_size;
+  bool     ok     = r.paired && 0 == r.again && (loss || 0 == missed) && (copies || 0 == r.recovered);
+  if(copies && !retries && loss) ok &= missed && 100.0 * r.recovered / missed >= 100.0 * (1 - pow(loss / 100.0, copies)) - SLACK_PCT;
+  printf("  %2u%% lost, %u retries, %u copies: %5u sent, %5u direct, %4u recovered, %4u lost: %5.1f%% of %4u missed recovered "
+         "(%u by the link stats), %u again | latency p50 %5.1f ms, p99 %6.1f ms, max %6.1f ms | %2d bytes, %3u us a frame, "
+         "%.2f frames a change%s\n",
+         loss, retries, copies, r.sent, r.direct, r.recovered, r.lost, missed ? 100.0 * r.recovered / missed : 0.0, missed,
+         r.link_recovered, r.again, r.latency_us.percentile(50) / 1000.0, r.latency_us.percentile(99) / 1000.0,
+         r.latency_us.get_max() / 1000.0, bytes, (unsigned)NowCommSim::airtime_us(bytes), r.sent ? (double)r.frames / r.sent : 0.0,
+         ok ? "" : "  FAILED");
+  return ok;
+}
+
+
+// Scribble over the stack where send() will build its frame, differently each time.
+//
+static void __attribute__((noinline)) poison(uint8_t value) {
+  volatile uint8_t junk[1024];
+  for(size_t i = 0; i < sizeof(junk); i++) junk[i] = (uint8_t)(value + i);
+}
+
+
+static void __attribute__((noinline)) send(Spied& stick, const BugCommand* command) {
+  stick.send_command(command);
+}
+
+
+// Send A, B, B, B, C with two copies: B's frames must all carry just A, and C's B then A.
+//
+static bool repeats() {
+  Spied       stick, robot;
+  BugCommand  a, b, c;
+  int         lens[5];
+  bool        copies_ok = true;
+  stick.get_transport().set_mac_address(stick_mac);
+  robot.get_transport().set_mac_address(robot_mac);
+  stick.begin(NOWCOMM_MODE_CONTROLLER, CHANNEL);
+  robot.begin(NOWCOMM_MODE_RECEIVER, CHANNEL);
+  bool paired = false;
+  for(int i = 0; i < 1000 && !paired; i++) {
+    bool done = stick.service_pairing();
+    paired = robot.service_pairing() && done;
+    delay(1);
+  }
+  a.speed_0 = 10;
+  b.speed_0 = 20;
+  c.speed_0 = 30;
+  const BugCommand* order[] = { &a, &b, &b, &b, &c };
+  stick.set_redundancy(2);
+  for(int i = 0; i < 5; i++) {
+    poison((uint8_t)(i * 37));
+    send(stick, order[i]);
+    const uint8_t* f = stick.get_transport().last;
+    lens[i] = stick.get_transport().last_len;
+    if(1 <= i && 3 >= i) copies_ok &= 1 == f[4] && a.speed_0 == (int8_t)f[NOWCOMM_REDUNDANT_SIZE + Spied::command_payload + 1];
+    if(4 == i)           copies_ok &= 2 == f[4] && b.speed_0 == (int8_t)f[NOWCOMM_REDUNDANT_SIZE + Spied::command_payload + 1] &&
+                                      a.speed_0 == (int8_t)f[NOWCOMM_REDUNDANT_SIZE + 2 * Spied::command_payload + 2];
+  }
+  bool ok = paired && copies_ok;
+  printf("repeated: frames of %d, %d, %d, %d and %d bytes for A, B, B, B, C: %s\n", lens[0], lens[1], lens[2], lens[3], lens[4],
+         ok ? "a repeat adds no copy" : "WRONG COPIES");
+  return ok;
+}
+
+
+int main() {
+  static const uint8_t losses[]  = { 0, 10, 20, 30 };
+  static const uint8_t retries[] = { 7, 0 };
+  bool   ok = true;
+  Result result;
+  printf("a stick change every %d - %d ms for %d ms, on channel %d, %u us jitter\n", CHANGE_MS / 2, CHANGE_MS * 3 / 2, DRIVE_MS,
+         CHANNEL, JITTER_US);
+  for(uint8_t retry : retries) {
+    printf("%s:\n", retry ? "unicast, retried by the MAC" : "no MAC retries, as for a broadcast");
+    for(uint8_t loss : losses) {
+      for(uint8_t copies = 0; copies <= NOWCOMM_MAX_COPIES; copies++) {
+        drive(loss, retry, copies, result);
+        ok &= report(loss, retry, copies, result);
+      }
+    }
+  }
+  ok &= repeats();
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,96 @@
+// Host stress benchmark: NowComm's receive ring under a producer and a consumer thread.
+// The producer thread plays the WiFi task: it sends numbered commands over the loopback transport and
+// polls the receiver, so NowComm's receive callback pushes into the ring. The main thread plays loop()
+// and pops. Every popped command is checked for tearing and ordering, and every command sent must be
+// either received or counted as an overrun. Exits non-zero if any check fails.
+//
+// pio run -e native_ring && .pio/build/native_ring/program
+
+#include <thread>
+#include <NowComm.h>
+#include <BugComm.h>
+
+#define STRESS_COMMANDS   2000000
+#define STRESS_BURST      4           // Commands sent between yields, so a single core still interleaves
+
+
+typedef BasicNowComm<LoopbackTransport, BugCommand> Comm;
+
+static std::atomic<bool> producer_done{false};
+
+
+// Spread the counter over the command so a half-written slot can't pass the check.
+//
+static void fill(BugCommand& cmd, uint32_t n) {
+  cmd.speed_0     = (int8_t)(n % 201 - 100);          // Speeds must be +/- 100: count in base 201
+  cmd.speed_1     = (int8_t)(n / 201 % 201 - 100);
+  cmd.speed_2     = (int8_t)(n / 201 / 201 % 201 - 100);
+  cmd.speed_3     = (int8_t)(n / 201 / 201 / 201 % 201 - 100);
+  cmd.color_left  = (n * 2654435761u) >> 29;
+  cmd.color_right = (~n * 2654435761u) >> 29;
+  cmd.button      = n & 1;
+}
+
+
+static bool check(const BugCommand* cmd, uint32_t& n) {
+  n = (cmd->speed_0 + 100) + 201 * ((cmd->speed_1 + 100) + 201 * ((cmd->speed_2 + 100) + 201 * (cmd->speed_3 + 100)));
+  return cmd->color_left == (n * 2654435761u) >> 29 && cmd->color_right == (~n * 2654435761u) >> 29 && cmd->button == (n & 1);
+}
+
+
+static void produce(Comm& controller, Comm& receiver) {
+  BugCommand cmd;
+  NowComm_Message<BugCommand> msg;
+  for(uint32_t n = 0; n < STRESS_COMMANDS; n++) {
+    fill(cmd, n);
+    controller.send_command(&cmd);
+    receiver.update();                      // Receive callback: pushes into receiver's ring
+    controller.update();
+    while(controller.receive(msg)) {}       // Responses; this thread is the controller's consumer
+    if(0 == n % STRESS_BURST) std::this_thread::yield();
+  }
+  producer_done = true;
+}
+
+
+int main() {
+  Comm controller;
+  Comm receiver;
+  controller.begin(NOWCOMM_MODE_CONTROLLER, 1);
+  receiver.begin(NOWCOMM_MODE_RECEIVER, 1);
+  controller.send_discovery();              // Pair by hand: each learns the other's address
+  receiver.update();
+  receiver.process_discovery_response();
+  controller.update();
+  controller.process_discovery_response();
+
+  uint32_t      received      = 0;
+  uint32_t      torn          = 0;
+  uint32_t      out_of_order  = 0;
+  int64_t       last          = -1;
+  NowComm_Message<BugCommand> msg;
+  unsigned long start         = micros();
+  std::thread   producer(produce, std::ref(controller), std::ref(receiver));
+  while(true) {
+    bool done = producer_done;              // Read before popping so the final pushes are seen
+    while(receiver.receive(msg)) {
+      uint32_t n;
+      if(NOWCOMM_KIND_COMMAND != msg.kind) continue;
+      if(!check(msg.get<BugCommand>(), n)) { torn++; continue; }
+      if((int64_t)n <= last) out_of_order++;
+      last = n;
+      received++;
+    }
+    if(done) break;
+    std::this_thread::yield();
+  }
+  producer.join();
+  float seconds = (micros() - start) / 1000000.0f;
+
+  uint32_t overruns = receiver.get_rx_overruns();
+  bool     ok       = 0 == torn && 0 == out_of_order && STRESS_COMMANDS == received + overruns;
+  printf("ring stress: %d commands in %.2f s (%.0f/s)\n", STRESS_COMMANDS, seconds, STRESS_COMMANDS / seconds);
+  printf("  received %u  overruns %u  rejected %u  torn %u  out of order %u  => %s\n", received, overruns,
+         receiver.get_rx_rejected(), torn, out_of_order, ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
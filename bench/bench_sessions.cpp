@@ -0,0 +1,195 @@
+// Host benchmark: NowComm sessions side by side on one radio, and what routing costs per frame.
+// Two loopback devices each run two sessions: a control link (BugComm, stick to robot) and a telemetry
+// link (robot to stick, the other way round). Both links run at once for SIDE_BY_SIDE_ROUNDS rounds;
+// each session must get exactly its own frames, and its own responses.
+// Then frames are pushed straight into NowCommRouter, with 1, 2 and 4 sessions sharing the radio,
+// to time route(), deliver() (the bare callback) and the whole receive path to the queue.
+// Exits non-zero if any frame reaches the wrong session.
+//
+// pio run -e native_sessions && .pio/build/native_sessions/program
+
+#include <chrono>
+#include <BugComm.h>
+
+#define SIDE_BY_SIDE_ROUNDS 5000
+#define DISPATCH_FRAMES     2000000
+#define DISPATCH_CHANNEL    14            // Away from the side-by-side sessions
+
+
+// Wire: header, millivolts (LE), rssi
+// Its kind is clear of BugTelemetry's, which the control link accepts too.
+//
+typedef struct Telemetry {
+  static constexpr NowComm_Kind kind      = (NowComm_Kind)(NOWCOMM_KIND_USER + 1);
+  static constexpr uint8_t      wire_size = NOWCOMM_HEADER_SIZE + 3;
+  static constexpr bool         acknowledge = true;
+  uint16_t      millivolts  = 0;
+  int8_t        rssi        = 0;
+  void          encode(uint8_t* frame) const  { frame[0] = nowcomm_header(kind); wire_put_u16(frame + 3, millivolts); frame[5] = (uint8_t)rssi; }
+  bool          decode(const uint8_t* frame)  { millivolts = wire_get_u16(frame + 3); rssi = (int8_t)frame[5]; return true; }
+} Telemetry;
+
+
+// A message of its own kind for each of the dispatch sessions.
+//
+template <uint8_t K> struct Probe {
+  static constexpr NowComm_Kind kind      = (NowComm_Kind)(NOWCOMM_KIND_USER + 1 + K);
+  static constexpr uint8_t      wire_size = NOWCOMM_HEADER_SIZE + 8;
+  uint8_t       payload[8]  = { 0 };
+  void          encode(uint8_t* frame) const  { frame[0] = nowcomm_header(kind); memcpy(frame + 3, payload, 8); }
+  bool          decode(const uint8_t* frame)  { memcpy(payload, frame + 3, 8); return true; }
+};
+
+
+typedef BasicBugComm<LoopbackTransport>               Control;
+typedef BasicNowComm<LoopbackTransport, Telemetry>    Telemetry_Link;
+
+static const uint8_t  stick_mac[6]  = { 0x02, 0x53, 0x54, 0x49, 0x43, 0x4B };
+static const uint8_t  robot_mac[6]  = { 0x02, 0x52, 0x4F, 0x42, 0x4F, 0x54 };
+static const uint8_t  probe_mac[6]  = { 0x02, 0x50, 0x52, 0x4F, 0x42, 0x45 };
+static const uint8_t  sender_mac[6] = { 0x02, 0x53, 0x45, 0x4E, 0x44, 0x52 };
+
+
+struct Counts {
+  uint32_t  commands    = 0;
+  uint32_t  telemetry   = 0;
+  uint32_t  responses   = 0;
+};
+
+
+template <class Comm> static void drain(Comm& comm, Counts& counts) {
+  typename Comm::Message msg;
+  comm.update();
+  while(comm.receive(msg)) {
+    if(NOWCOMM_KIND_COMMAND  == msg.kind) counts.commands++;
+    if(Telemetry::kind       == msg.kind) counts.telemetry++;
+    if(NOWCOMM_KIND_RESPONSE == msg.kind) counts.responses++;
+  }
+}
+
+
+template <class Comm> static bool link_clean(Comm& comm, const char* name) {
+  NowComm_LinkStats stats;
+  comm.get_link_stats(stats);
+  printf("  %-18s sent %5u  acked %5u  lost %u  rejected %u\n", name, stats.sent, stats.acked, stats.lost, comm.get_rx_rejected());
+  return stats.sent == stats.acked && 0 == comm.get_rx_rejected();
+}
+
+
+static bool side_by_side() {
+  Control         stick_control;
+  Telemetry_Link  stick_telemetry;
+  Control         robot_control;
+  Telemetry_Link  robot_telemetry;
+  Counts          sc, st, rc, rt;
+  stick_control.get_transport().set_mac_address(stick_mac);
+  stick_telemetry.get_transport().set_mac_address(stick_mac);
+  robot_control.get_transport().set_mac_address(robot_mac);
+  robot_telemetry.get_transport().set_mac_address(robot_mac);
+  stick_control.begin(NOWCOMM_MODE_CONTROLLER, 1);
+  stick_telemetry.begin(NOWCOMM_MODE_RECEIVER, 1);
+  robot_control.begin(NOWCOMM_MODE_RECEIVER, 1);
+  robot_telemetry.begin(NOWCOMM_MODE_CONTROLLER, 1);
+  for(int i = 0; i < 1000; i++) {
+    bool done = stick_control.service_pairing();
+    done &= stick_telemetry.service_pairing();
+    done &= robot_control.service_pairing();
+    done &= robot_telemetry.service_pairing();
+    if(done) break;
+    delay(1);
+  }
+  if(!stick_control.is_connected() || !stick_telemetry.is_connected() || !robot_control.is_connected() || !robot_telemetry.is_connected()) {
+    printf("side by side: pairing failed\n");
+    return false;
+  }
+  BugCommand  command;
+  Telemetry   telemetry;
+  for(int i = 0; i < SIDE_BY_SIDE_ROUNDS; i++) {
+    stick_control.BugNowComm<LoopbackTransport>::send_command(&command);
+    robot_telemetry.send_command(&telemetry);
+    drain(robot_control, rc);
+    drain(robot_telemetry, rt);
+    drain(stick_control, sc);
+    drain(stick_telemetry, st);
+  }
+  drain(robot_control, rc);                               // The last responses
+  drain(robot_telemetry, rt);
+  drain(stick_control, sc);
+  printf("side by side, %d rounds: robot control got %u commands, stick telemetry got %u reports\n",
+         SIDE_BY_SIDE_ROUNDS, rc.commands, st.telemetry);
+  bool ok = link_clean(stick_control, "stick control") & link_clean(robot_telemetry, "robot telemetry") &
+            link_clean(robot_control, "robot control") & link_clean(stick_telemetry, "stick telemetry");
+  ok &= SIDE_BY_SIDE_ROUNDS == rc.commands && SIDE_BY_SIDE_ROUNDS == st.telemetry;
+  ok &= 0 == rc.telemetry + rc.responses;               // Nothing of the telemetry link's, and no responses,
+  ok &= 0 == st.commands  + st.responses;               // ...on the receiving sessions
+  ok &= 0 == sc.telemetry + rt.commands;
+  ok &= SIDE_BY_SIDE_ROUNDS == sc.responses && SIDE_BY_SIDE_ROUNDS == rt.responses;
+  return ok;
+}
+
+
+static double ns_per(std::chrono::steady_clock::time_point start, int frames) {
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / frames;
+}
+
+
+// Time the router with sessions sessions on the probe radio. Frames are for the first of them.
+//
+static bool dispatch(int sessions) {
+  BasicNowComm<LoopbackTransport, Probe<0>> p0;
+  BasicNowComm<LoopbackTransport, Probe<1>> p1;
+  BasicNowComm<LoopbackTransport, Probe<2>> p2;
+  BasicNowComm<LoopbackTransport, Probe<3>> p3;
+  p0.get_transport().set_mac_address(probe_mac);
+  p1.get_transport().set_mac_address(probe_mac);
+  p2.get_transport().set_mac_address(probe_mac);
+  p3.get_transport().set_mac_address(probe_mac);
+  p0.begin(NOWCOMM_MODE_RECEIVER, DISPATCH_CHANNEL);
+  if(2 <= sessions) p1.begin(NOWCOMM_MODE_RECEIVER, DISPATCH_CHANNEL);
+  if(4 <= sessions) {
+    p2.begin(NOWCOMM_MODE_RECEIVER, DISPATCH_CHANNEL);
+    p3.begin(NOWCOMM_MODE_RECEIVER, DISPATCH_CHANNEL);
+  }
+  Probe<0>  probe;
+  uint8_t   frame[Probe<0>::wire_size];
+  probe.encode(frame);
+  volatile uint32_t sink = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for(int i = 0; i < DISPATCH_FRAMES; i++) sink += NowCommRouter::route(probe_mac, sender_mac, frame, sizeof(frame));
+  double route_ns = ns_per(start, DISPATCH_FRAMES);
+
+  uint32_t  target = NowCommRouter::route(probe_mac, sender_mac, frame, sizeof(frame));
+  BasicNowComm<LoopbackTransport, Probe<0>>::Message msg;
+  start = std::chrono::steady_clock::now();
+  for(int i = 0; i < DISPATCH_FRAMES; i++) {
+    nowcomm_put_seq(frame, (uint16_t)i);
+    NowCommRouter::deliver(target, sender_mac, frame, sizeof(frame));
+    p0.receive(msg);
+  }
+  double deliver_ns = ns_per(start, DISPATCH_FRAMES);
+
+  uint32_t received = 0;
+  start = std::chrono::steady_clock::now();
+  for(int i = 0; i < DISPATCH_FRAMES; i++) {
+    nowcomm_put_seq(frame, (uint16_t)i);
+    NowCommRouter::receive(probe_mac, sender_mac, frame, sizeof(frame));
+    received += p0.receive(msg);
+  }
+  double receive_ns = ns_per(start, DISPATCH_FRAMES);
+  bool   ok         = DISPATCH_FRAMES == (int)received && 0 == p1.get_rx_count() + p2.get_rx_count() + p3.get_rx_count();
+  printf("  %d session%s  route %5.1f ns   callback + queue %5.1f ns   route + callback + queue %5.1f ns  (+%.1f ns)%s\n",
+         sessions, 1 == sessions ? " " : "s", route_ns, deliver_ns, receive_ns, receive_ns - deliver_ns, ok ? "" : "  WRONG SESSION");
+  return ok;
+}
+
+
+int main() {
+  bool ok = side_by_side();
+  printf("per-frame dispatch, %d frames:\n", DISPATCH_FRAMES);
+  ok &= dispatch(1);
+  ok &= dispatch(2);
+  ok &= dispatch(4);
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
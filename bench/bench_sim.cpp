@@ -0,0 +1,245 @@
+// Host benchmark: many controller / BugC pairs on the simulated air (SimTransport), on simulated time.
+// Each pair is a controller BugComm and a receiver BugComm, powered on at random within STAGGER_MS of each
+// other, each with a loop() every LOOP_US: service_pairing() until paired, as pair_with_receiver() does,
+// then the controller moves its stick every CHANGE_MS or so and the receiver takes what comes.
+//   assigned:  competition mode; every pair picks a channel from 1 - 13 at random, as select_comm_channel()
+//              does, so with enough pairs some share one
+//   scan:      every pair on NOWCOMM_CHANNEL_AUTO, all scanning at once
+// For 1, 5, 10 and 20 pairs: how many paired by PAIR_DEADLINE_MS and with whom (crossed: a controller
+// paired with another pair's BugC), time to pair, and over DRIVE_MS after the deadline, the stick changes
+// that reached a BugC and how long they took, from set_command() to the receive callback. Then what the
+// air carried, and how much faster than real time it all ran.
+// Exits non-zero if a lone pair doesn't pair and drive cleanly, or a run isn't repeatable from its seed.
+//
+// pio run -e native_sim && .pio/build/native_sim/program
+
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <BugComm.h>
+
+#define LOOP_US             1000UL
+#define STAGGER_MS          1000
+#define PAIR_DEADLINE_MS    8000
+#define DRIVE_MS            10000
+#define CHANGE_MS           40            // Stick changes every CHANGE_MS / 2 to CHANGE_MS * 3 / 2
+#define CHANGES             256           // Change times kept per controller (power of two)
+#define LOSS_PCT            2
+#define JITTER_US           200
+#define SEED                12345
+
+
+typedef BasicBugComm<SimTransport>   Comm;
+
+struct Pair;
+
+struct Side {
+  Pair*         pair;
+  bool          controller;
+  bool          started     = false;
+  bool          paired      = false;
+};
+
+
+struct Pair {
+  Comm          controller;
+  Comm          receiver;
+  Side          sides[2];
+  uint8_t       channel;
+  uint16_t      counter       = 0;                // Stick changes so far
+  unsigned long next_change   = 0;
+  unsigned long changed_at[CHANGES];
+  uint16_t      heard         = 0xFFFF;           // The last change the receiver took
+  uint32_t      made          = 0;                // Changes in the drive window...
+  uint32_t      arrived       = 0;                // ...and those that reached a BugC
+};
+
+
+struct Result {
+  uint32_t              pairs;
+  uint32_t              paired;
+  uint32_t              crossed;
+  NowCommRttHistogram   pair_us;
+  NowCommRttHistogram   latency_us;
+  uint32_t              made;
+  uint32_t              arrived;
+  SimStats              air;
+  double                wall_s;
+  uint64_t              fingerprint;
+};
+
+
+static std::vector<std::unique_ptr<Pair>> pairs;
+static NowCommRttHistogram*               latencies   = nullptr;
+static uint32_t                           drive_from  = 0;
+
+
+static bool in_drive(unsigned long us) {
+  return us >= drive_from && us < drive_from + DRIVE_MS * 1000UL;
+}
+
+
+// The pair whose controller has this address, for a change that went to the wrong BugC.
+//
+static Pair* controller_of(const uint8_t* mac) {
+  uint8_t own[6];
+  for(auto& p : pairs) {
+    p->controller.get_transport().get_mac_address(own);
+    if(0 == memcmp(own, mac, 6)) return p.get();
+  }
+  return nullptr;
+}
+
+
+static void make_command(uint16_t counter, BugCommand& command) {
+  command.speed_0 = (int8_t)(counter % 100);
+  command.speed_1 = (int8_t)(counter / 100 % 100);
+}
+
+
+static unsigned long controller_loop(Pair& p) {
+  Comm& c = p.controller;
+  if(!p.sides[0].paired) {
+    p.sides[0].paired = c.service_pairing();
+    if(p.sides[0].paired) p.next_change = NowCommSim::now();
+    return LOOP_US;
+  }
+  unsigned long now = NowCommSim::now();
+  if((long)(now - p.next_change) >= 0) {
+    BugCommand command;
+    make_command(++p.counter, command);
+    c.set_command(command);
+    p.changed_at[p.counter & (CHANGES - 1)] = now;
+    if(in_drive(now)) p.made++;
+    p.next_change = now + (CHANGE_MS / 2 + nowcomm_random() % CHANGE_MS) * 1000UL;
+  }
+  c.service();
+  c.update();
+  while(c.is_data_ready()) c.clear_data_ready();
+  return LOOP_US;
+}
+
+
+static unsigned long receiver_loop(Pair& p) {
+  Comm& r = p.receiver;
+  if(!p.sides[1].paired) {
+    p.sides[1].paired = r.service_pairing();
+    return LOOP_US;
+  }
+  r.update();
+  while(r.is_data_ready()) {
+    if(NOWCOMM_KIND_COMMAND == r.get_msg_kind()) {
+      const BugCommand* command = r.get_data();
+      uint16_t          counter = (uint16_t)(command->speed_0 + command->speed_1 * 100);
+      Pair*             from    = controller_of(r.get_msg_mac());
+      if(from && counter != p.heard && counter) {
+        unsigned long changed = from->changed_at[counter & (CHANGES - 1)];
+        p.heard = counter;
+        if(in_drive(changed)) {
+          from->arrived++;
+          latencies->add(r.get_msg_rx_us() - changed);
+        }
+      }
+    }
+    r.clear_data_ready();
+  }
+  return LOOP_US;
+}
+
+
+static unsigned long side_loop(void* context) {
+  Side& side = *(Side*)context;
+  Pair& p    = *side.pair;
+  if(!side.started) {
+    side.started = true;
+    if(side.controller) p.controller.begin(NOWCOMM_MODE_CONTROLLER, p.channel);
+    else                p.receiver.begin(NOWCOMM_MODE_RECEIVER, p.channel);
+  }
+  return side.controller ? controller_loop(p) : receiver_loop(p);
+}
+
+
+static void run(uint32_t count, bool scan, uint32_t seed, Result& result) {
+  SimConfig config;
+  config.loss_pct   = LOSS_PCT;
+  config.jitter_us  = JITTER_US;
+  config.seed       = seed;
+  pairs.clear();
+  NowCommSim::reset(config);
+  result            = Result();
+  result.pairs      = count;
+  latencies         = &result.latency_us;
+  drive_from        = PAIR_DEADLINE_MS * 1000UL;
+  for(uint32_t i = 0; i < count; i++) {
+    pairs.emplace_back(new Pair());
+    Pair& p    = *pairs.back();
+    p.channel  = scan ? NOWCOMM_CHANNEL_AUTO : (uint8_t)(nowcomm_random() % 13 + 1);
+    p.sides[0] = { &p, true };
+    p.sides[1] = { &p, false };
+    NowCommSim::start_task(side_loop, &p.sides[0], nowcomm_random() % (STAGGER_MS * 1000UL));
+    NowCommSim::start_task(side_loop, &p.sides[1], nowcomm_random() % (STAGGER_MS * 1000UL));
+  }
+  auto start = std::chrono::steady_clock::now();
+  NowCommSim::run_until(drive_from + DRIVE_MS * 1000UL + 500000UL);   // Time for the last changes to land
+  result.wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  NowCommSim::get_stats(result.air);
+  result.fingerprint = result.air.frames * 1000003ULL + result.air.delivered;
+  for(auto& p : pairs) {
+    uint8_t own[6];
+    p->receiver.get_transport().get_mac_address(own);
+    result.made    += p->made;
+    result.arrived += p->arrived;
+    if(!p->sides[0].paired || !p->controller.is_connected()) continue;
+    result.paired++;
+    result.pair_us.add(p->controller.get_time_to_pair());
+    if(0 != memcmp(p->controller.get_peer_address(), own, 6)) result.crossed++;
+    result.fingerprint = result.fingerprint * 31 + p->controller.get_time_to_pair();
+  }
+  result.fingerprint = result.fingerprint * 31 + result.latency_us.percentile(99);
+  pairs.clear();
+  NowCommSim::stop();
+}
+
+
+static void print(const char* mode, Result& r) {
+  uint64_t busy = 0;
+  for(int c = 1; c < SIM_CHANNELS; c++) busy += r.air.busy_us[c];
+  double sim_s = (PAIR_DEADLINE_MS + DRIVE_MS + 500) / 1000.0;
+  printf("  %-8s %2u pairs: %2u paired, %2u crossed; pair p50 %6.1f ms, p99 %6.1f ms, max %6.1f ms | "
+         "%5.1f%% of %5u changes arrived, p50 %5.1f ms, p99 %6.1f ms, max %6.1f ms | %7llu frames, %4.1f%% collided, "
+         "%5llu retries, %4llu failed, air %4.1f%% busy per channel | %5.0fx real time\n",
+         mode, r.pairs, r.paired, r.crossed, r.pair_us.percentile(50) / 1000.0, r.pair_us.percentile(99) / 1000.0,
+         r.pair_us.get_max() / 1000.0, r.made ? 100.0 * r.arrived / r.made : 0.0, r.made,
+         r.latency_us.percentile(50) / 1000.0, r.latency_us.percentile(99) / 1000.0, r.latency_us.get_max() / 1000.0,
+         (unsigned long long)r.air.frames, r.air.frames ? 100.0 * r.air.collided / r.air.frames : 0.0,
+         (unsigned long long)r.air.retries, (unsigned long long)r.air.failed, 100.0 * busy / 14 / (sim_s * 1e6),
+         r.wall_s > 0 ? sim_s / r.wall_s : 0.0);
+}
+
+
+int main() {
+  static const uint32_t counts[] = { 1, 5, 10, 20 };
+  bool   ok = true;
+  Result result, again;
+  printf("%u ms to pair, then %u ms of driving; %u%% loss, %u us jitter; airtime %u us for a command, %u us for a response\n",
+         PAIR_DEADLINE_MS, DRIVE_MS, LOSS_PCT, JITTER_US, (unsigned)NowCommSim::airtime_us(BugCommand::wire_size),
+         (unsigned)NowCommSim::airtime_us(Comm::response_size));
+  for(int mode = 0; mode < 2; mode++) {
+    for(uint32_t count : counts) {
+      run(count, 1 == mode, SEED + count, result);
+      print(mode ? "scan" : "assigned", result);
+      if(1 == count) {
+        bool clean = 1 == result.paired && 0 == result.crossed && result.made && result.arrived == result.made;
+        if(!clean) printf("    FAILED: a lone pair should pair and get every change through\n");
+        ok &= clean;
+      }
+    }
+  }
+  run(10, false, SEED, result);
+  run(10, false, SEED, again);
+  bool repeatable = result.fingerprint == again.fingerprint;
+  printf("repeatable: 10 pairs from one seed twice, %s\n", repeatable ? "the same" : "DIFFERENT");
+  ok &= repeatable;
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,257 @@
+// Host benchmark: receiver-side smoothing, against driving the motors with the last command as it came.
+// On a simulated clock, a controller follows a stick swept back and forth (STICK_PERIOD_MS) and sends at
+// a few rates, over a link that loses frames at random and delays the rest by LATENCY_US plus up to
+// JITTER_US. The receiver drives its motors every MOTOR_PERIOD_US, with each.
+//   motion:   the largest change between one motor update and the next, and how far the motors are from
+//             the stick on average (RMS), for each send rate and loss
+//   bridging: a stick held at CRUISE_SPEED, so only keepalives go out, and one of them lost; the motors
+//             must not dip, nor time out
+//   stop:     the link dies with the robot at CRUISE_SPEED; how long until the motors stop
+//   fleet:    a controller driving FLEET_SIZE robots at 50 Hz, so each robot's seqs step by FLEET_SIZE,
+//             with some frames lost; the interval must still come out near 20 ms
+//   BugComm:  a loopback pair, the receiver reading get_smoothed_speeds() on the real clock, until the
+//             controller goes quiet
+// Exits non-zero if a smoothed step breaks the slew limit, the motors dip across the gap, they don't
+// stop in time, or the fleet's seq gaps are taken for lost frames.
+//
+// pio run -e native_smoothing && .pio/build/native_smoothing/program
+
+#include <math.h>
+#include <vector>
+#include <BugComm.h>
+
+#define RUN_MS              6000
+#define STICK_PERIOD_MS     1500
+#define STICK_SPEED         80            // Amplitude
+#define MOTOR_PERIOD_US     1000
+#define LATENCY_US          2000
+#define JITTER_US           1000
+#define CRUISE_SPEED        70
+#define KEEPALIVE_US        (1000000UL / SEND_KEEPALIVE_HZ)   // Between frames while the stick is held
+#define FLEET_SIZE          6
+
+
+typedef BasicBugComm<LoopbackTransport>               Comm;
+typedef BugNowComm<LoopbackTransport>                 Raw;
+
+static const uint8_t  stick_mac[6]  = { 0x02, 0x53, 0x54, 0x49, 0x43, 0x4B };
+static const uint8_t  robot_mac[6]  = { 0x02, 0x52, 0x4F, 0x42, 0x4F, 0x54 };
+
+
+struct Frame {
+  unsigned long rx_us;
+  uint16_t      seq;
+  int8_t        speed;
+};
+
+
+static uint32_t random_state = 1;
+
+static uint32_t next_random() {
+  random_state = random_state * 1664525 + 1013904223;
+  return random_state >> 8;
+}
+
+
+static int8_t stick_at(unsigned long us) {
+  return (int8_t)lround(STICK_SPEED * sin(2 * M_PI * us / (STICK_PERIOD_MS * 1000.0)));
+}
+
+
+// The frames a controller sending at hz gets through to the receiver, in order of arrival.
+//
+static std::vector<Frame> link(uint16_t hz, uint8_t loss_pct) {
+  std::vector<Frame> frames;
+  unsigned long      period = 1000000UL / hz;
+  uint16_t           seq    = 0;
+  for(unsigned long us = 0; us < RUN_MS * 1000UL; us += period) {
+    seq++;
+    if(next_random() % 100 < loss_pct) continue;
+    frames.push_back({ us + LATENCY_US + next_random() % JITTER_US, seq, stick_at(us) });
+  }
+  return frames;
+}
+
+
+struct Motion {
+  int       max_step;
+  double    rms;
+};
+
+
+// Drive the motors through the run, with the last command (raw) or through a BugSmoother.
+//
+static Motion drive(const std::vector<Frame>& frames, bool smoothed) {
+  BugSmoother smoother;
+  size_t      next    = 0;
+  int         speed   = 0;
+  int         was     = 0;
+  Motion      motion  = { 0, 0 };
+  long        count   = 0;
+  for(unsigned long us = 0; us < RUN_MS * 1000UL; us += MOTOR_PERIOD_US) {
+    for(; next < frames.size() && frames[next].rx_us <= us; next++) {
+      int8_t speeds[4] = { frames[next].speed, 0, 0, 0 };
+      if(smoothed) smoother.add(speeds, frames[next].seq, frames[next].rx_us);
+      else         speed = frames[next].speed;
+    }
+    if(smoothed) {
+      int8_t speeds[4];
+      smoother.output(us, speeds);
+      speed = speeds[0];
+    }
+    int step  = abs(speed - was);
+    int error = speed - stick_at(us);
+    if(step > motion.max_step) motion.max_step = step;
+    motion.rms += error * error;
+    was = speed;
+    count++;
+  }
+  motion.rms = sqrt(motion.rms / count);
+  return motion;
+}
+
+
+static bool motion() {
+  static const uint16_t rates[]  = { 50, 20, 10 };
+  static const uint8_t  losses[] = { 0, 10, 30 };
+  BugSmoothConfig       config;
+  int                   limit    = (config.slew_per_s * MOTOR_PERIOD_US + 999999) / 1000000 + 1;   // Per update, rounding included
+  bool                  ok       = true;
+  printf("motion: largest step between motor updates, and RMS distance from the stick\n");
+  for(uint16_t hz : rates) {
+    for(uint8_t loss : losses) {
+      std::vector<Frame> frames = link(hz, loss);
+      Motion raw    = drive(frames, false);
+      Motion smooth = drive(frames, true);
+      bool   good   = smooth.max_step <= limit;
+      printf("  %2u Hz, %2u%% lost:  last command step %3d, RMS %5.1f;  smoothed step %2d, RMS %5.1f%s\n",
+             hz, loss, raw.max_step, raw.rms, smooth.max_step, smooth.rms, good ? "" : "  FAILED");
+      ok &= good;
+    }
+  }
+  return ok;
+}
+
+
+// Cruise at 50 Hz for a second, then hold the stick: a keepalive every KEEPALIVE_US, the third of them
+// lost, so the gap across it is two keepalive periods.
+//
+static bool bridging() {
+  BugSmoother smoother;
+  int8_t      cruise[4] = { CRUISE_SPEED, CRUISE_SPEED, CRUISE_SPEED, CRUISE_SPEED };
+  int8_t      speeds[4];
+  uint16_t    seq       = 0;
+  int         lowest    = 100;
+  unsigned long us      = 0;
+  for(; us < 1000000UL; us += 20000) {
+    smoother.add(cruise, ++seq, us);
+    for(unsigned long t = us; t < us + 20000; t += MOTOR_PERIOD_US) smoother.output(t, speeds);
+  }
+  for(int k = 1; k <= 6; k++) {
+    unsigned long at = 1000000UL + k * KEEPALIVE_US;
+    for(; us < at; us += MOTOR_PERIOD_US) {
+      smoother.output(us, speeds);
+      if(speeds[0] < lowest) lowest = speeds[0];
+    }
+    seq++;
+    if(3 != k) smoother.add(cruise, seq, us);               // The third is lost
+  }
+  smoother.output(us, speeds);
+  bool ok = CRUISE_SPEED == lowest && CRUISE_SPEED == speeds[0] && 0 == smoother.get_timeouts();
+  printf("bridging: held at %d, keepalives every %lu ms, one lost: lowest %d, %u timeouts%s\n", CRUISE_SPEED,
+         KEEPALIVE_US / 1000, lowest, smoother.get_timeouts(), ok ? "" : "  FAILED");
+  return ok;
+}
+
+
+static bool stop() {
+  BugSmoother     smoother;
+  BugSmoothConfig config;
+  int8_t          cruise[4] = { CRUISE_SPEED, -CRUISE_SPEED, CRUISE_SPEED, -CRUISE_SPEED };
+  int8_t          speeds[4];
+  unsigned long   us        = 0;
+  unsigned long   stopped   = 0;
+  unsigned long   last      = 49 * 20000UL;
+  uint16_t        seq       = 0;
+  for(; us < last + 2000000UL; us += MOTOR_PERIOD_US) {
+    if(us <= last && 0 == us % 20000) smoother.add(cruise, ++seq, us);
+    bool live = smoother.output(us, speeds);
+    if(us > last && 0 == stopped && !live && 0 == speeds[0] && 0 == speeds[1]) stopped = us - last;
+  }
+  unsigned long most = (config.timeout_ms + config.stop_ms) * 1000UL + MOTOR_PERIOD_US;
+  bool ok = 0 < stopped && stopped <= most && 1 == smoother.get_timeouts();
+  printf("stop: the link dies at %d; last command drives on for ever, smoothed stops %lu ms after the last frame "
+         "(at most %lu)%s\n", CRUISE_SPEED, stopped / 1000, most / 1000, ok ? "" : "  FAILED");
+  return ok;
+}
+
+
+// Each robot's commands come every 20 ms, FLEET_SIZE seqs apart; every seventh is lost.
+//
+static bool fleet() {
+  BugSmoother smoother;
+  int8_t      cruise[4] = { CRUISE_SPEED, CRUISE_SPEED, CRUISE_SPEED, CRUISE_SPEED };
+  uint16_t    seq       = 0;
+  for(int i = 1; i <= 200; i++) {
+    seq += FLEET_SIZE;
+    if(0 != i % 7) smoother.add(cruise, seq, i * 20000UL + next_random() % JITTER_US);
+  }
+  uint32_t interval = smoother.get_interval_us();
+  bool     ok       = 18000 <= interval && 22000 >= interval;
+  printf("fleet: %d robots at 50 Hz, 1 frame in 7 lost: interval %.1f ms (20)%s\n", FLEET_SIZE, interval / 1000.0, ok ? "" : "  FAILED");
+  return ok;
+}
+
+
+static bool bug_comm() {
+  Comm        controller, receiver;
+  BugCommand  command;
+  int8_t      speeds[4] = { 0 };
+  bool        live      = false;
+  controller.get_transport().set_mac_address(stick_mac);
+  receiver.get_transport().set_mac_address(robot_mac);
+  controller.begin(NOWCOMM_MODE_CONTROLLER, 1);
+  receiver.begin(NOWCOMM_MODE_RECEIVER, 1);
+  bool paired = false;
+  for(int i = 0; i < 1000 && !paired; i++) {
+    bool done = controller.service_pairing();
+    paired = receiver.service_pairing() && done;
+    delay(1);
+  }
+  if(!paired) { printf("BugComm: pairing failed\n"); return false; }
+  command.speed_0 = CRUISE_SPEED;
+  command.speed_1 = -CRUISE_SPEED;
+  BugSmoothConfig config;
+  unsigned long start = millis();
+  unsigned long quiet = start + 300;
+  unsigned long next  = start;
+  int           top   = 0;
+  while((long)(millis() - quiet) < (long)(config.timeout_ms + config.stop_ms + 200)) {
+    if((long)(millis() - quiet) < 0 && (long)(millis() - next) >= 0) {
+      controller.Raw::send_command(&command);
+      next += 20;
+    }
+    receiver.update();
+    while(receiver.is_data_ready()) receiver.clear_data_ready();
+    controller.update();
+    while(controller.is_data_ready()) controller.clear_data_ready();
+    live = receiver.get_smoothed_speeds(speeds);
+    if(speeds[0] > top) top = speeds[0];
+    delay(1);
+  }
+  bool ok = CRUISE_SPEED == top && !live && 0 == speeds[0] && 0 == speeds[1];
+  printf("BugComm: reached %d, then %s after the controller went quiet%s\n", top,
+         0 == speeds[0] && !live ? "stopped" : "still driving", ok ? "" : "  FAILED");
+  return ok;
+}
+
+
+int main() {
+  bool ok = motion();
+  ok &= bridging();
+  ok &= stop();
+  ok &= fleet();
+  ok &= bug_comm();
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,124 @@
+// Host benchmark: NowCommStream, a blob of STREAM_BYTES between two loopback devices.
+//   loss:     pushed controller to receiver with the channel losing 0 - 30% of frames, both ways, so
+//             fragments and acks alike; the blob must arrive intact every time
+//   window:   at 10% loss, with windows from stop-and-wait up; one past NOWCOMM_STREAM_WINDOW_MAX must be
+//             held to it
+//   pull:     the other way, receiver to controller, and a stream too big for the buffer, which must be
+//             refused
+// Reports bytes per second, and frames on the air per fragment, fragments and acks together. The
+// loopback medium delivers as fast as the CPU goes, so the rate is the protocol's own cost and its
+// waits on timeouts; on the radio, air time adds to it.
+// Exits non-zero if a stream doesn't arrive intact, or the big one isn't refused.
+//
+// pio run -e native_stream && .pio/build/native_stream/program
+
+#define NOWCOMM_RX_DEPTH    32            // A window of up to 31 fits each poll of the loopback medium
+#include <NowComm.h>
+#include <NowCommStream.h>
+
+#define STREAM_BYTES        (64 * 1024)
+#define STREAM_CHANNEL      3
+#define TIMEOUT_MS          20000
+
+
+typedef BasicNowComm<LoopbackTransport, NowComm_StreamData, NowComm_StreamAck>  Link;
+
+static const uint8_t  stick_mac[6]  = { 0x02, 0x53, 0x54, 0x49, 0x43, 0x4B };
+static const uint8_t  robot_mac[6]  = { 0x02, 0x52, 0x4F, 0x42, 0x4F, 0x54 };
+static uint8_t        blob[STREAM_BYTES];
+static uint8_t        landed[STREAM_BYTES];
+
+
+struct Pair {
+  Link                  stick;
+  Link                  robot;
+  NowCommStream<Link>   stick_stream{stick};
+  NowCommStream<Link>   robot_stream{robot};
+  bool pair() {
+    stick.get_transport().set_mac_address(stick_mac);
+    robot.get_transport().set_mac_address(robot_mac);
+    stick.begin(NOWCOMM_MODE_CONTROLLER, STREAM_CHANNEL);
+    robot.begin(NOWCOMM_MODE_RECEIVER, STREAM_CHANNEL);
+    for(int i = 0; i < 1000; i++) {
+      bool done = stick.service_pairing();
+      if(robot.service_pairing() && done) return true;
+      delay(1);
+    }
+    return false;
+  }
+  void run() {
+    Link::Message msg;
+    stick.update();
+    while(stick.receive(msg)) stick_stream.handle(msg);
+    stick_stream.service();
+    robot.update();
+    while(robot.receive(msg)) robot_stream.handle(msg);
+    robot_stream.service();
+  }
+};
+
+
+// Send len bytes of the blob from one end of a pair to the other, and check what arrived.
+//
+static bool transfer(const char* name, uint8_t loss, uint8_t window, bool pull, uint32_t len = STREAM_BYTES) {
+  Pair                  pair;
+  NowComm_StreamStats   sent, got;
+  if(!pair.pair()) { printf("%s: pairing failed\n", name); return false; }
+  NowCommStream<Link>&  from = pull ? pair.robot_stream : pair.stick_stream;
+  NowCommStream<Link>&  to   = pull ? pair.stick_stream : pair.robot_stream;
+  Link&                 sender = pull ? pair.robot : pair.stick;
+  Link&                 receiver = pull ? pair.stick : pair.robot;
+  memset(landed, 0, sizeof(landed));
+  to.set_buffer(landed, sizeof(landed));
+  from.set_window(window);
+  LoopbackTransport::set_channel_loss(STREAM_CHANNEL, loss);
+  uint32_t air_before = sender.get_transport().get_frames_sent() + receiver.get_transport().get_frames_sent();
+  unsigned long start = millis();
+  from.send(blob, len);
+  while(NOWCOMM_STREAM_BUSY == from.get_send_state() && millis() - start < TIMEOUT_MS) pair.run();
+  LoopbackTransport::set_channel_loss(STREAM_CHANNEL, 0);
+  uint32_t air = sender.get_transport().get_frames_sent() + receiver.get_transport().get_frames_sent() - air_before;
+  from.get_send_stats(sent);
+  to.get_receive_stats(got);
+  bool arrived = NOWCOMM_STREAM_DONE == from.get_send_state() && NOWCOMM_STREAM_DONE == to.get_receive_state() &&
+                 len == to.get_received_length() && 0 == memcmp(blob, landed, len);
+  double seconds = sent.us / 1e6;
+  printf("  %-12s %2u%% lost, window %2u (asked %2u): %s  %8.0f bytes/s  %5u fragments, %5u sent (%4u on timeout, %4u on holes), "
+         "%4u acks, %4u repeats, %.2f frames each, timeout %lu us\n",
+         name, loss, from.get_window(), window, arrived ? "intact" : "FAILED", arrived && seconds > 0 ? len / seconds : 0.0, sent.fragments,
+         sent.frames_sent, sent.resent, sent.fast_resent, got.frames_sent, got.duplicates,
+         sent.fragments ? (double)air / sent.fragments : 0.0, (unsigned long)sent.rto_us);
+  return arrived && from.get_window() <= NOWCOMM_STREAM_WINDOW_MAX;
+}
+
+
+static bool refused() {
+  Pair    pair;
+  uint8_t small[NOWCOMM_STREAM_FRAGMENT * 2];
+  if(!pair.pair()) { printf("refused: pairing failed\n"); return false; }
+  pair.robot_stream.set_buffer(small, sizeof(small));
+  pair.stick_stream.send(blob, sizeof(small) + 1);
+  unsigned long start = millis();
+  while(NOWCOMM_STREAM_BUSY == pair.stick_stream.get_send_state() && millis() - start < TIMEOUT_MS) pair.run();
+  bool ok = NOWCOMM_STREAM_FAILED == pair.stick_stream.get_send_state() && NOWCOMM_STREAM_FAILED == pair.robot_stream.get_receive_state();
+  printf("  %u bytes into a %u-byte buffer: %s\n", (unsigned)sizeof(small) + 1, (unsigned)sizeof(small), ok ? "refused" : "NOT REFUSED");
+  return ok;
+}
+
+
+int main() {
+  static const uint8_t losses[]  = { 0, 5, 10, 20, 30 };
+  static const uint8_t windows[] = { 1, 4, 8, 16, NOWCOMM_STREAM_WINDOW_MAX, NOWCOMM_STREAM_WINDOW_MAX + 1 };
+  bool ok = true;
+  for(uint32_t i = 0; i < STREAM_BYTES; i++) blob[i] = (uint8_t)(nowcomm_random() >> 8);
+  printf("loss, %d bytes pushed in %d-byte fragments:\n", STREAM_BYTES, NOWCOMM_STREAM_FRAGMENT);
+  for(uint8_t loss : losses) ok &= transfer("push", loss, NOWCOMM_STREAM_WINDOW, false);
+  printf("window:\n");
+  for(uint8_t window : windows) ok &= transfer("push", 10, window, false);
+  printf("pull, and a stream too big:\n");
+  ok &= transfer("pull", 10, NOWCOMM_STREAM_WINDOW, true);
+  ok &= transfer("short", 10, NOWCOMM_STREAM_WINDOW, false, NOWCOMM_STREAM_FRAGMENT + 7);
+  ok &= refused();
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
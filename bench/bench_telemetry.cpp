@@ -0,0 +1,169 @@
+// Host benchmark: telemetry carried on command responses.
+// A loopback controller sends a BugCommand every COMMAND_PERIOD_MS for RUN_MS to a receiver that drives
+// its motors through the smoother every millisecond and reports a battery running down. Both sides are
+// serviced every millisecond on one thread, so what the controller hears can be checked against what the
+// receiver had when it answered.
+//   carried:  responses that brought telemetry, and whether every one matched the receiver's battery and
+//             driven speeds at the time
+//   age:      the telemetry's age, sampled every millisecond on the controller, at 0 and LOSS_PCT loss
+//   airtime:  frames on the air per command, and response bytes, with and without telemetry
+//   alone:    a BugTelemetry sent on its own, as a receiver might while no commands come
+// Exits non-zero if any telemetry disagrees with the receiver, a response goes without it, or it costs a
+// frame.
+//
+// pio run -e native_telemetry && .pio/build/native_telemetry/program
+
+#include <BugComm.h>
+
+#define RUN_MS              2000
+#define COMMAND_PERIOD_MS   20
+#define LOSS_PCT            10
+#define FULL_MV             4200
+#define CHANNEL             1
+
+
+typedef BasicBugComm<LoopbackTransport>               Comm;
+typedef BugNowComm<LoopbackTransport>                 Raw;
+typedef BasicNowComm<LoopbackTransport, BugCommand>   Plain;   // No telemetry type
+
+static_assert(6 == Plain::response_size, "A NowComm without telemetry must answer as it always has");
+static_assert(6 + BugTelemetry::wire_size - NOWCOMM_HEADER_SIZE == Comm::response_size, "The telemetry rides after the response");
+
+static const uint8_t  stick_mac[6]  = { 0x02, 0x53, 0x54, 0x49, 0x43, 0x4B };
+static const uint8_t  robot_mac[6]  = { 0x02, 0x52, 0x4F, 0x42, 0x4F, 0x54 };
+
+
+struct Run {
+  uint32_t              commands;         // Sent by the controller
+  uint32_t              responses;        // Acked, by the link stats
+  uint32_t              carried;          // Telemetry updates the controller saw
+  uint32_t              mismatched;
+  uint32_t              frames;           // On the air, both ways
+  NowCommRttHistogram   age;
+};
+
+
+static bool pair(Comm& controller, Comm& receiver) {
+  controller.get_transport().set_mac_address(stick_mac);
+  receiver.get_transport().set_mac_address(robot_mac);
+  controller.begin(NOWCOMM_MODE_CONTROLLER, CHANNEL);
+  receiver.begin(NOWCOMM_MODE_RECEIVER, CHANNEL);
+  for(int i = 0; i < 1000; i++) {
+    bool done = controller.service_pairing();
+    if(receiver.service_pairing() && done) return true;
+    delay(1);
+  }
+  return false;
+}
+
+
+static bool same(const BugTelemetry& telemetry, uint16_t millivolts, const int8_t speeds[4]) {
+  return millivolts == telemetry.millivolts && speeds[0] == telemetry.speed_0 && speeds[1] == telemetry.speed_1 &&
+         speeds[2] == telemetry.speed_2 && speeds[3] == telemetry.speed_3;
+}
+
+
+static bool drive(bool telemetry, uint8_t loss, Run& run) {
+  Comm              controller, receiver;
+  BugCommand        command;
+  BugTelemetry      heard;
+  NowComm_LinkStats link;
+  int8_t            driven[4]   = { 0 };
+  unsigned long     last_heard  = 0;
+  run = Run();
+  if(!pair(controller, receiver)) return false;
+  if(!telemetry) receiver.set_telemetry_source(nullptr);
+  controller.reset_link_stats();
+  LoopbackTransport::set_channel_loss(CHANNEL, loss);
+  uint32_t      air_before  = controller.get_transport().get_frames_sent() + receiver.get_transport().get_frames_sent();
+  unsigned long start       = millis();
+  unsigned long next        = start;
+  while(millis() - start < RUN_MS + 50) {
+    unsigned long ms = millis() - start;
+    if(ms < RUN_MS && (long)(millis() - next) >= 0) {
+      command.speed_0 = (int8_t)(ms / 25 % 100);
+      command.speed_1 = (int8_t)-command.speed_0;
+      controller.Raw::send_command(&command);
+      run.commands++;
+      next += COMMAND_PERIOD_MS;
+    }
+    uint16_t      battery = (uint16_t)(FULL_MV - ms / 4);
+    int8_t        before[4];
+    unsigned long age_us;
+    memcpy(before, driven, sizeof(before));
+    receiver.set_battery(battery);
+    receiver.update();                    // Answers with what it had: this battery, the speeds driven last
+    while(receiver.is_data_ready()) receiver.clear_data_ready();
+    receiver.get_smoothed_speeds(driven);
+    controller.update();
+    while(controller.is_data_ready()) controller.clear_data_ready();
+    if(controller.get_telemetry(heard, age_us)) {
+      if(controller.get_telemetry_rx_us() != last_heard) {
+        last_heard = controller.get_telemetry_rx_us();
+        run.carried++;
+        if(!same(heard, battery, before)) run.mismatched++;
+      }
+      if(ms < RUN_MS) run.age.add(age_us);
+    }
+    delay(1);
+  }
+  LoopbackTransport::set_channel_loss(CHANNEL, 0);
+  controller.get_link_stats(link);
+  run.responses = link.acked;
+  run.frames    = controller.get_transport().get_frames_sent() + receiver.get_transport().get_frames_sent() - air_before;
+  return true;
+}
+
+
+static bool carried() {
+  static const uint8_t losses[] = { 0, LOSS_PCT };
+  bool ok = true;
+  printf("carried, and age: a command every %d ms for %d ms\n", COMMAND_PERIOD_MS, RUN_MS);
+  for(uint8_t loss : losses) {
+    Run  run;
+    bool good = drive(true, loss, run);
+    good = good && 0 < run.carried && run.carried == run.responses && 0 == run.mismatched;
+    printf("  %2u%% lost: %4u commands, %4u responses, %4u with telemetry, %u mismatched; age p50 %5u us, p99 %5u us, "
+           "max %6u us%s\n", loss, run.commands, run.responses, run.carried, run.mismatched, run.age.percentile(50),
+           run.age.percentile(99), run.age.get_max(), good ? "" : "  FAILED");
+    ok &= good;
+  }
+  return ok;
+}
+
+
+static bool airtime() {
+  Run  with, without;
+  bool ok = drive(true, 0, with) && drive(false, 0, without);
+  double with_each    = with.commands ? (double)with.frames / with.commands : 0;
+  double without_each = without.commands ? (double)without.frames / without.commands : 0;
+  ok = ok && 0 == without.carried && with_each <= without_each + 0.01;
+  printf("airtime: %.3f frames per command with telemetry, %.3f without; responses %u bytes against %u%s\n",
+         with_each, without_each, Comm::response_size, Plain::response_size, ok ? "" : "  FAILED");
+  return ok;
+}
+
+
+static bool alone() {
+  Comm          controller, receiver;
+  BugTelemetry  telemetry, heard;
+  unsigned long age_us = 0;
+  if(!pair(controller, receiver)) return false;
+  telemetry.millivolts = 3456;
+  telemetry.speed_2    = -7;
+  receiver.send_command(&telemetry);
+  controller.update();
+  while(controller.is_data_ready()) controller.clear_data_ready();
+  bool ok = controller.get_telemetry(heard, age_us) && 3456 == heard.millivolts && -7 == heard.speed_2;
+  printf("alone: a BugTelemetry sent on its own %s\n", ok ? "is taken as the latest" : "was MISSED");
+  return ok;
+}
+
+
+int main() {
+  bool ok = carried();
+  ok &= airtime();
+  ok &= alone();
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -1,57 +1,221 @@
-#include <Arduino.h>
 #include "BugComm.h"
 
 
-void BugComm::send_command(int8_t x, int8_t y, bool button) {
-  // Joystick values are +/- 128, we need to scale these to +/- 100
-  x =  (int8_t)(((int16_t)(x)*100)/128);
-  y = -(int8_t)(((int16_t)(y)*100)/128);  // Invert Y so steering is natural
-  // dampen down the small numbers
-  if (abs(x) < 2) x = 0;
-  if (abs(y) < 2) y = 0;
-  float delta = y / 100.0;
-  if(0 > delta) delta = 1.0 + delta;
-  else if(0 < delta) delta = -(1.0 - delta);
-  if(last_x != x || last_y != y || last_b != button) {
+static const uint32_t bug_palette[] = {
+  0x000000,   // BUG_COLOR_OFF
+  0x001000,   // BUG_COLOR_GREEN
+  0x100000,   // BUG_COLOR_RED
+  0x000010,   // BUG_COLOR_BLUE
+  0x101000,   // BUG_COLOR_YELLOW
+  0x001010,   // BUG_COLOR_CYAN
+  0x100010,   // BUG_COLOR_MAGENTA
+  0x101010    // BUG_COLOR_WHITE
+};
+
+
+void BugCommand::encode(uint8_t* frame) const {
+  uint8_t* p = frame + NOWCOMM_HEADER_SIZE;
+  frame[0] = nowcomm_header(kind);
+  p[0]     = (uint8_t)speed_0;
+  p[1]     = (uint8_t)speed_1;
+  p[2]     = (uint8_t)speed_2;
+  p[3]     = (uint8_t)speed_3;
+  p[4]     = (button ? 0x01 : 0x00) | ((color_left & 0x07) << 1) | ((color_right & 0x07) << 4);
+}
+
+
+bool BugCommand::decode(const uint8_t* frame) {
+  const uint8_t* p = frame + NOWCOMM_HEADER_SIZE;
+  speed_0     = (int8_t)p[0];
+  speed_1     = (int8_t)p[1];
+  speed_2     = (int8_t)p[2];
+  speed_3     = (int8_t)p[3];
+  button      = p[4] & 0x01;
+  color_left  = (p[4] >> 1) & 0x07;
+  color_right = (p[4] >> 4) & 0x07;
+  return 0 == (p[4] & 0x80) &&
+         100 >= abs(speed_0) && 100 >= abs(speed_1) && 100 >= abs(speed_2) && 100 >= abs(speed_3);
+}
+
+
+void BugTelemetry::encode(uint8_t* frame) const {
+  uint8_t* p = frame + NOWCOMM_HEADER_SIZE;
+  frame[0] = nowcomm_header(kind);
+  wire_put_u16(p, millivolts);
+  p[2]     = (uint8_t)speed_0;
+  p[3]     = (uint8_t)speed_1;
+  p[4]     = (uint8_t)speed_2;
+  p[5]     = (uint8_t)speed_3;
+}
+
+
+bool BugTelemetry::decode(const uint8_t* frame) {
+  const uint8_t* p = frame + NOWCOMM_HEADER_SIZE;
+  millivolts  = wire_get_u16(p);
+  speed_0     = (int8_t)p[2];
+  speed_1     = (int8_t)p[3];
+  speed_2     = (int8_t)p[4];
+  speed_3     = (int8_t)p[5];
+  return 100 >= abs(speed_0) && 100 >= abs(speed_1) && 100 >= abs(speed_2) && 100 >= abs(speed_3);
+}
+
+
+template <class Transport, class Mixer> void BasicBugComm<Transport, Mixer>::send_command(int8_t x, int8_t y, bool button) {
+  set_input(x, y, button);
+  service();
+}
+
+
+// Record the latest stick position. Nothing is sent until service() says it's time.
+//
+template <class Transport, class Mixer> void BasicBugComm<Transport, Mixer>::set_input(int8_t x, int8_t y, bool button) {
+  x =  bug_scale_axis(x);
+  y = -bug_scale_axis(y);   // Invert Y so steering is natural
+  if(last_x != x || last_y != y || last_b != button || use_staged) {
     last_x = x;
     last_y = y;
     last_b = button;
-    uint32_t color = 0x0000;          // Black
-    if     (x > 0) color = 0x001000;  // Moving forward, set color to green
-    else if(x < 0) color = 0x100000;  // Moving backward, set color to red
-
-    // If Y is < 0, trim the speed of motors 1 & 3
-    // If Y is > 0. trim the speed of motors 0 & 2
-    uint8_t scaled_value = (int)((float)x * delta);
-    command.speed_0      = 0 >= delta ?  x : scaled_value;
-    command.speed_1      = 0 <= delta ? -x : scaled_value;
-    command.speed_2      = 0 >= delta ?  x : scaled_value;
-    command.speed_3      = 0 <= delta ? -x : scaled_value;
-    command.color_left   = color;
-    command.color_right  = color;
-    command.button       = button;
-    NowComm<BugCommand>::send_command(&command);
+    use_staged = false;
+    scheduler.mark_changed();
   }
 }
 
 
-uint32_t BugComm::get_light_color(uint8_t pos) {
+// Stage a command mixed elsewhere. It is sent by service(), on the schedule, like a change of input.
+//
+template <class Transport, class Mixer> bool BasicBugComm<Transport, Mixer>::set_command(const BugCommand& command) {
+  uint8_t now[BugCommand::wire_size];
+  uint8_t was[BugCommand::wire_size];
+  command.encode(now);
+  staged.encode(was);
+  if(use_staged && 0 == memcmp(now, was, sizeof(now))) return false;
+  staged      = command;
+  use_staged  = true;
+  scheduler.mark_changed();
+  return true;
+}
+
+
+template <class Transport, class Mixer> void BasicBugComm<Transport, Mixer>::make_command(int8_t x, int8_t y, bool button, BugCommand& command) {
+  mix_command(bug_scale_axis(x), -bug_scale_axis(y), button, command);
+}
+
+
+template <class Transport, class Mixer> void BasicBugComm<Transport, Mixer>::mix_command(int8_t x, int8_t y, bool button, BugCommand& command) {
+  int8_t  speeds[4];
+  uint8_t color = BUG_COLOR_OFF;
+  if     (x > 0) color = BUG_COLOR_GREEN;   // Moving forward
+  else if(x < 0) color = BUG_COLOR_RED;     // Moving backward
+  Mixer::mix(x, y, speeds);
+  command.speed_0     = speeds[0];
+  command.speed_1     = speeds[1];
+  command.speed_2     = speeds[2];
+  command.speed_3     = speeds[3];
+  command.color_left  = color;
+  command.color_right = color;
+  command.button      = button;
+}
+
+
+// If the scheduler says so, mix the latest input into a command and send it.
+// A keepalive resends the command unchanged. Until a receiver is paired nothing goes out, and the
+// scheduler doesn't count it.
+//
+template <class Transport, class Mixer> bool BasicBugComm<Transport, Mixer>::service() {
+  unsigned long now       = micros();
+  SendDecision  decision  = scheduler.poll(now);
+  if(SEND_NONE == decision) return false;
+  BugCommand& command = *this->get_data();
+  if(SEND_UPDATE == decision) {
+    if(use_staged) command = staged;
+    else           mix_command(last_x, last_y, last_b, command);
+  }
+  uint8_t peers = this->get_peer_count();
+  if(1 < peers) {
+    BugCommand fleet[NOWCOMM_MAX_PEERS];   // The whole fleet follows the stick, in one frame
+    for(uint8_t i = 0; i < peers; i++) fleet[i] = command;
+    this->send_multiplexed(fleet);
+  }
+  else if(!BugNowComm<Transport>::send_command(&command)) {
+    return false;
+  }
+  scheduler.sent(decision, now);
+  return true;
+}
+
+
+// Make the oldest message current, as NowComm does, and if it is a command, let the smoother have it.
+// A command that is still current is the same seq, which the smoother ignores. A recovered one isn't
+// given to it: the newer command it came with follows at once, and the smoother shares the change across
+// the frames it spans anyway, where the two arriving together would make the frame interval look short.
+//
+template <class Transport, class Mixer> bool BasicBugComm<Transport, Mixer>::is_data_ready() {
+  if(!BugNowComm<Transport>::is_data_ready()) return false;
+  if(NOWCOMM_KIND_COMMAND == this->get_msg_kind() && !this->get_msg_recovered()) {
+    const BugCommand* command  = this->get_data();
+    int8_t            speeds[] = { command->speed_0, command->speed_1, command->speed_2, command->speed_3 };
+    smoother.add(speeds, this->get_msg_seq(), this->get_msg_rx_us());
+  }
+  return true;
+}
+
+
+// The speeds to drive at now. They are also kept, packed in one word, for the telemetry.
+//
+template <class Transport, class Mixer> bool BasicBugComm<Transport, Mixer>::get_smoothed_speeds(int8_t speeds[4]) {
+  bool live = smoother.output(micros(), speeds);
+  driven.store((uint8_t)speeds[0] | (uint8_t)speeds[1] << 8 | (uint32_t)(uint8_t)speeds[2] << 16 | (uint32_t)(uint8_t)speeds[3] << 24,
+               std::memory_order_relaxed);
+  return live;
+}
+
+
+// The receive callback's telemetry source: copies out what loop() last stored, and nothing more.
+//
+template <class Transport, class Mixer> bool BasicBugComm<Transport, Mixer>::fill_telemetry(void* self, BugTelemetry& telemetry) {
+  BasicBugComm* comm  = (BasicBugComm*)self;
+  uint32_t      word  = comm->driven.load(std::memory_order_relaxed);
+  telemetry.millivolts  = comm->battery.load(std::memory_order_relaxed);
+  telemetry.speed_0     = (int8_t)(word);
+  telemetry.speed_1     = (int8_t)(word >> 8);
+  telemetry.speed_2     = (int8_t)(word >> 16);
+  telemetry.speed_3     = (int8_t)(word >> 24);
+  return true;
+}
+
+
+template <class Transport, class Mixer> uint32_t BasicBugComm<Transport, Mixer>::get_light_color(uint8_t pos) {
   if(pos > 2) return 0;
-  return (pos == 0) ? command.color_left : command.color_right;
+  return bug_palette[(pos == 0) ? this->get_data()->color_left : this->get_data()->color_right];
 }
 
 
-uint8_t  BugComm::get_motor_speed(uint8_t pos) {
+template <class Transport, class Mixer> uint8_t  BasicBugComm<Transport, Mixer>::get_motor_speed(uint8_t pos) {
   switch(pos) {
-    case 0:   return command.speed_0;
-    case 1:   return command.speed_1;
-    case 2:   return command.speed_2;
-    case 3:   return command.speed_3;
+    case 0:   return this->get_data()->speed_0;
+    case 1:   return this->get_data()->speed_1;
+    case 2:   return this->get_data()->speed_2;
+    case 3:   return this->get_data()->speed_3;
     default:  return 0;
   }
 }
 
 
-uint8_t  BugComm::get_button() {
-  return command.button;
+template <class Transport, class Mixer> uint8_t  BasicBugComm<Transport, Mixer>::get_button() {
+  return this->get_data()->button;
 }
+
+
+#define BUGCOMM_INSTANTIATE(Transport)                          \
+  template class BasicBugComm<Transport, BugDifferentialMixer>; \
+  template class BasicBugComm<Transport, BugTankMixer>;         \
+  template class BasicBugComm<Transport, BugArcadeMixer>;       \
+  template class BasicBugComm<Transport, BugMecanumMixer>;
+
+#ifdef ARDUINO
+BUGCOMM_INSTANTIATE(EspNowTransport)
+#else
+BUGCOMM_INSTANTIATE(LoopbackTransport)
+BUGCOMM_INSTANTIATE(UdpTransport)
+BUGCOMM_INSTANTIATE(SimTransport)
+#endif
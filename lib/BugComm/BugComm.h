@@ -1,30 +1,120 @@
 #pragma once
 #include <NowComm.h>
+#include "SendScheduler.h"
+#include "BugMixer.h"
+#include "BugSmoother.h"
 
 // Just a test of the NowComm Template Class
 
+// BugC LED colors. A command carries an index into this palette, not RGB.
+//
+enum BugColor {
+  BUG_COLOR_OFF,
+  BUG_COLOR_GREEN,
+  BUG_COLOR_RED,
+  BUG_COLOR_BLUE,
+  BUG_COLOR_YELLOW,
+  BUG_COLOR_CYAN,
+  BUG_COLOR_MAGENTA,
+  BUG_COLOR_WHITE
+};
+
+
+// Wire: header, speed_0 - speed_3 (two's complement, +/- 100), flags
+//   flags bit 0:    button
+//   flags bits 1-3: color_left
+//   flags bits 4-6: color_right
+//
 typedef struct BugCommand {
-  ulong         signature = NOWCOMM_SIGNATURE;
-  uint16_t      version   = NOWCOMM_VERSION;
-  NowComm_Kind  kind      = NOWCOMM_KIND_COMMAND;
-  int8_t        speed_0;
-  int8_t        speed_1;
-  int8_t        speed_2;
-  int8_t        speed_3;
-  uint32_t      color_left;
-  uint32_t      color_right;
-  bool          button;
+  static constexpr NowComm_Kind kind      = NOWCOMM_KIND_COMMAND;
+  static constexpr uint8_t      wire_size = NOWCOMM_HEADER_SIZE + 5;
+  static constexpr bool         acknowledge = true;
+  int8_t        speed_0     = 0;
+  int8_t        speed_1     = 0;
+  int8_t        speed_2     = 0;
+  int8_t        speed_3     = 0;
+  uint8_t       color_left  = BUG_COLOR_OFF;    // BugColor
+  uint8_t       color_right = BUG_COLOR_OFF;    // BugColor
+  bool          button      = false;
+  void          encode(uint8_t* frame) const;
+  bool          decode(const uint8_t* frame);
 } BugCommand;
 
+static_assert(8 == BugCommand::wire_size, "BugCommand encoding changed; bump NOWCOMM_VERSION");
+
+
+// Wire: header, millivolts (LE), speed_0 - speed_3 (two's complement, +/- 100)
+// What a BugC reports back on the response to every command: its battery, 0 if it hasn't measured it,
+// and the speeds it is driving, after smoothing.
+//
+typedef struct BugTelemetry {
+  static constexpr NowComm_Kind kind      = (NowComm_Kind)NOWCOMM_KIND_USER;
+  static constexpr uint8_t      wire_size = NOWCOMM_HEADER_SIZE + 6;
+  static constexpr bool         telemetry = true;
+  uint16_t      millivolts  = 0;
+  int8_t        speed_0     = 0;
+  int8_t        speed_1     = 0;
+  int8_t        speed_2     = 0;
+  int8_t        speed_3     = 0;
+  void          encode(uint8_t* frame) const;
+  bool          decode(const uint8_t* frame);
+} BugTelemetry;
 
-class BugComm : public NowComm<BugCommand> {
+static_assert(9 == BugTelemetry::wire_size, "BugTelemetry encoding changed; bump NOWCOMM_VERSION");
+
+
+template <class Transport> using BugNowComm = BasicNowComm<Transport, BugCommand, BugTelemetry>;
+
+
+// Transport is the NowComm transport policy. BugComm (below) uses the platform default;
+// host builds can also use BasicBugComm<UdpTransport>. Mixer turns the stick into motor speeds
+// (see BugMixer.h). Instantiations for every transport and mixer live in BugComm.cpp.
+// On the controller, set_input() records the stick as often as it's read and service() transmits
+// on the SendScheduler's schedule; send_command() does both. With more than one receiver paired, every
+// BugC gets the same command in one multiplexed frame. With one, set_redundancy() has each frame carry
+// copies of the commands before it, for a BugC to recover one it missed.
+// A command can also be mixed elsewhere, with make_command(), and handed over with set_command(); it
+// goes out on the same schedule. BugPipeline does that, mixing in a task of its own.
+// On the receiver, get_motor_speed() is the last command as it arrived. get_smoothed_speeds(), called at
+// the motor rate, is what to drive with: the commands made current by is_data_ready() are fed to a
+// BugSmoother, which glides between them, bridges a lost frame and stops the motors when the link goes
+// quiet. Commands taken with receive() instead are for the caller to hand to get_smoother().add().
+// Every response a receiver sends carries a BugTelemetry: the speeds get_smoothed_speeds() last gave and
+// the battery, as set_battery() was last told. On the controller, get_telemetry() has the latest.
+//
+template <class Transport, class Mixer = BugDifferentialMixer>
+class BasicBugComm : public BugNowComm<Transport> {
   public:
+    BasicBugComm()                                               { this->set_telemetry_source(fill_telemetry, this); }
+    using       BugNowComm<Transport>::send_command;            // A ready-made BugCommand, to one peer
     void        send_command(int8_t x, int8_t y, bool button);  // this takes x & y as +/- 128
-    uint32_t    get_light_color(uint8_t pos);
+    void        set_input(int8_t x, int8_t y, bool button);     // this takes x & y as +/- 128
+    bool        set_command(const BugCommand& command);         // Instead of set_input(); true if it changed anything
+    static void make_command(int8_t x, int8_t y, bool button, BugCommand& command);   // What set_input() would send
+    bool        service();                                      // Call every loop; true if a frame was sent
+    void        set_send_rate(uint16_t hz, uint16_t keepalive_hz) { scheduler.set_rate(hz, keepalive_hz);       }
+    void        get_send_stats(SendStats& stats)                 { scheduler.get_stats(stats, micros());        }
+    void        reset_send_stats()                               { scheduler.reset_stats(micros());             }
+    uint32_t    get_light_color(uint8_t pos);                   // RGB
     uint8_t     get_motor_speed(uint8_t pos);
     uint8_t     get_button();
+    bool        is_data_ready();                                // NowComm's, feeding each new command to the smoother
+    void        set_smoothing(const BugSmoothConfig& config)     { smoother.configure(config);                 }
+    bool        get_smoothed_speeds(int8_t speeds[4]);          // False until a command, and once the link has timed out
+    BugSmoother& get_smoother()                                  { return smoother;                             }
+    void        set_battery(uint16_t millivolts)                 { battery.store(millivolts, std::memory_order_relaxed); }
   private:
+    static void mix_command(int8_t x, int8_t y, bool button, BugCommand& command);   // x & y already scaled
+    static bool fill_telemetry(void* self, BugTelemetry& telemetry);   // From the receive callback
+    SendScheduler scheduler;
     int8_t      last_x  = 127;
     int8_t      last_y  = 127;
     bool        last_b  = false;
+    BugCommand  staged;                   // From set_command()
+    bool        use_staged = false;       // ...until set_input() is called again
+    BugSmoother smoother;
+    std::atomic<uint32_t> driven{0};      // get_smoothed_speeds()'s last, a byte each, for fill_telemetry()
+    std::atomic<uint16_t> battery{0};
 };
+
+typedef BasicBugComm<NowCommDefaultTransport> BugComm;
@@ -0,0 +1,114 @@
+#pragma once
+#include <stdint.h>
+
+// Joystick-to-motor mixing for the BugC.
+// Input is the stick scaled to +/- 100 (see bug_scale_axis): x is forward/back, y is left/right.
+// Output is the four motor speeds in BugCommand order: 0 front left, 1 front right, 2 rear left,
+// 3 rear right. The right-hand motors are mounted mirrored, so forward on them is negative.
+// A mixer is a policy class with
+//   static void mix(int8_t x, int8_t y, int8_t speeds[4]);
+// and is chosen at compile time with BasicBugComm's Mixer parameter. All of them are integer-only.
+
+
+// Joystick values are +/- 128, scaled to +/- 100, and the small numbers are dampened to 0.
+//
+struct BugAxisTable {
+  int8_t  value[256];
+};
+
+
+constexpr BugAxisTable make_bug_axis_table() {
+  BugAxisTable table = {};
+  for(int raw = -128; raw < 128; raw++) {
+    int scaled = raw * 100 / 128;
+    table.value[(uint8_t)raw] = (-2 < scaled && scaled < 2) ? 0 : scaled;
+  }
+  return table;
+}
+
+
+inline constexpr BugAxisTable bug_axis_table = make_bug_axis_table();
+
+inline int8_t bug_scale_axis(int8_t raw) { return bug_axis_table.value[(uint8_t)raw]; }
+
+
+// Scale a speed down so that neither of a pair exceeds 100, keeping their ratio.
+//
+inline void bug_normalize(int16_t& a, int16_t& b) {
+  int16_t ma  = a < 0 ? -a : a;
+  int16_t mb  = b < 0 ? -b : b;
+  int16_t m   = ma > mb ? ma : mb;
+  if(100 >= m) return;
+  a = (int16_t)(a * 100 / m);
+  b = (int16_t)(b * 100 / m);
+}
+
+
+// (100 - a) / 100 in Q16 for a = 0 - 100, rounded up, so (|x| * factor[a]) >> 16 is exactly the
+// truncated |x| * (100 - a) / 100 for every |x| <= 100.
+//
+struct BugTrimTable {
+  uint32_t  factor[101];
+};
+
+
+constexpr BugTrimTable make_bug_trim_table() {
+  BugTrimTable table = {};
+  for(int a = 0; a <= 100; a++) table.factor[a] = ((100 - a) * 65536 + 99) / 100;
+  return table;
+}
+
+
+inline constexpr BugTrimTable bug_trim_table = make_bug_trim_table();
+
+
+// The BugC's original steering rule, and the default: y trims the inside pair of wheels by |y| percent
+// while the outside pair runs at x.
+//
+struct BugDifferentialMixer {
+  static void mix(int8_t x, int8_t y, int8_t speeds[4]) {
+    uint8_t mag     = x < 0 ? -x : x;
+    int8_t  trimmed = (int8_t)((mag * bug_trim_table.factor[y < 0 ? -y : y]) >> 16);
+    if(x < 0) trimmed = -trimmed;
+    speeds[0] = speeds[2] = (0 > y) ? trimmed : x;
+    speeds[1] = speeds[3] = (0 < y) ? -trimmed : -x;
+  }
+};
+
+
+// Tank: each axis is a lever for one side. x drives the left wheels, y the right.
+//
+struct BugTankMixer {
+  static void mix(int8_t x, int8_t y, int8_t speeds[4]) {
+    speeds[0] = speeds[2] = x;
+    speeds[1] = speeds[3] = -y;
+  }
+};
+
+
+// Arcade: left = x + y, right = x - y, scaled back into range together so turns keep their shape.
+//
+struct BugArcadeMixer {
+  static void mix(int8_t x, int8_t y, int8_t speeds[4]) {
+    int16_t left  = x + y;
+    int16_t right = x - y;
+    bug_normalize(left, right);
+    speeds[0] = speeds[2] = (int8_t)left;
+    speeds[1] = speeds[3] = (int8_t)-right;
+  }
+};
+
+
+// Mecanum: y strafes instead of steering. Diagonal wheel pairs share a speed.
+//
+struct BugMecanumMixer {
+  static void mix(int8_t x, int8_t y, int8_t speeds[4]) {
+    int16_t a = x + y;                  // Front left and rear right
+    int16_t b = x - y;                  // Front right and rear left
+    bug_normalize(a, b);
+    speeds[0] = (int8_t)a;
+    speeds[1] = (int8_t)-b;
+    speeds[2] = (int8_t)b;
+    speeds[3] = (int8_t)-a;
+  }
+};
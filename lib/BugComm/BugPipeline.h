@@ -0,0 +1,362 @@
+#pragma once
+#include <NowCommTask.h>
+#include <NowCommRing.h>
+#include <NowCommStats.h>
+#include <JoySampler.h>
+#include "BugComm.h"
+
+// The controller as a pipeline of tasks instead of one loop():
+//   sampler  reads the stick every 1 / JOY_SAMPLE_HZ, and queues the sample
+//   mixer    turns the newest sample into a BugCommand, and queues that
+//   radio    hands the newest command to BugComm, which sends it on the SendScheduler's schedule, and
+//            does everything else loop() did for the link: update(), responses, keepalives, hops
+//   display  calls back at its own rate, to draw
+// The first three are pinned to BUG_PIPELINE_CONTROL_CORE, each a priority above the one before it, so
+// a notification hands the sample straight on. The display runs on the other core at low priority: a
+// slow LCD push can hold up nothing but the next frame. Queues are NowCommRings: fixed, allocation-free,
+// and a full queue counts an overrun instead of blocking.
+// The radio task is the only one that touches Comm once start() is called; everyone else asks it for a
+// report (request_report(), then get_report() until it returns true), or reads the few values it
+// publishes for the display: the channel, when the peer was last heard, and its latest telemetry. Comm
+// must already be paired.
+// Each sample carries its timestamps down the pipeline, so the radio task can time every stage, from the
+// start of the stick read to the end of the send, against a budget for each.
+
+#define BUG_PIPELINE_CONTROL_CORE   1
+#define BUG_PIPELINE_DISPLAY_CORE   0
+#define BUG_PIPELINE_SAMPLES        16        // Queue depths (powers of two)
+#define BUG_PIPELINE_COMMANDS       8
+#define BUG_PIPELINE_RADIO_IDLE_US  1000UL    // The radio task runs at least this often with no command
+#define BUG_PIPELINE_DISPLAY_HZ     20
+
+
+enum BugStage : uint8_t {
+  BUG_STAGE_READ,                         // Stick read and filter
+  BUG_STAGE_TO_MIXER,                     // Sample queued until the mixer has it
+  BUG_STAGE_MIX,
+  BUG_STAGE_TO_RADIO,                     // Command queued until the radio task has it
+  BUG_STAGE_SCHEDULE,                     // ...until the send scheduler lets it go
+  BUG_STAGE_SEND,                         // The transport's send
+  BUG_STAGE_TOTAL,                        // Start of the stick read to the end of the send
+  BUG_STAGES
+};
+
+
+static const char* const bug_stage_names[BUG_STAGES]      = { "read", "to mixer", "mix", "to radio", "schedule", "send", "total" };
+static const uint32_t    bug_stage_budgets_us[BUG_STAGES] = { 1000, 500, 100, 500, 1000000UL / SEND_RATE_HZ, 1000, 25000 };
+
+
+typedef struct BugStageStats {
+  uint32_t          count;
+  uint32_t          p50_us;
+  uint32_t          p99_us;
+  uint32_t          max_us;
+  uint32_t          budget_us;
+  uint32_t          over_budget;
+} BugStageStats;
+
+
+// Since the last report, except the queue counts, which are since start().
+//
+typedef struct BugPipelineReport {
+  BugStageStats     stages[BUG_STAGES];
+  SendStats         send;
+  NowComm_LinkStats link;
+  NowComm_HopStats  hop;
+  uint32_t          samples;              // Queued by the sampler
+  uint32_t          sample_overruns;      // ...that didn't fit
+  uint32_t          commands;             // Queued by the mixer
+  uint32_t          command_overruns;
+  uint32_t          display_frames;
+  uint32_t          display_max_us;
+  uint32_t          display_over_budget;  // Frames longer than the display period
+} BugPipelineReport;
+
+
+template <class Comm, class Source>
+class BugPipeline {
+  public:
+    typedef void (*Display)(void* context);
+    BugPipeline(Comm& comm, JoySampler<Source>& sampler) : comm(comm), sampler(sampler) {
+      memcpy(budgets, bug_stage_budgets_us, sizeof(budgets));
+    }
+    void                    set_display(Display draw, void* context, uint16_t hz = BUG_PIPELINE_DISPLAY_HZ);
+    void                    set_budget(BugStage stage, uint32_t us)   { budgets[stage] = us; }
+    bool                    start(uint16_t sample_hz = JOY_SAMPLE_HZ);
+    void                    stop();
+    void                    request_report();                        // From any task...
+    bool                    get_report(BugPipelineReport& report);   // ...then this, until it's true
+    bool                    get_stick(JoySample& sample)              { return sampler.get_latest(sample); }
+    uint8_t                 get_channel()                             { return channel.load(std::memory_order_relaxed);   }
+    unsigned long           get_peer_last_seen()                      { return last_seen.load(std::memory_order_relaxed); }
+    bool                    get_telemetry(BugTelemetry& telemetry, unsigned long& age_us);   // False until the first
+  private:
+    struct Sample {
+      JoySample             sample;
+      unsigned long         read_start;
+      unsigned long         read_end;
+    };
+    struct Mixed {
+      BugCommand            command;
+      unsigned long         read_start;
+      unsigned long         read_end;
+      unsigned long         mix_start;
+      unsigned long         mix_end;
+    };
+    enum ReportState : uint8_t { REPORT_IDLE, REPORT_REQUESTED, REPORT_READY };
+    static void             sampler_task(NowCommTask& task, void* self);
+    static void             mixer_task(NowCommTask& task, void* self);
+    static void             radio_task(NowCommTask& task, void* self);
+    static void             display_task(NowCommTask& task, void* self);
+    void                    radio_step();
+    void                    record(BugStage stage, unsigned long us);
+    void                    fill_report();
+    void                    publish_telemetry();
+    Comm&                   comm;
+    JoySampler<Source>&     sampler;
+    NowCommTask             sampler_thread;
+    NowCommTask             mixer_thread;
+    NowCommTask             radio_thread;
+    NowCommTask             display_thread;
+    NowCommRing<Sample, BUG_PIPELINE_SAMPLES>   samples;
+    NowCommRing<Mixed, BUG_PIPELINE_COMMANDS>   commands;
+    uint32_t                sample_period_us  = 1000000UL / JOY_SAMPLE_HZ;
+    Display                 display           = nullptr;
+    void*                   display_context   = nullptr;
+    uint32_t                display_period_us = 1000000UL / BUG_PIPELINE_DISPLAY_HZ;
+    std::atomic<uint32_t>   display_frames{0};        // Written by the display task
+    std::atomic<uint32_t>   display_max_us{0};
+    std::atomic<uint32_t>   display_over{0};
+    // The radio task's own
+    uint32_t                budgets[BUG_STAGES];
+    NowCommRttHistogram     stage_times[BUG_STAGES];
+    uint32_t                over_budget[BUG_STAGES]   = { 0 };
+    Mixed                   change;                   // The newest command that changed what will be sent...
+    unsigned long           change_arrived    = 0;
+    bool                    change_pending    = false;    // ...until it is
+    // Published by it
+    std::atomic<uint8_t>    channel{0};
+    std::atomic<unsigned long> last_seen{0};
+    std::atomic<uint32_t>   telemetry_version{0};     // Odd while the three below are being written
+    std::atomic<uint32_t>   telemetry_speeds{0};      // A byte each
+    std::atomic<uint16_t>   telemetry_mv{0};
+    std::atomic<unsigned long> telemetry_us{0};       // When it arrived; 0 for none yet
+    std::atomic<uint8_t>    report_state{REPORT_IDLE};
+    BugPipelineReport       report;
+};
+
+
+template <class Comm, class Source> void BugPipeline<Comm, Source>::set_display(Display draw, void* context, uint16_t hz) {
+  display           = draw;
+  display_context   = context;
+  display_period_us = 1000000UL / (hz ? hz : BUG_PIPELINE_DISPLAY_HZ);
+}
+
+
+// Consumers first, so nothing is queued before it can be taken.
+//
+template <class Comm, class Source> bool BugPipeline<Comm, Source>::start(uint16_t sample_hz) {
+  sample_period_us = 1000000UL / (sample_hz ? sample_hz : JOY_SAMPLE_HZ);
+  for(uint8_t i = 0; i < BUG_STAGES; i++) {
+    stage_times[i].reset();
+    over_budget[i] = 0;
+  }
+  channel.store(comm.get_channel());
+  last_seen.store(comm.get_peer_last_seen());
+  bool ok = radio_thread.start("bug_radio", radio_task, this, 5, BUG_PIPELINE_CONTROL_CORE);
+  ok = ok && mixer_thread.start("bug_mixer", mixer_task, this, 4, BUG_PIPELINE_CONTROL_CORE);
+  ok = ok && sampler_thread.start("bug_sampler", sampler_task, this, 3, BUG_PIPELINE_CONTROL_CORE);
+  if(ok && display) ok = display_thread.start("bug_display", display_task, this, 1, BUG_PIPELINE_DISPLAY_CORE, 4096);
+  if(!ok) stop();
+  return ok;
+}
+
+
+template <class Comm, class Source> void BugPipeline<Comm, Source>::stop() {
+  display_thread.stop();
+  sampler_thread.stop();
+  mixer_thread.stop();
+  radio_thread.stop();
+}
+
+
+template <class Comm, class Source> void BugPipeline<Comm, Source>::request_report() {
+  uint8_t idle = REPORT_IDLE;
+  report_state.compare_exchange_strong(idle, REPORT_REQUESTED);
+}
+
+
+template <class Comm, class Source> bool BugPipeline<Comm, Source>::get_report(BugPipelineReport& out) {
+  if(REPORT_READY != report_state.load(std::memory_order_acquire)) return false;
+  out = report;
+  report_state.store(REPORT_IDLE, std::memory_order_release);
+  return true;
+}
+
+
+template <class Comm, class Source> void BugPipeline<Comm, Source>::sampler_task(NowCommTask& task, void* self) {
+  BugPipeline* p = (BugPipeline*)self;
+  while(task.running()) {
+    Sample sample;
+    sample.read_start = micros();
+    if(p->sampler.sample() && p->sampler.get_latest(sample.sample)) {
+      sample.read_end = micros();
+      if(p->samples.push(sample)) p->mixer_thread.notify();
+    }
+    task.sleep_period(p->sample_period_us);
+  }
+}
+
+
+// Only the newest sample matters: any older ones still queued are dropped unmixed.
+//
+template <class Comm, class Source> void BugPipeline<Comm, Source>::mixer_task(NowCommTask& task, void* self) {
+  BugPipeline* p = (BugPipeline*)self;
+  while(task.running()) {
+    Sample  sample;
+    bool    got = false;
+    task.wait(BUG_PIPELINE_RADIO_IDLE_US);
+    while(p->samples.pop(sample)) got = true;
+    if(!got) continue;
+    Mixed mixed;
+    mixed.read_start  = sample.read_start;
+    mixed.read_end    = sample.read_end;
+    mixed.mix_start   = micros();
+    Comm::make_command(sample.sample.x, sample.sample.y, sample.sample.button, mixed.command);
+    mixed.mix_end     = micros();
+    if(p->commands.push(mixed)) p->radio_thread.notify();
+  }
+}
+
+
+template <class Comm, class Source> void BugPipeline<Comm, Source>::radio_task(NowCommTask& task, void* self) {
+  BugPipeline* p = (BugPipeline*)self;
+  while(task.running()) {
+    task.wait(BUG_PIPELINE_RADIO_IDLE_US);
+    p->radio_step();
+  }
+}
+
+
+// What loop() used to do for the link, with the newest command in place of the stick.
+//
+template <class Comm, class Source> void BugPipeline<Comm, Source>::radio_step() {
+  Mixed mixed;
+  comm.update();
+  while(comm.is_data_ready()) comm.clear_data_ready();
+  while(commands.pop(mixed)) {
+    unsigned long now = micros();
+    record(BUG_STAGE_READ,      mixed.read_end  - mixed.read_start);
+    record(BUG_STAGE_TO_MIXER,  mixed.mix_start - mixed.read_end);
+    record(BUG_STAGE_MIX,       mixed.mix_end   - mixed.mix_start);
+    record(BUG_STAGE_TO_RADIO,  now             - mixed.mix_end);
+    if(comm.set_command(mixed.command)) {
+      change          = mixed;
+      change_arrived  = now;
+      change_pending  = true;
+    }
+  }
+  unsigned long start = micros();
+  if(comm.service() && change_pending) {                // A keepalive carries nothing new, so isn't timed
+    unsigned long end = micros();
+    record(BUG_STAGE_SCHEDULE,  start - change_arrived);
+    record(BUG_STAGE_SEND,      end   - start);
+    record(BUG_STAGE_TOTAL,     end   - change.read_start);
+    change_pending = false;
+  }
+  channel.store(comm.get_channel(), std::memory_order_relaxed);
+  last_seen.store(comm.get_peer_last_seen(), std::memory_order_relaxed);
+  publish_telemetry();
+  if(REPORT_REQUESTED == report_state.load(std::memory_order_acquire)) {
+    fill_report();
+    report_state.store(REPORT_READY, std::memory_order_release);
+  }
+}
+
+
+// Publish the peer's telemetry, if more has come since last time. The version is odd while it is being
+// written, so get_telemetry() can tell a torn read and try again.
+//
+template <class Comm, class Source> void BugPipeline<Comm, Source>::publish_telemetry() {
+  BugTelemetry  telemetry;
+  unsigned long age_us;
+  unsigned long arrived = comm.get_telemetry_rx_us();
+  if(!comm.get_telemetry(telemetry, age_us) || (arrived ? arrived : 1) == telemetry_us.load(std::memory_order_relaxed)) return;
+  uint32_t version = telemetry_version.load(std::memory_order_relaxed);
+  telemetry_version.store(version + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  telemetry_speeds.store((uint8_t)telemetry.speed_0 | (uint8_t)telemetry.speed_1 << 8 | (uint32_t)(uint8_t)telemetry.speed_2 << 16 |
+                         (uint32_t)(uint8_t)telemetry.speed_3 << 24, std::memory_order_relaxed);
+  telemetry_mv.store(telemetry.millivolts, std::memory_order_relaxed);
+  telemetry_us.store(arrived ? arrived : 1, std::memory_order_relaxed);
+  telemetry_version.store(version + 2, std::memory_order_release);
+}
+
+
+template <class Comm, class Source> bool BugPipeline<Comm, Source>::get_telemetry(BugTelemetry& telemetry, unsigned long& age_us) {
+  uint32_t      version, speeds;
+  unsigned long arrived;
+  do {
+    version               = telemetry_version.load(std::memory_order_acquire);
+    speeds                = telemetry_speeds.load(std::memory_order_relaxed);
+    telemetry.millivolts  = telemetry_mv.load(std::memory_order_relaxed);
+    arrived               = telemetry_us.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while((version & 1) || version != telemetry_version.load(std::memory_order_relaxed));
+  if(0 == arrived) return false;
+  telemetry.speed_0 = (int8_t)(speeds);
+  telemetry.speed_1 = (int8_t)(speeds >> 8);
+  telemetry.speed_2 = (int8_t)(speeds >> 16);
+  telemetry.speed_3 = (int8_t)(speeds >> 24);
+  age_us            = micros() - arrived;
+  return true;
+}
+
+
+template <class Comm, class Source> void BugPipeline<Comm, Source>::display_task(NowCommTask& task, void* self) {
+  BugPipeline* p = (BugPipeline*)self;
+  while(task.running()) {
+    unsigned long start = micros();
+    p->display(p->display_context);
+    uint32_t us = micros() - start;
+    p->display_frames.fetch_add(1, std::memory_order_relaxed);
+    if(p->display_max_us.load(std::memory_order_relaxed) < us) p->display_max_us.store(us, std::memory_order_relaxed);
+    if(p->display_period_us < us) p->display_over.fetch_add(1, std::memory_order_relaxed);
+    task.sleep_period(p->display_period_us);
+  }
+}
+
+
+template <class Comm, class Source> void BugPipeline<Comm, Source>::record(BugStage stage, unsigned long us) {
+  stage_times[stage].add((uint32_t)us);
+  if(budgets[stage] < us) over_budget[stage]++;
+}
+
+
+// The stage times, send and link stats start again after each report.
+//
+template <class Comm, class Source> void BugPipeline<Comm, Source>::fill_report() {
+  for(uint8_t i = 0; i < BUG_STAGES; i++) {
+    BugStageStats& s = report.stages[i];
+    s.count       = stage_times[i].get_count();
+    s.p50_us      = stage_times[i].percentile(50);
+    s.p99_us      = stage_times[i].percentile(99);
+    s.max_us      = stage_times[i].get_max();
+    s.budget_us   = budgets[i];
+    s.over_budget = over_budget[i];
+    stage_times[i].reset();
+    over_budget[i] = 0;
+  }
+  comm.get_send_stats(report.send);
+  comm.reset_send_stats();
+  comm.get_link_stats(report.link);
+  comm.reset_link_stats();
+  comm.get_hop_stats(report.hop);
+  report.samples              = samples.get_pushed();
+  report.sample_overruns      = samples.get_overruns();
+  report.commands             = commands.get_pushed();
+  report.command_overruns     = commands.get_overruns();
+  report.display_frames       = display_frames.exchange(0, std::memory_order_relaxed);
+  report.display_max_us       = display_max_us.exchange(0, std::memory_order_relaxed);
+  report.display_over_budget  = display_over.exchange(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,171 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include "BugComm.h"
+
+// Host only: runs a packet capture (see NowCommCapture.h) back through a BugComm receiver built from
+// the code in the tree, and hands over what it decodes, for tools/nowcomm_replay to check against
+// golden values.
+// Give it every record of a trace with add(). The frames that carry commands, plain, multiplexed or
+// redundant, are replayed: those the capturing device received if it received any (a receiver's trace),
+// otherwise those it sent (a controller's). They go into the receiver through NowCommRouter, as a radio would deliver
+// them, from the peer they came from, which the receiver has as a peer from the start: the copies in a
+// redundant frame are only taken from one, so a command whose own frame is missing from the trace is
+// recovered as it was on the air. The receiver is the one the trace was taken on, or sent to; a
+// controller's multiplexed frames go to the first receiver in them, unless set_receiver() says otherwise.
+// A trace taken on a host may hold both ends of a link; the sessions' BEGIN records tell them apart.
+// Frames cut short by the capture's snap length can't be replayed and are counted as skipped.
+
+#define BUG_REPLAY_ANY_MAC      { 0x02, 0x52, 0x45, 0x50, 0x4C, 0x59 }   // Stands in for a device the trace doesn't name
+
+
+typedef struct BugReplayOutput {
+  uint16_t      seq;                      // The command's own; a recovered one's is older than the frame that carried it
+  int8_t        speeds[4];                // What the receiver would drive the motors with
+  uint32_t      color_left;               // RGB
+  uint32_t      color_right;
+  bool          button;
+} BugReplayOutput;
+
+
+typedef struct BugReplayStats {
+  uint32_t      frames;                   // Replayed
+  uint32_t      commands;                 // ...that the receiver decoded and made current
+  uint32_t      rejected;                 // ...that it refused
+  uint32_t      skipped;                  // Commands in the trace that couldn't be replayed
+  unsigned long us;                       // Time taken, sleeps included at recorded speed
+} BugReplayStats;
+
+
+template <class Mixer = BugDifferentialMixer>
+class BugReplay {
+  public:
+    void                  add(const NowComm_CaptureRecord& record);
+    void                  set_receiver(const uint8_t* mac)  { memcpy(receiver, mac, 6); receiver_set = true; }
+    uint32_t              get_frames()                      { return (uint32_t)(received.empty() ? sent.size() : received.size()); }
+    template <class OnOutput> void run(bool realtime, uint32_t passes, OnOutput&& on_output, BugReplayStats& stats);
+  private:
+    struct Frame {
+      uint32_t            us;
+      uint8_t             peer[6];        // Source for a received frame, destination for a sent one
+      uint8_t             len;
+      uint8_t             data[NOWCOMM_CAPTURE_SNAP];
+    };
+    bool                  pick_receiver(const std::vector<Frame>& frames, uint8_t* mac);
+    std::vector<Frame>    received;
+    std::vector<Frame>    sent;
+    uint8_t               controller[6]     = BUG_REPLAY_ANY_MAC;   // The trace was taken on this...
+    uint8_t               receiver_own[6]   = BUG_REPLAY_ANY_MAC;   // ...or this
+    uint8_t               receiver[6]       = BUG_REPLAY_ANY_MAC;   // From set_receiver()
+    bool                  receiver_known    = false;
+    bool                  receiver_set      = false;
+    uint8_t               channel           = 1;
+    uint32_t              skipped           = 0;
+};
+
+
+template <class Mixer> void BugReplay<Mixer>::add(const NowComm_CaptureRecord& record) {
+  if(record.flags & NOWCOMM_CAPTURE_BEGIN) {
+    bool is_receiver = 0 < record.captured && NOWCOMM_MODE_RECEIVER == record.data[0];
+    memcpy(is_receiver ? receiver_own : controller, record.mac, 6);
+    receiver_known |= is_receiver;
+    return;
+  }
+  if(NOWCOMM_HEADER_SIZE > record.captured) return;
+  uint8_t kind = nowcomm_header_kind(record.data[0]);
+  if(NOWCOMM_KIND_COMMAND != kind && NOWCOMM_KIND_MULTIPLEX != kind && NOWCOMM_KIND_REDUNDANT != kind) return;
+  if(record.captured < record.len || (record.flags & NOWCOMM_CAPTURE_REFUSED)) {
+    skipped++;
+    return;
+  }
+  Frame frame;
+  frame.us  = record.us;
+  frame.len = record.len;
+  memcpy(frame.peer, record.mac, 6);
+  memcpy(frame.data, record.data, record.len);
+  if(received.empty() && sent.empty()) channel = record.channel;
+  if(record.flags & NOWCOMM_CAPTURE_TX) sent.push_back(frame);
+  else                                  received.push_back(frame);
+}
+
+
+// The receiver a trace's commands were for: the device itself, for a receiver's trace; otherwise the
+// first peer a command was sent to, or the first receiver in a multiplexed frame.
+//
+template <class Mixer> bool BugReplay<Mixer>::pick_receiver(const std::vector<Frame>& frames, uint8_t* mac) {
+  static const uint8_t broadcast[6] = BROADCAST_MAC_ADDRESS;
+  if(receiver_set) {
+    memcpy(mac, receiver, 6);
+    return true;
+  }
+  if(&frames == &received && receiver_known) {
+    memcpy(mac, receiver_own, 6);
+    return true;
+  }
+  for(const Frame& frame : frames) {
+    if(&frames == &sent && 0 != memcmp(frame.peer, broadcast, 6)) {
+      memcpy(mac, frame.peer, 6);
+      return true;
+    }
+    if(NOWCOMM_KIND_MULTIPLEX == nowcomm_header_kind(frame.data[0]) && NOWCOMM_MULTIPLEX_SIZE + 6 <= frame.len) {
+      memcpy(mac, frame.data + NOWCOMM_MULTIPLEX_SIZE, 6);
+      return true;
+    }
+  }
+  return false;
+}
+
+
+// Replay the frames passes times, each frame on its own, then take what the receiver decoded before the
+// next. At recorded speed each frame waits for its time; otherwise none do. on_output(const
+// BugReplayOutput&) gets every command the receiver made current.
+//
+template <class Mixer> template <class OnOutput> void BugReplay<Mixer>::run(bool realtime, uint32_t passes, OnOutput&& on_output, BugReplayStats& stats) {
+  static const uint8_t broadcast[6] = BROADCAST_MAC_ADDRESS;
+  const std::vector<Frame>& frames  = received.empty() ? sent : received;
+  uint8_t               radio[6];
+  BasicBugComm<LoopbackTransport, Mixer> bug;
+  stats = BugReplayStats();
+  stats.skipped = skipped * passes;
+  if(frames.empty()) return;
+  if(!pick_receiver(frames, radio)) memcpy(radio, receiver, 6);
+  bug.get_transport().set_mac_address(radio);
+  bug.begin(NOWCOMM_MODE_RECEIVER, channel);
+  for(const Frame& frame : frames) {                        // Whoever sent them is paired already
+    const uint8_t* from = (&frames == &received) ? frame.peer : controller;
+    if(0 > bug.find_peer(from) && !bug.add_peer(from)) break;
+  }
+  unsigned long start = micros();
+  for(uint32_t pass = 0; pass < passes; pass++) {
+    unsigned long pass_start = micros();
+    for(const Frame& frame : frames) {
+      const uint8_t* from = (&frames == &received) ? frame.peer : controller;
+      if(&frames == &sent && 0 != memcmp(frame.peer, broadcast, 6) && 0 != memcmp(frame.peer, radio, 6)) {
+        stats.skipped++;                                    // Sent to another receiver
+        continue;
+      }
+      if(realtime) {
+        long wait = (long)(frame.us - frames[0].us) - (long)(micros() - pass_start);
+        if(0 < wait) std::this_thread::sleep_for(std::chrono::microseconds(wait));
+      }
+      uint32_t rejected = bug.get_rx_rejected();
+      NowCommRouter::receive(radio, from, frame.data, frame.len);
+      stats.frames++;
+      stats.rejected += bug.get_rx_rejected() - rejected;
+      while(bug.is_data_ready()) {
+        if(NOWCOMM_KIND_COMMAND == bug.get_msg_kind()) {
+          BugReplayOutput output;
+          output.seq          = bug.get_msg_seq();
+          for(uint8_t i = 0; i < 4; i++) output.speeds[i] = (int8_t)bug.get_motor_speed(i);
+          output.color_left   = bug.get_light_color(0);
+          output.color_right  = bug.get_light_color(1);
+          output.button       = bug.get_button();
+          stats.commands++;
+          on_output(output);
+        }
+        bug.clear_data_ready();
+      }
+    }
+  }
+  stats.us = micros() - start;
+}
@@ -0,0 +1,166 @@
+#pragma once
+#include <NowCommPlatform.h>
+#include <NowCommWire.h>
+#include <NowCommStats.h>
+#include "SendScheduler.h"
+
+#define BUG_SMOOTH_SPEEDS       4         // BugCommand's speed_0 - speed_3
+#define BUG_SMOOTH_TIMEOUT_MS   (3 * 1000 / SEND_KEEPALIVE_HZ)   // Three keepalive periods: one lost keepalive is ridden out
+
+
+// slew_per_s:     the most a speed may change in a second, in speed units; 0 for no limit
+// glide_ms:       the longest a new command is spread over. It is spread over the time the controller
+//                 takes between frames, as estimated from arrivals; 0 jumps straight to each command
+// extrapolate_ms: how long to carry on a steady change once the next frame is overdue; 0 never does
+// timeout_ms:     no command for this long and the link is taken as lost...
+// stop_ms:        ...and the speeds ramp to 0 over this long
+// A stick held still is only repeated every keepalive, so one lost keepalive leaves a gap of two periods.
+// The default timeout is three, so that gap is ridden out and only a second loss in a row stops the robot.
+//
+typedef struct BugSmoothConfig {
+  uint16_t  slew_per_s      = 800;        // Full reverse to full forward in a quarter second
+  uint16_t  glide_ms        = 100;
+  uint16_t  extrapolate_ms  = 60;
+  uint16_t  timeout_ms      = BUG_SMOOTH_TIMEOUT_MS;
+  uint16_t  stop_ms         = 200;
+} BugSmoothConfig;
+
+
+// Turns the commands a receiver gets, a frame now and then, into motor speeds that move smoothly at the
+// rate the motors are driven.
+// add() takes each command with its seq and arrival time. The speeds glide from where they are to the
+// new command over the estimated frame interval, so a controller can send less often without the robot
+// lurching at every frame. A gap in the seqs may be lost commands, or frames the controller sent to other
+// receivers or of other kinds; NowCommCadence judges from the time how many commands it spans, and a
+// change is shared across those. A command older than the last, by seq, is dropped.
+// When the next frame is overdue and the last two moved the same way, the speeds carry on that way, by at
+// most another frame's change and never through 0: dead reckoning across a lost frame. If no frame has
+// come by extrapolate_ms, the stick more likely stopped than the frame was lost, and they go back to the
+// last command. When no frame has come for timeout_ms they ramp to a stop, so a robot out of range doesn't
+// drive on blind.
+// output() is called at the motor rate, and applies the slew limit, to everything above, on the way out.
+// All integer, in Q8 speed units; the caller passes the time, so a host can run it on any clock.
+//
+class BugSmoother {
+  public:
+    void            configure(const BugSmoothConfig& config)  { smooth = config; }
+    bool            add(const int8_t speeds[BUG_SMOOTH_SPEEDS], uint16_t seq, unsigned long rx_us);   // False if it was stale
+    bool            output(unsigned long now_us, int8_t speeds[BUG_SMOOTH_SPEEDS]);   // False until a command, and once timed out
+    bool            is_timed_out(unsigned long now_us)        { return !have_command || now_us - last_rx >= smooth.timeout_ms * 1000UL; }
+    uint32_t        get_stale()                               { return stale;      }
+    uint32_t        get_timeouts()                            { return timeouts;   }
+    uint32_t        get_interval_us()                         { return cadence.get_interval_us(); }   // Estimated time between frames
+    void            reset();                                  // Forget the commands, keeping the config
+  private:
+    int32_t         follow(uint8_t i, unsigned long since_us);
+    int32_t         position(uint8_t i, unsigned long now_us);
+    BugSmoothConfig smooth;
+    int32_t         out_q8[BUG_SMOOTH_SPEEDS]     = { 0 };  // What output() last gave
+    int32_t         from_q8[BUG_SMOOTH_SPEEDS]    = { 0 };  // Where the glide to target started
+    int32_t         target_q8[BUG_SMOOTH_SPEEDS]  = { 0 };  // The last command
+    int32_t         step_q8[BUG_SMOOTH_SPEEDS]    = { 0 };  // Its change per frame
+    int32_t         trend_q8[BUG_SMOOTH_SPEEDS]   = { 0 };  // ...and what dead reckoning may carry on with
+    uint32_t        glide_us                      = 0;
+    NowCommCadence  cadence;
+    unsigned long   last_rx                       = 0;
+    unsigned long   last_output                   = 0;
+    uint16_t        last_seq                      = 0;
+    bool            have_command                  = false;
+    bool            started                       = false;  // output() has been called
+    bool            was_timed_out                 = false;
+    uint32_t        stale                         = 0;
+    uint32_t        timeouts                      = 0;
+};
+
+
+// The cadence's interval tracks the controller's send rate while the stick moves, and keepalives sent
+// while it rests don't stretch the next glide much.
+//
+inline bool BugSmoother::add(const int8_t speeds[BUG_SMOOTH_SPEEDS], uint16_t seq, unsigned long rx_us) {
+  uint16_t frames = 1;
+  if(have_command) {
+    int16_t ahead = (int16_t)((uint16_t)(seq - last_seq) << NOWCOMM_SESSION_BITS) >> NOWCOMM_SESSION_BITS;
+    if(0 == ahead) return true;                             // The same command, made current again
+    if(0 > ahead) {
+      stale++;
+      return false;
+    }
+    frames = cadence.spanned((uint16_t)ahead, rx_us);
+  }
+  else cadence.spanned(1, rx_us);
+  bool fresh = !have_command || is_timed_out(rx_us);        // Nothing to glide from but where the speeds are now
+  for(uint8_t i = 0; i < BUG_SMOOTH_SPEEDS; i++) {
+    int32_t now_q8  = fresh ? out_q8[i] : position(i, rx_us);
+    int32_t step    = fresh ? 0 : (speeds[i] * 256 - target_q8[i]) / frames;
+    bool    steady  = (0 < step && 0 < step_q8[i]) || (0 > step && 0 > step_q8[i]);
+    trend_q8[i]   = !steady ? 0 : (0 < step) == (step < step_q8[i]) ? step : step_q8[i];   // The smaller of the last two
+    step_q8[i]    = step;
+    from_q8[i]    = now_q8;
+    target_q8[i]  = speeds[i] * 256;
+  }
+  uint32_t cap  = smooth.glide_ms * 1000UL;
+  glide_us      = cadence.get_interval_us() < cap ? cadence.get_interval_us() : cap;
+  last_rx       = rx_us;
+  last_seq      = seq;
+  have_command  = true;
+  was_timed_out = false;
+  return true;
+}
+
+
+// Where speed i would be since_us after the last command, link or no link.
+//
+inline int32_t BugSmoother::follow(uint8_t i, unsigned long since_us) {
+  uint32_t interval_us = cadence.get_interval_us();
+  if(since_us < glide_us) return from_q8[i] + (int32_t)((int64_t)(target_q8[i] - from_q8[i]) * (int64_t)since_us / glide_us);
+  uint32_t overdue = interval_us && since_us > interval_us ? since_us - interval_us : 0;
+  if(0 == trend_q8[i] || 0 == overdue || overdue > smooth.extrapolate_ms * 1000UL) return target_q8[i];
+  if(overdue > interval_us) overdue = interval_us;          // No more than one frame's change
+  int32_t value = target_q8[i] + (int32_t)((int64_t)trend_q8[i] * (int64_t)overdue / interval_us);
+  if(0 <= target_q8[i] ? 0 > value : 0 < value) return 0;   // Never guess a reversal
+  return value < -100 * 256 ? -100 * 256 : value > 100 * 256 ? 100 * 256 : value;
+}
+
+
+// Where speed i should be at now_us, before the slew limit.
+//
+inline int32_t BugSmoother::position(uint8_t i, unsigned long now_us) {
+  if(!have_command) return 0;
+  unsigned long since   = now_us - last_rx;
+  unsigned long timeout = smooth.timeout_ms * 1000UL;
+  if(since < timeout) return follow(i, since);
+  unsigned long ramp    = smooth.stop_ms * 1000UL;
+  unsigned long into    = since - timeout;
+  if(into >= ramp) return 0;
+  int32_t at_timeout = follow(i, timeout);
+  return at_timeout - (int32_t)((int64_t)at_timeout * (int64_t)into / (int64_t)ramp);
+}
+
+
+inline void BugSmoother::reset() {
+  BugSmoothConfig config = smooth;
+  *this  = BugSmoother();
+  smooth = config;
+}
+
+
+// The speeds to drive at now_us, each rounded to the nearest unit.
+//
+inline bool BugSmoother::output(unsigned long now_us, int8_t speeds[BUG_SMOOTH_SPEEDS]) {
+  unsigned long elapsed  = started ? now_us - last_output : 0;
+  int64_t       max_q8   = (int64_t)smooth.slew_per_s * 256 * (int64_t)elapsed / 1000000;
+  bool          timed_out = is_timed_out(now_us);
+  if(have_command && timed_out && !was_timed_out) timeouts++;
+  was_timed_out = have_command && timed_out;
+  last_output   = now_us;
+  started       = true;
+  for(uint8_t i = 0; i < BUG_SMOOTH_SPEEDS; i++) {
+    int32_t want  = position(i, now_us);
+    int32_t delta = want - out_q8[i];
+    if(smooth.slew_per_s && delta >  max_q8) delta = (int32_t) max_q8;
+    if(smooth.slew_per_s && delta < -max_q8) delta = (int32_t)-max_q8;
+    out_q8[i] += delta;
+    speeds[i]  = (int8_t)((out_q8[i] + (0 <= out_q8[i] ? 128 : -128)) / 256);
+  }
+  return !timed_out;
+}
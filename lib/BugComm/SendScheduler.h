@@ -0,0 +1,91 @@
+#pragma once
+#include <NowCommPlatform.h>
+
+#define SEND_RATE_HZ            50        // At most this many frames per second
+#define SEND_KEEPALIVE_HZ       5         // Resend the current command this often when nothing changes
+
+
+enum SendDecision {
+  SEND_NONE,
+  SEND_UPDATE,                            // Input changed: send the new command
+  SEND_KEEPALIVE                          // Nothing changed for a while: resend the current one
+};
+
+
+typedef struct SendStats {
+  uint32_t  frames_sent;                  // Updates plus keepalives
+  uint32_t  keepalives;
+  uint32_t  frames_coalesced;             // Input changes merged into another change's frame
+  float     update_hz;                    // frames_sent per second since the stats were reset
+} SendStats;
+
+
+// Decides when a controller transmits. Input changes are marked as they happen; poll() is called often
+// (every loop) and says whether to send now. A change goes out at once if the last frame is at least one
+// tick old, otherwise it waits for the tick, and every change made in the meantime rides in the same frame.
+// When nothing changes, the current command is repeated at the keepalive rate so a lost frame can't leave
+// the receiver on a stale command. poll() only decides; sent() records a frame that actually went out, so
+// one that couldn't be sent (no peer yet) is neither counted nor delays the next.
+//
+class SendScheduler {
+  public:
+    void            set_rate(uint16_t tick_hz, uint16_t keepalive_hz);  // 0 disables the limit / the keepalives
+    void            mark_changed()          { if(pending) coalesced++; pending = true; }
+    SendDecision    poll(unsigned long now_us);
+    void            sent(SendDecision decision, unsigned long now_us);   // The frame poll() asked for was sent
+    void            reset_stats(unsigned long now_us);
+    void            get_stats(SendStats& stats, unsigned long now_us);
+  private:
+    unsigned long   tick_us             = 1000000UL / SEND_RATE_HZ;
+    unsigned long   keepalive_us        = 1000000UL / SEND_KEEPALIVE_HZ;
+    unsigned long   last_send           = 0;
+    unsigned long   stats_start         = 0;
+    bool            pending             = false;
+    bool            ever_sent           = false;
+    uint32_t        frames              = 0;
+    uint32_t        keepalives          = 0;
+    uint32_t        coalesced           = 0;
+};
+
+
+inline void SendScheduler::set_rate(uint16_t tick_hz, uint16_t keepalive_hz) {
+  tick_us       = tick_hz ? 1000000UL / tick_hz : 0;
+  keepalive_us  = keepalive_hz ? 1000000UL / keepalive_hz : 0;
+}
+
+
+inline SendDecision SendScheduler::poll(unsigned long now_us) {
+  unsigned long since     = now_us - last_send;
+  SendDecision  decision  = SEND_NONE;
+  if(ever_sent && since < tick_us) return SEND_NONE;
+  if(pending)                                                     decision = SEND_UPDATE;
+  else if(!ever_sent || (keepalive_us && since >= keepalive_us))  decision = SEND_KEEPALIVE;
+  return decision;
+}
+
+
+inline void SendScheduler::sent(SendDecision decision, unsigned long now_us) {
+  if(SEND_NONE == decision) return;
+  if(SEND_KEEPALIVE == decision) keepalives++;
+  pending   = false;
+  ever_sent = true;
+  last_send = now_us;
+  frames++;
+}
+
+
+inline void SendScheduler::reset_stats(unsigned long now_us) {
+  stats_start = now_us;
+  frames      = 0;
+  keepalives  = 0;
+  coalesced   = 0;
+}
+
+
+inline void SendScheduler::get_stats(SendStats& stats, unsigned long now_us) {
+  unsigned long elapsed   = now_us - stats_start;
+  stats.frames_sent       = frames;
+  stats.keepalives        = keepalives;
+  stats.frames_coalesced  = coalesced;
+  stats.update_hz         = elapsed ? frames * 1000000.0f / elapsed : 0;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include "Hud.h"
+
+
+// Hud panel for a host: a canvas and a screen, both in memory, and a count of what is pushed between
+// them. Text is drawn in a stand-in font, a block of pixels per character at roughly the size the
+// M5StickC's fonts are, each character a different pattern, so a field that changes changes pixels.
+// Enough to count and time the work, and to compare screens; nothing to look at.
+//
+class HostPanel {
+  public:
+    ~HostPanel()                      { delete[] canvas; delete[] screen; }
+    bool begin(int16_t w, int16_t h) {
+      delete[] canvas;
+      delete[] screen;
+      width   = w;
+      height  = h;
+      canvas  = new uint16_t[w * h]();
+      screen  = new uint16_t[w * h]();
+      return true;
+    }
+    void fill_rect(const HudRect& rect, uint16_t color) {
+      for(int16_t y = rect.y; y < rect.y + rect.h; y++) {
+        for(int16_t x = rect.x; x < rect.x + rect.w; x++) plot(x, y, color);
+      }
+    }
+    void draw_text(const char* text, const HudRect& rect, HudAlign align, uint8_t font, uint16_t color) {
+      int16_t cw    = (1 == font) ? 6 : (4 == font) ? 14 : 8;
+      int16_t ch    = (1 == font) ? 8 : (4 == font) ? 26 : 16;
+      int16_t len   = (int16_t)strlen(text);
+      int16_t x     = (HUD_LEFT == align) ? rect.x : (HUD_CENTRE == align) ? rect.x + (rect.w - len * cw) / 2 : rect.x + rect.w - len * cw;
+      for(int16_t i = 0; i < len; i++, x += cw) {
+        uint32_t bits = (uint8_t)text[i] * 2654435761u;           // The character's pattern
+        if(' ' == text[i]) continue;
+        for(int16_t gy = 1; gy < ch - 1; gy++) {
+          for(int16_t gx = 0; gx < cw - 1; gx++) {
+            if(bits >> ((gx + gy * 3) & 31) & 1) plot_in(rect, x + gx, rect.y + gy, color);
+          }
+        }
+      }
+    }
+    void push(const HudRect& rect) {
+      for(int16_t y = rect.y; y < rect.y + rect.h; y++) {
+        if(0 > y || height <= y) continue;
+        for(int16_t x = rect.x; x < rect.x + rect.w; x++) {
+          if(0 <= x && width > x) screen[y * width + x] = canvas[y * width + x];
+        }
+      }
+      pushes++;
+      pixels_pushed += rect.w * rect.h;
+    }
+    const uint16_t*   get_screen()    { return screen; }
+    const uint16_t*   get_canvas()    { return canvas; }
+    int               get_size()      { return width * height; }
+    uint32_t          pushes          = 0;
+    uint32_t          pixels_pushed   = 0;
+  private:
+    void plot(int16_t x, int16_t y, uint16_t color) {
+      if(0 <= x && width > x && 0 <= y && height > y) canvas[y * width + x] = color;
+    }
+    void plot_in(const HudRect& rect, int16_t x, int16_t y, uint16_t color) {
+      if(rect.x <= x && rect.x + rect.w > x && rect.y <= y && rect.y + rect.h > y) plot(x, y, color);
+    }
+    uint16_t*         canvas          = nullptr;
+    uint16_t*         screen          = nullptr;
+    int16_t           width           = 0;
+    int16_t           height          = 0;
+};
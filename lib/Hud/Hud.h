@@ -0,0 +1,184 @@
+#pragma once
+#include <NowCommPlatform.h>
+
+// Retained-mode display for the controller.
+// The screen is a fixed set of text fields, each a HudText with its own rectangle, font, alignment and
+// colours. Setting a field to the value it already has does nothing; a change marks it dirty. render()
+// redraws only the dirty fields, into the panel's off-screen canvas, then pushes just their rectangles
+// to the screen. Text is formatted into each field's own buffer, so nothing allocates after setup.
+// Panel is the policy that draws. It must provide:
+//   bool begin(int16_t width, int16_t height);      // Make the canvas; the only allocation
+//   void fill_rect(const HudRect& rect, uint16_t color);
+//   void draw_text(const char* text, const HudRect& rect, HudAlign align, uint8_t font, uint16_t color);
+//   void push(const HudRect& rect);                  // Canvas to screen
+// M5SpritePanel draws on the M5StickC's LCD; HostPanel keeps both in memory and counts what is pushed.
+
+#define HUD_WIDTH         160       // M5StickC, landscape
+#define HUD_HEIGHT        80
+#define HUD_MAX_FIELDS    8
+#define HUD_TEXT_SIZE     24        // Characters in a field, with the terminator
+
+
+enum HudAlign : uint8_t {
+  HUD_LEFT,
+  HUD_CENTRE,
+  HUD_RIGHT
+};
+
+
+typedef struct HudRect {
+  int16_t       x;
+  int16_t       y;
+  int16_t       w;
+  int16_t       h;
+} HudRect;
+
+
+typedef struct HudStats {
+  uint32_t      frames;             // render() calls
+  uint32_t      frames_drawn;       // ...that had something to draw
+  uint32_t      fields_drawn;
+  uint32_t      pixels_pushed;
+  uint32_t      render_us;          // Drawing and pushing, over all frames
+  uint32_t      render_max_us;      // The slowest frame
+} HudStats;
+
+
+// One field. Set its text with set() or printf(), its colour with set_color(); either marks it dirty
+// only if something changed. The text must fit the rectangle: nothing outside it is redrawn.
+//
+class HudText {
+  public:
+    void                  set(const char* value);
+    void                  printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    void                  set_color(uint16_t color);
+    void                  invalidate()      { dirty = true; }
+    bool                  is_dirty()        { return dirty; }
+    const char*           get()             { return text; }
+  private:
+    template <class Panel> friend class Hud;
+    char                  text[HUD_TEXT_SIZE] = { 0 };
+    HudRect               rect              = { 0, 0, 0, 0 };
+    uint8_t               font              = 2;
+    HudAlign              align             = HUD_LEFT;
+    uint16_t              fg                = 0xFFFF;
+    uint16_t              bg                = 0x0000;
+    bool                  dirty             = true;
+};
+
+
+template <class Panel>
+class Hud {
+  public:
+    Hud(Panel& panel) : panel(panel) {}
+    bool                  begin(uint16_t background);
+    HudText*              add(const HudRect& rect, uint8_t font, HudAlign align, uint16_t fg);   // nullptr if full
+    void                  invalidate();                          // Redraw everything, after drawing past the HUD
+    void                  render();                              // Call from loop(); cheap when nothing changed
+    void                  get_stats(HudStats& stats)  { stats = hud_stats; }
+    void                  reset_stats()               { hud_stats = HudStats(); }
+    Panel&                get_panel()                 { return panel; }
+  private:
+    Panel&                panel;
+    HudText               fields[HUD_MAX_FIELDS];
+    uint8_t               field_count       = 0;
+    uint16_t              background        = 0;
+    bool                  whole_screen      = true;               // Background too: after begin() or invalidate()
+    HudStats              hud_stats         = {};
+};
+
+
+inline void HudText::set(const char* value) {
+  if(0 == strncmp(text, value, HUD_TEXT_SIZE - 1)) return;
+  strncpy(text, value, HUD_TEXT_SIZE - 1);
+  text[HUD_TEXT_SIZE - 1] = 0;
+  dirty = true;
+}
+
+
+// Formatted into a buffer on the stack first, so an unchanged value costs a compare and no redraw.
+//
+inline void HudText::printf(const char* format, ...) {
+  char    value[HUD_TEXT_SIZE];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(value, sizeof(value), format, args);
+  va_end(args);
+  set(value);
+}
+
+
+inline void HudText::set_color(uint16_t color) {
+  if(fg == color) return;
+  fg    = color;
+  dirty = true;
+}
+
+
+template <class Panel> bool Hud<Panel>::begin(uint16_t background_color) {
+  background    = background_color;
+  whole_screen  = true;
+  for(uint8_t i = 0; i < field_count; i++) fields[i].bg = background;
+  return panel.begin(HUD_WIDTH, HUD_HEIGHT);
+}
+
+
+template <class Panel> HudText* Hud<Panel>::add(const HudRect& rect, uint8_t font, HudAlign align, uint16_t fg) {
+  if(HUD_MAX_FIELDS <= field_count) return nullptr;
+  HudText* field = &fields[field_count++];
+  field->rect   = rect;
+  field->font   = font;
+  field->align  = align;
+  field->fg     = fg;
+  field->bg     = background;
+  field->dirty  = true;
+  return field;
+}
+
+
+template <class Panel> void Hud<Panel>::invalidate() {
+  whole_screen = true;
+}
+
+
+// Draw what changed into the canvas, then push it. After begin() or invalidate() that is the whole
+// screen, as one rectangle.
+//
+template <class Panel> void Hud<Panel>::render() {
+  unsigned long start = micros();
+  uint8_t       drawn = 0;
+  hud_stats.frames++;
+  if(whole_screen) {
+    HudRect all = { 0, 0, HUD_WIDTH, HUD_HEIGHT };
+    panel.fill_rect(all, background);
+    for(uint8_t i = 0; i < field_count; i++) fields[i].dirty = true;
+  }
+  for(uint8_t i = 0; i < field_count; i++) {
+    HudText& f = fields[i];
+    if(!f.dirty) continue;
+    if(!whole_screen) panel.fill_rect(f.rect, f.bg);
+    panel.draw_text(f.text, f.rect, f.align, f.font, f.fg);
+    drawn++;
+  }
+  if(whole_screen) {
+    HudRect all = { 0, 0, HUD_WIDTH, HUD_HEIGHT };
+    panel.push(all);
+    hud_stats.pixels_pushed += HUD_WIDTH * HUD_HEIGHT;
+  }
+  for(uint8_t i = 0; i < field_count; i++) {
+    HudText& f = fields[i];
+    if(!f.dirty) continue;
+    if(!whole_screen) {
+      panel.push(f.rect);
+      hud_stats.pixels_pushed += f.rect.w * f.rect.h;
+    }
+    f.dirty = false;
+  }
+  if(0 == drawn && !whole_screen) return;
+  whole_screen = false;
+  uint32_t us = micros() - start;
+  hud_stats.frames_drawn++;
+  hud_stats.fields_drawn  += drawn;
+  hud_stats.render_us     += us;
+  if(hud_stats.render_max_us < us) hud_stats.render_max_us = us;
+}
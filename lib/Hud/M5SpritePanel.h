@@ -0,0 +1,42 @@
+#pragma once
+#ifdef ARDUINO
+#include <M5StickC.h>
+#include "Hud.h"
+
+
+// Hud panel for the M5StickC: the canvas is a sprite, allocated once by begin(), and push() copies one
+// rectangle of it to the LCD a row at a time. The sprite holds colours in the LCD's byte order, as
+// pushSprite() sends them, so the rows go out unswapped.
+//
+class M5SpritePanel {
+  public:
+    M5SpritePanel() : sprite(&M5.Lcd) {}
+    bool begin(int16_t width, int16_t height) {
+      sprite.setColorDepth(16);
+      pixels = (uint16_t*)sprite.createSprite(width, height);
+      stride = width;
+      return nullptr != pixels;
+    }
+    void fill_rect(const HudRect& rect, uint16_t color) {
+      sprite.fillRect(rect.x, rect.y, rect.w, rect.h, color);
+    }
+    void draw_text(const char* text, const HudRect& rect, HudAlign align, uint8_t font, uint16_t color) {
+      sprite.setTextColor(color);
+      switch(align) {
+        case HUD_LEFT:   sprite.setTextDatum(TL_DATUM); sprite.drawString(text, rect.x,              rect.y, font); break;
+        case HUD_CENTRE: sprite.setTextDatum(TC_DATUM); sprite.drawString(text, rect.x + rect.w / 2, rect.y, font); break;
+        case HUD_RIGHT:  sprite.setTextDatum(TR_DATUM); sprite.drawString(text, rect.x + rect.w,     rect.y, font); break;
+      }
+    }
+    void push(const HudRect& rect) {
+      M5.Lcd.setSwapBytes(false);
+      for(int16_t row = 0; row < rect.h; row++) {
+        M5.Lcd.pushImage(rect.x, rect.y + row, rect.w, 1, pixels + (rect.y + row) * stride + rect.x);
+      }
+    }
+  private:
+    TFT_eSprite         sprite;
+    uint16_t*           pixels    = nullptr;
+    int16_t             stride    = 0;
+};
+#endif
@@ -0,0 +1,24 @@
+#pragma once
+#ifdef ARDUINO
+#include <Wire.h>
+
+#define JOY_HAT_ADDR            0x38
+
+
+// Joystick source for the M5StickC Joystick Hat on Wire. The caller starts Wire (pins 0 and 26).
+// Each read is a blocking I2C transaction, which is why JoySampler runs it from its own task.
+//
+class JoyHatSource {
+  public:
+    bool read(int8_t& x, int8_t& y, bool& button) {
+      Wire.beginTransmission(JOY_HAT_ADDR);
+      Wire.write(0x02);
+      if(0 != Wire.endTransmission()) return false;
+      if(3 != Wire.requestFrom(JOY_HAT_ADDR, 3)) return false;
+      x       = Wire.read();
+      y       = Wire.read();
+      button  = Wire.read() > 0 ? false : true;   // Button value is inverted
+      return true;
+    }
+};
+#endif
@@ -0,0 +1,151 @@
+#pragma once
+#include <NowCommPlatform.h>
+#include <atomic>
+
+#define JOY_SAMPLE_HZ           500       // Default sampling rate
+#define JOY_WINDOW              5         // Raw samples kept per axis; the largest median window
+#define JOY_SEQ_MASK            0x3FFF    // JoySample::seq wraps at 14 bits
+
+
+typedef struct JoySample {
+  int8_t    x;                            // Raw joystick scale, +/- 128
+  int8_t    y;
+  bool      button;
+  uint16_t  seq;                          // Counts samples, so a new sample can be told from a repeat
+} JoySample;
+
+
+// median:    window of the median filter: 1 (off), 3 or 5 raw samples
+// ema_alpha: weight of each new sample in the moving average, Q8; 256 means no smoothing
+// deadband:  filtered values this close to center read as 0
+//
+typedef struct JoyFilterConfig {
+  uint8_t   median    = 3;
+  uint16_t  ema_alpha = 128;
+  uint8_t   deadband  = 4;
+} JoyFilterConfig;
+
+
+// Samples a joystick at a steady rate, away from the main loop, and filters it.
+// Source is the hardware policy, and must provide
+//   bool read(int8_t& x, int8_t& y, bool& button);     // One raw reading; false if it failed
+// JoyHatSource reads the M5StickC Joystick Hat; ScriptedJoystick stands in for it on a host.
+// sample() takes one reading and is the only writer. On the M5StickC, start() calls it from a task of its
+// own; on a host the caller drives it on whatever clock it likes. get_latest() never blocks or tears: the
+// filtered sample is published as one 32-bit atomic word.
+//
+template <class Source>
+class JoySampler {
+  public:
+    JoySampler(Source& source) : source(source) {}
+    void                    configure(const JoyFilterConfig& config)  { filter = config; }
+    bool                    sample();
+    bool                    get_latest(JoySample& sample);              // False until the first sample
+    uint32_t                get_samples()                               { return samples;     }
+    uint32_t                get_read_errors()                           { return read_errors; }
+#ifdef ARDUINO
+    bool                    start(uint16_t rate_hz = JOY_SAMPLE_HZ, uint8_t core = 0);
+#endif
+  private:
+    struct Axis {
+      int8_t                raw[JOY_WINDOW] = { 0 };
+      int32_t               ema_q8          = 0;
+    };
+    int8_t                  filter_axis(Axis& axis, int8_t value);
+#ifdef ARDUINO
+    static void             task(void* self);
+    TickType_t              period          = 1;
+#endif
+    Source&                 source;
+    JoyFilterConfig         filter;
+    Axis                    x_axis;
+    Axis                    y_axis;
+    uint8_t                 head            = 0;
+    uint8_t                 filled          = 0;
+    uint32_t                samples         = 0;
+    uint32_t                read_errors     = 0;
+    std::atomic<uint32_t>   latest{0};        // seq:14 | valid:1 | button:1 | y:8 | x:8
+};
+
+
+// Take and filter one reading, and publish it.
+//
+template <class Source> bool JoySampler<Source>::sample() {
+  int8_t  x       = 0;
+  int8_t  y       = 0;
+  bool    button  = false;
+  if(!source.read(x, y, button)) {
+    read_errors++;
+    return false;
+  }
+  if(0 == filled) {
+    x_axis.ema_q8 = x * 256;              // Start the average from the first reading rather than from center
+    y_axis.ema_q8 = y * 256;
+  }
+  if(JOY_WINDOW > filled) filled++;
+  head = (head + 1) % JOY_WINDOW;
+  x = filter_axis(x_axis, x);
+  y = filter_axis(y_axis, y);
+  samples++;
+  latest.store(((samples & JOY_SEQ_MASK) << 18) | (1UL << 17) | ((uint32_t)button << 16) | ((uint32_t)(uint8_t)y << 8) | (uint8_t)x,
+               std::memory_order_release);
+  return true;
+}
+
+
+template <class Source> bool JoySampler<Source>::get_latest(JoySample& sample) {
+  uint32_t word = latest.load(std::memory_order_acquire);
+  if(!(word & (1UL << 17))) return false;
+  sample.x      = (int8_t)(word & 0xFF);
+  sample.y      = (int8_t)((word >> 8) & 0xFF);
+  sample.button = (word >> 16) & 1;
+  sample.seq    = (uint16_t)(word >> 18);
+  return true;
+}
+
+
+// Median of the last few readings to drop I2C glitches, then a moving average for ADC noise, then the
+// deadband. All integer.
+//
+template <class Source> int8_t JoySampler<Source>::filter_axis(Axis& axis, int8_t value) {
+  axis.raw[head] = value;
+  uint8_t n = filter.median;
+  if(n > filled) n = filled;
+  if(n > 1) {
+    int8_t window[JOY_WINDOW];
+    for(uint8_t i = 0; i < n; i++) {
+      int8_t v = axis.raw[(head + JOY_WINDOW - i) % JOY_WINDOW];
+      uint8_t j = i;
+      for(; j > 0 && window[j - 1] > v; j--) window[j] = window[j - 1];
+      window[j] = v;
+    }
+    value = window[n / 2];
+  }
+  uint16_t alpha = filter.ema_alpha;
+  if(alpha >= 256) axis.ema_q8 = value * 256;
+  else axis.ema_q8 += ((value * 256 - axis.ema_q8) * alpha) / 256;
+  int16_t out = (int16_t)((axis.ema_q8 + (0 <= axis.ema_q8 ? 128 : -128)) / 256);
+  if(-filter.deadband <= out && out <= filter.deadband) out = 0;
+  return (int8_t)out;
+}
+
+
+#ifdef ARDUINO
+// Sample from a task of its own, so the I2C transaction never holds up loop().
+//
+template <class Source> bool JoySampler<Source>::start(uint16_t rate_hz, uint8_t core) {
+  period = pdMS_TO_TICKS(1000 / (rate_hz ? rate_hz : JOY_SAMPLE_HZ));
+  if(0 == period) period = 1;
+  return pdPASS == xTaskCreatePinnedToCore(task, "joystick", 2048, this, 2, nullptr, core);
+}
+
+
+template <class Source> void JoySampler<Source>::task(void* self) {
+  JoySampler* sampler = (JoySampler*)self;
+  TickType_t  wake    = xTaskGetTickCount();
+  for(;;) {
+    sampler->sample();
+    vTaskDelayUntil(&wake, sampler->period);
+  }
+}
+#endif
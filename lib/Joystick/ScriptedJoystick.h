@@ -0,0 +1,56 @@
+#pragma once
+#include <stdint.h>
+
+// Joystick source for host tests: plays back a script of stick positions against a clock the test
+// sets, with optional noise and glitches, so JoySampler can be measured without the hat.
+
+
+typedef struct JoyKeyframe {
+  unsigned long at_us;                    // The stick holds this position from at_us until the next keyframe
+  int8_t        x;
+  int8_t        y;
+  bool          button;
+} JoyKeyframe;
+
+
+class ScriptedJoystick {
+  public:
+    ScriptedJoystick(const JoyKeyframe* script, uint16_t count) : script(script), count(count) {}
+    void            set_time(unsigned long now_us)            { now = now_us; }
+    void            set_noise(uint8_t amplitude)              { noise = amplitude; }       // +/- this much on each axis
+    void            set_glitch_rate(uint16_t one_in)          { glitch_one_in = one_in; }  // A full-scale spike, 1 read in this many
+    void            set_fail_rate(uint16_t one_in)            { fail_one_in = one_in; }    // A failed read, 1 in this many
+    bool            read(int8_t& x, int8_t& y, bool& button);
+    uint32_t        get_reads()                               { return reads; }
+  private:
+    int8_t          perturb(int8_t value);
+    uint32_t        next_random()                             { seed = seed * 1664525UL + 1013904223UL; return seed >> 8; }
+    const JoyKeyframe*  script;
+    uint16_t        count;
+    unsigned long   now             = 0;
+    uint8_t         noise           = 0;
+    uint16_t        glitch_one_in   = 0;
+    uint16_t        fail_one_in     = 0;
+    uint32_t        seed            = 12345;
+    uint32_t        reads           = 0;
+};
+
+
+inline bool ScriptedJoystick::read(int8_t& x, int8_t& y, bool& button) {
+  reads++;
+  if(fail_one_in && 0 == next_random() % fail_one_in) return false;
+  const JoyKeyframe* frame = script;
+  for(uint16_t i = 1; i < count && script[i].at_us <= now; i++) frame = &script[i];
+  x       = perturb(frame->x);
+  y       = perturb(frame->y);
+  button  = frame->button;
+  return true;
+}
+
+
+inline int8_t ScriptedJoystick::perturb(int8_t value) {
+  int v = value;
+  if(glitch_one_in && 0 == next_random() % glitch_one_in) return (0 <= v) ? -128 : 127;
+  if(noise) v += (int)(next_random() % (2 * noise + 1)) - noise;
+  return (int8_t)(v < -128 ? -128 : (127 < v ? 127 : v));
+}
@@ -0,0 +1,139 @@
+#pragma once
+#include "NowCommPlatform.h"
+#include "NowCommRouter.h"
+#include <esp_now.h>
+#include <esp_wifi.h>
+#include <WiFi.h>
+#include <atomic>
+
+#define NOWCOMM_AP_NAME         "NowCommAP"
+#define ESPNOW_MAX_PEERS        20        // ESP-NOW's own limit
+
+
+// The ESP-NOW radio. This is the transport NowComm uses on the M5StickC.
+// There is one radio, but any number of NowComm sessions may use it, each with an EspNowTransport of its
+// own. ESP-NOW's callbacks carry no context, so they go to NowCommRouter, which finds the session.
+// The sessions share the radio's channel, and its peers: a peer two sessions have both added is
+// only removed from ESP-NOW when both have deleted it.
+//
+class EspNowTransport {
+  public:
+    ~EspNowTransport()                                  { NowCommRouter::detach(slot); }
+    bool                  init(uint8_t chan, NowComm_Session& session);
+    bool                  add_peer(const uint8_t* mac, uint8_t chan);
+    bool                  del_peer(const uint8_t* mac);
+    bool                  set_channel(uint8_t chan);
+    bool                  send(const uint8_t* mac, const uint8_t* data, int len);
+    void                  poll()                        {}    // The radio delivers on its own task
+    void                  get_mac_address(uint8_t* mac) { memcpy(mac, radio_mac(), 6); }
+  private:
+    struct PeerRef {
+      uint8_t             mac[6];
+      uint8_t             refs;
+    };
+    static void           on_data_sent_wrapper(const uint8_t *mac, esp_now_send_status_t status);
+    static void           on_data_received_wrapper(const uint8_t *mac, const uint8_t *incomingData, int len);
+    static uint8_t*       radio_mac();
+    static PeerRef*       find_peer_ref(const uint8_t* mac);      // nullptr if no session has added it
+    inline static std::atomic<bool> running{false};               // One radio, shared by every session
+    int8_t                slot          = -1;                     // In NowCommRouter
+};
+
+
+inline uint8_t* EspNowTransport::radio_mac() {
+  static uint8_t mac[6] = { 0 };
+  return mac;
+}
+
+
+// Bring up the radio, if no session has yet: make sure wifi is running but idle by starting a hidden
+// access point and switching to station mode, then register the callbacks. Then join the router.
+// A later session finds the radio on the first one's channel.
+// TODO: Handle startup w/ WiFi already running, switch channels w/ autoconnect.
+//
+inline bool EspNowTransport::init(uint8_t chan, NowComm_Session& session) {
+  if(!running.load()) {
+    WiFi.disconnect();
+    WiFi.softAP(NOWCOMM_AP_NAME, "", chan, 1);  // Create a hidden AP on given channel
+    WiFi.mode(WIFI_STA);                        // ...and switch to station mode
+    if(ESP_OK != esp_now_init()) return false;
+    WiFi.macAddress(radio_mac());
+    esp_now_register_send_cb(on_data_sent_wrapper);
+    esp_now_register_recv_cb(on_data_received_wrapper);
+    running.store(true);
+  }
+  NowCommRouter::detach(slot);
+  slot = NowCommRouter::attach(radio_mac(), session);
+  return 0 <= slot;
+}
+
+
+// A peer's sessions are counted; ESP-NOW hears of it from the first. Loop context only.
+//
+inline EspNowTransport::PeerRef* EspNowTransport::find_peer_ref(const uint8_t* mac) {
+  static PeerRef refs[ESPNOW_MAX_PEERS] = {};
+  PeerRef* free = nullptr;
+  for(PeerRef& ref : refs) {
+    if(ref.refs && 0 == memcmp(ref.mac, mac, 6)) return &ref;
+    if(!ref.refs && nullptr == free)              free = &ref;
+  }
+  if(free) memcpy(free->mac, mac, 6);   // Not added yet: a place to count it, refs still 0
+  return free;
+}
+
+
+inline bool EspNowTransport::add_peer(const uint8_t* mac, uint8_t chan) {
+  PeerRef* ref = find_peer_ref(mac);
+  if(nullptr == ref) return false;
+  if(0 == ref->refs) {
+    esp_now_peer_info_t peerInfo = {};
+    memcpy(peerInfo.peer_addr, mac, 6);
+    peerInfo.channel = chan;
+    peerInfo.encrypt = false;
+    if(ESP_OK != esp_now_add_peer(&peerInfo)) return false;
+  }
+  ref->refs++;
+  return true;
+}
+
+
+inline bool EspNowTransport::del_peer(const uint8_t* mac) {
+  PeerRef* ref = find_peer_ref(mac);
+  if(nullptr == ref || 0 == ref->refs) return false;
+  if(0 < --ref->refs) return true;
+  return ESP_OK == esp_now_del_peer(mac);
+}
+
+
+// Retune the radio, and move every registered peer with it; ESP-NOW refuses to send to a peer
+// registered on another channel. esp_now_fetch_peer() skips the broadcast peer, so it is done by name.
+//
+inline bool EspNowTransport::set_channel(uint8_t chan) {
+  static const uint8_t  broadcast[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+  esp_now_peer_info_t   peer;
+  if(ESP_OK != esp_wifi_set_channel(chan, WIFI_SECOND_CHAN_NONE)) return false;
+  for(esp_err_t err = esp_now_fetch_peer(true, &peer); ESP_OK == err; err = esp_now_fetch_peer(false, &peer)) {
+    peer.channel = chan;
+    esp_now_mod_peer(&peer);
+  }
+  if(ESP_OK == esp_now_get_peer(broadcast, &peer)) {
+    peer.channel = chan;
+    esp_now_mod_peer(&peer);
+  }
+  return true;
+}
+
+
+inline bool EspNowTransport::send(const uint8_t* mac, const uint8_t* data, int len) {
+  return ESP_OK == esp_now_send(mac, data, len);
+}
+
+
+inline void EspNowTransport::on_data_sent_wrapper(const uint8_t *mac, esp_now_send_status_t status) {
+  NowCommRouter::sent(radio_mac(), mac, ESP_NOW_SEND_SUCCESS == status);
+}
+
+
+inline void EspNowTransport::on_data_received_wrapper(const uint8_t *mac, const uint8_t *incomingData, int len) {
+  NowCommRouter::receive(radio_mac(), mac, incomingData, len);
+}
@@ -0,0 +1,153 @@
+#pragma once
+#include "NowCommPlatform.h"
+#include "NowCommRouter.h"
+
+#define LOOPBACK_MAX_ENDPOINTS  8
+#define LOOPBACK_INBOX_DEPTH    32
+#define LOOPBACK_MAX_FRAME      250
+
+
+// An in-process stand-in for the radio, for host builds.
+// Every LoopbackTransport in the process shares one medium. A frame sent on a channel is queued in
+// the inbox of each other endpoint on that channel that it is addressed to (or all of them, if broadcast).
+// Frames are delivered to the registered callback from poll(), so nothing re-enters NowComm during a send.
+// Transports given the same address with set_mac_address() are sessions on one device: they don't hear
+// each other, and NowCommRouter decides which of them gets each frame sent to the device.
+// set_channel_loss() gives a channel a loss rate: each copy of a frame sent on it is dropped with that
+// probability, so a noisy channel can be simulated.
+//
+class LoopbackTransport {
+  public:
+    LoopbackTransport();
+    ~LoopbackTransport();
+    bool                  init(uint8_t chan, NowComm_Session& session);
+    bool                  add_peer(const uint8_t* /*mac*/, uint8_t /*chan*/) { return true; }
+    bool                  del_peer(const uint8_t* /*mac*/)           { return true; }
+    bool                  set_channel(uint8_t chan)                  { channel = chan; return true; }
+    bool                  send(const uint8_t* mac, const uint8_t* data, int len);
+    void                  poll();
+    void                  get_mac_address(uint8_t* mac)              { memcpy(mac, own_mac, 6); }
+    void                  set_mac_address(const uint8_t* mac)        { memcpy(own_mac, mac, 6); }   // Before init(): be the same device across restarts, or another session on one
+    uint32_t              get_frames_sent()                          { return frames_sent;     }
+    uint32_t              get_frames_received()                      { return frames_received; }
+    uint32_t              get_frames_dropped()                       { return frames_dropped;  }
+    static void           set_channel_loss(uint8_t chan, uint8_t percent) { channel_loss()[chan & 0x0F] = percent; }
+  private:
+    struct Frame {
+      uint8_t             src[6];
+      int                 len;
+      uint8_t             data[LOOPBACK_MAX_FRAME];
+    };
+    static LoopbackTransport** endpoints();
+    static uint8_t*       channel_loss();
+    bool                  enqueue(const uint8_t* src, const uint8_t* data, int len);
+    Frame                 inbox[LOOPBACK_INBOX_DEPTH];
+    uint16_t              inbox_head          = 0;
+    uint16_t              inbox_tail          = 0;
+    NowComm_Session       session;
+    int8_t                slot                = -1;           // In NowCommRouter
+    uint8_t               channel             = 0;
+    uint8_t               own_mac[6]          = { 0 };
+    uint32_t              frames_sent         = 0;
+    uint32_t              frames_received     = 0;
+    uint32_t              frames_dropped      = 0;
+};
+
+
+// The medium: a fixed table of live endpoints.
+//
+inline LoopbackTransport** LoopbackTransport::endpoints() {
+  static LoopbackTransport* table[LOOPBACK_MAX_ENDPOINTS] = { nullptr };
+  return table;
+}
+
+
+// Loss rates of the medium, in percent, by channel.
+//
+inline uint8_t* LoopbackTransport::channel_loss() {
+  static uint8_t table[16] = { 0 };
+  return table;
+}
+
+
+// Join the medium with a locally administered MAC address that is unique within the process.
+//
+inline LoopbackTransport::LoopbackTransport() {
+  static uint8_t  next_id = 0;
+  const uint8_t   mac[6]  = { 0x02, 0x4C, 0x4F, 0x4F, 0x50, ++next_id };
+  memcpy(own_mac, mac, 6);
+  LoopbackTransport** table = endpoints();
+  for(int i = 0; i < LOOPBACK_MAX_ENDPOINTS; i++) {
+    if(nullptr == table[i]) { table[i] = this; break; }
+  }
+}
+
+
+inline LoopbackTransport::~LoopbackTransport() {
+  NowCommRouter::detach(slot);
+  LoopbackTransport** table = endpoints();
+  for(int i = 0; i < LOOPBACK_MAX_ENDPOINTS; i++) {
+    if(this == table[i]) table[i] = nullptr;
+  }
+}
+
+
+inline bool LoopbackTransport::init(uint8_t chan, NowComm_Session& s) {
+  NowCommRouter::detach(slot);
+  channel = chan;
+  slot    = NowCommRouter::attach(own_mac, s);
+  session = s;
+  return 0 <= slot;
+}
+
+
+// Queue the frame for every endpoint on our channel that it is addressed to and routed to, less any the
+// channel loses. Returns false only if no endpoint could accept it.
+//
+inline bool LoopbackTransport::send(const uint8_t* mac, const uint8_t* data, int len) {
+  static const uint8_t  broadcast[6]  = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+  bool                  is_broadcast  = 0 == memcmp(mac, broadcast, 6);
+  bool                  delivered     = false;
+  uint8_t               loss          = channel_loss()[channel & 0x0F];
+  if(LOOPBACK_MAX_FRAME < len) return false;
+  LoopbackTransport** table = endpoints();
+  for(int i = 0; i < LOOPBACK_MAX_ENDPOINTS; i++) {
+    LoopbackTransport* ep = table[i];
+    if(nullptr == ep || channel != ep->channel || 0 == memcmp(own_mac, ep->own_mac, 6)) continue;   // Not on the air, or this device
+    if(!is_broadcast && 0 != memcmp(mac, ep->own_mac, 6))   continue;
+    if(0 > ep->slot || 0 == (NowCommRouter::route(ep->own_mac, own_mac, data, len) & (1UL << ep->slot))) continue;
+    if(loss && nowcomm_random() % 100 < loss)                continue;
+    delivered |= ep->enqueue(own_mac, data, len);
+  }
+  frames_sent++;
+  if(0 <= slot) session.sent_cb(session.context, mac, delivered);
+  return true;
+}
+
+
+inline bool LoopbackTransport::enqueue(const uint8_t* src, const uint8_t* data, int len) {
+  uint16_t next = (inbox_head + 1) % LOOPBACK_INBOX_DEPTH;
+  if(next == inbox_tail) {
+    frames_dropped++;
+    return false;
+  }
+  Frame& frame = inbox[inbox_head];
+  memcpy(frame.src, src, 6);
+  memcpy(frame.data, data, len);
+  frame.len  = len;
+  inbox_head = next;
+  return true;
+}
+
+
+// Deliver everything queued so far. Frames queued by the callbacks themselves wait for the next poll.
+//
+inline void LoopbackTransport::poll() {
+  uint16_t end = inbox_head;
+  while(inbox_tail != end) {
+    Frame& frame = inbox[inbox_tail];
+    inbox_tail   = (inbox_tail + 1) % LOOPBACK_INBOX_DEPTH;
+    frames_received++;
+    if(0 <= slot) session.recv_cb(session.context, frame.src, frame.data, frame.len);
+  }
+}
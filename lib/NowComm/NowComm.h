@@ -1,15 +1,37 @@
 #pragma once
-#include <stdint.h>
-#include <esp_now.h>
-#include <WiFi.h>
+#include "NowCommPlatform.h"
+#include "NowCommBond.h"
+#include "NowCommCapture.h"
+#include "NowCommHop.h"
+#include "NowCommLog.h"
+#include "NowCommRing.h"
+#include "NowCommRouter.h"
+#include "NowCommScan.h"
+#include "NowCommStats.h"
+#include "NowCommWire.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <tuple>
+#include <type_traits>
+#ifdef ARDUINO
+#include "EspNowTransport.h"
+typedef EspNowTransport   NowCommDefaultTransport;
+#else
+#include "LoopbackTransport.h"
+#include "UdpTransport.h"
+#include "SimTransport.h"
+typedef LoopbackTransport NowCommDefaultTransport;
+#endif
 
-#define NOWCOMM_SIGNATURE       0x43574F4E
-#define NOWCOMM_VERSION         0X0211
+#define NOWCOMM_MAGIC           0x434E    // "NC": tells our broadcast discovery apart from other ESP-NOW traffic
 #define BROADCAST_MAC_ADDRESS   {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}
-#define NOWCOMM_AP_NAME         "NowCommAP"
-
-// #define DEBUG_MSG_ON_DATA_SENT
-// #define DEBUG_DUMP_PACKET
+#ifndef NOWCOMM_RX_DEPTH
+#define NOWCOMM_RX_DEPTH        8       // Receive ring slots (power of two); one fewer messages can wait
+#endif
+#ifndef NOWCOMM_MAX_PEERS
+#define NOWCOMM_MAX_PEERS       8       // Up to 19: ESP-NOW's limit of 20, less the broadcast peer
+#endif
 
 
 enum NowComm_Status {
@@ -19,14 +41,6 @@ enum NowComm_Status {
 };
 
 
-enum NowComm_Kind {
-  NOWCOMM_KIND_NONE,
-  NOWCOMM_KIND_COMMAND,
-  NOWCOMM_KIND_RESPONSE,
-  NOWCOMM_KIND_DISCOVERY
-};
-
-
 enum NowComm_Mode {
   NOWCOMM_MODE_CONTROLLER,
   NOWCOMM_MODE_RECEIVER,
@@ -34,57 +48,326 @@ enum NowComm_Mode {
 };
 
 
+// Wire: header, ack_seq (LE), status, then the telemetry payload, if the NowComm has a telemetry type
+//   status bits 0-6: NowComm_Status
+//   status bit 7:    the payload holds telemetry; clear, it is zeros
+// ack_seq is the seq of the frame being answered. wire_size is without the payload.
+//
+#define NOWCOMM_RESP_TELEMETRY  0x80
+
 typedef struct NowComm_Response {
-  uint32_t        signature = NOWCOMM_SIGNATURE;
-  uint16_t        version   = NOWCOMM_VERSION;
-  NowComm_Kind    kind      = NOWCOMM_KIND_RESPONSE;
-  NowComm_Status  status;
+  static constexpr NowComm_Kind kind      = NOWCOMM_KIND_RESPONSE;
+  static constexpr uint8_t      wire_size = NOWCOMM_HEADER_SIZE + 3;
+  uint16_t        ack_seq   = 0;
+  NowComm_Status  status    = NOWCOMM_RESP_NOERR;
+  bool            telemetry = false;
+  void            encode(uint8_t* frame) const  { frame[0] = nowcomm_header(kind); wire_put_u16(frame + 3, ack_seq); frame[5] = (uint8_t)status | (telemetry ? NOWCOMM_RESP_TELEMETRY : 0); }
+  bool            decode(const uint8_t* frame)  { ack_seq = wire_get_u16(frame + 3); status = (NowComm_Status)(frame[5] & ~NOWCOMM_RESP_TELEMETRY);
+                                                  telemetry = frame[5] & NOWCOMM_RESP_TELEMETRY; return NOWCOMM_RESP_ERROR >= status; }
 } NowComm_Response;
 
 
+// Wire: header, magic (LE), mode
+//
 typedef struct NowComm_Discovery {
-  ulong         signature = NOWCOMM_SIGNATURE;
-  uint16_t      version   = NOWCOMM_VERSION;
-  NowComm_Kind  kind      = NOWCOMM_KIND_DISCOVERY;
-  NowComm_Mode  mode;
+  static constexpr NowComm_Kind kind      = NOWCOMM_KIND_DISCOVERY;
+  static constexpr uint8_t      wire_size = NOWCOMM_HEADER_SIZE + 3;
+  NowComm_Mode    mode      = NOWCOMM_MODE_UNINITIALIZED;
+  void            encode(uint8_t* frame) const  { frame[0] = nowcomm_header(kind); wire_put_u16(frame + 3, NOWCOMM_MAGIC); frame[5] = (uint8_t)mode; }
+  bool            decode(const uint8_t* frame)  { mode = (NowComm_Mode)frame[5]; return NOWCOMM_MAGIC == wire_get_u16(frame + 3) && NOWCOMM_MODE_RECEIVER >= mode; }
 } NowComm_Discovery;
 
+// Wire: header, channel, confirm, delay_ms (LE)
+// From the controller: move to channel delay_ms after this arrives. From a receiver, with confirm set: will do.
+//
+typedef struct NowComm_Hop {
+  static constexpr NowComm_Kind kind      = NOWCOMM_KIND_HOP;
+  static constexpr uint8_t      wire_size = NOWCOMM_HEADER_SIZE + 4;
+  uint8_t         channel   = 0;
+  bool            confirm   = false;
+  uint16_t        delay_ms  = 0;
+  void            encode(uint8_t* frame) const  { frame[0] = nowcomm_header(kind); frame[3] = channel; frame[4] = confirm; wire_put_u16(frame + 5, delay_ms); }
+  bool            decode(const uint8_t* frame)  { channel = frame[3]; confirm = frame[4]; delay_ms = wire_get_u16(frame + 5);
+                                                  return NOWCOMM_SCAN_FIRST <= channel && NOWCOMM_SCAN_LAST >= channel && 1 >= frame[4]; }
+} NowComm_Hop;
+
+static_assert(6 == NowComm_Response::wire_size,  "NowComm_Response encoding changed; bump NOWCOMM_VERSION");
+static_assert(6 == NowComm_Discovery::wire_size, "NowComm_Discovery encoding changed; bump NOWCOMM_VERSION");
+static_assert(7 == NowComm_Hop::wire_size,       "NowComm_Hop encoding changed; bump NOWCOMM_VERSION");
+static_assert(19 >= NOWCOMM_MAX_PEERS, "ESP-NOW has room for 20 peers, and one is the broadcast address");
+
+
+// A multiplexed frame carries one message of a type for each of several receivers, broadcast once.
+// Wire: header, inner kind, count, then count slots of: mac[6], the message's encoding after its header.
+// A receiver takes the slot with its own address and handles it as if it had arrived on its own.
+//
+#define NOWCOMM_MULTIPLEX_SIZE  (NOWCOMM_HEADER_SIZE + 2)
+
 
-// T is the type of the structure used for sending commands.
-// It must be no more than 250 bytes total, and the first three fields must be defined is:
-//   ulong         signature = NOWCOMM_SIGNATURE;
-//   uint16_t      version   = NOWCOMM_VERSION;
-//   NowComm_Kind  kind      = NOWCOMM_KIND_COMMAND;
+// A redundant frame carries a command and compact copies of the last few different ones sent to the same
+// peer, so a receiver that missed one takes it from the next frame that arrives, with no round trip.
+// Wire: header (the command's own seq), inner kind, count, the command's encoding after its header, then
+// count copies, newest first, of: back, the copy's encoding after its header. back is how many frames
+// before this one the copy was first sent, so its seq is this frame's less back. See set_redundancy().
 //
-template <class T>
-class NowComm {
+#define NOWCOMM_REDUNDANT_SIZE  (NOWCOMM_HEADER_SIZE + 2)
+#ifndef NOWCOMM_MAX_COPIES
+#define NOWCOMM_MAX_COPIES      2       // Copies a redundant frame can carry, if they fit
+#endif
+
+
+// A message type may declare static constexpr bool acknowledge = true to have every valid one
+// answered with a NowComm_Response. Without it, none are.
+//
+template <class M, class = void> struct NowComm_Acknowledged : std::false_type {};
+template <class M> struct NowComm_Acknowledged<M, std::void_t<decltype(M::acknowledge)>> : std::integral_constant<bool, M::acknowledge> {};
+
+
+// One message type may declare static constexpr bool telemetry = true. Its encoding, after the header,
+// then rides on every response sent, filled in by the receiver (see set_telemetry_source()), so the
+// controller hears how the receiver is doing at the command rate with no frames of its own. Without one,
+// NowComm_NoTelemetry stands in, and responses carry nothing more.
+//
+template <class M, class = void> struct NowComm_IsTelemetry : std::false_type {};
+template <class M> struct NowComm_IsTelemetry<M, std::void_t<decltype(M::telemetry)>> : std::integral_constant<bool, M::telemetry> {};
+
+typedef struct NowComm_NoTelemetry {
+  static constexpr NowComm_Kind kind      = NOWCOMM_KIND_NONE;
+  static constexpr uint8_t      wire_size = NOWCOMM_HEADER_SIZE;
+  void            encode(uint8_t* frame) const  { frame[0] = nowcomm_header(kind); }
+  bool            decode(const uint8_t*)        { return true; }
+} NowComm_NoTelemetry;
+
+template <class... Ms> struct NowComm_TelemetryOf { typedef NowComm_NoTelemetry type; };
+template <class M, class... Ms> struct NowComm_TelemetryOf<M, Ms...> {
+  typedef typename std::conditional<NowComm_IsTelemetry<M>::value, M, typename NowComm_TelemetryOf<Ms...>::type>::type type;
+};
+
+
+// True if no two of Ms share a kind, and all are within the header's 5 bits.
+//
+template <class... Ms> constexpr bool nowcomm_kinds_unique() {
+  const uint8_t kinds[]   = { (uint8_t)Ms::kind... };
+  for(size_t i = 0; i < sizeof...(Ms); i++) {
+    if(NOWCOMM_KIND_NONE == kinds[i] || NOWCOMM_KIND_MULTIPLEX == kinds[i] || NOWCOMM_KIND_REDUNDANT == kinds[i]) return false;
+    if(NOWCOMM_KIND_MAX < kinds[i]) return false;
+    for(size_t j = i + 1; j < sizeof...(Ms); j++) if(kinds[i] == kinds[j]) return false;
+  }
+  return true;
+}
+
+
+// One validated incoming message, decoded by the receive callback and queued for loop() to consume.
+// data holds one of Msgs, a NowComm_Response, a NowComm_Discovery or a NowComm_Hop, according to kind;
+// len is its size on the wire, seq the sender's sequence number, channel the one it arrived on
+// and rx_us when, in micros(). A response with its telemetry flag set has the payload in telemetry.
+// recovered is set on a message taken from a copy in a later frame, its own having been missed.
+//
+template <class... Msgs> struct NowComm_Message {
+  typedef typename NowComm_TelemetryOf<Msgs...>::type Telemetry;
+  NowComm_Kind  kind      = NOWCOMM_KIND_NONE;
+  uint8_t       mac[6]    = { 0 };
+  uint8_t       len       = 0;
+  uint8_t       channel   = 0;
+  uint16_t      seq       = 0;
+  unsigned long rx_us     = 0;
+  bool          recovered = false;
+  alignas(4) uint8_t data[std::max({ sizeof(NowComm_Response), sizeof(NowComm_Discovery), sizeof(NowComm_Hop), sizeof(Msgs)... })];
+  Telemetry     telemetry;
+  template <class M> const M* get() const { return (M::kind == kind) ? (const M*)data : nullptr; }   // nullptr if it isn't an M
+};
+
+
+// Msgs are the application's message types, typically one command structure. None are sent as-is;
+// each must provide its own packed encoding (see NowCommWire.h):
+//   static constexpr NowComm_Kind  kind      = NOWCOMM_KIND_COMMAND;   // Or NOWCOMM_KIND_USER + n; unique
+//   static constexpr uint8_t       wire_size = ...;        // Including the header; at most 250
+//   static constexpr bool          acknowledge = true;     // Optional: answer each one with a response
+//   static constexpr bool          telemetry = true;       // Optional, for one type: carry it on every response
+//   void encode(uint8_t* frame) const;                     // Write nowcomm_header(kind), then fields from NOWCOMM_HEADER_SIZE
+//   bool decode(const uint8_t* frame);                     // Read wire_size bytes; false if the contents are invalid
+// Incoming frames are dispatched on the header's kind through a table built at compile time.
+// Every frame sent is numbered. Frames of acknowledged types are tracked until their response
+// echoes the number back; get_link_stats() reports the loss and round-trip times that result.
+//
+// A controller can drive up to NOWCOMM_MAX_PEERS receivers. Discovery stays open until
+// set_discovery_limit() receivers have paired (one, by default). Each peer has its own sequence
+// tracking, last-seen time and link stats. send_command() goes to one peer; send_multiplexed()
+// updates every peer with a single broadcast frame.
+//
+// Pairing: call service_pairing() from loop() until it returns true. It sends discovery on a jittered
+// schedule and handles the answers. Begun on NOWCOMM_CHANNEL_AUTO, the controller sweeps every channel
+// and the receiver dwells on each in turn until they meet (see NowCommScan.h).
+// With a bond store set, the first receiver paired is remembered. At the next begin() the controller
+// sends discovery straight to it on its old channel, and the receiver waits there, so a restart
+// reconnects in a few milliseconds; if that peer doesn't answer, both fall back to discovery.
+//
+// A receiver with a telemetry type fills one in for each response, from set_telemetry_source()'s callback;
+// the controller keeps the latest from each peer, for get_telemetry(). A telemetry message can also be
+// sent on its own, with send_command(), and counts the same.
+//
+// With set_redundancy(copies), each Command sent with send_command() also carries copies of up to that
+// many different ones sent to that peer before it (see NOWCOMM_REDUNDANT_SIZE). A receiver that missed one
+// takes it from the next frame that arrives, just before that frame's own command, and get_msg_recovered()
+// says so. Copies of anything it already has are dropped by seq. A copy isn't answered, so the controller
+// counts the frame it stood in for as lost, as it was; the receiver counts it in its link stats as
+// recovered. A repeated command, a keepalive, isn't copied again. Multiplexed frames carry no copies.
+//
+// Once paired, both sides estimate loss and round-trip time per channel. With set_hopping(true), the
+// controller moves the session to a better channel when the current one degrades, telling its receivers
+// when to follow (see NowCommHop.h). Receivers always follow. Both need update() called from loop().
+//
+// Several NowComm instances can share one radio, say a control link and a telemetry link, as long as no
+// two share a message kind with the same peer; NowCommRouter gives each the frames that are its own.
+// They share the radio's channel too, so only one of them should hop.
+//
+// Transport is the policy that moves frames. It must provide:
+//   bool init(uint8_t chan, NowComm_Session& session);   // Attach the session to NowCommRouter
+//   bool add_peer(const uint8_t* mac, uint8_t chan);
+//   bool del_peer(const uint8_t* mac);
+//   bool set_channel(uint8_t chan);                // Retune, keeping peers
+//   bool send(const uint8_t* mac, const uint8_t* data, int len);
+//   void poll();                                   // Deliver pending frames, if the transport doesn't on its own
+//   void get_mac_address(uint8_t* mac);
+// EspNowTransport is the radio; LoopbackTransport and UdpTransport run on a host.
+// NowComm<Msgs...> uses the platform's default transport.
+//
+template <class Transport, class... Msgs>
+class BasicNowComm {
+  static_assert(0 < sizeof...(Msgs), "NowComm needs at least one message type");
+  static_assert(NOWCOMM_MAX_FRAME >= std::max({ Msgs::wire_size... }), "Every message must encode to one ESP-NOW frame");
+  static_assert(nowcomm_kinds_unique<NowComm_Response, NowComm_Discovery, NowComm_Hop, Msgs...>(), "Message kinds must be unique, and 1 - 31");
+  static_assert(1 >= (0 + ... + NowComm_IsTelemetry<Msgs>::value), "Only one message type can be the telemetry");
   public:
-    void                 begin(NowComm_Mode mode, uint8_t chan);   // Mode of this unit, not the peer.  Channel = 1 - 14
+    typedef NowComm_Message<Msgs...>                               Message;
+    typedef typename std::tuple_element<0, std::tuple<Msgs...>>::type  Command;   // The first message type
+    typedef typename Message::Telemetry                            Telemetry;   // NowComm_NoTelemetry if none is
+    typedef bool (*TelemetrySource)(void* context, Telemetry& telemetry);       // False to send none this time
+    static constexpr int response_size = NowComm_Response::wire_size + Telemetry::wire_size - NOWCOMM_HEADER_SIZE;
+    static_assert(NOWCOMM_MAX_FRAME >= response_size, "The telemetry must fit in one ESP-NOW frame after the response");
+    static constexpr int command_payload = Command::wire_size - NOWCOMM_HEADER_SIZE;
+    static constexpr int max_copies = std::max(0, std::min(NOWCOMM_MAX_COPIES, (NOWCOMM_MAX_FRAME - NOWCOMM_REDUNDANT_SIZE - command_payload) / (1 + command_payload)));
+    void                 begin(NowComm_Mode mode, uint8_t chan);   // Mode of this unit, not the peer.  Channel = 1 - NOWCOMM_SCAN_LAST, or NOWCOMM_CHANNEL_AUTO
+    void                 update();                                 // Call from loop(); lets host transports deliver, and hops
+    void                 set_discovery_limit(uint8_t receivers)   { discovery_limit = receivers; }   // Before pairing
+    void                 set_bond_store(NowCommBondStore* store)  { bond_store = store; }   // Before begin(); nullptr for none
+    bool                 is_resumed()        { return resumed;     }   // Paired with the bonded peer, without discovery
+    void                 set_hopping(bool enable)                 { hopping = enable; }   // Controller: leave a poor channel
+    void                 set_redundancy(uint8_t copies)           { redundancy = std::min<uint8_t>(copies, max_copies); }   // Earlier commands in each; 0 for none
+    uint8_t              get_redundancy()    { return redundancy;  }
+    void                 get_hop_stats(NowComm_HopStats& stats)   { stats = hop_stats; }
+    void                 get_channel_quality(uint8_t chan, NowComm_ChannelQuality& quality) { channel_quality.get(chan, quality, micros()); }
+    bool                 is_discovery_open() { return discovery_open; }
+    bool                 service_pairing();                        // Call every loop while pairing; true once discovery has closed
+    unsigned long        get_time_to_pair()  { return pair_us;     }   // begin() to the first peer, in us; 0 until then
+    uint32_t             get_discoveries_sent() { return discoveries_sent; }
+    uint32_t             get_channel_hops()  { return scan.get_hops(); }
     void                 send_discovery();
     bool                 process_discovery_response();
-    void                 send_command(T* command);
-    void                 send_response(NowComm_Status status);
+    template <class M> bool send_command(const M* command, uint8_t peer = 0);   // Any of Msgs; false if peer isn't paired
+    template <class M> void send_multiplexed(const M* commands);   // commands[i] goes to peer i, for every peer
+    void                 send_response(NowComm_Status status);     // Answers the last frame received
+    void                 set_telemetry_source(TelemetrySource fill, void* context = nullptr) { telemetry_source = fill; telemetry_context = context; }   // Before begin()
+    bool                 get_telemetry(Telemetry& telemetry, unsigned long& age_us, uint8_t peer = 0);   // The latest from peer; false if none yet
+    unsigned long        get_telemetry_rx_us(uint8_t peer = 0)     { return get_peer_count() > peer ? peers[peer].telemetry_us : 0; }   // ...and when it arrived, in micros()
     bool                 is_connected()      { return connected;   }
-    bool                 is_data_ready()     { return data_ready;  }
-    void                 clear_data_ready()  { data_ready = false; }
+    bool                 is_data_ready();                          // Makes the oldest queued message current
+    void                 clear_data_ready()  { data_ready = false; }   // ...and this releases it
+    bool                 receive(Message& msg);                    // Non-blocking; or use the pair above
+    uint32_t             get_rx_count()      { return inbox.get_pushed();   }
+    uint32_t             get_rx_overruns()   { return inbox.get_overruns(); }
+    uint32_t             get_rx_rejected()   { return rx_rejected;  }      // Unknown kind, wrong size or invalid contents
+    bool                 get_link_stats(NowComm_LinkStats& stats, uint8_t peer = 0);   // False, and zeros, if peer isn't paired
+    void                 reset_link_stats();
     bool                 get_data_valid()    { return data_valid;  }
-    uint8_t*             get_peer_address()  { return peerAddress; }
+    uint8_t              get_peer_count()    { return peer_count.load(std::memory_order_acquire); }
+    int8_t               find_peer(const uint8_t* mac);            // Index in the peer table, or -1
+    bool                 add_peer(const uint8_t* mac);             // Without discovery: a peer already known, as a replayed trace's
+    uint8_t*             get_peer_address(uint8_t peer = 0)        { return get_peer_count() > peer ? peers[peer].mac : nullptr; }
+    unsigned long        get_peer_last_seen(uint8_t peer = 0)      { return get_peer_count() > peer ? peers[peer].last_seen_us : 0; }   // micros()
     uint8_t              get_channel()       { return channel;     }
     NowComm_Kind         get_msg_kind()      { return msg_kind;    }
-    T*                   get_data()          { return &command;    }
-  protected:
-    T                    command;
+    uint16_t             get_msg_seq()       { return msg_seq;     }      // The current message's seq...
+    unsigned long        get_msg_rx_us()     { return msg_rx_us;   }      // ...and when it arrived, in micros()
+    bool                 get_msg_recovered() { return msg_recovered; }    // ...and if from a copy in a later frame
+    const uint8_t*       get_msg_mac()       { return responseAddress; }  // ...and who sent it
+    template <class M = Command> M* get_data()  { return &std::get<M>(latest); }  // The last M made current
+    Transport&           get_transport()     { return transport;   }
   private:
-    static NowComm<T>*   self_reference;      // TODO: I'm not happy with this solution
-    static void          on_data_sent_wrapper(const uint8_t *mac, esp_now_send_status_t status);
-    static void          on_data_received_wrapper(const uint8_t *mac, const uint8_t *incomingData, int len);
+    struct Dispatch {                         // One per kind
+      uint8_t            wire_size;           // 0 if the kind isn't accepted
+      bool               acknowledge;
+      bool               (*decode)(Message& msg, const uint8_t* frame);
+      void               (*load)(BasicNowComm& self, const Message& msg);
+    };
+    static constexpr std::array<Dispatch, NOWCOMM_KIND_MAX + 1> make_dispatch();
+    static const Dispatch& dispatch(uint8_t kind);
+    template <class M> static constexpr Dispatch dispatch_entry();
+    template <class M> static bool decode_message(Message& msg, const uint8_t* frame);
+    static bool          decode_response(Message& msg, const uint8_t* frame);
+    template <class M> static void load_message(BasicNowComm& self, const Message& msg);
+    static void          on_data_sent_wrapper(void* context, const uint8_t *mac, bool success);
+    static void          on_data_received_wrapper(void* context, const uint8_t *mac, const uint8_t *incomingData, int len);
+    static bool          claims_peer_wrapper(void* context, const uint8_t *mac);
+    static constexpr uint32_t accepted_kinds();
+    struct Peer {
+      uint8_t            mac[6]               = { 0 };
+      uint16_t           rx_last_seq          = 0;    // These are written only by on_data_received
+      bool               rx_seq_valid         = false;
+      unsigned long      last_seen_us         = 0;
+      uint32_t           rx_duplicated        = 0;
+      uint32_t           rx_recovered         = 0;
+      uint32_t           tx_failed            = 0;    // Written only by on_data_sent
+      NowCommAckTracker  acks;                        // These are loop() only
+      uint8_t            sent[max_copies + 1][command_payload] = {};      // The last different commands sent, newest first, after the header...
+      uint16_t           sent_seq[max_copies + 1]             = {};       // ...and the seq each was first sent with
+      uint8_t            sent_count           = 0;
+      uint16_t           noted_seq            = 0;
+      bool               noted_seq_valid      = false;
+      NowCommCadence     noted_cadence;               // How many frames a gap after noted_seq spans
+      bool               hop_confirmed        = false;
+      Telemetry          telemetry;
+      unsigned long      telemetry_us         = 0;
+      bool               telemetry_valid      = false;
+    };
+    enum HopState : uint8_t { HOP_IDLE, HOP_PENDING, HOP_WATCH };
     bool                 initialize_esp_now(uint8_t chan, uint8_t* mac_address);
-    void                 on_data_sent(const uint8_t *mac, esp_now_send_status_t status);
+    void                 close_discovery();
+    void                 send_discovery_to(const uint8_t* mac);
+    bool                 switch_channel(uint8_t chan);
+    void                 follow_scan(unsigned long now);
+    bool                 load_bond(uint8_t chan);
+    void                 save_bond();
+    void                 end_bonding();
+    void                 service_hop(unsigned long now);
+    void                 start_hop(uint8_t chan, unsigned long now);
+    void                 do_hop(unsigned long now);
+    void                 note_hop(const Message& msg, int8_t peer);
+    void                 note_outcome(uint8_t chan, bool delivered, uint32_t rtt_us, unsigned long now);
+    void                 send_hop_to(const uint8_t* mac, bool confirm, uint16_t delay_ms);
+    void                 expire_acks(unsigned long now);
+    uint16_t             next_seq();
+    uint16_t             send_frame(const uint8_t* mac, uint8_t* frame, int len);   // Returns the seq it was sent with
+    uint16_t             send_frame(const uint8_t* mac, uint8_t* frame, int len, uint16_t seq);
+    uint16_t             send_command_frame(uint8_t* frame, uint8_t peer);
+    void                 note_message(const Message& msg);
+    void                 note_telemetry(Peer& p, const Telemetry& telemetry, unsigned long rx_us);
+    void                 on_data_sent(const uint8_t *mac, bool success);
     void                 on_data_received(const uint8_t *mac, const uint8_t *incomingData, int len);
-    esp_now_peer_info_t  peerInfo;
+    void                 on_multiplex_received(const uint8_t *mac, const uint8_t *incomingData, int len);
+    void                 on_redundant_received(const uint8_t *mac, const uint8_t *incomingData, int len);
+    void                 accept_frame(const uint8_t *mac, const uint8_t *frame, int len, bool copy = false);
+    Transport            transport;
+    NowComm_Session      session;                                    // session.id is stamped in every seq
+    NowCommRing<Message, NOWCOMM_RX_DEPTH> inbox;                   // Written only by on_data_received
+    std::tuple<Msgs...>  latest;                                     // These are written only by is_data_ready()
     NowComm_Response     response;
     NowComm_Discovery    discovery;
     NowComm_Kind         msg_kind             = NOWCOMM_KIND_NONE;
+    uint8_t              msg_channel          = 0;
+    uint16_t             msg_seq              = 0;
+    unsigned long        msg_rx_us            = 0;
+    bool                 msg_recovered        = false;
     NowComm_Mode         device_mode          = NOWCOMM_MODE_UNINITIALIZED;
     bool                 data_ready           = false;
     bool                 data_valid           = false;
@@ -93,94 +376,340 @@ class NowComm {
     uint8_t              response_len         = 0;
     uint8_t              responseAddress[6]   = { 0 };
     uint8_t              broadcastAddress[6]  = BROADCAST_MAC_ADDRESS;
-    uint8_t              peerAddress[6]       = { 0 };
+    uint8_t              ownAddress[6]        = { 0 };
+    uint32_t             rx_rejected          = 0;
+    std::atomic<uint32_t> tx_seq{0};                                 // Sent from loop() and from the receive callback
+    Peer                 peers[NOWCOMM_MAX_PEERS];
+    std::atomic<uint8_t> peer_count{0};                              // Peers are only ever appended, so the callbacks read the table without a lock
+    uint8_t              discovery_limit      = 1;
+    bool                 discovery_open       = true;
+    NowCommScan          scan;
+    unsigned long        begin_us             = 0;
+    unsigned long        pair_us              = 0;
+    uint32_t             discoveries_sent     = 0;
+    NowCommBondStore*    bond_store           = nullptr;
+    NowComm_Bond         bond;                                       // As loaded, then as last saved
+    bool                 bond_valid           = false;
+    bool                 bonding              = false;               // Trying the bonded peer before discovery
+    bool                 resumed              = false;
+    unsigned long        bond_until           = 0;
+    uint8_t              scan_chan            = 0;                   // What begin() was asked for, to fall back to
+    NowCommChannelQuality channel_quality;                           // These are loop() only
+    NowComm_HopStats     hop_stats            = {};
+    bool                 hopping              = false;
+    uint8_t              redundancy           = 0;                   // Copies of earlier commands in each
+    HopState             hop_state            = HOP_IDLE;
+    uint8_t              hop_channel          = 0;                   // Where we're going
+    uint8_t              hop_prev             = 0;                   // ...and where from, if we must go back
+    unsigned long        hop_decided_us       = 0;
+    unsigned long        hop_at_us            = 0;
+    unsigned long        hop_sent_us          = 0;
+    unsigned long        hop_switched_us      = 0;
+    uint16_t             settle_left          = 0;                   // Frames still to count toward post-hop loss
+    uint16_t             settle_lost          = 0;
+    uint16_t             rx_last_seq          = 0;                   // These are written only by on_data_received
+    uint8_t              rx_last_mac[6]       = { 0 };
+    TelemetrySource      telemetry_source     = nullptr;             // Called from the receive callback
+    void*                telemetry_context    = nullptr;
 };
 
-template <class T> NowComm<T>* NowComm<T>::self_reference;
+
+template <class... Msgs> using NowComm = BasicNowComm<NowCommDefaultTransport, Msgs...>;
 
 
 // Set the mode that this device operates in.
 //
-template <typename T> void NowComm<T>::begin(NowComm_Mode mode, uint8_t chan) {
-  device_mode = mode;
-  channel     = chan;
-  initialize_esp_now(mode, broadcastAddress);
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::begin(NowComm_Mode mode, uint8_t chan) {
+  begin_us        = micros();
+  bonding         = load_bond(chan);
+  scan_chan       = chan;
+  bond_until      = begin_us + ((NOWCOMM_MODE_CONTROLLER == mode) ? NOWCOMM_BOND_TRY_US : NOWCOMM_BOND_HOLD_US);
+  scan.start(NOWCOMM_MODE_CONTROLLER == mode, bonding ? bond.channel : chan, begin_us);
+  device_mode     = mode;
+  channel         = scan.get_channel();
+  discovery_open  = true;
+  resumed         = false;
+  pair_us         = 0;
+  hop_state       = HOP_IDLE;
+  hop_switched_us = begin_us;     // No hop in the first NOWCOMM_HOP_HOLDOFF_US either
+  initialize_esp_now(channel, broadcastAddress);
+  transport.get_mac_address(ownAddress);
+  uint8_t mode_byte = mode;
+  NOWCOMM_CAPTURE(NOWCOMM_CAPTURE_BEGIN | (session.id << 6), channel, ownAddress, &mode_byte, 1);
+  if(bonding && NOWCOMM_MODE_CONTROLLER == mode) transport.add_peer(bond.mac, channel);   // Until it answers, or we give up
 }
 
 
-// Make sure wifi is running bug idle by starting hidden access point and switching to station mode.
-// Set WiFi channel to channel provided.
-// Register callbacks and set the peer address.
-// TODO: Handle startup w/ WiFi already running, switch channels w/ autoconnect.
+// Read the bond, if there is a store. It is only worth trying if it is from this protocol version
+// and on the channel asked for, when one was.
 //
-template <typename T> bool NowComm<T>::initialize_esp_now(uint8_t chan, uint8_t* mac) {
-  WiFi.disconnect();
-  WiFi.softAP(NOWCOMM_AP_NAME, "", channel, 1); // Create a hidden AP on given channel
-  WiFi.mode(WIFI_STA);                          // ...and switch to station mode
-  if(ESP_OK != esp_now_init()) {
-    Serial.println("Error initializing ESP-NOW");
+template <typename Transport, typename... Msgs> bool BasicNowComm<Transport, Msgs...>::load_bond(uint8_t chan) {
+  bond_valid = nullptr != bond_store && bond_store->load(bond);
+  if(!bond_valid || NOWCOMM_VERSION != bond.version)                       return false;
+  if(bond.channel < NOWCOMM_SCAN_FIRST || NOWCOMM_SCAN_LAST < bond.channel) return false;
+  return NOWCOMM_CHANNEL_AUTO == chan || bond.channel == chan;
+}
+
+
+// Remember the first peer. Only written when something has changed.
+//
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::save_bond() {
+  if(nullptr == bond_store) return;
+  NowComm_Bond current;
+  memcpy(current.mac, peers[0].mac, 6);
+  current.channel = channel;
+  current.version = NOWCOMM_VERSION;
+  if(bond_valid && 0 == memcmp(&current, &bond, sizeof(bond))) return;
+  bond_valid = bond_store->save(current);
+  bond       = current;
+}
+
+
+// Stop trying the bonded peer. The controller unregisters it; add_peer() registers it properly if it answered.
+//
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::end_bonding() {
+  bonding = false;
+  if(NOWCOMM_MODE_CONTROLLER == device_mode) transport.del_peer(bond.mac);
+}
+
+
+// Deliver anything the transport holds, then settle overdue frames and move the hop along.
+//
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::update() {
+  transport.poll();
+  if(NOWCOMM_MODE_UNINITIALIZED == device_mode || 0 == get_peer_count()) return;
+  unsigned long now = micros();
+  expire_acks(now);
+  service_hop(now);
+}
+
+
+// Move this station, and its peers, to another channel. If the radio refuses it (outside the
+// country's channels, say) the station stays where it was.
+//
+template <typename Transport, typename... Msgs> bool BasicNowComm<Transport, Msgs...>::switch_channel(uint8_t chan) {
+  if(chan == channel) return true;
+  if(!transport.set_channel(chan)) {
+    NOWCOMM_TRACE(NOWCOMM_LOG_ERROR, chan, NOWCOMM_LOG_ERROR_CHANNEL);
     return false;
   }
-  self_reference = this;       // TODO: I'm not happy with this solution
-  esp_now_register_send_cb(on_data_sent_wrapper);
-  esp_now_register_recv_cb(on_data_received_wrapper);
+  channel = chan;
+  return true;
+}
+
 
-  memcpy(peerInfo.peer_addr, mac, 6);
-  peerInfo.channel = channel;
-  peerInfo.encrypt = false;
-  if (ESP_OK == esp_now_add_peer(&peerInfo)) {
-    Serial.println("Added peer");
+// Move to the scan's channel, skipping any the radio refuses.
+//
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::follow_scan(unsigned long now) {
+  for(int i = 0; i < NOWCOMM_SCAN_CHANNELS && !switch_channel(scan.get_channel()); i++) scan.skip(now);
+}
+
+
+// One step of pairing: handle any discovery that has arrived, then change channel or send discovery
+// if the scan says it's time. Never blocks.
+//
+template <typename Transport, typename... Msgs> bool BasicNowComm<Transport, Msgs...>::service_pairing() {
+  if(!discovery_open) return true;
+  update();
+  while(discovery_open && is_data_ready()) {
+    if(NOWCOMM_KIND_DISCOVERY == msg_kind) process_discovery_response();
+    else                                   clear_data_ready();    // Not for us while pairing; move on to the next
   }
-  else {
-    Serial.println("Failed to add peer");
+  if(!discovery_open) return true;
+  unsigned long now = micros();
+  if(bonding && (long)(now - bond_until) >= 0) {
+    end_bonding();                                                // No answer: discover as if there were no bond
+    scan.start(NOWCOMM_MODE_CONTROLLER == device_mode, scan_chan, now);
+    follow_scan(now);
+  }
+  switch(scan.poll(now)) {
+    case NOWCOMM_SCAN_HOP:
+      follow_scan(now);
+      NOWCOMM_TRACE(NOWCOMM_LOG_SCAN, channel);
+      break;
+    case NOWCOMM_SCAN_SEND: send_discovery_to(bonding ? bond.mac : broadcastAddress); break;
+    default:                                                                      break;
+  }
+  return false;
+}
+
+
+// Bring up the transport on the channel, register callbacks and set the peer address.
+//
+template <typename Transport, typename... Msgs> bool BasicNowComm<Transport, Msgs...>::initialize_esp_now(uint8_t chan, uint8_t* mac) {
+  session.context = this;
+  session.recv_cb = on_data_received_wrapper;
+  session.sent_cb = on_data_sent_wrapper;
+  session.claims  = claims_peer_wrapper;
+  session.kinds   = accepted_kinds();
+  if(!transport.init(chan, session)) {
+    NOWCOMM_TRACE(NOWCOMM_LOG_ERROR, chan, NOWCOMM_LOG_ERROR_INIT);
     return false;
   }
-  return true;
+  bool added = transport.add_peer(mac, chan);
+  NOWCOMM_TRACE(NOWCOMM_LOG_PEER, chan, added ? NOWCOMM_LOG_PEER_ADDED : NOWCOMM_LOG_PEER_ADD_FAILED, nowcomm_log_peer(mac));
+  return added;
 }
 
 
 // Send a discovery packet to the broadcast address. Indicate the mode of the sender.
 //
-template <typename T> void NowComm<T>::send_discovery() {
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::send_discovery() {
+  send_discovery_to(broadcastAddress);
+}
+
+
+// Discovery goes out hundreds of times a second while scanning, so it is counted and logged, never printed.
+//
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::send_discovery_to(const uint8_t* mac) {
   if(NOWCOMM_MODE_UNINITIALIZED == device_mode) {
-    Serial.println("ERROR: Call begin(mode)");
+    NOWCOMM_TRACE(NOWCOMM_LOG_ERROR, 0, NOWCOMM_LOG_ERROR_NOT_BEGUN);
     return;
   }
-  discovery.mode = device_mode;
-  Serial.printf("Sending discovery message: %s\n", NOWCOMM_MODE_CONTROLLER == device_mode ? "NOWCOMM_MODE_CONTROLLER" : "NOWCOMM_MODE_RECEIVER");
-  esp_now_send(broadcastAddress, (uint8_t*)&discovery, sizeof(NowComm_Discovery));
-#ifdef DEBUG_DUMP_PACKET
-  for(int i = 0; i < 6; i++) { Serial.printf("%02X", peerAddress[i]); } Serial.print(" DIS ");
-  for(int i = 0; i < sizeof(NowComm_Response); i++) { Serial.printf("%02X ", ((char*)&response)[i]); } Serial.println();
-#endif
+  NowComm_Discovery outgoing;     // discovery holds the last one received
+  uint8_t           frame[NowComm_Discovery::wire_size];
+  outgoing.mode = device_mode;
+  outgoing.encode(frame);
+  send_frame(mac, frame, sizeof(frame));
+  discoveries_sent++;
 }
 
 
 // Send a status response back to the BugController to let it know how the last message was handled.
+// Called from the receive callback, so it builds its own frame rather than using response, and the
+// telemetry source, if there is one, runs there too: it should only copy out what loop() last stored.
 //
-template <typename T> void NowComm<T>::send_response(NowComm_Status status) {
-  response.status = status;
-#ifdef DEBUG_MSG_ON_DATA_SENT
-  esp_err_t result = esp_now_send(peerAddress, (uint8_t *) &response, sizeof(NowComm_Response));
-  Serial.printf("send_response result = %d\n", result);
-#else
-  esp_now_send(peerAddress, (uint8_t *) &response, sizeof(NowComm_Response));
-#endif
-#ifdef DEBUG_DUMP_PACKET
-  for(int i = 0; i < 6; i++) { Serial.printf("%02X", peerAddress[i]); } Serial.print(" RSP ");
-  for(int i = 0; i < sizeof(NowComm_Response); i++) { Serial.printf("%02X ", ((char*)&response)[i]); } Serial.println();
-#endif
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::send_response(NowComm_Status status) {
+  NowComm_Response  outgoing;
+  Telemetry         telemetry;
+  uint8_t           frame[response_size];
+  uint8_t           encoded[Telemetry::wire_size];
+  outgoing.ack_seq    = rx_last_seq;
+  outgoing.status     = status;
+  outgoing.telemetry  = nullptr != telemetry_source && telemetry_source(telemetry_context, telemetry);
+  outgoing.encode(frame);
+  if(outgoing.telemetry) telemetry.encode(encoded);
+  else                   memset(encoded, 0, sizeof(encoded));
+  memcpy(frame + NowComm_Response::wire_size, encoded + NOWCOMM_HEADER_SIZE, Telemetry::wire_size - NOWCOMM_HEADER_SIZE);
+  send_frame(rx_last_mac, frame, sizeof(frame));
 }
 
 
-// Send the data structure the template was created with
+// The latest telemetry from peer, from a response or on its own, and how long ago it arrived.
 //
-template <typename T> void NowComm<T>::send_command(T* data) {
-#ifdef DEBUG_DUMP_PACKET
-  for(int i = 0; i < 6; i++) { Serial.printf("%02X", peerAddress[i]); } Serial.print(" CMD ");
-  for(int i = 0; i < sizeof(T); i++) { Serial.printf("%02X ", ((char*)data)[i]); } Serial.println();
-#endif
-  esp_now_send(peerAddress, (uint8_t*)data, sizeof(T));
+template <typename Transport, typename... Msgs> bool BasicNowComm<Transport, Msgs...>::get_telemetry(Telemetry& telemetry, unsigned long& age_us, uint8_t peer) {
+  if(get_peer_count() <= peer) return false;
+  const Peer& p = peers[peer];
+  if(!p.telemetry_valid) return false;
+  telemetry = p.telemetry;
+  age_us    = micros() - p.telemetry_us;
+  return true;
+}
+
+
+// Send one of the message types the template was created with, to one peer. Nothing is sent to a
+// peer index that isn't in the table.
+//
+template <typename Transport, typename... Msgs> template <class M> bool BasicNowComm<Transport, Msgs...>::send_command(const M* data, uint8_t peer) {
+  static_assert((std::is_same<M, Msgs>::value || ...), "send_command: M is not one of this NowComm's message types");
+  if(get_peer_count() <= peer) return false;
+  uint8_t  frame[M::wire_size];
+  uint16_t seq;
+  data->encode(frame);
+  if constexpr(std::is_same<M, Command>::value) seq = send_command_frame(frame, peer);
+  else                                          seq = send_frame(peers[peer].mac, frame, sizeof(frame));
+  if(NowComm_Acknowledged<M>::value) peers[peer].acks.on_sent(seq, channel, micros());
+  return true;
+}
+
+
+// Send an encoded Command to peer: as it is, or with redundancy set, in a redundant frame with copies of
+// the last different ones. Either way it is remembered for the copies to come. A command the same as the
+// last keeps the seq it was first sent with, so only a receiver that missed every sending takes its copy.
+// Only the encoding after the header is compared and kept: the seq isn't in it until the frame is sent.
+//
+template <typename Transport, typename... Msgs> uint16_t BasicNowComm<Transport, Msgs...>::send_command_frame(uint8_t* encoded, uint8_t peer) {
+  Peer&    p      = peers[peer];
+  bool     repeat = 0 < p.sent_count && 0 == memcmp(p.sent[0], encoded + NOWCOMM_HEADER_SIZE, command_payload);
+  uint16_t seq;
+  if(0 == redundancy) seq = send_frame(p.mac, encoded, Command::wire_size);
+  else {
+    uint8_t  frame[NOWCOMM_REDUNDANT_SIZE + command_payload + max_copies * (1 + command_payload)];
+    uint8_t* copy  = frame + NOWCOMM_REDUNDANT_SIZE + command_payload;
+    uint8_t  count = 0;
+    seq = next_seq();
+    frame[0] = nowcomm_header(NOWCOMM_KIND_REDUNDANT);
+    frame[3] = Command::kind;
+    memcpy(frame + NOWCOMM_REDUNDANT_SIZE, encoded + NOWCOMM_HEADER_SIZE, command_payload);
+    for(uint8_t i = repeat ? 1 : 0; i < p.sent_count && count < redundancy; i++, count++) {
+      uint16_t back = (seq - p.sent_seq[i]) & NOWCOMM_SEQ_MASK;
+      if(0xFF < back) break;                                        // The rest are older still
+      copy[0] = (uint8_t)back;
+      memcpy(copy + 1, p.sent[i], command_payload);
+      copy += 1 + command_payload;
+    }
+    frame[4] = count;
+    send_frame(p.mac, frame, copy - frame, seq);
+  }
+  if(repeat) return seq;
+  if(p.sent_count <= max_copies) p.sent_count++;
+  memmove(p.sent[1], p.sent[0], (p.sent_count - 1) * sizeof(p.sent[0]));
+  memmove(&p.sent_seq[1], &p.sent_seq[0], (p.sent_count - 1) * sizeof(p.sent_seq[0]));
+  memcpy(p.sent[0], encoded + NOWCOMM_HEADER_SIZE, command_payload);
+  p.sent_seq[0] = seq;
+  return seq;
+}
+
+
+// Send one message to each peer in one broadcast frame: commands[i] to peer i.
+// Each peer acknowledges its own slot, if M is acknowledged, and is tracked as if sent to alone.
+// Discovery must have been opened for more than one receiver, which keeps the broadcast peer.
+//
+template <typename Transport, typename... Msgs> template <class M> void BasicNowComm<Transport, Msgs...>::send_multiplexed(const M* commands) {
+  static_assert((std::is_same<M, Msgs>::value || ...), "send_multiplexed: M is not one of this NowComm's message types");
+  constexpr int slot_size = 6 + M::wire_size - NOWCOMM_HEADER_SIZE;
+  static_assert(NOWCOMM_MAX_FRAME >= NOWCOMM_MULTIPLEX_SIZE + NOWCOMM_MAX_PEERS * slot_size, "send_multiplexed: a slot for every peer won't fit in one frame");
+  uint8_t count = get_peer_count();
+  uint8_t frame[NOWCOMM_MULTIPLEX_SIZE + NOWCOMM_MAX_PEERS * slot_size];
+  uint8_t encoded[M::wire_size];
+  frame[0] = nowcomm_header(NOWCOMM_KIND_MULTIPLEX);
+  frame[3] = M::kind;
+  frame[4] = count;
+  for(uint8_t i = 0; i < count; i++) {
+    uint8_t* slot = frame + NOWCOMM_MULTIPLEX_SIZE + i * slot_size;
+    commands[i].encode(encoded);
+    memcpy(slot, peers[i].mac, 6);
+    memcpy(slot + 6, encoded + NOWCOMM_HEADER_SIZE, M::wire_size - NOWCOMM_HEADER_SIZE);
+  }
+  uint16_t seq = send_frame(broadcastAddress, frame, NOWCOMM_MULTIPLEX_SIZE + count * slot_size);
+  if(NowComm_Acknowledged<M>::value) {
+    unsigned long now = micros();
+    for(uint8_t i = 0; i < count; i++) peers[i].acks.on_sent(seq, channel, now);
+  }
+}
+
+
+// Number a frame and hand it to the transport. Every frame sent goes through here, so this is where
+// it is logged and captured.
+//
+template <typename Transport, typename... Msgs> uint16_t BasicNowComm<Transport, Msgs...>::send_frame(const uint8_t* mac, uint8_t* frame, int len) {
+  return send_frame(mac, frame, len, next_seq());
+}
+
+
+// ...or with a seq taken beforehand, by a frame that needs to know its own.
+//
+template <typename Transport, typename... Msgs> uint16_t BasicNowComm<Transport, Msgs...>::send_frame(const uint8_t* mac, uint8_t* frame, int len, uint16_t seq) {
+  nowcomm_put_seq(frame, seq);
+  bool sent = transport.send(mac, frame, len);
+  NOWCOMM_TRACE(NOWCOMM_LOG_TX, nowcomm_header_kind(frame[0]) | (sent ? 0 : 0x80), seq, nowcomm_log_peer(mac, len));
+  NOWCOMM_CAPTURE(NOWCOMM_CAPTURE_TX | (sent ? 0 : NOWCOMM_CAPTURE_REFUSED) | (session.id << 6), channel, mac, frame, len);
+  return seq;
+}
+
+
+template <typename Transport, typename... Msgs> uint16_t BasicNowComm<Transport, Msgs...>::next_seq() {
+  return (uint16_t)((session.id << NOWCOMM_SEQ_BITS) | (tx_seq.fetch_add(1, std::memory_order_relaxed) & NOWCOMM_SEQ_MASK));
 }
 
 
@@ -188,109 +717,553 @@ template <typename T> void NowComm<T>::send_command(T* data) {
 // and reinitialize with new peer. Mode is the mode of this station, not the peer.
 // Return true if a connection was made, else false.
 //
-template <typename T> bool NowComm<T>::process_discovery_response() {
+template <typename Transport, typename... Msgs> bool BasicNowComm<Transport, Msgs...>::process_discovery_response() {
   if(NOWCOMM_MODE_UNINITIALIZED == device_mode) {
-    Serial.println("ERROR: Call begin(mode), channel");
+    NOWCOMM_TRACE(NOWCOMM_LOG_ERROR, 0, NOWCOMM_LOG_ERROR_NOT_BEGUN);
     return false;
   }
-  if(data_ready) {
-    Serial.printf("Processing discovery response. msg_kind = %d, msg_len = %d, mode = %d\n", msg_kind, response_len, discovery.mode);
+  if(is_data_ready()) {
     data_ready = false;
-    data_valid = (NOWCOMM_KIND_DISCOVERY == msg_kind && sizeof(NowComm_Discovery) == response_len);
-    if(data_valid) data_valid = NOWCOMM_SIGNATURE == discovery.signature &&
-                                NOWCOMM_VERSION   == discovery.version &&
-                                discovery.mode    == (NOWCOMM_MODE_CONTROLLER == device_mode) ? NOWCOMM_MODE_RECEIVER : NOWCOMM_MODE_CONTROLLER;
+    // Size, version and magic were checked on arrival; it must also come from the other kind of station.
+    // Discovery arrives hundreds of times a second while scanning, so the outcome is logged, not printed.
+    NowComm_Mode peer_mode = (NOWCOMM_MODE_CONTROLLER == device_mode) ? NOWCOMM_MODE_RECEIVER : NOWCOMM_MODE_CONTROLLER;
+    data_valid = (NOWCOMM_KIND_DISCOVERY == msg_kind && peer_mode == discovery.mode);
     if(data_valid) {
-      Serial.println("Incoming discovery packet validated.");
-      connected = true;
-      send_discovery();
-      memcpy(peerAddress, responseAddress, 6);              // This is who we will be talking to.
-      if (ESP_OK == esp_now_del_peer(broadcastAddress)) {   // We are finished with discovery
-        Serial.println("Deleted broadcast peer");
-      }
-      else {
-        Serial.println("Failed to delete broadcast peer");
+      if(0 <= find_peer(responseAddress)) {
+        // A controller still sending discovery to us missed our answer; answer again.
+        NOWCOMM_TRACE(NOWCOMM_LOG_DISCOVERY, discovery.mode, NOWCOMM_LOG_DISCOVERY_KNOWN, nowcomm_log_peer(responseAddress));
+        if(NOWCOMM_MODE_RECEIVER == device_mode) send_discovery_to(responseAddress);
         return false;
       }
-      // Reinitialize WiFi with the new channel, which must match ESP-Now channel
-      initialize_esp_now(channel, responseAddress);
+      NOWCOMM_TRACE(NOWCOMM_LOG_DISCOVERY, discovery.mode, discovery_open ? NOWCOMM_LOG_DISCOVERY_NEW : NOWCOMM_LOG_DISCOVERY_CLOSED,
+                    nowcomm_log_peer(responseAddress));
+      if(!discovery_open) return false;
+      if(!switch_channel(msg_channel)) return false;        // Where we heard it, if the scan has moved on since
+      scan.lock(channel);
+      if(bonding) {
+        resumed = 0 == memcmp(responseAddress, bond.mac, 6);
+        end_bonding();
+      }
+      if(!add_peer(responseAddress)) return false;          // This is who we will be talking to.
+      if(!connected) {
+        pair_us = micros() - begin_us;
+        save_bond();
+      }
+      connected = true;
+      NOWCOMM_TRACE(NOWCOMM_LOG_PAIRED, channel, get_peer_count(), nowcomm_log_peer(responseAddress));
+      send_discovery();
+      if(get_peer_count() >= discovery_limit) close_discovery();
       return true;
     }
-    else {
-      Serial.print("COMM FAILURE: Incoming packet rejected. ");
-      if(sizeof(NowComm_Discovery) != response_len) Serial.printf("Expected size: %d. Actual size: %d\n", sizeof(NowComm_Discovery), response_len);
-      else if(NOWCOMM_SIGNATURE != response.signature) Serial.printf("Expected signature: %d. Actual signature: %d\n", NOWCOMM_SIGNATURE, response.signature);
-      else if(NOWCOMM_VERSION   != response.version)   Serial.printf("Expected version: %d. Actual version: %d\n", NOWCOMM_VERSION, response.version);
-      else if(discovery.mode    != (device_mode == NOWCOMM_MODE_CONTROLLER) ? NOWCOMM_MODE_RECEIVER : NOWCOMM_MODE_CONTROLLER) Serial.printf("Expected kind: %s. Actual kind: %s\n",
-                                   (device_mode == NOWCOMM_MODE_CONTROLLER) ? "NOWCOMM_MODE_RECEIVER" : "NOWCOMM_MODE_CONTROLLER",
-                                   (device_mode == NOWCOMM_MODE_CONTROLLER) ? "NOWCOMM_MODE_CONTROLLER" : "NOWCOMM_MODE_RECEIVER");
-      else Serial.println("Coding error.\n");
+    else if(NOWCOMM_KIND_DISCOVERY == msg_kind) {
+      NOWCOMM_TRACE(NOWCOMM_LOG_DISCOVERY, discovery.mode, NOWCOMM_LOG_DISCOVERY_MODE, nowcomm_log_peer(responseAddress));
     }
   }
   return false;
 }
 
 
+// Stop accepting receivers. With a single receiver the broadcast peer goes too; a fleet keeps it
+// for send_multiplexed().
+//
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::close_discovery() {
+  discovery_open = false;
+  if(1 < discovery_limit) return;
+  bool deleted = transport.del_peer(broadcastAddress);             // We are finished with discovery
+  NOWCOMM_TRACE(NOWCOMM_LOG_PEER, channel, deleted ? NOWCOMM_LOG_PEER_DELETED : NOWCOMM_LOG_PEER_DELETE_FAILED, nowcomm_log_peer(broadcastAddress));
+}
+
+
+// Register a peer with the transport and append it to the table.
+// It is filled in before the count is published, so the callbacks never see a partial entry.
+//
+template <typename Transport, typename... Msgs> bool BasicNowComm<Transport, Msgs...>::add_peer(const uint8_t* mac) {
+  uint8_t count = get_peer_count();
+  if(NOWCOMM_MAX_PEERS <= count) {
+    NOWCOMM_TRACE(NOWCOMM_LOG_PEER, channel, NOWCOMM_LOG_PEER_TABLE_FULL, nowcomm_log_peer(mac));
+    return false;
+  }
+  bool added = transport.add_peer(mac, channel);
+  NOWCOMM_TRACE(NOWCOMM_LOG_PEER, channel, added ? NOWCOMM_LOG_PEER_ADDED : NOWCOMM_LOG_PEER_ADD_FAILED, nowcomm_log_peer(mac));
+  if(!added) return false;
+  peers[count] = Peer();
+  memcpy(peers[count].mac, mac, 6);
+  peer_count.store(count + 1, std::memory_order_release);
+  return true;
+}
+
+
+template <typename Transport, typename... Msgs> int8_t BasicNowComm<Transport, Msgs...>::find_peer(const uint8_t* mac) {
+  uint8_t count = get_peer_count();
+  for(uint8_t i = 0; i < count; i++) if(0 == memcmp(peers[i].mac, mac, 6)) return i;
+  return -1;
+}
+
+
 // Static function: ESP-Now callback function that will be executed when data is sent
 //
-template <typename T> void NowComm<T>::on_data_sent(const uint8_t *mac_addr, esp_now_send_status_t status) {
-#ifdef DEBUG_MSG_ON_DATA_SENT
-  Serial.printf("Last Packet Send Status:\t%s\n", (status == ESP_NOW_SEND_SUCCESS) ? "Delivery Success" : "Delivery Fail");
-#endif
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::on_data_sent(const uint8_t *mac_addr, bool success) {
+  int8_t peer = find_peer(mac_addr);
+  if(!success && 0 <= peer) peers[peer].tx_failed++;
+  NOWCOMM_TRACE(NOWCOMM_LOG_TX_STATUS, success, 0, nowcomm_log_peer(mac_addr));
 }
 
 
 // ESP-Now callback function that will be executed when data is received
-// This is on a high-priority system thread. Do as little as possible.
-// An incoming packet is arrainged in little-endian fashion and looks like this:
-//    43 47 55 42 10 01 00 00 03 00 00 00 ...
-//    |signature |ver        |kind       |data
-//
-template <typename T> void NowComm<T>::on_data_received(const uint8_t * mac, const uint8_t *incomingData, int len) {
-#ifdef DEBUG_DUMP_PACKET
-  for(int i = 0; i < 6; i++) { Serial.printf("%02X", mac[i]); } Serial.print(" REC ");
-  for(int i = 0; i < len; i++) { Serial.printf("%02X ", incomingData[i]); } Serial.println();
-#endif
-  if(sizeof(T) == len && NOWCOMM_KIND_COMMAND == ((uint32_t*)incomingData)[2]) {
-    msg_kind = NOWCOMM_KIND_COMMAND;
-    memcpy(&command, incomingData, sizeof(T));
-    data_valid = NOWCOMM_SIGNATURE == command.signature &&
-                 NOWCOMM_VERSION   == command.version;
-    // Serial.printf("Incoming command message received: %s\n", data_valid ? "Valid" : "Invalid");
-    if(data_valid) send_response(NOWCOMM_RESP_NOERR);
-  }
-  else if(sizeof(NowComm_Response) == len && NOWCOMM_KIND_RESPONSE == ((uint32_t*)incomingData)[2]) {
-    msg_kind = NOWCOMM_KIND_RESPONSE;
-    memcpy(&response, incomingData, sizeof(NowComm_Response));
-    data_valid = (sizeof(NowComm_Response) == len);
-    if(data_valid) data_valid = NOWCOMM_SIGNATURE == response.signature &&
-                                NOWCOMM_VERSION   == response.version;
-    // Serial.printf("Incoming response message received: %s\n", data_valid ? "Valid" : "Invalid");
-  }
-  else if(sizeof(NowComm_Discovery) == len && NOWCOMM_KIND_DISCOVERY == ((uint32_t*)incomingData)[2]) {
-    msg_kind = NOWCOMM_KIND_DISCOVERY;
-    memcpy(&discovery, incomingData, sizeof(NowComm_Discovery));
-    data_valid = (sizeof(NowComm_Discovery) == len);
-    if(data_valid) data_valid = NOWCOMM_SIGNATURE == discovery.signature &&
-                                NOWCOMM_VERSION   == discovery.version;
-    Serial.printf("Incoming discovery message received: %s\n", data_valid ? "Valid" : "Invalid");
+// This is on a high-priority system thread. Do as little as possible: validate the packet and queue it.
+// Nothing here prints; what happens goes to the log, for something of low priority to write out.
+// Nothing here touches the members loop() reads; is_data_ready() and receive() take it from the queue.
+// A frame that repeats the last one from the same peer is answered again but not queued.
+// An incoming packet is a header (version and kind, seq) followed by the message's packed encoding:
+//    41 07 00 ...
+//    |hdr    |data
+//
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::on_data_received(const uint8_t * mac, const uint8_t *incomingData, int len) {
+  NOWCOMM_CAPTURE(session.id << 6, channel, mac, incomingData, len);
+  if(NOWCOMM_HEADER_SIZE > len) return;
+  uint8_t kind = nowcomm_header_kind(incomingData[0]);
+  if     (NOWCOMM_KIND_MULTIPLEX == kind) on_multiplex_received(mac, incomingData, len);
+  else if(NOWCOMM_KIND_REDUNDANT == kind) on_redundant_received(mac, incomingData, len);
+  else                                    accept_frame(mac, incomingData, len);
+}
+
+
+// Find this station's slot in a multiplexed frame and accept it as a frame of its own.
+// Frames with no slot for us are ignored; malformed ones are rejected.
+//
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::on_multiplex_received(const uint8_t * mac, const uint8_t *incomingData, int len) {
+  if(NOWCOMM_MULTIPLEX_SIZE > len || NOWCOMM_VERSION != nowcomm_header_version(incomingData[0])) {
+    rx_rejected++;
+    NOWCOMM_TRACE(NOWCOMM_LOG_RX_REJECTED, NOWCOMM_KIND_MULTIPLEX, NOWCOMM_MULTIPLEX_SIZE > len ? NOWCOMM_LOG_REJECT_SIZE : NOWCOMM_LOG_REJECT_VERSION,
+                  nowcomm_log_peer(mac, len));
+    return;
+  }
+  uint8_t         kind      = incomingData[3];
+  uint8_t         count     = incomingData[4];
+  const Dispatch& entry     = dispatch(kind);
+  int             payload   = entry.wire_size - NOWCOMM_HEADER_SIZE;
+  int             slot_size = 6 + payload;
+  if(0 == entry.wire_size || NOWCOMM_MULTIPLEX_SIZE + count * slot_size != len) {
+    rx_rejected++;
+    NOWCOMM_TRACE(NOWCOMM_LOG_RX_REJECTED, NOWCOMM_KIND_MULTIPLEX, entry.wire_size ? NOWCOMM_LOG_REJECT_SIZE : NOWCOMM_LOG_REJECT_KIND,
+                  nowcomm_log_peer(mac, len));
+    return;
+  }
+  for(uint8_t i = 0; i < count; i++) {
+    const uint8_t* slot = incomingData + NOWCOMM_MULTIPLEX_SIZE + i * slot_size;
+    if(0 != memcmp(slot, ownAddress, 6)) continue;
+    uint8_t frame[NOWCOMM_MAX_FRAME];
+    frame[0] = nowcomm_header(kind);
+    nowcomm_put_seq(frame, nowcomm_get_seq(incomingData));
+    memcpy(frame + NOWCOMM_HEADER_SIZE, slot + 6, payload);
+    accept_frame(mac, frame, entry.wire_size);
+    return;
+  }
+}
+
+
+// Take a redundant frame apart: the copies of frames we missed, oldest first, then the command it carries,
+// each accepted as a frame of its own. Malformed ones are rejected.
+//
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::on_redundant_received(const uint8_t * mac, const uint8_t *incomingData, int len) {
+  if(NOWCOMM_REDUNDANT_SIZE > len || NOWCOMM_VERSION != nowcomm_header_version(incomingData[0])) {
+    rx_rejected++;
+    NOWCOMM_TRACE(NOWCOMM_LOG_RX_REJECTED, NOWCOMM_KIND_REDUNDANT, NOWCOMM_REDUNDANT_SIZE > len ? NOWCOMM_LOG_REJECT_SIZE : NOWCOMM_LOG_REJECT_VERSION,
+                  nowcomm_log_peer(mac, len));
+    return;
+  }
+  uint8_t         kind      = incomingData[3];
+  uint8_t         count     = incomingData[4];
+  const Dispatch& entry     = dispatch(kind);
+  int             payload   = entry.wire_size - NOWCOMM_HEADER_SIZE;
+  if(0 == entry.wire_size || NOWCOMM_REDUNDANT_SIZE + payload + count * (1 + payload) != len) {
+    rx_rejected++;
+    NOWCOMM_TRACE(NOWCOMM_LOG_RX_REJECTED, NOWCOMM_KIND_REDUNDANT, entry.wire_size ? NOWCOMM_LOG_REJECT_SIZE : NOWCOMM_LOG_REJECT_KIND,
+                  nowcomm_log_peer(mac, len));
+    return;
+  }
+  uint16_t  seq = nowcomm_get_seq(incomingData);
+  uint8_t   frame[NOWCOMM_MAX_FRAME];
+  frame[0] = nowcomm_header(kind);
+  for(int i = count - 1; i >= 0; i--) {
+    const uint8_t* copy = incomingData + NOWCOMM_REDUNDANT_SIZE + payload + i * (1 + payload);
+    if(0 == copy[0]) continue;
+    nowcomm_put_seq(frame, (uint16_t)((seq & ~NOWCOMM_SEQ_MASK) | ((seq - copy[0]) & NOWCOMM_SEQ_MASK)));
+    memcpy(frame + NOWCOMM_HEADER_SIZE, copy + 1, payload);
+    accept_frame(mac, frame, entry.wire_size, true);
+  }
+  nowcomm_put_seq(frame, seq);
+  memcpy(frame + NOWCOMM_HEADER_SIZE, incomingData + NOWCOMM_REDUNDANT_SIZE, payload);
+  accept_frame(mac, frame, entry.wire_size);
+}
+
+
+// Validate one frame, queue it, and acknowledge it if its type asks for that.
+// A copy, from a redundant frame, is only taken from a peer, and only if it is newer than anything that
+// peer has sent us; it isn't acknowledged, and is marked recovered.
+//
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::accept_frame(const uint8_t * mac, const uint8_t *incomingData, int len, bool copy) {
+  const Dispatch& entry = dispatch(nowcomm_header_kind(incomingData[0]));
+  Message         msg;
+  if(entry.wire_size != len || NOWCOMM_VERSION != nowcomm_header_version(incomingData[0]) || !entry.decode(msg, incomingData)) {
+    rx_rejected++;
+    NOWCOMM_TRACE(NOWCOMM_LOG_RX_REJECTED, nowcomm_header_kind(incomingData[0]),
+                  0 == entry.wire_size ? NOWCOMM_LOG_REJECT_KIND : entry.wire_size != len ? NOWCOMM_LOG_REJECT_SIZE :
+                  NOWCOMM_VERSION != nowcomm_header_version(incomingData[0]) ? NOWCOMM_LOG_REJECT_VERSION : NOWCOMM_LOG_REJECT_CONTENTS,
+                  nowcomm_log_peer(mac, len));
+    return;
+  }
+  uint16_t seq  = nowcomm_get_seq(incomingData);
+  int8_t   peer = find_peer(mac);
+  if(copy) {
+    if(0 > peer) return;
+    uint16_t ahead = (seq - peers[peer].rx_last_seq) & NOWCOMM_SEQ_MASK;
+    if(peers[peer].rx_seq_valid && (0 == ahead || NOWCOMM_ACK_WINDOW <= ahead)) return;
+    peers[peer].rx_recovered++;
   }
   else {
-    Serial.printf("Incoming message of unknown kind received: %d\n", ((uint32_t*)incomingData)[2]);
+    rx_last_seq = seq;
+    memcpy(rx_last_mac, mac, 6);
   }
-  memcpy(&responseAddress, mac, 6);
-  response_len  = len;
-  data_ready    = data_valid;
+  if(0 <= peer) {
+    Peer& p = peers[peer];
+    p.last_seen_us = micros();
+    if(p.rx_seq_valid && seq == p.rx_last_seq) {
+      p.rx_duplicated++;
+      NOWCOMM_TRACE(NOWCOMM_LOG_RX_DUPLICATE, msg.kind, seq, nowcomm_log_peer(mac, len));
+      if(entry.acknowledge) send_response(NOWCOMM_RESP_NOERR);
+      return;
+    }
+    p.rx_last_seq   = seq;
+    p.rx_seq_valid  = true;
+  }
+  memcpy(msg.mac, mac, 6);
+  msg.len     = len;
+  msg.channel = channel;
+  msg.seq     = seq;
+  msg.rx_us = micros();
+  msg.recovered = copy;
+  if(inbox.push(msg)) NOWCOMM_TRACE(copy ? NOWCOMM_LOG_RX_RECOVERED : NOWCOMM_LOG_RX, msg.kind, seq, nowcomm_log_peer(mac, len));
+  else                NOWCOMM_TRACE(NOWCOMM_LOG_RX_OVERRUN, msg.kind, seq, nowcomm_log_peer(mac, len));
+  if(entry.acknowledge && !copy) send_response(NOWCOMM_RESP_NOERR);
+}
+
+
+// The receive dispatch table: one entry per possible kind, built at compile time.
+// Kinds nobody registered have wire_size 0, which no frame can match.
+//
+template <typename Transport, typename... Msgs> constexpr std::array<typename BasicNowComm<Transport, Msgs...>::Dispatch, NOWCOMM_KIND_MAX + 1> BasicNowComm<Transport, Msgs...>::make_dispatch() {
+  std::array<Dispatch, NOWCOMM_KIND_MAX + 1> table = {};
+  table[NowComm_Response::kind]   = Dispatch { response_size, false, &decode_response, &load_message<NowComm_Response> };
+  table[NowComm_Discovery::kind]  = dispatch_entry<NowComm_Discovery>();
+  table[NowComm_Hop::kind]        = dispatch_entry<NowComm_Hop>();
+  ((table[Msgs::kind] = dispatch_entry<Msgs>()), ...);
+  return table;
+}
+
+
+template <typename Transport, typename... Msgs> const typename BasicNowComm<Transport, Msgs...>::Dispatch& BasicNowComm<Transport, Msgs...>::dispatch(uint8_t kind) {
+  static constexpr std::array<Dispatch, NOWCOMM_KIND_MAX + 1> table = make_dispatch();
+  return table[kind & NOWCOMM_KIND_MAX];
+}
+
+
+// The kinds the dispatch table accepts, as a mask for the router.
+//
+template <typename Transport, typename... Msgs> constexpr uint32_t BasicNowComm<Transport, Msgs...>::accepted_kinds() {
+  constexpr std::array<Dispatch, NOWCOMM_KIND_MAX + 1> table = make_dispatch();
+  uint32_t kinds = 0;
+  for(size_t k = 0; k < table.size(); k++) if(table[k].wire_size) kinds |= 1UL << k;
+  return kinds;
+}
+
+
+template <typename Transport, typename... Msgs> template <class M> constexpr typename BasicNowComm<Transport, Msgs...>::Dispatch BasicNowComm<Transport, Msgs...>::dispatch_entry() {
+  return Dispatch { M::wire_size, NowComm_Acknowledged<M>::value, &decode_message<M>, &load_message<M> };
+}
+
+
+// Decode a frame of message type M into msg. Returns false if its contents are invalid.
+//
+template <typename Transport, typename... Msgs> template <class M> bool BasicNowComm<Transport, Msgs...>::decode_message(Message& msg, const uint8_t* frame) {
+  M    decoded;
+  bool valid = decoded.decode(frame);
+  memcpy(msg.data, &decoded, sizeof(M));
+  msg.kind = M::kind;
+  return valid;
+}
+
+
+// A response, and the telemetry after it if it is flagged as holding some. The payload is decoded as
+// the telemetry type's own frame would be, so it is validated the same way.
+//
+template <typename Transport, typename... Msgs> bool BasicNowComm<Transport, Msgs...>::decode_response(Message& msg, const uint8_t* frame) {
+  uint8_t encoded[Telemetry::wire_size];
+  if(!decode_message<NowComm_Response>(msg, frame)) return false;
+  if(!msg.template get<NowComm_Response>()->telemetry) return true;
+  encoded[0] = nowcomm_header(Telemetry::kind);
+  nowcomm_put_seq(encoded, nowcomm_get_seq(frame));
+  memcpy(encoded + NOWCOMM_HEADER_SIZE, frame + NowComm_Response::wire_size, Telemetry::wire_size - NOWCOMM_HEADER_SIZE);
+  return msg.telemetry.decode(encoded);
+}
+
+
+// Copy a queued M to where loop() reads it: response, discovery, or the latest of its type.
+// A hop is acted on by note_message() instead.
+//
+template <typename Transport, typename... Msgs> template <class M> void BasicNowComm<Transport, Msgs...>::load_message(BasicNowComm& self, const Message& msg) {
+  if constexpr(std::is_same<M, NowComm_Response>::value)        self.response  = *msg.template get<M>();
+  else if constexpr(std::is_same<M, NowComm_Discovery>::value)  self.discovery = *msg.template get<M>();
+  else if constexpr(std::is_same<M, NowComm_Hop>::value)        return;
+  else                                                          std::get<M>(self.latest) = *msg.template get<M>();
+}
+
+
+// Make the oldest queued message current, loading it into response, discovery or the latest of its type.
+// It stays current until clear_data_ready() is called.
+//
+template <typename Transport, typename... Msgs> bool BasicNowComm<Transport, Msgs...>::is_data_ready() {
+  if(data_ready) return true;
+  Message* msg = inbox.peek();
+  if(nullptr == msg) return false;
+  dispatch(msg->kind).load(*this, *msg);
+  memcpy(responseAddress, msg->mac, 6);
+  msg_kind      = msg->kind;
+  msg_channel   = msg->channel;
+  msg_seq       = msg->seq;
+  msg_rx_us     = msg->rx_us;
+  msg_recovered = msg->recovered;
+  response_len  = msg->len;
+  note_message(*msg);
+  inbox.drop();
+  data_valid    = true;
+  data_ready    = true;
+  return true;
+}
+
+
+// Take the oldest queued message, leaving the current one alone.
+//
+template <typename Transport, typename... Msgs> bool BasicNowComm<Transport, Msgs...>::receive(Message& msg) {
+  if(!inbox.pop(msg)) return false;
+  note_message(msg);
+  return true;
+}
+
+
+// Learn what we can from a message as loop() takes it. A response is matched to the frame it answers,
+// timed from when it arrived so a slow loop() doesn't show up as radio latency. Anything else from a peer
+// counts toward the channel's estimate, and so do the frames a gap in its sequence numbers spans. The
+// controller's seq covers what it sends to other receivers too, so the cadence of arrivals decides how
+// many of the gap were really lost. A recovered message fills its gap, but was still lost on the air.
+//
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::note_message(const Message& msg) {
+  int8_t peer = find_peer(msg.mac);
+  if(0 > peer) return;
+  Peer& p = peers[peer];
+  if(HOP_WATCH == hop_state && msg.channel == channel) {           // Heard on the new channel: the hop worked
+    hop_stats.latency_us  = msg.rx_us - hop_decided_us;
+    hop_stats.outage_us   = msg.rx_us - hop_switched_us;
+    hop_state             = HOP_IDLE;
+    save_bond();                                                   // So a restart resumes here, not on the old channel
+  }
+  if(NOWCOMM_KIND_RESPONSE == msg.kind) {
+    const NowComm_Response* response = msg.template get<NowComm_Response>();
+    if(response->telemetry) note_telemetry(p, msg.telemetry, msg.rx_us);
+    p.acks.on_ack(response->ack_seq, msg.rx_us, [&](uint8_t chan, uint32_t rtt_us) {
+      note_outcome(chan, true, rtt_us, msg.rx_us);
+    });
+    return;
+  }
+  if(NOWCOMM_KIND_NONE != Telemetry::kind && Telemetry::kind == msg.kind) note_telemetry(p, *msg.template get<Telemetry>(), msg.rx_us);
+  if(NOWCOMM_KIND_HOP == msg.kind) note_hop(msg, peer);
+  if(NOWCOMM_MODE_RECEIVER != device_mode) return;
+  uint16_t gap = (msg.seq - p.noted_seq - 1) & NOWCOMM_SEQ_MASK;
+  if(p.noted_seq_valid && NOWCOMM_ACK_WINDOW > gap) {              // A bigger jump is a restart, or reordering
+    uint16_t lost = p.noted_cadence.spanned(gap + 1, msg.rx_us) - 1;
+    for(uint16_t i = 0; i < lost; i++) note_outcome(msg.channel, false, 0, msg.rx_us);
+  }
+  else p.noted_cadence.spanned(1, msg.rx_us);
+  p.noted_seq       = msg.seq;
+  p.noted_seq_valid = true;
+  note_outcome(msg.channel, !msg.recovered, 0, msg.rx_us);
+}
+
+
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::note_telemetry(Peer& p, const Telemetry& telemetry, unsigned long rx_us) {
+  p.telemetry       = telemetry;
+  p.telemetry_us    = rx_us;
+  p.telemetry_valid = true;
+}
+
+
+// One frame delivered or lost on chan: into the channel's estimate and, just after a hop, its post-hop loss.
+//
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::note_outcome(uint8_t chan, bool delivered, uint32_t rtt_us, unsigned long now) {
+  if(delivered) channel_quality.on_delivered(chan, rtt_us ? rtt_us : 1, now);
+  else          channel_quality.on_lost(chan, now);
+  if(0 == settle_left || chan != channel) return;
+  if(!delivered) settle_lost++;
+  if(0 == --settle_left) hop_stats.post_hop_loss_permille = (uint16_t)(settle_lost * 1000UL / NOWCOMM_HOP_SETTLE);
+}
+
+
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::expire_acks(unsigned long now) {
+  uint8_t count = get_peer_count();
+  for(uint8_t i = 0; i < count; i++) peers[i].acks.expire(now, [&](uint8_t chan) { note_outcome(chan, false, 0, now); });
+}
+
+
+// A hop from the controller is scheduled and confirmed, each time it's repeated; a confirmation from a
+// receiver is recorded against the hop in progress.
+//
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::note_hop(const Message& msg, int8_t peer) {
+  const NowComm_Hop* hop = msg.template get<NowComm_Hop>();
+  if(NOWCOMM_MODE_CONTROLLER == device_mode) {
+    if(hop->confirm && HOP_PENDING == hop_state && hop->channel == hop_channel) peers[peer].hop_confirmed = true;
+    return;
+  }
+  if(hop->confirm) return;
+  if(HOP_PENDING != hop_state || hop->channel != hop_channel) {
+    hop_decided_us = msg.rx_us;
+    NOWCOMM_TRACE(NOWCOMM_LOG_HOP, hop->channel, NOWCOMM_LOG_HOP_START);
+  }
+  hop_state   = HOP_PENDING;
+  hop_channel = hop->channel;
+  hop_at_us   = msg.rx_us + hop->delay_ms * 1000UL;
+  send_hop_to(msg.mac, true, 0);
+}
+
+
+// The controller watches the channel and starts a hop when it degrades; then either side switches at the
+// agreed time, and goes back if the peer isn't heard on the new channel.
+//
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::service_hop(unsigned long now) {
+  bool controller = NOWCOMM_MODE_CONTROLLER == device_mode;
+  switch(hop_state) {
+    case HOP_IDLE:
+      if(!controller || !hopping || discovery_open)              break;
+      if(NOWCOMM_HOP_HOLDOFF_US > now - hop_switched_us)        break;
+      if(channel_quality.is_poor(channel, now)) start_hop(channel_quality.best_channel(channel, now), now);
+      break;
+    case HOP_PENDING:
+      if((long)(now - hop_at_us) >= 0) {
+        bool confirmed = true;
+        for(uint8_t i = 0; controller && i < get_peer_count(); i++) confirmed &= peers[i].hop_confirmed;
+        if(confirmed) do_hop(now);
+        else {
+          NOWCOMM_TRACE(NOWCOMM_LOG_HOP, hop_channel, NOWCOMM_LOG_HOP_ABORT);
+          hop_stats.aborted++;
+          hop_state       = HOP_IDLE;
+          hop_switched_us = now;                                   // Hold off before trying again
+        }
+      }
+      else if(controller && NOWCOMM_HOP_REPEAT_US <= now - hop_sent_us) {
+        uint16_t delay_ms = (uint16_t)((hop_at_us - now) / 1000);
+        for(uint8_t i = 0; i < get_peer_count(); i++) {
+          if(!peers[i].hop_confirmed) send_hop_to(peers[i].mac, false, delay_ms);
+        }
+        hop_sent_us = now;
+      }
+      break;
+    case HOP_WATCH:
+      if(NOWCOMM_HOP_REVERT_US <= now - hop_switched_us) {
+        switch_channel(hop_prev);
+        NOWCOMM_TRACE(NOWCOMM_LOG_HOP, hop_prev, NOWCOMM_LOG_HOP_REVERT);
+        hop_stats.reverted++;
+        hop_state = HOP_IDLE;
+      }
+      break;
+  }
+}
+
+
+// Decide to hop: tell every receiver where, and when. Repeated by service_hop() until each confirms.
+//
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::start_hop(uint8_t chan, unsigned long now) {
+  if(chan == channel) return;
+  NOWCOMM_TRACE(NOWCOMM_LOG_HOP, chan, NOWCOMM_LOG_HOP_START);
+  hop_state       = HOP_PENDING;
+  hop_channel     = chan;
+  hop_decided_us  = now;
+  hop_at_us       = now + NOWCOMM_HOP_LEAD_US;
+  hop_sent_us     = now;
+  for(uint8_t i = 0; i < get_peer_count(); i++) {
+    peers[i].hop_confirmed = false;
+    send_hop_to(peers[i].mac, false, NOWCOMM_HOP_LEAD_US / 1000);
+  }
+}
+
+
+// Switch at the agreed time. The ESP-NOW peers move with the radio, so there is nothing to re-register.
+//
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::do_hop(unsigned long now) {
+  hop_prev                = channel;
+  if(!switch_channel(hop_channel)) {
+    NOWCOMM_TRACE(NOWCOMM_LOG_HOP, hop_channel, NOWCOMM_LOG_HOP_ABORT);     // Receivers that moved will revert
+    hop_stats.aborted++;
+    hop_state             = HOP_IDLE;
+    hop_switched_us       = now;
+    return;
+  }
+  NOWCOMM_TRACE(NOWCOMM_LOG_HOP, hop_channel, NOWCOMM_LOG_HOP_SWITCH);
+  hop_switched_us         = now;
+  hop_state               = HOP_WATCH;
+  hop_stats.hops++;
+  hop_stats.from_channel  = hop_prev;
+  hop_stats.to_channel    = hop_channel;
+  settle_left             = NOWCOMM_HOP_SETTLE;
+  settle_lost             = 0;
+}
+
+
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::send_hop_to(const uint8_t* mac, bool confirm, uint16_t delay_ms) {
+  NowComm_Hop outgoing;
+  uint8_t     frame[NowComm_Hop::wire_size];
+  outgoing.channel  = hop_channel;
+  outgoing.confirm  = confirm;
+  outgoing.delay_ms = delay_ms;
+  outgoing.encode(frame);
+  send_frame(mac, frame, sizeof(frame));
+}
+
+
+// Counters from both sides of one peer's link. Cheap enough to call from loop(), and touches nothing
+// the radio callback waits on.
+//
+template <typename Transport, typename... Msgs> bool BasicNowComm<Transport, Msgs...>::get_link_stats(NowComm_LinkStats& stats, uint8_t peer) {
+  stats = {};
+  if(get_peer_count() <= peer) return false;
+  Peer& p = peers[peer];
+  expire_acks(micros());
+  p.acks.get_stats(stats);
+  stats.duplicated += p.rx_duplicated;
+  stats.recovered   = p.rx_recovered;
+  stats.tx_failed   = p.tx_failed;
+  return true;
+}
+
+
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::reset_link_stats() {
+  for(Peer& p : peers) {
+    p.acks.reset();
+    p.rx_duplicated = 0;
+    p.rx_recovered  = 0;
+    p.tx_failed     = 0;
+  }
+}
+
+
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::on_data_sent_wrapper(void* context, const uint8_t *mac, bool success) {
+  ((BasicNowComm<Transport, Msgs...>*)context)->on_data_sent(mac, success);
 }
 
 
-template <typename T> void NowComm<T>::on_data_sent_wrapper(const uint8_t *mac, esp_now_send_status_t status) {
-  auto func = std::bind(&NowComm<T>::on_data_sent, self_reference, mac, status);
-  func();
+template <typename Transport, typename... Msgs> void BasicNowComm<Transport, Msgs...>::on_data_received_wrapper(void* context, const uint8_t *mac, const uint8_t *incomingData, int len) {
+  ((BasicNowComm<Transport, Msgs...>*)context)->on_data_received(mac, incomingData, len);
 }
 
 
-template <typename T> void NowComm<T>::on_data_received_wrapper(const uint8_t *mac, const uint8_t *incomingData, int len) {
-  auto func = std::bind(&NowComm<T>::on_data_received, self_reference, mac, incomingData, len);
-  func();
+template <typename Transport, typename... Msgs> bool BasicNowComm<Transport, Msgs...>::claims_peer_wrapper(void* context, const uint8_t *mac) {
+  return 0 <= ((BasicNowComm<Transport, Msgs...>*)context)->find_peer(mac);
 }
@@ -0,0 +1,102 @@
+#pragma once
+#include "NowCommPlatform.h"
+#ifdef ARDUINO
+#include <Preferences.h>
+#endif
+
+// The bonded peer: who this station last paired with, on which channel, under which protocol version.
+// NowComm saves it when it pairs and, at the next begin(), tries that peer directly before falling
+// back to discovery (see BasicNowComm::set_bond_store()).
+
+#define NOWCOMM_BOND_TRY_US     50000UL   // A controller tries its bonded receiver this long before scanning
+#define NOWCOMM_BOND_HOLD_US    1000000UL // A receiver waits this long on its bonded channel; a scanning controller finds it there too
+
+
+// Stored as-is: mac[6], channel, version. A record from another protocol version is ignored.
+//
+typedef struct NowComm_Bond {
+  uint8_t       mac[6]    = { 0 };
+  uint8_t       channel   = 0;
+  uint8_t       version   = 0;
+} NowComm_Bond;
+
+static_assert(8 == sizeof(NowComm_Bond), "NowComm_Bond is stored as raw bytes");
+
+
+#ifdef ARDUINO
+
+// Keeps the bond in NVS, through Preferences. name is the NVS namespace.
+// NowComm only saves a bond that has changed, so flash isn't worn by every power cycle.
+//
+class NowCommPrefsBondStore {
+  public:
+    NowCommPrefsBondStore(const char* name = "nowcomm")  : name(name) {}
+    bool                  load(NowComm_Bond& bond);
+    bool                  save(const NowComm_Bond& bond);
+    void                  clear();
+  private:
+    const char*           name;
+};
+
+typedef NowCommPrefsBondStore NowCommBondStore;
+
+
+inline bool NowCommPrefsBondStore::load(NowComm_Bond& bond) {
+  Preferences prefs;
+  if(!prefs.begin(name, true)) return false;
+  size_t len = prefs.getBytes("bond", &bond, sizeof(bond));
+  prefs.end();
+  return sizeof(bond) == len;
+}
+
+
+inline bool NowCommPrefsBondStore::save(const NowComm_Bond& bond) {
+  Preferences prefs;
+  if(!prefs.begin(name, false)) return false;
+  size_t len = prefs.putBytes("bond", &bond, sizeof(bond));
+  prefs.end();
+  return sizeof(bond) == len;
+}
+
+
+inline void NowCommPrefsBondStore::clear() {
+  Preferences prefs;
+  if(!prefs.begin(name, false)) return;
+  prefs.remove("bond");
+  prefs.end();
+}
+
+#else
+
+// Keeps the bond in a file, standing in for NVS on a host.
+//
+class NowCommFileBondStore {
+  public:
+    NowCommFileBondStore(const char* path = "nowcomm.bond")  : path(path) {}
+    bool                  load(NowComm_Bond& bond);
+    bool                  save(const NowComm_Bond& bond);
+    void                  clear()                             { remove(path); }
+  private:
+    const char*           path;
+};
+
+typedef NowCommFileBondStore NowCommBondStore;
+
+
+inline bool NowCommFileBondStore::load(NowComm_Bond& bond) {
+  FILE* file = fopen(path, "rb");
+  if(nullptr == file) return false;
+  size_t len = fread(&bond, 1, sizeof(bond), file);
+  fclose(file);
+  return sizeof(bond) == len;
+}
+
+
+inline bool NowCommFileBondStore::save(const NowComm_Bond& bond) {
+  FILE* file = fopen(path, "wb");
+  if(nullptr == file) return false;
+  size_t len = fwrite(&bond, 1, sizeof(bond), file);
+  return 0 == fclose(file) && sizeof(bond) == len;
+}
+
+#endif
@@ -0,0 +1,253 @@
+#pragma once
+#include "NowCommPlatform.h"
+#include "NowCommWire.h"
+#include <atomic>
+#ifndef ARDUINO
+#include <mutex>
+#endif
+
+// Packet capture: every frame a NowComm sends or receives, with the time, the peer and the channel, as a
+// compact binary trace that tools/nowcomm_replay can run back through new code.
+// The capture hook is in send_frame() and on_data_received(), so it sees frames as they went on and came
+// off the air: before validation, duplicates and rejects included. A frame longer than
+// NOWCOMM_CAPTURE_SNAP is cut short there, with its full length noted.
+// Frames go into a RAM ring that keeps the newest NOWCOMM_CAPTURE_DEPTH: a flight recorder, which
+// dump() writes out, oldest first, on request (over Serial, on the M5StickC). Adding is lock-free, from
+// any task or callback; a slot being overwritten while it is dumped is skipped. On a host, open() also
+// writes every frame to a file as it is captured.
+// Capture is off until enable(true); off, NOWCOMM_CAPTURE is a load and a branch.
+// A record is two sync bytes, its size, the body (LE) and a checksum, like NowCommLog's, so a trace can
+// be cut out of a Serial capture full of other things. NowCommCaptureReader finds the records.
+
+#ifndef NOWCOMM_CAPTURE_DEPTH
+#ifdef ARDUINO
+#define NOWCOMM_CAPTURE_DEPTH   32        // Frames (power of two); 2.6 KB
+#else
+#define NOWCOMM_CAPTURE_DEPTH   1024
+#endif
+#endif
+#ifndef NOWCOMM_CAPTURE_SNAP
+#define NOWCOMM_CAPTURE_SNAP    64        // Bytes kept of each frame; a BugCommand is 8, a multiplexed one 5 + 11 per receiver
+#endif
+#define NOWCOMM_CAPTURE_SYNC0   0xC4
+#define NOWCOMM_CAPTURE_SYNC1   0x4C
+#define NOWCOMM_CAPTURE_HEADER  13        // us (4), flags, channel, len, mac (6)
+#define NOWCOMM_CAPTURE_RECORD_MAX  (3 + NOWCOMM_CAPTURE_HEADER + NOWCOMM_CAPTURE_SNAP + 1)
+
+static_assert(0 == (NOWCOMM_CAPTURE_DEPTH & (NOWCOMM_CAPTURE_DEPTH - 1)), "NOWCOMM_CAPTURE_DEPTH must be a power of two");
+static_assert(255 >= NOWCOMM_CAPTURE_HEADER + NOWCOMM_CAPTURE_SNAP, "A capture record's size must fit a byte");
+
+
+// flags. The top two bits are the session (see NowCommRouter.h).
+//
+enum NowComm_CaptureFlag : uint8_t {
+  NOWCOMM_CAPTURE_TX      = 0x01,         // Sent, to mac; otherwise received, from mac
+  NOWCOMM_CAPTURE_REFUSED = 0x02,         // Sent, but the transport refused it
+  NOWCOMM_CAPTURE_BEGIN   = 0x04,         // Not a frame: a session began. mac is the device's own; data is its mode
+  NOWCOMM_CAPTURE_SESSION = 0xC0
+};
+
+
+typedef struct NowComm_CaptureRecord {
+  uint32_t      us;
+  uint8_t       flags;                    // NowComm_CaptureFlag
+  uint8_t       channel;
+  uint8_t       len;                      // The frame's length
+  uint8_t       captured;                 // ...and how much of it is in data
+  uint8_t       mac[6];
+  uint8_t       data[NOWCOMM_CAPTURE_SNAP];
+} NowComm_CaptureRecord;
+
+
+class NowCommCapture {
+  public:
+    NowCommCapture();
+    void                  enable(bool on)   { enabled.store(on, std::memory_order_relaxed); }
+    bool                  is_enabled()      { return enabled.load(std::memory_order_relaxed); }
+    void                  add(uint8_t flags, uint8_t channel, const uint8_t* mac, const uint8_t* data, int len);   // Any context
+    template <class Out> uint32_t dump(Out& out);          // The ring, oldest first; returns records written
+    uint32_t              get_captured()    { return head.load(std::memory_order_relaxed); }
+    static uint8_t        encode(const NowComm_CaptureRecord& record, uint8_t* frame);   // Returns the size
+#ifndef ARDUINO
+    bool                  open(const char* path);           // Host: also write each frame to path as it comes
+    void                  close();
+#endif
+  private:
+    struct Slot {
+      std::atomic<uint32_t> seq;                  // Odd while being written; 2 * position + 2 once written
+      uint8_t             size;
+      uint8_t             frame[NOWCOMM_CAPTURE_RECORD_MAX];
+    };
+    Slot                  slots[NOWCOMM_CAPTURE_DEPTH];
+    std::atomic<uint32_t> head;                   // Next position to write
+    std::atomic<bool>     enabled;
+#ifndef ARDUINO
+    FILE*                 file              = nullptr;
+    std::mutex            file_lock;
+#endif
+};
+
+
+// The one capture every NowComm writes to.
+//
+inline NowCommCapture& nowcomm_capture() {
+  static NowCommCapture instance;
+  return instance;
+}
+
+
+#define NOWCOMM_CAPTURE(...)  do { if(nowcomm_capture().is_enabled()) nowcomm_capture().add(__VA_ARGS__); } while(0)
+
+
+inline NowCommCapture::NowCommCapture() : head(0), enabled(false) {
+  for(uint32_t i = 0; i < NOWCOMM_CAPTURE_DEPTH; i++) slots[i].seq.store(0, std::memory_order_relaxed);
+}
+
+
+// Take the next position whether or not its slot has been dumped: the newest frames are the ones kept.
+// The slot's seq is odd while it is written, so dump() can tell a torn copy.
+//
+inline void NowCommCapture::add(uint8_t flags, uint8_t channel, const uint8_t* mac, const uint8_t* data, int len) {
+  NowComm_CaptureRecord record;
+  record.us       = (uint32_t)micros();
+  record.flags    = flags;
+  record.channel  = channel;
+  record.len      = (uint8_t)(255 < len ? 255 : len);
+  record.captured = (uint8_t)(NOWCOMM_CAPTURE_SNAP < len ? NOWCOMM_CAPTURE_SNAP : len);
+  memcpy(record.mac, mac, 6);
+  memcpy(record.data, data, record.captured);
+  uint8_t  frame[NOWCOMM_CAPTURE_RECORD_MAX];
+  uint8_t  size = encode(record, frame);
+  uint32_t pos  = head.fetch_add(1, std::memory_order_relaxed);
+  Slot&    slot = slots[pos & (NOWCOMM_CAPTURE_DEPTH - 1)];
+  slot.seq.store(2 * pos + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.size = size;
+  memcpy(slot.frame, frame, size);
+  slot.seq.store(2 * pos + 2, std::memory_order_release);
+#ifndef ARDUINO
+  std::lock_guard<std::mutex> lock(file_lock);
+  if(file) fwrite(frame, 1, size, file);
+#endif
+}
+
+
+// Write the frames in the ring to out, which needs write(const uint8_t*, size_t). Capture carries on
+// meanwhile; anything overwritten before it is copied is left out.
+//
+template <class Out> uint32_t NowCommCapture::dump(Out& out) {
+  uint32_t end   = head.load(std::memory_order_acquire);
+  uint32_t pos   = NOWCOMM_CAPTURE_DEPTH < end ? end - NOWCOMM_CAPTURE_DEPTH : 0;
+  uint32_t count = 0;
+  uint8_t  frame[NOWCOMM_CAPTURE_RECORD_MAX];
+  for(; pos != end; pos++) {
+    Slot&    slot = slots[pos & (NOWCOMM_CAPTURE_DEPTH - 1)];
+    uint32_t seq  = slot.seq.load(std::memory_order_acquire);
+    if(2 * pos + 2 != seq) continue;
+    uint8_t size = slot.size;
+    memcpy(frame, slot.frame, sizeof(frame));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if(seq != slot.seq.load(std::memory_order_relaxed) || NOWCOMM_CAPTURE_RECORD_MAX < size) continue;
+    out.write(frame, size);
+    count++;
+  }
+  return count;
+}
+
+
+inline uint8_t NowCommCapture::encode(const NowComm_CaptureRecord& record, uint8_t* frame) {
+  uint8_t body = NOWCOMM_CAPTURE_HEADER + record.captured;
+  uint8_t* r   = frame + 3;
+  frame[0] = NOWCOMM_CAPTURE_SYNC0;
+  frame[1] = NOWCOMM_CAPTURE_SYNC1;
+  frame[2] = body;
+  wire_put_u16(r + 0, (uint16_t)record.us);
+  wire_put_u16(r + 2, (uint16_t)(record.us >> 16));
+  r[4] = record.flags;
+  r[5] = record.channel;
+  r[6] = record.len;
+  memcpy(r + 7, record.mac, 6);
+  memcpy(r + NOWCOMM_CAPTURE_HEADER, record.data, record.captured);
+  uint8_t sum = body;
+  for(int i = 0; i < body; i++) sum += r[i];
+  r[body] = sum;
+  return 3 + body + 1;
+}
+
+
+#ifndef ARDUINO
+inline bool NowCommCapture::open(const char* path) {
+  std::lock_guard<std::mutex> lock(file_lock);
+  if(file) fclose(file);
+  file = fopen(path, "wb");
+  return nullptr != file;
+}
+
+
+inline void NowCommCapture::close() {
+  std::lock_guard<std::mutex> lock(file_lock);
+  if(file) fclose(file);
+  file = nullptr;
+}
+#endif
+
+
+// Finds the records in a byte stream, whatever else is mixed in with them. A record is only taken if its
+// checksum matches; otherwise the search moves on a byte.
+//
+class NowCommCaptureReader {
+  public:
+    template <class OnRecord> void put(const uint8_t* data, size_t len, OnRecord&& on_record);
+    uint32_t              get_records()     { return records; }
+    uint32_t              get_skipped()     { return skipped; }     // Bytes that weren't part of a record
+  private:
+    bool                  parse(NowComm_CaptureRecord& record);
+    uint8_t               buffer[NOWCOMM_CAPTURE_RECORD_MAX];
+    uint16_t              held              = 0;
+    uint32_t              records           = 0;
+    uint32_t              skipped           = 0;
+};
+
+
+// on_record(const NowComm_CaptureRecord&) for each record, in order.
+//
+template <class OnRecord> void NowCommCaptureReader::put(const uint8_t* data, size_t len, OnRecord&& on_record) {
+  NowComm_CaptureRecord record;
+  for(size_t i = 0; i < len; i++) {
+    buffer[held++] = data[i];
+    while(held) {
+      bool start = NOWCOMM_CAPTURE_SYNC0 == buffer[0] && (1 == held || NOWCOMM_CAPTURE_SYNC1 == buffer[1]);
+      if(start && 3 <= held) {
+        uint8_t body = buffer[2];
+        start = NOWCOMM_CAPTURE_HEADER <= body && NOWCOMM_CAPTURE_HEADER + NOWCOMM_CAPTURE_SNAP >= body;
+        if(start && held < 3 + body + 1) break;
+      }
+      else if(start) break;
+      if(start && parse(record)) {
+        held = 0;
+        records++;
+        on_record(record);
+        break;
+      }
+      skipped++;
+      memmove(buffer, buffer + 1, --held);
+    }
+  }
+}
+
+
+inline bool NowCommCaptureReader::parse(NowComm_CaptureRecord& record) {
+  uint8_t        body = buffer[2];
+  const uint8_t* r    = buffer + 3;
+  uint8_t        sum  = body;
+  for(int i = 0; i < body; i++) sum += r[i];
+  if(sum != r[body]) return false;
+  record.us       = wire_get_u16(r + 0) | ((uint32_t)wire_get_u16(r + 2) << 16);
+  record.flags    = r[4];
+  record.channel  = r[5];
+  record.len      = r[6];
+  record.captured = body - NOWCOMM_CAPTURE_HEADER;
+  memcpy(record.mac, r + 7, 6);
+  memcpy(record.data, r + NOWCOMM_CAPTURE_HEADER, record.captured);
+  return true;
+}
@@ -0,0 +1,138 @@
+#pragma once
+#include "NowCommPlatform.h"
+#include "NowCommScan.h"
+
+// Adaptive channel hopping.
+// Each station keeps a rolling estimate of loss and round-trip time for every channel it has used:
+// the controller from its acknowledged frames, a receiver from gaps in the controller's sequence numbers.
+// When the controller's estimate for the current channel passes NOWCOMM_HOP_LOSS_Q16 or NOWCOMM_HOP_RTT_US,
+// it picks the best other channel and sends each receiver a NowComm_Hop naming it and how long until
+// the switch. Receivers confirm, and at the agreed time both sides move. If a receiver hasn't confirmed
+// by then, the controller stays put. A station that hears nothing from its peer within
+// NOWCOMM_HOP_REVERT_US of a hop goes back to the channel it came from.
+// Everything here runs in loop() context.
+
+#define NOWCOMM_HOP_EWMA_SHIFT    4           // Estimates move 1/16 of the way toward each new frame
+#define NOWCOMM_HOP_LOSS_Q16      13107       // Hop when the loss estimate passes this (20%, of 65536)
+#define NOWCOMM_HOP_RTT_US        30000UL     // ...or the round trip estimate passes this
+#define NOWCOMM_HOP_MIN_SAMPLES   16          // Frames on a channel before its estimate counts
+#define NOWCOMM_HOP_FORGET_US     30000000UL  // An estimate this old is no better than none
+#define NOWCOMM_HOP_HOLDOFF_US    2000000UL   // Stay at least this long after a hop
+#define NOWCOMM_HOP_LEAD_US       60000UL     // Decision to switch; the hop message is repeated meanwhile
+#define NOWCOMM_HOP_REPEAT_US     10000UL
+#define NOWCOMM_HOP_REVERT_US     300000UL
+#define NOWCOMM_HOP_SETTLE        50          // Frames after a hop that its post-hop loss is measured over
+
+
+// One channel's estimate, as reported. loss_permille and rtt_us are 0 until samples arrive.
+//
+typedef struct NowComm_ChannelQuality {
+  uint16_t      loss_permille;
+  uint32_t      rtt_us;
+  uint32_t      samples;                      // Frames seen on the channel since it was last forgotten
+  unsigned long age_us;                       // Since the last sample
+} NowComm_ChannelQuality;
+
+
+typedef struct NowComm_HopStats {
+  uint32_t      hops;                         // Channel changes made
+  uint32_t      aborted;                      // Hops called off because a receiver didn't confirm
+  uint32_t      reverted;                     // Hops undone because the peer wasn't heard on the new channel
+  uint8_t       from_channel;                 // The last hop
+  uint8_t       to_channel;
+  uint32_t      latency_us;                   // Decision to the first frame heard on the new channel
+  uint32_t      outage_us;                    // Switch to the first frame heard on the new channel
+  uint16_t      post_hop_loss_permille;       // Over the first NOWCOMM_HOP_SETTLE frames after it
+} NowComm_HopStats;
+
+
+// Per-channel loss and round-trip estimates: exponentially weighted, in fixed point.
+//
+class NowCommChannelQuality {
+  public:
+    void                  on_delivered(uint8_t chan, uint32_t rtt_us, unsigned long now_us);   // rtt_us 0 if unknown
+    void                  on_lost(uint8_t chan, unsigned long now_us);
+    bool                  is_poor(uint8_t chan, unsigned long now_us);
+    uint8_t               best_channel(uint8_t current, unsigned long now_us);   // The best channel other than current
+    void                  get(uint8_t chan, NowComm_ChannelQuality& quality, unsigned long now_us);
+  private:
+    struct Estimate {
+      uint32_t            loss_q16;
+      uint32_t            rtt_us;
+      uint32_t            samples;
+      unsigned long       updated_us;
+    };
+    Estimate*             estimate(uint8_t chan, unsigned long now_us);   // nullptr if chan is out of range
+    Estimate              channels[NOWCOMM_SCAN_CHANNELS] = {};
+};
+
+
+// The estimate for a channel, forgotten first if it has gone stale.
+//
+inline NowCommChannelQuality::Estimate* NowCommChannelQuality::estimate(uint8_t chan, unsigned long now_us) {
+  if(chan < NOWCOMM_SCAN_FIRST || NOWCOMM_SCAN_LAST < chan) return nullptr;
+  Estimate* e = &channels[chan - NOWCOMM_SCAN_FIRST];
+  if(e->samples && NOWCOMM_HOP_FORGET_US < now_us - e->updated_us) *e = Estimate();
+  return e;
+}
+
+
+inline void NowCommChannelQuality::on_delivered(uint8_t chan, uint32_t rtt_us, unsigned long now_us) {
+  Estimate* e = estimate(chan, now_us);
+  if(nullptr == e) return;
+  e->loss_q16  -= e->loss_q16 >> NOWCOMM_HOP_EWMA_SHIFT;
+  if(rtt_us) e->rtt_us = e->rtt_us ? e->rtt_us + (((int32_t)rtt_us - (int32_t)e->rtt_us) >> NOWCOMM_HOP_EWMA_SHIFT) : rtt_us;
+  e->samples++;
+  e->updated_us = now_us;
+}
+
+
+inline void NowCommChannelQuality::on_lost(uint8_t chan, unsigned long now_us) {
+  Estimate* e = estimate(chan, now_us);
+  if(nullptr == e) return;
+  e->loss_q16  += (65536 - e->loss_q16) >> NOWCOMM_HOP_EWMA_SHIFT;
+  e->samples++;
+  e->updated_us = now_us;
+}
+
+
+inline bool NowCommChannelQuality::is_poor(uint8_t chan, unsigned long now_us) {
+  Estimate* e = estimate(chan, now_us);
+  if(nullptr == e || NOWCOMM_HOP_MIN_SAMPLES > e->samples) return false;
+  return NOWCOMM_HOP_LOSS_Q16 < e->loss_q16 || NOWCOMM_HOP_RTT_US < e->rtt_us;
+}
+
+
+// Channels with an estimate are scored by their loss. One without is assumed half as bad as the
+// threshold, so a channel known to be clean beats an unknown one, and an unknown one beats a poor one.
+// Ties go to the first found counting up from current, which spreads hopping pairs around.
+//
+inline uint8_t NowCommChannelQuality::best_channel(uint8_t current, unsigned long now_us) {
+  uint8_t   best        = current;
+  uint32_t  best_score  = UINT32_MAX;
+  uint8_t   chan        = current;
+  for(int i = 1; i < NOWCOMM_SCAN_CHANNELS; i++) {
+    chan = (NOWCOMM_SCAN_LAST <= chan) ? NOWCOMM_SCAN_FIRST : chan + 1;
+    Estimate* e     = estimate(chan, now_us);
+    uint32_t  score = (NOWCOMM_HOP_MIN_SAMPLES > e->samples) ? NOWCOMM_HOP_LOSS_Q16 / 2 : e->loss_q16;
+    if(NOWCOMM_HOP_RTT_US < e->rtt_us && NOWCOMM_HOP_MIN_SAMPLES <= e->samples) score += NOWCOMM_HOP_LOSS_Q16;
+    if(score < best_score) {
+      best        = chan;
+      best_score  = score;
+    }
+  }
+  return best;
+}
+
+
+inline void NowCommChannelQuality::get(uint8_t chan, NowComm_ChannelQuality& quality, unsigned long now_us) {
+  Estimate* e = estimate(chan, now_us);
+  if(nullptr == e) {
+    quality = NowComm_ChannelQuality();
+    return;
+  }
+  quality.loss_permille = (uint16_t)((e->loss_q16 * 1000 + 32768) >> 16);
+  quality.rtt_us        = e->rtt_us;
+  quality.samples       = e->samples;
+  quality.age_us        = e->samples ? now_us - e->updated_us : 0;
+}
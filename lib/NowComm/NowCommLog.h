@@ -0,0 +1,374 @@
+#pragma once
+#include "NowCommPlatform.h"
+#include "NowCommWire.h"
+#include <atomic>
+
+// Deferred binary event log.
+// Anything, the radio callbacks included, can record an event: a fixed-size record of an event id,
+// the time, and three small arguments, put in a lock-free ring. Nothing is formatted and nothing waits
+// for a UART. Something of low priority drains the ring later: on the M5StickC a task of its own
+// writing framed records to Serial, on a host whatever calls drain(). A full ring drops the new
+// record and counts it, so a slow drain costs events, never timing.
+// Logging is off until enable(true); off, NOWCOMM_TRACE is a load and a branch.
+// A frame is two sync bytes, the record (LE), and a checksum; it can share Serial with text, which
+// NowCommLogDecoder passes through. tools/nowcomm_logdecode turns a capture back into text.
+
+#ifndef NOWCOMM_LOG_DEPTH
+#ifdef ARDUINO
+#define NOWCOMM_LOG_DEPTH       128       // Records (power of two); 2 KB
+#else
+#define NOWCOMM_LOG_DEPTH       4096
+#endif
+#endif
+#define NOWCOMM_LOG_SYNC0       0x5A
+#define NOWCOMM_LOG_SYNC1       0xA5
+#define NOWCOMM_LOG_RECORD_SIZE 12        // On the wire: us (4), event, a, b (2), c (4)
+#define NOWCOMM_LOG_FRAME_SIZE  (2 + NOWCOMM_LOG_RECORD_SIZE + 1)
+
+static_assert(0 == (NOWCOMM_LOG_DEPTH & (NOWCOMM_LOG_DEPTH - 1)), "NOWCOMM_LOG_DEPTH must be a power of two");
+
+
+// What happened. The comment gives the meaning of a, b and c; "len:peer" is the frame length in the
+// top byte of c and the last three bytes of the peer's MAC address below it.
+//
+enum NowComm_LogEvent : uint8_t {
+  NOWCOMM_LOG_NONE,
+  NOWCOMM_LOG_TX,                 // kind (bit 7: the transport refused it), seq, len:peer
+  NOWCOMM_LOG_TX_STATUS,          // delivered, -, peer
+  NOWCOMM_LOG_RX,                 // kind, seq, len:peer
+  NOWCOMM_LOG_RX_DUPLICATE,       // kind, seq, len:peer
+  NOWCOMM_LOG_RX_REJECTED,        // kind, NowComm_LogReject, len:peer
+  NOWCOMM_LOG_RX_OVERRUN,         // kind, seq, len:peer: the receive queue was full
+  NOWCOMM_LOG_DISCOVERY,          // sender's mode, NowComm_LogDiscovery, peer
+  NOWCOMM_LOG_PAIRED,             // channel, peers, peer
+  NOWCOMM_LOG_SCAN,               // channel
+  NOWCOMM_LOG_HOP,                // channel, NowComm_LogHop, -
+  NOWCOMM_LOG_DROPPED,            // -, -, records lost because the ring was full
+  NOWCOMM_LOG_RX_RECOVERED,       // kind, seq, len:peer: missed, and taken from a copy in a later frame
+  NOWCOMM_LOG_PEER,               // channel, NowComm_LogPeer, peer
+  NOWCOMM_LOG_ERROR,              // channel, NowComm_LogError, -
+  NOWCOMM_LOG_USER        = 64    // Application events from here; the decoder prints them as numbers
+};
+
+
+enum NowComm_LogReject : uint16_t {
+  NOWCOMM_LOG_REJECT_KIND,        // Nobody here handles that kind
+  NOWCOMM_LOG_REJECT_SIZE,
+  NOWCOMM_LOG_REJECT_VERSION,
+  NOWCOMM_LOG_REJECT_CONTENTS     // The message's decode() refused it
+};
+
+
+enum NowComm_LogDiscovery : uint16_t {
+  NOWCOMM_LOG_DISCOVERY_NEW,      // From a station we will pair with
+  NOWCOMM_LOG_DISCOVERY_KNOWN,    // From a peer we already have
+  NOWCOMM_LOG_DISCOVERY_CLOSED,   // Discovery is closed
+  NOWCOMM_LOG_DISCOVERY_MODE      // From a station of our own mode
+};
+
+
+enum NowComm_LogHop : uint16_t {
+  NOWCOMM_LOG_HOP_START,          // Decided, or told, to hop to channel
+  NOWCOMM_LOG_HOP_SWITCH,
+  NOWCOMM_LOG_HOP_ABORT,          // A receiver didn't confirm
+  NOWCOMM_LOG_HOP_REVERT          // The peer wasn't heard on the new channel
+};
+
+
+enum NowComm_LogPeer : uint16_t {
+  NOWCOMM_LOG_PEER_ADDED,         // Registered with the transport
+  NOWCOMM_LOG_PEER_ADD_FAILED,
+  NOWCOMM_LOG_PEER_DELETED,
+  NOWCOMM_LOG_PEER_DELETE_FAILED,
+  NOWCOMM_LOG_PEER_TABLE_FULL     // NOWCOMM_MAX_PEERS already
+};
+
+
+enum NowComm_LogError : uint16_t {
+  NOWCOMM_LOG_ERROR_INIT,         // The transport didn't come up
+  NOWCOMM_LOG_ERROR_NOT_BEGUN,    // Called before begin()
+  NOWCOMM_LOG_ERROR_CHANNEL       // The radio refused the channel
+};
+
+
+typedef struct NowComm_LogRecord {
+  uint32_t      us;
+  uint8_t       event;
+  uint8_t       a;
+  uint16_t      b;
+  uint32_t      c;
+} NowComm_LogRecord;
+
+
+// The usual c: a frame's length and the peer it went to or came from.
+//
+inline uint32_t nowcomm_log_peer(const uint8_t* mac, int len = 0) {
+  return ((uint32_t)(len & 0xFF) << 24) | ((uint32_t)mac[3] << 16) | ((uint32_t)mac[4] << 8) | mac[5];
+}
+
+
+class NowCommLog {
+  public:
+    NowCommLog();
+    void                  enable(bool on)   { enabled.store(on, std::memory_order_relaxed); }
+    bool                  is_enabled()      { return enabled.load(std::memory_order_relaxed); }
+    bool                  add(uint8_t event, uint8_t a = 0, uint16_t b = 0, uint32_t c = 0);  // Any context; false if full
+    bool                  pop(NowComm_LogRecord& record);                  // One consumer at a time
+    template <class Out> uint16_t drain(Out& out, uint16_t max = NOWCOMM_LOG_DEPTH);   // Framed; returns records written
+    uint32_t              get_logged()      { return logged.load(std::memory_order_relaxed); }
+    uint32_t              get_dropped()     { return dropped.load(std::memory_order_relaxed); }
+    static void           encode(const NowComm_LogRecord& record, uint8_t* frame);     // NOWCOMM_LOG_FRAME_SIZE bytes
+#ifdef ARDUINO
+    bool                  start(uint16_t period_ms = 20, uint8_t core = 0);            // Drain to Serial from a task
+#endif
+  private:
+    struct Slot {
+      std::atomic<uint32_t> seq;                  // Position it is free for; that plus one once written
+      NowComm_LogRecord   record;
+    };
+    Slot                  slots[NOWCOMM_LOG_DEPTH];
+    std::atomic<uint32_t> head;                   // Next position to claim
+    uint32_t              tail              = 0;  // Next position to read; the consumer's own
+    std::atomic<bool>     enabled;
+    std::atomic<uint32_t> logged;
+    std::atomic<uint32_t> dropped;
+    uint32_t              dropped_reported  = 0;
+#ifdef ARDUINO
+    TickType_t            period            = 1;
+    static void           task(void* self);
+#endif
+};
+
+
+// The one log every NowComm writes to.
+//
+inline NowCommLog& nowcomm_log() {
+  static NowCommLog instance;
+  return instance;
+}
+
+
+#define NOWCOMM_TRACE(...)  do { if(nowcomm_log().is_enabled()) nowcomm_log().add(__VA_ARGS__); } while(0)
+
+
+inline NowCommLog::NowCommLog() : head(0), enabled(false), logged(0), dropped(0) {
+  for(uint32_t i = 0; i < NOWCOMM_LOG_DEPTH; i++) slots[i].seq.store(i, std::memory_order_relaxed);
+}
+
+
+// Claim a position, fill its slot, then publish it. Any number of producers, on either core; a slot
+// the consumer hasn't read yet means the ring is full.
+//
+inline bool NowCommLog::add(uint8_t event, uint8_t a, uint16_t b, uint32_t c) {
+  uint32_t pos = head.load(std::memory_order_relaxed);
+  Slot*    slot;
+  for(;;) {
+    slot = &slots[pos & (NOWCOMM_LOG_DEPTH - 1)];
+    int32_t diff = (int32_t)(slot->seq.load(std::memory_order_acquire) - pos);
+    if(0 == diff) {
+      if(head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+    }
+    else if(0 > diff) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    else pos = head.load(std::memory_order_relaxed);
+  }
+  slot->record.us     = (uint32_t)micros();
+  slot->record.event  = event;
+  slot->record.a      = a;
+  slot->record.b      = b;
+  slot->record.c      = c;
+  slot->seq.store(pos + 1, std::memory_order_release);
+  logged.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+
+// The oldest record, if it has been written. A record still being written holds up the ones after it.
+//
+inline bool NowCommLog::pop(NowComm_LogRecord& record) {
+  Slot& slot = slots[tail & (NOWCOMM_LOG_DEPTH - 1)];
+  if(slot.seq.load(std::memory_order_acquire) != tail + 1) return false;
+  record = slot.record;
+  slot.seq.store(tail + NOWCOMM_LOG_DEPTH, std::memory_order_release);
+  tail++;
+  return true;
+}
+
+
+// Write up to max records to out, which needs write(const uint8_t*, size_t), then a NOWCOMM_LOG_DROPPED
+// record if any were lost since the last drain.
+//
+template <class Out> uint16_t NowCommLog::drain(Out& out, uint16_t max) {
+  NowComm_LogRecord record;
+  uint8_t           frame[NOWCOMM_LOG_FRAME_SIZE];
+  uint16_t          count = 0;
+  while(count < max && pop(record)) {
+    encode(record, frame);
+    out.write(frame, sizeof(frame));
+    count++;
+  }
+  uint32_t lost = get_dropped();
+  if(lost != dropped_reported) {
+    record = { (uint32_t)micros(), NOWCOMM_LOG_DROPPED, 0, 0, lost - dropped_reported };
+    encode(record, frame);
+    out.write(frame, sizeof(frame));
+    dropped_reported = lost;
+  }
+  return count;
+}
+
+
+inline void NowCommLog::encode(const NowComm_LogRecord& record, uint8_t* frame) {
+  frame[0] = NOWCOMM_LOG_SYNC0;
+  frame[1] = NOWCOMM_LOG_SYNC1;
+  uint8_t* r = frame + 2;
+  wire_put_u16(r + 0, (uint16_t)record.us);
+  wire_put_u16(r + 2, (uint16_t)(record.us >> 16));
+  r[4] = record.event;
+  r[5] = record.a;
+  wire_put_u16(r + 6, record.b);
+  wire_put_u16(r + 8, (uint16_t)record.c);
+  wire_put_u16(r + 10, (uint16_t)(record.c >> 16));
+  uint8_t sum = 0;
+  for(int i = 0; i < NOWCOMM_LOG_RECORD_SIZE; i++) sum += r[i];
+  frame[2 + NOWCOMM_LOG_RECORD_SIZE] = sum;
+}
+
+
+#ifdef ARDUINO
+// Drain from a task at idle priority plus one, beside the WiFi stack's core by default, so Serial
+// never holds up loop() or the radio.
+//
+inline bool NowCommLog::start(uint16_t period_ms, uint8_t core) {
+  period = pdMS_TO_TICKS(period_ms);
+  if(0 == period) period = 1;
+  return pdPASS == xTaskCreatePinnedToCore(task, "nowcomm_log", 2048, this, 1, nullptr, core);
+}
+
+
+inline void NowCommLog::task(void* self) {
+  NowCommLog* log  = (NowCommLog*)self;
+  TickType_t  wake = xTaskGetTickCount();
+  for(;;) {
+    log->drain(Serial);
+    vTaskDelayUntil(&wake, log->period);
+  }
+}
+#endif
+
+
+// Splits a byte stream back into records and the text between them. A frame is only taken if its
+// checksum matches; otherwise its first byte is text and the search moves on.
+//
+class NowCommLogDecoder {
+  public:
+    template <class OnRecord, class OnText> void put(const uint8_t* data, size_t len, OnRecord&& on_record, OnText&& on_text);
+    template <class OnText> void finish(OnText&& on_text);     // At the end of the stream: what's held is text
+    uint32_t              get_records()     { return records; }
+  private:
+    uint8_t               buffer[NOWCOMM_LOG_FRAME_SIZE];
+    uint8_t               held              = 0;
+    uint32_t              records           = 0;
+    bool                  parse(NowComm_LogRecord& record);
+};
+
+
+// on_record(const NowComm_LogRecord&) for each frame, on_text(uint8_t) for every other byte, in order.
+//
+template <class OnRecord, class OnText> void NowCommLogDecoder::put(const uint8_t* data, size_t len, OnRecord&& on_record, OnText&& on_text) {
+  NowComm_LogRecord record;
+  for(size_t i = 0; i < len; i++) {
+    buffer[held++] = data[i];
+    while(held) {
+      bool start = NOWCOMM_LOG_SYNC0 == buffer[0] && (1 == held || NOWCOMM_LOG_SYNC1 == buffer[1]);
+      if(start && NOWCOMM_LOG_FRAME_SIZE > held) break;
+      if(start && parse(record)) {
+        held = 0;
+        records++;
+        on_record(record);
+        break;
+      }
+      on_text(buffer[0]);
+      memmove(buffer, buffer + 1, --held);
+    }
+  }
+}
+
+
+template <class OnText> void NowCommLogDecoder::finish(OnText&& on_text) {
+  for(uint8_t i = 0; i < held; i++) on_text(buffer[i]);
+  held = 0;
+}
+
+
+inline bool NowCommLogDecoder::parse(NowComm_LogRecord& record) {
+  const uint8_t* r = buffer + 2;
+  uint8_t sum = 0;
+  for(int i = 0; i < NOWCOMM_LOG_RECORD_SIZE; i++) sum += r[i];
+  if(sum != buffer[2 + NOWCOMM_LOG_RECORD_SIZE]) return false;
+  record.us     = wire_get_u16(r + 0) | ((uint32_t)wire_get_u16(r + 2) << 16);
+  record.event  = r[4];
+  record.a      = r[5];
+  record.b      = wire_get_u16(r + 6);
+  record.c      = wire_get_u16(r + 8) | ((uint32_t)wire_get_u16(r + 10) << 16);
+  return true;
+}
+
+
+// One record as a line of text, without the newline. Returns what snprintf() does.
+//
+inline int nowcomm_log_format(const NowComm_LogRecord& record, char* text, size_t size) {
+  static const char* const kinds[]    = { "NONE", "COMMAND", "RESPONSE", "DISCOVERY", "MULTIPLEX", "HOP", "STREAM", "STREAM_ACK", "REDUNDANT" };
+  static const char* const rejects[]  = { "kind", "size", "version", "contents" };
+  static const char* const outcomes[] = { "new", "known", "closed", "same mode" };
+  static const char* const hops[]     = { "start", "switch", "abort", "revert" };
+  static const char* const peers[]    = { "added", "ADD FAILED", "deleted", "DELETE FAILED", "TABLE FULL" };
+  static const char* const errors[]   = { "the transport didn't start", "called before begin()", "the radio refused channel" };
+  char          kind[12];
+  char          peer[16];
+  uint8_t       k     = record.a & NOWCOMM_KIND_MAX;
+  unsigned      len   = record.c >> 24;
+  unsigned long us    = record.us;
+  if(NOWCOMM_KIND_REDUNDANT >= k)  snprintf(kind, sizeof(kind), "%s", kinds[k]);
+  else                             snprintf(kind, sizeof(kind), "kind %u", k);
+  snprintf(peer, sizeof(peer), "%02X:%02X:%02X", (unsigned)(record.c >> 16) & 0xFF, (unsigned)(record.c >> 8) & 0xFF, (unsigned)record.c & 0xFF);
+  int n = snprintf(text, size, "%6lu.%06lu  ", us / 1000000, us % 1000000);
+  if(0 > n || (size_t)n >= size) return n;
+  text += n;
+  size -= n;
+  switch(record.event) {
+    case NOWCOMM_LOG_TX:
+      return n + snprintf(text, size, "TX        %-9s seq %5u  %2u bytes to ..%s%s", kind, record.b, len, peer, (record.a & 0x80) ? "  REFUSED" : "");
+    case NOWCOMM_LOG_TX_STATUS:
+      return n + snprintf(text, size, "TX_STATUS %s to ..%s", record.a ? "delivered" : "FAILED", peer);
+    case NOWCOMM_LOG_RX:
+      return n + snprintf(text, size, "RX        %-9s seq %5u  %2u bytes from ..%s", kind, record.b, len, peer);
+    case NOWCOMM_LOG_RX_DUPLICATE:
+      return n + snprintf(text, size, "RX_DUP    %-9s seq %5u  %2u bytes from ..%s", kind, record.b, len, peer);
+    case NOWCOMM_LOG_RX_REJECTED:
+      return n + snprintf(text, size, "RX_REJECT %-9s (%s)  %2u bytes from ..%s", kind, 3 >= record.b ? rejects[record.b] : "?", len, peer);
+    case NOWCOMM_LOG_RX_OVERRUN:
+      return n + snprintf(text, size, "RX_OVERRUN %-8s seq %5u  %2u bytes from ..%s", kind, record.b, len, peer);
+    case NOWCOMM_LOG_RX_RECOVERED:
+      return n + snprintf(text, size, "RX_RECOV  %-9s seq %5u  %2u bytes from ..%s", kind, record.b, len, peer);
+    case NOWCOMM_LOG_DISCOVERY:
+      return n + snprintf(text, size, "DISCOVERY from ..%s, a %s: %s", peer, record.a ? "receiver" : "controller", 3 >= record.b ? outcomes[record.b] : "?");
+    case NOWCOMM_LOG_PAIRED:
+      return n + snprintf(text, size, "PAIRED    with ..%s on channel %u, %u peers", peer, record.a, record.b);
+    case NOWCOMM_LOG_SCAN:
+      return n + snprintf(text, size, "SCAN      channel %u", record.a);
+    case NOWCOMM_LOG_HOP:
+      return n + snprintf(text, size, "HOP       %s, channel %u", 3 >= record.b ? hops[record.b] : "?", record.a);
+    case NOWCOMM_LOG_PEER:
+      return n + snprintf(text, size, "PEER      ..%s %s, channel %u", peer, 4 >= record.b ? peers[record.b] : "?", record.a);
+    case NOWCOMM_LOG_ERROR:
+      if(NOWCOMM_LOG_ERROR_CHANNEL == record.b) return n + snprintf(text, size, "ERROR     %s %u", errors[record.b], record.a);
+      return n + snprintf(text, size, "ERROR     %s", 2 >= record.b ? errors[record.b] : "?");
+    case NOWCOMM_LOG_DROPPED:
+      return n + snprintf(text, size, "DROPPED   %lu records: the log was full", (unsigned long)record.c);
+    default:
+      return n + snprintf(text, size, "EVENT %-3u a %u  b %u  c %lu", record.event, record.a, record.b, (unsigned long)record.c);
+  }
+}
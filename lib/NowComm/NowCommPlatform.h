@@ -0,0 +1,95 @@
+#pragma once
+// Platform shims for NowComm.
+// On the M5StickC this simply pulls in Arduino. On a host (the PlatformIO native environment)
+// it supplies the handful of Arduino calls NowComm and BugComm use, so the protocol code
+// can be compiled, measured and exercised on Linux without touching it.
+
+#ifdef ARDUINO
+
+#include <Arduino.h>
+
+inline uint32_t nowcomm_random() { return esp_random(); }
+
+#else
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <chrono>
+#include <thread>
+
+
+// A host can run NowComm on a clock of its own, a simulator's say, by setting one here. micros() and
+// millis() read it instead of the steady clock until it is set back to nullptr. Nothing in NowComm
+// waits on the clock, so only the caller's own delay()s need to know.
+//
+typedef unsigned long (*NowComm_Clock)();
+
+inline NowComm_Clock& nowcomm_clock() {
+  static NowComm_Clock clock = nullptr;
+  return clock;
+}
+
+
+// Microseconds since the first call, like the Arduino clock.
+//
+inline unsigned long micros() {
+  static const auto start = std::chrono::steady_clock::now();
+  if(nowcomm_clock()) return nowcomm_clock()();
+  return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+inline unsigned long millis()                { return micros() / 1000; }
+inline void          delay(unsigned long ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+
+
+// Cheap per-thread xorshift, seeded from the clock; esp_random() stands in for it on the M5StickC.
+// nowcomm_seed() makes the calling thread's sequence repeatable, for a simulation.
+//
+inline uint32_t& nowcomm_random_state() {
+  static thread_local uint32_t state = (uint32_t)std::chrono::steady_clock::now().time_since_epoch().count() | 1;
+  return state;
+}
+
+
+inline void nowcomm_seed(uint32_t seed) { nowcomm_random_state() = seed | 1; }
+
+
+inline uint32_t nowcomm_random() {
+  uint32_t& state = nowcomm_random_state();
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+
+// Diagnostic output goes to stderr so benchmark results on stdout stay clean.
+//
+class HostSerial {
+  public:
+    void print(const char* s)   { fputs(s, stderr); }
+    void println(const char* s) { fputs(s, stderr); fputc('\n', stderr); }
+    void println()              { fputc('\n', stderr); }
+    int  printf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+      va_list args;
+      va_start(args, fmt);
+      int result = vfprintf(stderr, fmt, args);
+      va_end(args);
+      return result;
+    }
+};
+
+inline HostSerial Serial;
+
+#endif
+
+
+// Transport callbacks. A transport calls these when a frame arrives or a send completes.
+// context is the object that registered them (normally a NowComm instance).
+//
+typedef void (*NowComm_Recv_Cb)(void* context, const uint8_t* mac, const uint8_t* data, int len);
+typedef void (*NowComm_Sent_Cb)(void* context, const uint8_t* mac, bool success);
@@ -0,0 +1,68 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+
+
+// A fixed-capacity, allocation-free, single-producer/single-consumer ring.
+// The producer (the radio callback) calls push(); the consumer (loop()) calls pop().
+// Neither blocks. When the ring is full push() fails and the overrun is counted, so
+// lost packets are visible instead of silently overwritten.
+// N must be a power of two; one slot is never used, so N - 1 entries fit.
+//
+template <class T, uint16_t N>
+class NowCommRing {
+  static_assert(N >= 2 && 0 == (N & (N - 1)), "NowCommRing size must be a power of two");
+  public:
+    bool                    push(const T& item);          // Producer only
+    bool                    pop(T& item);                 // Consumer only
+    T*                      peek();                       // Consumer only: the next item, or nullptr
+    void                    drop();                       // Consumer only: discard the next item
+    bool                    is_empty()                    { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+    uint16_t                get_count()                   { return (head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire)) & (N - 1); }
+    uint16_t                get_capacity()                { return N - 1; }
+    uint32_t                get_pushed()                  { return pushed.load(std::memory_order_relaxed);   }
+    uint32_t                get_overruns()                { return overruns.load(std::memory_order_relaxed); }
+  private:
+    T                       slots[N];
+    std::atomic<uint16_t>   head{0};                      // Written by the producer
+    std::atomic<uint16_t>   tail{0};                      // Written by the consumer
+    std::atomic<uint32_t>   pushed{0};
+    std::atomic<uint32_t>   overruns{0};
+};
+
+
+template <class T, uint16_t N> bool NowCommRing<T, N>::push(const T& item) {
+  uint16_t h    = head.load(std::memory_order_relaxed);
+  uint16_t next = (h + 1) & (N - 1);
+  if(next == tail.load(std::memory_order_acquire)) {
+    overruns.store(overruns.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    return false;
+  }
+  slots[h] = item;
+  head.store(next, std::memory_order_release);
+  pushed.store(pushed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  return true;
+}
+
+
+template <class T, uint16_t N> bool NowCommRing<T, N>::pop(T& item) {
+  T* next = peek();
+  if(nullptr == next) return false;
+  item = *next;
+  drop();
+  return true;
+}
+
+
+template <class T, uint16_t N> T* NowCommRing<T, N>::peek() {
+  uint16_t t = tail.load(std::memory_order_relaxed);
+  if(t == head.load(std::memory_order_acquire)) return nullptr;
+  return &slots[t];
+}
+
+
+template <class T, uint16_t N> void NowCommRing<T, N>::drop() {
+  uint16_t t = tail.load(std::memory_order_relaxed);
+  if(t == head.load(std::memory_order_acquire)) return;
+  tail.store((t + 1) & (N - 1), std::memory_order_release);
+}
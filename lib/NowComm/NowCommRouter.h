@@ -0,0 +1,147 @@
+#pragma once
+#include "NowCommPlatform.h"
+#include "NowCommWire.h"
+#include <atomic>
+
+// Routes what a radio receives to the NowComm sessions sharing it, so several can run side by side:
+// a control link and a telemetry link, say, each a NowComm of its own. A transport attaches a session
+// in init() and detaches it when destroyed; the radio is identified by its MAC address.
+// A received frame goes to:
+//   - for a response, the session whose number is in the top bits of the seq it echoes;
+//   - for discovery, every session that accepts it, since any of them may be pairing with the sender;
+//   - otherwise, the sessions that accept its kind (for a multiplexed or redundant frame,
+//     the kind inside) and have the sender as a peer;
+//   - failing that, every session that accepts the kind: a station nobody has paired with yet;
+//   - failing that, every session on the radio, each of which rejects it and counts it.
+// A send status goes to the sessions that have the destination as a peer.
+// The table is fixed-size and lock-free. Nothing allocates; route() reads a few entries and is
+// safe in any radio callback.
+
+#ifndef NOWCOMM_MAX_SESSIONS
+#ifdef ARDUINO
+#define NOWCOMM_MAX_SESSIONS    4         // Over all radios
+#else
+#define NOWCOMM_MAX_SESSIONS    16        // Host benchmarks put many devices in one process
+#endif
+#endif
+#define NOWCOMM_RADIO_SESSIONS  (1 << NOWCOMM_SESSION_BITS)   // On one radio
+
+static_assert(32 >= NOWCOMM_MAX_SESSIONS, "route() returns the sessions as a 32-bit mask");
+
+
+// True if mac is one of the session's peers. Called from the radio callback.
+//
+typedef bool (*NowComm_Claim_Cb)(void* context, const uint8_t* mac);
+
+
+// What a NowComm gives its transport's init(). attach() fills in id.
+//
+typedef struct NowComm_Session {
+  void*             context   = nullptr;
+  NowComm_Recv_Cb   recv_cb   = nullptr;
+  NowComm_Sent_Cb   sent_cb   = nullptr;
+  NowComm_Claim_Cb  claims    = nullptr;
+  uint32_t          kinds     = 0;        // Bit n: accepts NowComm_Kind n
+  uint8_t           id        = 0;        // The session's number on its radio, 0 to NOWCOMM_RADIO_SESSIONS - 1
+} NowComm_Session;
+
+
+class NowCommRouter {
+  public:
+    static int8_t         attach(const uint8_t* radio, NowComm_Session& session);  // Table index, or -1 if full
+    static void           detach(int8_t slot);
+    static uint32_t       route(const uint8_t* radio, const uint8_t* mac, const uint8_t* data, int len);   // Bit n: slot n
+    static void           deliver(uint32_t slots, const uint8_t* mac, const uint8_t* data, int len);
+    static void           receive(const uint8_t* radio, const uint8_t* mac, const uint8_t* data, int len) { deliver(route(radio, mac, data, len), mac, data, len); }
+    static void           sent(const uint8_t* radio, const uint8_t* mac, bool success);
+  private:
+    enum State : uint8_t { SLOT_FREE, SLOT_CLAIMED, SLOT_ACTIVE };
+    struct Entry {
+      std::atomic<uint8_t> state;
+      uint8_t             radio[6];
+      NowComm_Session     session;
+    };
+    static Entry*         table();
+    static bool           on_radio(Entry& entry, const uint8_t* radio) {
+      return SLOT_ACTIVE == entry.state.load(std::memory_order_acquire) && 0 == memcmp(entry.radio, radio, 6);
+    }
+};
+
+
+inline NowCommRouter::Entry* NowCommRouter::table() {
+  static Entry entries[NOWCOMM_MAX_SESSIONS];
+  return entries;
+}
+
+
+// Take a free entry, and the lowest session number not in use on this radio. The entry is filled in
+// before it is published, so route() never sees a partial one.
+//
+inline int8_t NowCommRouter::attach(const uint8_t* radio, NowComm_Session& session) {
+  Entry*  t     = table();
+  uint8_t used  = 0;
+  for(int i = 0; i < NOWCOMM_MAX_SESSIONS; i++) {
+    if(on_radio(t[i], radio)) used |= 1 << t[i].session.id;
+  }
+  uint8_t id = 0;
+  while(id < NOWCOMM_RADIO_SESSIONS && (used & (1 << id))) id++;
+  if(NOWCOMM_RADIO_SESSIONS <= id) return -1;
+  for(int i = 0; i < NOWCOMM_MAX_SESSIONS; i++) {
+    uint8_t expected = SLOT_FREE;
+    if(!t[i].state.compare_exchange_strong(expected, SLOT_CLAIMED, std::memory_order_acq_rel)) continue;
+    session.id = id;
+    memcpy(t[i].radio, radio, 6);
+    t[i].session = session;
+    t[i].state.store(SLOT_ACTIVE, std::memory_order_release);
+    return i;
+  }
+  return -1;
+}
+
+
+inline void NowCommRouter::detach(int8_t slot) {
+  if(0 <= slot && NOWCOMM_MAX_SESSIONS > slot) table()[slot].state.store(SLOT_FREE, std::memory_order_release);
+}
+
+
+inline uint32_t NowCommRouter::route(const uint8_t* radio, const uint8_t* mac, const uint8_t* data, int len) {
+  if(NOWCOMM_HEADER_SIZE > len) return 0;
+  Entry*    t       = table();
+  uint8_t   kind    = nowcomm_header_kind(data[0]);
+  uint32_t  slots   = 0;
+  if(NOWCOMM_KIND_RESPONSE == kind && NOWCOMM_HEADER_SIZE + 2 <= len) {
+    uint8_t id = wire_get_u16(data + NOWCOMM_HEADER_SIZE) >> NOWCOMM_SEQ_BITS;   // ack_seq
+    for(int i = 0; i < NOWCOMM_MAX_SESSIONS; i++) {
+      if(on_radio(t[i], radio) && id == t[i].session.id) return 1UL << i;
+    }
+  }
+  bool      discovery = NOWCOMM_KIND_DISCOVERY == kind;
+  if(NOWCOMM_KIND_MULTIPLEX == kind || NOWCOMM_KIND_REDUNDANT == kind) kind = (NOWCOMM_HEADER_SIZE < len) ? data[NOWCOMM_HEADER_SIZE] & NOWCOMM_KIND_MAX : NOWCOMM_KIND_NONE;
+  uint32_t  bit       = 1UL << kind;
+  uint32_t  accepting = 0;
+  uint32_t  everyone  = 0;
+  for(int i = 0; i < NOWCOMM_MAX_SESSIONS; i++) {
+    if(!on_radio(t[i], radio)) continue;
+    everyone |= 1UL << i;
+    if(0 == (t[i].session.kinds & bit)) continue;
+    accepting |= 1UL << i;
+    if(!discovery && t[i].session.claims(t[i].session.context, mac)) slots |= 1UL << i;
+  }
+  return slots ? slots : accepting ? accepting : everyone;
+}
+
+
+inline void NowCommRouter::deliver(uint32_t slots, const uint8_t* mac, const uint8_t* data, int len) {
+  Entry* t = table();
+  for(int i = 0; slots; i++, slots >>= 1) {
+    if((slots & 1) && SLOT_ACTIVE == t[i].state.load(std::memory_order_acquire)) t[i].session.recv_cb(t[i].session.context, mac, data, len);
+  }
+}
+
+
+inline void NowCommRouter::sent(const uint8_t* radio, const uint8_t* mac, bool success) {
+  Entry* t = table();
+  for(int i = 0; i < NOWCOMM_MAX_SESSIONS; i++) {
+    if(on_radio(t[i], radio) && t[i].session.claims(t[i].session.context, mac)) t[i].session.sent_cb(t[i].session.context, mac, success);
+  }
+}
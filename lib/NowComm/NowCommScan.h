@@ -0,0 +1,98 @@
+#pragma once
+#include "NowCommPlatform.h"
+
+// Channel scanning for automatic pairing.
+// The controller sweeps the channels, spending NOWCOMM_SCAN_SLOT_US on each and sending
+// NOWCOMM_SCAN_BURSTS discovery frames there, each after a random backoff so controllers and
+// receivers don't fall into step. A receiver dwells on one channel for a whole sweep plus a slot,
+// so a complete controller slot always falls within its dwell, then moves on. Either side locks to a
+// channel once it has paired there.
+
+#define NOWCOMM_CHANNEL_AUTO    0         // Pass to begin() to scan instead of using a fixed channel
+#define NOWCOMM_SCAN_FIRST      1
+#ifndef NOWCOMM_SCAN_LAST
+#define NOWCOMM_SCAN_LAST       13        // Set for the country in build_flags: 11 in North America, 14 only in Japan
+#endif
+#define NOWCOMM_SCAN_SLOT_US    8000UL    // Controller time per channel per sweep
+#define NOWCOMM_SCAN_BURSTS     3         // Discovery frames per slot
+#define NOWCOMM_SCAN_BACKOFF_US 1500UL    // Up to this much random delay before each one
+#define NOWCOMM_SCAN_CHANNELS   (NOWCOMM_SCAN_LAST - NOWCOMM_SCAN_FIRST + 1)
+#define NOWCOMM_SCAN_SWEEP_US   (NOWCOMM_SCAN_CHANNELS * NOWCOMM_SCAN_SLOT_US)
+#define NOWCOMM_SCAN_DWELL_US   (NOWCOMM_SCAN_SWEEP_US + NOWCOMM_SCAN_SLOT_US)
+#define NOWCOMM_SCAN_SPACING_US (NOWCOMM_SCAN_SLOT_US / (2 * NOWCOMM_SCAN_BURSTS))   // Plus backoff, between bursts
+
+static_assert(NOWCOMM_SCAN_BURSTS * NOWCOMM_SCAN_BACKOFF_US + (NOWCOMM_SCAN_BURSTS - 1) * NOWCOMM_SCAN_SPACING_US < NOWCOMM_SCAN_SLOT_US,
+              "Every burst must go out within a slot, with time left to hear the answer");
+
+
+enum NowComm_ScanAction {
+  NOWCOMM_SCAN_NONE,
+  NOWCOMM_SCAN_HOP,                       // Move to get_channel()
+  NOWCOMM_SCAN_SEND                       // Send a discovery frame
+};
+
+
+// Decides, from the time alone, when to change channel and when to send discovery.
+// A scan started on a fixed channel is locked from the start and only paces discovery.
+//
+class NowCommScan {
+  public:
+    void                  start(bool controller, uint8_t chan, unsigned long now_us);   // chan NOWCOMM_CHANNEL_AUTO to scan
+    void                  lock(uint8_t chan)          { channel = chan; locked = true; }
+    NowComm_ScanAction    poll(unsigned long now_us);
+    void                  skip(unsigned long now_us);                                  // The radio refused get_channel(): start the next slot now
+    uint8_t               get_channel()               { return channel;  }
+    bool                  is_locked()                 { return locked;   }
+    uint32_t              get_hops()                  { return hops;     }
+  private:
+    unsigned long         backoff()                   { return nowcomm_random() % (NOWCOMM_SCAN_BACKOFF_US + 1); }
+    void                  next_slot(unsigned long now_us);
+    bool                  controller      = true;
+    bool                  locked          = true;
+    uint8_t               channel         = NOWCOMM_SCAN_FIRST;
+    uint8_t               bursts          = 0;
+    unsigned long         slot_start      = 0;
+    unsigned long         next_send       = 0;
+    uint32_t              hops            = 0;
+};
+
+
+// Scans begin on a random channel, so a room full of devices doesn't start in step.
+//
+inline void NowCommScan::start(bool is_controller, uint8_t chan, unsigned long now_us) {
+  controller  = is_controller;
+  locked      = NOWCOMM_CHANNEL_AUTO != chan;
+  channel     = locked ? chan : NOWCOMM_SCAN_FIRST + nowcomm_random() % NOWCOMM_SCAN_CHANNELS;
+  bursts      = 0;
+  hops        = 0;
+  slot_start  = now_us;
+  next_send   = now_us + backoff();
+}
+
+
+inline NowComm_ScanAction NowCommScan::poll(unsigned long now_us) {
+  unsigned long slot = controller ? NOWCOMM_SCAN_SLOT_US : NOWCOMM_SCAN_DWELL_US;
+  if(!locked && now_us - slot_start >= slot) {
+    next_slot(now_us);
+    return NOWCOMM_SCAN_HOP;
+  }
+  if(!controller || (long)(now_us - next_send) < 0) return NOWCOMM_SCAN_NONE;
+  if(!locked && NOWCOMM_SCAN_BURSTS <= bursts)       return NOWCOMM_SCAN_NONE;   // Listen out the rest of the slot
+  bursts++;
+  next_send = now_us + (locked ? NOWCOMM_SCAN_SLOT_US : NOWCOMM_SCAN_SPACING_US) + backoff();   // Locked: one per slot
+  return NOWCOMM_SCAN_SEND;
+}
+
+
+inline void NowCommScan::skip(unsigned long now_us) {
+  if(!locked) next_slot(now_us);
+}
+
+
+inline void NowCommScan::next_slot(unsigned long now_us) {
+  channel     = (NOWCOMM_SCAN_LAST == channel) ? NOWCOMM_SCAN_FIRST : channel + 1;
+  bursts      = 0;
+  slot_start  = now_us;
+  next_send   = now_us + backoff();
+  hops++;
+}
@@ -0,0 +1,208 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+// Link statistics: which acknowledged frames got their response, and how long it took.
+// Everything is fixed-size and allocation-free. The send and response sides both run in loop(), so none
+// of it needs to be shared with the radio callback.
+
+#define NOWCOMM_ACK_WINDOW      32        // Frames awaiting a response (power of two)
+#define NOWCOMM_ACK_TIMEOUT_US  250000UL  // A frame with no response after this long is counted lost
+#define NOWCOMM_RTT_SUB_BITS    3         // Histogram buckets per power of two: 1 << this, so within 12.5%
+#define NOWCOMM_RTT_BUCKETS     ((33 - NOWCOMM_RTT_SUB_BITS) << NOWCOMM_RTT_SUB_BITS)
+
+
+typedef struct NowComm_LinkStats {
+  uint32_t  sent;                         // Frames that ask for a response
+  uint32_t  acked;                        // ...that got one
+  uint32_t  lost;                         // ...that didn't within NOWCOMM_ACK_TIMEOUT_US
+  uint32_t  pending;                      // ...still waiting
+  uint32_t  duplicated;                   // Responses to frames already answered, and repeated frames received
+  uint32_t  tx_failed;                    // Frames the transport reported undelivered
+  uint32_t  recovered;                    // Frames received missed, then taken from a copy in a later one
+  uint32_t  rtt_p50_us;                   // Round trip, frame sent to response received
+  uint32_t  rtt_p99_us;
+  uint32_t  rtt_max_us;
+} NowComm_LinkStats;
+
+
+// Round-trip times in log-linear buckets: exact below 1 << NOWCOMM_RTT_SUB_BITS us, then
+// 1 << NOWCOMM_RTT_SUB_BITS buckets per power of two up to the full 32 bits.
+//
+class NowCommRttHistogram {
+  public:
+    void            add(uint32_t us)              { counts[bucket(us)]++; total++; if(us > max_us) max_us = us; }
+    uint32_t        percentile(uint8_t pct);      // Midpoint of the bucket holding the pct'th percentile; 0 if empty
+    uint32_t        get_count()                   { return total;  }
+    uint32_t        get_max()                     { return max_us; }
+    void            reset()                       { memset(counts, 0, sizeof(counts)); total = 0; max_us = 0; }
+    static uint16_t bucket(uint32_t us);
+    static uint32_t bucket_low(uint16_t b);
+  private:
+    uint32_t        counts[NOWCOMM_RTT_BUCKETS]   = { 0 };
+    uint32_t        total                         = 0;
+    uint32_t        max_us                        = 0;
+};
+
+
+inline uint16_t NowCommRttHistogram::bucket(uint32_t us) {
+  const uint32_t sub = 1UL << NOWCOMM_RTT_SUB_BITS;
+  if(us < sub) return (uint16_t)us;
+  uint8_t e = 31 - __builtin_clz(us);               // e >= NOWCOMM_RTT_SUB_BITS
+  return (uint16_t)(((e - NOWCOMM_RTT_SUB_BITS + 1) << NOWCOMM_RTT_SUB_BITS) | ((us >> (e - NOWCOMM_RTT_SUB_BITS)) & (sub - 1)));
+}
+
+
+inline uint32_t NowCommRttHistogram::bucket_low(uint16_t b) {
+  const uint32_t sub = 1UL << NOWCOMM_RTT_SUB_BITS;
+  if(b < sub) return b;
+  uint8_t e = (b >> NOWCOMM_RTT_SUB_BITS) + NOWCOMM_RTT_SUB_BITS - 1;
+  return (sub | (b & (sub - 1))) << (e - NOWCOMM_RTT_SUB_BITS);
+}
+
+
+inline uint32_t NowCommRttHistogram::percentile(uint8_t pct) {
+  if(0 == total) return 0;
+  uint32_t rank = (uint32_t)(((uint64_t)total * pct + 99) / 100);
+  if(0 == rank) rank = 1;
+  uint32_t seen = 0;
+  for(uint16_t b = 0; b < NOWCOMM_RTT_BUCKETS; b++) {
+    seen += counts[b];
+    if(seen < rank) continue;
+    uint32_t low  = bucket_low(b);
+    uint32_t high = (b + 1 < NOWCOMM_RTT_BUCKETS) ? bucket_low(b + 1) : 0xFFFFFFFFUL;
+    uint32_t mid  = low + (high - low) / 2;
+    return mid < max_us ? mid : max_us;
+  }
+  return max_us;
+}
+
+
+// Frames sent that are waiting for their response, indexed by sequence number.
+// A response is matched by the sequence number it echoes. A slot that is reused, or found
+// older than NOWCOMM_ACK_TIMEOUT_US by expire(), counts as lost; a response that turns up after
+// that is still counted, and takes the frame back out of lost.
+// Each frame carries the channel it was sent on; on_ack() and expire() pass it to the caller's function
+// for every frame they settle, so loss and round trips can be told apart by channel.
+//
+class NowCommAckTracker {
+  public:
+    void            on_sent(uint16_t seq, uint8_t channel, unsigned long now_us);
+    template <class F> void on_ack(uint16_t seq, unsigned long now_us, F&& on_acked);   // on_acked(channel, rtt_us), if newly answered
+    template <class F> void expire(unsigned long now_us, F&& on_lost);                 // on_lost(channel), for each newly lost
+    void            get_stats(NowComm_LinkStats& stats);
+    void            reset();
+  private:
+    enum State : uint8_t { SLOT_FREE, SLOT_PENDING, SLOT_ACKED, SLOT_LOST };
+    struct Slot {
+      uint16_t      seq;
+      State         state;
+      uint8_t       channel;
+      unsigned long sent_us;
+    };
+    Slot                  slots[NOWCOMM_ACK_WINDOW]   = {};
+    NowCommRttHistogram   rtt;
+    uint32_t              sent                        = 0;
+    uint32_t              acked                       = 0;
+    uint32_t              lost                        = 0;
+    uint32_t              duplicated                  = 0;
+};
+
+
+inline void NowCommAckTracker::on_sent(uint16_t seq, uint8_t channel, unsigned long now_us) {
+  Slot& slot = slots[seq & (NOWCOMM_ACK_WINDOW - 1)];
+  if(SLOT_PENDING == slot.state) lost++;
+  slot.seq      = seq;
+  slot.state    = SLOT_PENDING;
+  slot.channel  = channel;
+  slot.sent_us  = now_us;
+  sent++;
+}
+
+
+template <class F> void NowCommAckTracker::on_ack(uint16_t seq, unsigned long now_us, F&& on_acked) {
+  Slot& slot = slots[seq & (NOWCOMM_ACK_WINDOW - 1)];
+  if(slot.seq != seq || SLOT_FREE == slot.state) return;        // Too old to match; nothing to learn from it
+  if(SLOT_ACKED == slot.state) {
+    duplicated++;
+    return;
+  }
+  if(SLOT_LOST == slot.state) lost--;
+  slot.state = SLOT_ACKED;
+  acked++;
+  rtt.add(now_us - slot.sent_us);
+  on_acked(slot.channel, (uint32_t)(now_us - slot.sent_us));
+}
+
+
+template <class F> void NowCommAckTracker::expire(unsigned long now_us, F&& on_lost) {
+  for(Slot& slot : slots) {
+    if(SLOT_PENDING == slot.state && NOWCOMM_ACK_TIMEOUT_US < now_us - slot.sent_us) {
+      slot.state = SLOT_LOST;
+      lost++;
+      on_lost(slot.channel);
+    }
+  }
+}
+
+
+inline void NowCommAckTracker::get_stats(NowComm_LinkStats& stats) {
+  stats.sent        = sent;
+  stats.acked       = acked;
+  stats.lost        = lost;
+  stats.pending     = sent - acked - lost;
+  stats.duplicated  = duplicated;
+  stats.rtt_p50_us  = rtt.percentile(50);
+  stats.rtt_p99_us  = rtt.percentile(99);
+  stats.rtt_max_us  = rtt.get_max();
+}
+
+
+// Start counting again. Frames already in flight are forgotten, so their responses aren't counted.
+//
+inline void NowCommAckTracker::reset() {
+  for(Slot& slot : slots) slot.state = SLOT_FREE;
+  rtt.reset();
+  sent        = 0;
+  acked       = 0;
+  lost        = 0;
+  duplicated  = 0;
+}
+
+
+// How often one sender's frames arrive, and how many of them a gap in its seqs really spans. A sender's
+// seq counts everything it sends, to every peer and of every kind, so a gap is only an upper bound: a
+// controller driving a fleet skips a receiver's seq by the fleet's size with nothing lost. The frames
+// spanned are taken from the time since the last arrival over the interval, and never more than the gap.
+// The interval takes a shorter gap at once and a longer one slowly, so it follows the sender's rate while
+// it is busy, and a pause doesn't stretch it much.
+// The limit: once a sender's frames to this peer come further apart than its interval, a loss can't be
+// told from the gap alone; with one peer and one kind of frame, the gap and the time agree.
+//
+class NowCommCadence {
+  public:
+    uint16_t        spanned(uint16_t ahead, unsigned long rx_us);   // ahead is the seq gap plus 1; returns 1 - ahead
+    uint32_t        get_interval_us()             { return interval_us; }   // 0 until two frames have come
+  private:
+    uint32_t        interval_us                   = 0;
+    unsigned long   last_us                       = 0;
+    bool            valid                         = false;
+};
+
+
+inline uint16_t NowCommCadence::spanned(uint16_t ahead, unsigned long rx_us) {
+  uint32_t elapsed = valid ? (uint32_t)(rx_us - last_us) : 0;
+  uint16_t frames  = 1;
+  if(interval_us && 1 < ahead) {
+    uint32_t spans = (elapsed + interval_us / 2) / interval_us;
+    frames = 1 > spans ? 1 : spans < ahead ? (uint16_t)spans : ahead;
+  }
+  if(valid && 0 < elapsed) {                      // A copy that came in the same frame says nothing of the rate
+    uint32_t per = elapsed / frames;
+    if(0 == interval_us || per < interval_us) interval_us = per;
+    else                                      interval_us += (per - interval_us) / 8;
+  }
+  last_us = rx_us;
+  valid   = true;
+  return frames;
+}
@@ -0,0 +1,377 @@
+#pragma once
+#include "NowComm.h"
+
+// Streams: a buffer of any size, up to NOWCOMM_STREAM_MAX_FRAGMENTS fragments, sent over a NowComm
+// session as a run of numbered fragments, and put back together at the other end. A trim table pushed
+// to a robot, say, or a log pulled back from one.
+// The session's Msgs must include NowComm_StreamData and NowComm_StreamAck; a NowCommStream then sends
+// and receives on it, one stream each way at a time. Give it every message the session receives, with
+// handle() or handle_current(), and call service() from loop().
+// The sender keeps up to a window of fragments in flight. The receiver acknowledges selectively: an ack
+// carries the first fragment it is missing and a bitmap of those it has past that, so the sender resends
+// just the holes. A hole with NOWCOMM_STREAM_DUPACKS fragments received past it is resent at once;
+// otherwise a fragment is resent when its timer runs out, the timeout following the measured round trip.
+// The receiver acks every NOWCOMM_STREAM_ACK_EVERY fragments in order, at once on a hole or a repeat,
+// and after NOWCOMM_STREAM_ACK_DELAY_US otherwise.
+// Nothing allocates. The sender reads the caller's buffer as it goes, so it must stay put until the
+// stream is done; the receiver writes each fragment straight into the caller's buffer, set with
+// set_buffer(). A stream bigger than that buffer is refused, and the sender fails.
+// The window is held below NOWCOMM_RX_DEPTH, so a whole window fits the receiver's queue: past that,
+// the queue overflows on every burst and the stream runs on resends.
+
+#ifndef NOWCOMM_STREAM_WINDOW
+#define NOWCOMM_STREAM_WINDOW       8     // Fragments in flight, by default; held to NOWCOMM_STREAM_WINDOW_MAX
+#endif
+#define NOWCOMM_STREAM_WINDOW_MAX   (32 < NOWCOMM_RX_DEPTH - 1 ? 32 : NOWCOMM_RX_DEPTH - 1)   // The ack's bitmap, and the queue
+#define NOWCOMM_STREAM_FRAGMENT     (NOWCOMM_MAX_FRAME - NOWCOMM_HEADER_SIZE - 7)   // Payload bytes per fragment
+#define NOWCOMM_STREAM_MAX_FRAGMENTS  0xFFFF
+#define NOWCOMM_STREAM_ACK_EVERY    2
+#define NOWCOMM_STREAM_ACK_DELAY_US 5000
+#define NOWCOMM_STREAM_DUPACKS      3
+#define NOWCOMM_STREAM_RTO_US       50000 // Until the first round trip is measured
+#define NOWCOMM_STREAM_RTO_MIN_US   5000
+#define NOWCOMM_STREAM_RTO_MAX_US   500000
+#define NOWCOMM_STREAM_RETRIES      16    // Sends of one fragment before the stream fails
+
+static_assert(1 <= NOWCOMM_STREAM_WINDOW_MAX, "NOWCOMM_RX_DEPTH leaves no room for a stream's window");
+
+
+enum NowComm_StreamStatus : uint8_t {
+  NOWCOMM_STREAM_OK,
+  NOWCOMM_STREAM_NO_ROOM                  // The receiver's buffer is too small, or it has none
+};
+
+
+enum NowComm_StreamState : uint8_t {
+  NOWCOMM_STREAM_IDLE,
+  NOWCOMM_STREAM_BUSY,
+  NOWCOMM_STREAM_DONE,
+  NOWCOMM_STREAM_FAILED
+};
+
+
+// Wire: header, stream, index (LE), total (LE), NOWCOMM_STREAM_FRAGMENT bytes
+// Every fragment is the full size; the last is padded. total is the stream's length in bytes.
+//
+typedef struct NowComm_StreamData {
+  static constexpr NowComm_Kind kind      = NOWCOMM_KIND_STREAM;
+  static constexpr uint8_t      wire_size = NOWCOMM_MAX_FRAME;
+  uint8_t         stream    = 0;
+  uint16_t        index     = 0;
+  uint32_t        total     = 0;
+  uint8_t         data[NOWCOMM_STREAM_FRAGMENT];
+  void            encode(uint8_t* frame) const  { frame[0] = nowcomm_header(kind); frame[3] = stream; wire_put_u16(frame + 4, index);
+                                                  wire_put_u32(frame + 6, total); memcpy(frame + 10, data, NOWCOMM_STREAM_FRAGMENT); }
+  bool            decode(const uint8_t* frame)  { stream = frame[3]; index = wire_get_u16(frame + 4); total = wire_get_u32(frame + 6);
+                                                  memcpy(data, frame + 10, NOWCOMM_STREAM_FRAGMENT);
+                                                  return (uint32_t)index * NOWCOMM_STREAM_FRAGMENT < total &&
+                                                         (uint64_t)NOWCOMM_STREAM_MAX_FRAGMENTS * NOWCOMM_STREAM_FRAGMENT >= total; }
+} NowComm_StreamData;
+
+
+// Wire: header, stream, status, base (LE), received (LE)
+// base is the first fragment the receiver is missing; bit n of received is fragment base + n.
+//
+typedef struct NowComm_StreamAck {
+  static constexpr NowComm_Kind kind      = NOWCOMM_KIND_STREAM_ACK;
+  static constexpr uint8_t      wire_size = NOWCOMM_HEADER_SIZE + 8;
+  uint8_t         stream    = 0;
+  uint8_t         status    = NOWCOMM_STREAM_OK;
+  uint16_t        base      = 0;
+  uint32_t        received  = 0;
+  void            encode(uint8_t* frame) const  { frame[0] = nowcomm_header(kind); frame[3] = stream; frame[4] = status;
+                                                  wire_put_u16(frame + 5, base); wire_put_u32(frame + 7, received); }
+  bool            decode(const uint8_t* frame)  { stream = frame[3]; status = frame[4]; base = wire_get_u16(frame + 5);
+                                                  received = wire_get_u32(frame + 7); return NOWCOMM_STREAM_NO_ROOM >= status; }
+} NowComm_StreamAck;
+
+static_assert(250 == NowComm_StreamData::wire_size, "NowComm_StreamData encoding changed; bump NOWCOMM_VERSION");
+static_assert(11 == NowComm_StreamAck::wire_size,   "NowComm_StreamAck encoding changed; bump NOWCOMM_VERSION");
+
+
+// One direction of a stream. us runs from send() or the first fragment to the last ack or fragment.
+//
+typedef struct NowComm_StreamStats {
+  uint32_t      bytes;                    // The stream's length
+  uint16_t      fragments;
+  uint32_t      frames_sent;              // Sending: fragments, resends included; receiving: acks
+  uint32_t      resent;                   // Sending: on a timeout...
+  uint32_t      fast_resent;              // ...and on a hole in an ack
+  uint32_t      duplicates;               // Receiving: fragments that came again
+  uint32_t      rto_us;                   // Sending: the timeout at the end
+  unsigned long us;
+} NowComm_StreamStats;
+
+
+// Comm is a BasicNowComm whose Msgs include NowComm_StreamData and NowComm_StreamAck.
+//
+template <class Comm>
+class NowCommStream {
+  public:
+    NowCommStream(Comm& comm) : comm(comm), tx_stream((uint8_t)nowcomm_random()) {}
+    void                  set_window(uint8_t fragments) { window = limit_window(fragments); }   // 1 - NOWCOMM_STREAM_WINDOW_MAX
+    uint8_t               get_window()                  { return window; }
+    bool                  send(const uint8_t* data, uint32_t len, uint8_t peer = 0);   // False if a stream is going, len is too big or peer isn't paired
+    void                  cancel()                      { if(NOWCOMM_STREAM_BUSY == tx_state) tx_state = NOWCOMM_STREAM_FAILED; }
+    NowComm_StreamState   get_send_state()              { return tx_state; }
+    void                  set_buffer(uint8_t* buffer, uint32_t size);     // Where a stream received goes; resets the receiving side
+    NowComm_StreamState   get_receive_state()           { return rx_state; }
+    uint32_t              get_received_length()         { return NOWCOMM_STREAM_DONE == rx_state ? rx_total : 0; }
+    bool                  handle(const typename Comm::Message& msg);     // True if msg was the stream's
+    bool                  handle_current();                               // The same, for the message is_data_ready() made current
+    void                  service();                                      // Call from loop(): sends, resends and late acks
+    void                  get_send_stats(NowComm_StreamStats& stats)    { stats = tx_stats; }
+    void                  get_receive_stats(NowComm_StreamStats& stats) { stats = rx_stats; }
+  private:
+    struct Slot {
+      unsigned long       sent_us;
+      uint8_t             sends;
+      bool                acked;
+      bool                fast;           // Resent on an ack's hole since it was last sent
+    };
+    void                  on_data(const NowComm_StreamData& data, const uint8_t* mac);
+    void                  on_ack(const NowComm_StreamAck& ack);
+    void                  send_fragment(uint16_t index, unsigned long now);
+    void                  send_ack(uint8_t status);
+    void                  note_acked(uint16_t index, unsigned long now);
+    static constexpr uint8_t limit_window(unsigned fragments) { return 0 == fragments ? 1 : NOWCOMM_STREAM_WINDOW_MAX < fragments ? NOWCOMM_STREAM_WINDOW_MAX : fragments; }
+    Comm&                 comm;
+    uint8_t               window        = limit_window(NOWCOMM_STREAM_WINDOW);
+    NowComm_StreamData    fragment;                   // Sending; big, so kept here rather than on the stack
+    const uint8_t*        tx_data       = nullptr;
+    uint32_t              tx_total      = 0;
+    uint16_t              tx_count      = 0;          // Fragments
+    uint16_t              tx_base       = 0;          // The first not yet acked
+    uint16_t              tx_next       = 0;          // The first not yet sent
+    uint8_t               tx_stream;                  // Starts anywhere, so a restarted sender's first stream looks new
+    uint8_t               tx_peer       = 0;
+    NowComm_StreamState   tx_state      = NOWCOMM_STREAM_IDLE;
+    Slot                  slots[32];                  // By index % 32
+    uint32_t              srtt_us       = 0;          // 0 until measured
+    uint32_t              rto_us        = NOWCOMM_STREAM_RTO_US;
+    unsigned long         tx_start      = 0;
+    NowComm_StreamStats   tx_stats      = {};
+    uint8_t*              rx_buffer     = nullptr;
+    uint32_t              rx_size       = 0;
+    uint32_t              rx_total      = 0;
+    uint16_t              rx_count      = 0;
+    uint16_t              rx_base       = 0;          // The first missing
+    uint32_t              rx_received   = 0;          // Bit n: fragment rx_base + n
+    uint8_t               rx_stream     = 0;
+    int8_t                rx_peer       = -1;
+    uint8_t               rx_unacked    = 0;          // In-order fragments since the last ack
+    unsigned long         rx_ack_due    = 0;
+    NowComm_StreamState   rx_state      = NOWCOMM_STREAM_IDLE;
+    unsigned long         rx_start      = 0;
+    NowComm_StreamStats   rx_stats      = {};
+};
+
+
+// Start sending len bytes of data to peer. The stream number changes with each, so the receiver can tell
+// a new stream from the rest of the last.
+//
+template <class Comm> bool NowCommStream<Comm>::send(const uint8_t* data, uint32_t len, uint8_t peer) {
+  if(NOWCOMM_STREAM_BUSY == tx_state || 0 == len || (uint64_t)NOWCOMM_STREAM_MAX_FRAGMENTS * NOWCOMM_STREAM_FRAGMENT < len) return false;
+  if(comm.get_peer_count() <= peer) return false;
+  tx_data       = data;
+  tx_total      = len;
+  tx_count      = (uint16_t)((len + NOWCOMM_STREAM_FRAGMENT - 1) / NOWCOMM_STREAM_FRAGMENT);
+  tx_base       = 0;
+  tx_next       = 0;
+  tx_peer       = peer;
+  tx_stream++;
+  tx_state      = NOWCOMM_STREAM_BUSY;
+  tx_start      = micros();
+  tx_stats      = {};
+  tx_stats.bytes      = len;
+  tx_stats.fragments  = tx_count;
+  service();
+  return true;
+}
+
+
+template <class Comm> void NowCommStream<Comm>::set_buffer(uint8_t* buffer, uint32_t size) {
+  rx_buffer = buffer;
+  rx_size   = size;
+  rx_state  = NOWCOMM_STREAM_IDLE;
+  rx_peer   = -1;
+}
+
+
+template <class Comm> bool NowCommStream<Comm>::handle(const typename Comm::Message& msg) {
+  if(const NowComm_StreamData* data = msg.template get<NowComm_StreamData>()) on_data(*data, msg.mac);
+  else if(const NowComm_StreamAck* ack = msg.template get<NowComm_StreamAck>()) on_ack(*ack);
+  else return false;
+  return true;
+}
+
+
+template <class Comm> bool NowCommStream<Comm>::handle_current() {
+  if(NOWCOMM_KIND_STREAM == comm.get_msg_kind())          on_data(*comm.template get_data<NowComm_StreamData>(), comm.get_msg_mac());
+  else if(NOWCOMM_KIND_STREAM_ACK == comm.get_msg_kind()) on_ack(*comm.template get_data<NowComm_StreamAck>());
+  else return false;
+  return true;
+}
+
+
+// Resend what has timed out, oldest first, then fill the window. A timeout backs the timer off, once
+// per call, until an ack brings a fresh measurement.
+//
+template <class Comm> void NowCommStream<Comm>::service() {
+  unsigned long now = micros();
+  if(0 <= rx_peer && rx_unacked && (long)(now - rx_ack_due) >= 0) send_ack(NOWCOMM_STREAM_OK);
+  if(NOWCOMM_STREAM_BUSY != tx_state) return;
+  bool backed_off = false;
+  for(uint16_t i = tx_base; i != tx_next; i++) {
+    Slot& slot = slots[i & 31];
+    if(slot.acked || now - slot.sent_us < rto_us) continue;
+    if(NOWCOMM_STREAM_RETRIES <= slot.sends) {
+      tx_state = NOWCOMM_STREAM_FAILED;
+      return;
+    }
+    send_fragment(i, now);
+    tx_stats.resent++;
+    if(!backed_off) rto_us = (NOWCOMM_STREAM_RTO_MAX_US / 2 < rto_us) ? NOWCOMM_STREAM_RTO_MAX_US : rto_us * 2;
+    backed_off = true;
+  }
+  while(tx_next != tx_count && (uint16_t)(tx_next - tx_base) < window) {
+    slots[tx_next & 31].sends = 0;
+    send_fragment(tx_next++, now);
+  }
+}
+
+
+template <class Comm> void NowCommStream<Comm>::send_fragment(uint16_t index, unsigned long now) {
+  uint32_t offset = (uint32_t)index * NOWCOMM_STREAM_FRAGMENT;
+  uint32_t len    = tx_total - offset < NOWCOMM_STREAM_FRAGMENT ? tx_total - offset : NOWCOMM_STREAM_FRAGMENT;
+  Slot&    slot   = slots[index & 31];
+  fragment.stream = tx_stream;
+  fragment.index  = index;
+  fragment.total  = tx_total;
+  memcpy(fragment.data, tx_data + offset, len);
+  memset(fragment.data + len, 0, NOWCOMM_STREAM_FRAGMENT - len);
+  comm.send_command(&fragment, tx_peer);
+  slot.sent_us  = now;
+  slot.acked    = false;
+  slot.fast     = false;
+  slot.sends++;
+  tx_stats.frames_sent++;
+}
+
+
+// Only a fragment sent once times the round trip: an ack for a resent one could be for either send.
+//
+template <class Comm> void NowCommStream<Comm>::note_acked(uint16_t index, unsigned long now) {
+  Slot& slot = slots[index & 31];
+  if(slot.acked) return;
+  slot.acked = true;
+  if(1 != slot.sends) return;
+  uint32_t rtt = now - slot.sent_us;
+  srtt_us = srtt_us ? srtt_us + ((int32_t)(rtt - srtt_us) >> 3) : rtt;
+  rto_us  = 2 * srtt_us + NOWCOMM_STREAM_ACK_DELAY_US;
+  if(NOWCOMM_STREAM_RTO_MIN_US > rto_us) rto_us = NOWCOMM_STREAM_RTO_MIN_US;
+  if(NOWCOMM_STREAM_RTO_MAX_US < rto_us) rto_us = NOWCOMM_STREAM_RTO_MAX_US;
+}
+
+
+template <class Comm> void NowCommStream<Comm>::on_ack(const NowComm_StreamAck& ack) {
+  if(NOWCOMM_STREAM_BUSY != tx_state || ack.stream != tx_stream) return;
+  if(NOWCOMM_STREAM_OK != ack.status) {
+    tx_state = NOWCOMM_STREAM_FAILED;
+    return;
+  }
+  unsigned long now     = micros();
+  uint16_t      in_flight = tx_next - tx_base;
+  if((uint16_t)(ack.base - tx_base) > in_flight) return;  // From before tx_base moved on, or nonsense
+  for(uint16_t i = tx_base; i != ack.base; i++) note_acked(i, now);
+  uint8_t past = 0;
+  for(uint8_t n = 1; n < 32; n++) {
+    uint16_t i = ack.base + n;
+    if((uint16_t)(i - tx_base) >= in_flight) break;
+    if(ack.received & (1UL << n)) {
+      note_acked(i, now);
+      past++;
+    }
+  }
+  tx_base = ack.base;
+  while(tx_base != tx_next && slots[tx_base & 31].acked) tx_base++;
+  if(tx_base == tx_count) {
+    tx_state        = NOWCOMM_STREAM_DONE;
+    tx_stats.us     = now - tx_start;
+    tx_stats.rto_us = rto_us;
+    return;
+  }
+  Slot& hole = slots[tx_base & 31];
+  if(tx_base != tx_next && NOWCOMM_STREAM_DUPACKS <= past && !hole.fast) {
+    if(NOWCOMM_STREAM_RETRIES <= hole.sends) {
+      tx_state = NOWCOMM_STREAM_FAILED;
+      return;
+    }
+    send_fragment(tx_base, now);
+    hole.fast = true;
+    tx_stats.fast_resent++;
+  }
+  service();                                              // The window has moved
+}
+
+
+// A fragment of a new stream starts it over: another number, length or peer. One from before the current
+// stream's base is a repeat, whose sender must have missed an ack.
+//
+template <class Comm> void NowCommStream<Comm>::on_data(const NowComm_StreamData& data, const uint8_t* mac) {
+  unsigned long now  = micros();
+  int8_t        peer = comm.find_peer(mac);
+  if(0 > peer) return;
+  if(0 > rx_peer || data.stream != rx_stream || data.total != rx_total || peer != rx_peer) {
+    rx_peer       = peer;
+    rx_stream     = data.stream;
+    rx_total      = data.total;
+    rx_count      = (uint16_t)((data.total + NOWCOMM_STREAM_FRAGMENT - 1) / NOWCOMM_STREAM_FRAGMENT);
+    rx_base       = 0;
+    rx_received   = 0;
+    rx_unacked    = 0;
+    rx_start      = now;
+    rx_stats      = {};
+    rx_stats.bytes      = data.total;
+    rx_stats.fragments  = rx_count;
+    rx_state      = (nullptr == rx_buffer || rx_size < data.total) ? NOWCOMM_STREAM_FAILED : NOWCOMM_STREAM_BUSY;
+  }
+  if(NOWCOMM_STREAM_FAILED == rx_state) {
+    send_ack(NOWCOMM_STREAM_NO_ROOM);
+    return;
+  }
+  uint16_t ahead = data.index - rx_base;
+  if(data.index < rx_base || (ahead < 32 && (rx_received & (1UL << ahead)))) {
+    rx_stats.duplicates++;
+    send_ack(NOWCOMM_STREAM_OK);
+    return;
+  }
+  if(32 <= ahead) return;                                 // Past any window the sender could have
+  uint32_t offset = (uint32_t)data.index * NOWCOMM_STREAM_FRAGMENT;
+  uint32_t len    = rx_total - offset < NOWCOMM_STREAM_FRAGMENT ? rx_total - offset : NOWCOMM_STREAM_FRAGMENT;
+  memcpy(rx_buffer + offset, data.data, len);
+  rx_received |= 1UL << ahead;
+  while(rx_received & 1) {
+    rx_received >>= 1;
+    rx_base++;
+  }
+  if(rx_base == rx_count) {
+    rx_state    = NOWCOMM_STREAM_DONE;
+    rx_stats.us = now - rx_start;
+    send_ack(NOWCOMM_STREAM_OK);
+  }
+  else if(rx_received || NOWCOMM_STREAM_ACK_EVERY <= ++rx_unacked) send_ack(NOWCOMM_STREAM_OK);
+  else if(1 == rx_unacked) rx_ack_due = now + NOWCOMM_STREAM_ACK_DELAY_US;
+}
+
+
+template <class Comm> void NowCommStream<Comm>::send_ack(uint8_t status) {
+  NowComm_StreamAck ack;
+  ack.stream    = rx_stream;
+  ack.status    = status;
+  ack.base      = rx_base;
+  ack.received  = rx_received;
+  comm.send_command(&ack, (uint8_t)rx_peer);
+  rx_unacked = 0;
+  rx_stats.frames_sent++;
+}
@@ -0,0 +1,174 @@
+#pragma once
+#include <NowCommPlatform.h>
+#include <atomic>
+#ifndef ARDUINO
+#include <mutex>
+#include <condition_variable>
+#ifdef __linux__
+#include <pthread.h>
+#endif
+#endif
+
+// A task, pinned to a core, that can be woken by another.
+// On the M5StickC it is a FreeRTOS task: xTaskCreatePinnedToCore(), woken with a task notification. On a
+// host it is a std::thread, pinned where the OS allows it, woken through a condition variable; priority is
+// ignored there. Either way the body runs until stop() is called, so it should loop on running():
+//   void body(NowCommTask& task, void* context) {
+//     while(task.running()) { task.wait(1000); ... }
+//   }
+// Nothing allocates after start() except the task itself.
+
+#define NOWCOMM_TASK_STACK      3072      // Bytes; ignored on a host
+
+
+class NowCommTask {
+  public:
+    typedef void (*Body)(NowCommTask& task, void* context);
+    ~NowCommTask()                                  { stop(); }
+    bool                  start(const char* name, Body body, void* context, uint8_t priority, uint8_t core, uint32_t stack = NOWCOMM_TASK_STACK);
+    void                  stop();                   // Ask the body to return, and wait until it has
+    bool                  running()                 { return run.load(std::memory_order_acquire); }
+    void                  notify();                 // From another task: wake wait()
+    bool                  wait(uint32_t timeout_us);    // From the body: true if notified, false on timeout
+    void                  sleep_period(uint32_t period_us);   // From the body: wake every period_us
+  private:
+    static void           trampoline(void* self);
+    Body                  body                = nullptr;
+    void*                 context             = nullptr;
+    std::atomic<bool>     run{false};
+    std::atomic<bool>     done{true};
+#ifdef ARDUINO
+    TaskHandle_t          handle              = nullptr;
+    TickType_t            last_wake           = 0;
+#else
+    std::thread           thread;
+    std::mutex            mutex;
+    std::condition_variable wake;
+    uint32_t              pending             = 0;      // Notifications not yet taken by wait()
+    unsigned long         next_wake           = 0;
+#endif
+    bool                  periodic            = false;  // sleep_period() has its clock
+};
+
+
+inline void NowCommTask::trampoline(void* self) {
+  NowCommTask* task = (NowCommTask*)self;
+  task->body(*task, task->context);
+  task->done.store(true, std::memory_order_release);
+#ifdef ARDUINO
+  vTaskDelete(nullptr);
+#endif
+}
+
+
+#ifdef ARDUINO
+inline bool NowCommTask::start(const char* name, Body task_body, void* task_context, uint8_t priority, uint8_t core, uint32_t stack) {
+  if(!done.load(std::memory_order_acquire)) return false;
+  body      = task_body;
+  context   = task_context;
+  periodic  = false;
+  run.store(true, std::memory_order_release);
+  done.store(false, std::memory_order_release);
+  if(pdPASS == xTaskCreatePinnedToCore(trampoline, name, stack, this, priority, &handle, core)) return true;
+  run.store(false);
+  done.store(true);
+  return false;
+}
+
+
+inline void NowCommTask::stop() {
+  if(!run.exchange(false)) return;
+  notify();
+  while(!done.load(std::memory_order_acquire)) vTaskDelay(1);
+  handle = nullptr;
+}
+
+
+inline void NowCommTask::notify() {
+  if(handle) xTaskNotifyGive(handle);
+}
+
+
+inline bool NowCommTask::wait(uint32_t timeout_us) {
+  TickType_t ticks = pdMS_TO_TICKS((timeout_us + 999) / 1000);
+  return 0 < ulTaskNotifyTake(pdTRUE, ticks ? ticks : 1);
+}
+
+
+// vTaskDelayUntil(), so the period doesn't drift with the work done in it. The tick is 1 ms.
+//
+inline void NowCommTask::sleep_period(uint32_t period_us) {
+  TickType_t ticks = pdMS_TO_TICKS(period_us / 1000);
+  if(!periodic) {
+    last_wake = xTaskGetTickCount();
+    periodic  = true;
+  }
+  vTaskDelayUntil(&last_wake, ticks ? ticks : 1);
+}
+
+#else
+
+inline bool NowCommTask::start(const char* name, Body task_body, void* task_context, uint8_t priority, uint8_t core, uint32_t stack) {
+  (void)priority;                               // The host scheduler decides, and threads get its default stack
+  (void)stack;
+  if(!done.load(std::memory_order_acquire)) return false;
+  if(thread.joinable()) thread.join();
+  body      = task_body;
+  context   = task_context;
+  periodic  = false;
+  pending   = 0;
+  run.store(true, std::memory_order_release);
+  done.store(false, std::memory_order_release);
+  thread    = std::thread(trampoline, this);
+#ifdef __linux__
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(core % std::thread::hardware_concurrency(), &cpus);
+  pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);    // Best effort
+  pthread_setname_np(thread.native_handle(), name);
+#else
+  (void)name;
+  (void)core;
+#endif
+  return true;
+}
+
+
+inline void NowCommTask::stop() {
+  run.store(false, std::memory_order_release);
+  notify();
+  if(thread.joinable()) thread.join();
+}
+
+
+inline void NowCommTask::notify() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending++;
+  }
+  wake.notify_one();
+}
+
+
+inline bool NowCommTask::wait(uint32_t timeout_us) {
+  std::unique_lock<std::mutex> lock(mutex);
+  if(!wake.wait_for(lock, std::chrono::microseconds(timeout_us), [this] { return 0 < pending; })) return false;
+  pending = 0;
+  return true;
+}
+
+
+// Sleep to the next multiple of the period from the first call. A body that overruns by a whole period
+// starts counting again from now rather than running back to back to catch up.
+//
+inline void NowCommTask::sleep_period(uint32_t period_us) {
+  unsigned long now = micros();
+  if(!periodic) {
+    next_wake = now;
+    periodic  = true;
+  }
+  next_wake += period_us;
+  if((long)(now - next_wake) > (long)period_us) next_wake = now;
+  if((long)(next_wake - now) > 0) std::this_thread::sleep_for(std::chrono::microseconds(next_wake - now));
+}
+#endif
@@ -0,0 +1,75 @@
+#pragma once
+#include <stdint.h>
+
+// The NowComm wire format.
+// Every frame starts with a three-byte header:
+//    byte 0                  1  2
+//    bit  7 6 5 4 3 2 1 0
+//         |ver  |kind     |  |seq |
+// ver is NOWCOMM_VERSION (0 - 7) and kind is a NowComm_Kind (0 - 31). seq (LE) is stamped by NowComm when
+// it sends; a message's encode() writes byte 0 and leaves 1 and 2 alone. Its top NOWCOMM_SESSION_BITS are
+// the sending session's number on its radio, so a response, which echoes a seq, finds its way back to the
+// session that sent the frame (see NowCommRouter.h); the rest are that session's frame count.
+// The rest of the frame, from NOWCOMM_HEADER_SIZE on, is the message's own packed encoding.
+// Multi-byte fields are little-endian and are always written and read with the helpers below, never by
+// casting a struct over the buffer, so the layout is the same on the ESP32 and on any host regardless
+// of padding or enum size.
+
+#define NOWCOMM_VERSION         4         // Bump when any encoding changes
+#define NOWCOMM_MAX_FRAME       250       // ESP-NOW payload limit
+#define NOWCOMM_HEADER_SIZE     3
+#define NOWCOMM_SESSION_BITS    2
+#define NOWCOMM_SEQ_BITS        (16 - NOWCOMM_SESSION_BITS)
+#define NOWCOMM_SEQ_MASK        ((1U << NOWCOMM_SEQ_BITS) - 1)
+
+
+enum NowComm_Kind {
+  NOWCOMM_KIND_NONE,
+  NOWCOMM_KIND_COMMAND,
+  NOWCOMM_KIND_RESPONSE,
+  NOWCOMM_KIND_DISCOVERY,
+  NOWCOMM_KIND_MULTIPLEX,
+  NOWCOMM_KIND_HOP,
+  NOWCOMM_KIND_STREAM,                    // See NowCommStream.h
+  NOWCOMM_KIND_STREAM_ACK,
+  NOWCOMM_KIND_REDUNDANT                  // A command with copies of those before it; see set_redundancy()
+};
+
+
+// Kinds from NOWCOMM_KIND_USER to NOWCOMM_KIND_MAX are free for application messages.
+//
+#define NOWCOMM_KIND_USER       9
+#define NOWCOMM_KIND_MAX        31
+
+
+inline uint8_t  nowcomm_header(uint8_t kind)            { return (uint8_t)((NOWCOMM_VERSION << 5) | (kind & 0x1F)); }
+inline uint8_t  nowcomm_header_kind(uint8_t header)     { return header & 0x1F; }
+inline uint8_t  nowcomm_header_version(uint8_t header)  { return header >> 5;   }
+
+
+inline void wire_put_u16(uint8_t* p, uint16_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+
+inline void wire_put_u32(uint8_t* p, uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+
+inline uint16_t wire_get_u16(const uint8_t* p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+
+inline uint32_t wire_get_u32(const uint8_t* p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+inline void     nowcomm_put_seq(uint8_t* frame, uint16_t seq)   { wire_put_u16(frame + 1, seq); }
+inline uint16_t nowcomm_get_seq(const uint8_t* frame)           { return wire_get_u16(frame + 1); }
@@ -0,0 +1,415 @@
+#pragma once
+#include "NowCommPlatform.h"
+#include "NowCommRouter.h"
+#include <queue>
+#include <vector>
+
+#define SIM_CHANNELS        15            // 1 - 14; 0 is unused
+#define SIM_MAX_FRAME       250
+
+
+// How the simulated air behaves. The defaults are ESP-NOW's: 802.11b at 1 Mbps with a long preamble,
+// and a vendor-specific action frame wrapped around every payload.
+//
+typedef struct SimConfig {
+  uint16_t  kbps            = 1000;
+  uint16_t  preamble_us     = 192;        // PLCP preamble and header
+  uint8_t   overhead_bytes  = 43;         // MAC header, action frame and vendor element fields, FCS
+  uint16_t  ack_us          = 304;        // A 14-byte ACK, with its preamble
+  uint16_t  sifs_us         = 10;
+  uint16_t  difs_us         = 50;
+  uint16_t  slot_us         = 20;
+  uint16_t  cw_min          = 31;         // Backoff, in slots; doubles with each retry, up to cw_max
+  uint16_t  cw_max          = 1023;
+  uint8_t   retries         = 7;          // Unicast only; a broadcast goes once, unacknowledged
+  uint8_t   loss_pct        = 0;          // Each copy of a frame, on top of collisions
+  uint16_t  jitter_us       = 200;        // End of a frame to the receive callback: 0 up to this
+  uint8_t   adjacent        = 2;          // Channels this close interfere with each other (10 MHz, where the main lobes overlap); 0 for only the same one
+  uint8_t   queue_depth     = 32;         // Frames a radio holds waiting for the air
+  uint32_t  seed            = 1;
+} SimConfig;
+
+
+// Since reset(). A frame sent to several stations counts once in frames, and once per station in
+// delivered and lost.
+//
+typedef struct SimStats {
+  uint64_t  events;
+  uint64_t  frames;                       // Transmissions, retries included
+  uint64_t  retries;
+  uint64_t  collided;                     // Transmissions overlapped by another that interferes
+  uint64_t  delivered;                    // Copies handed to a receive callback
+  uint64_t  lost;                         // Copies lost at random, to a collision, or to a station sending
+  uint64_t  failed;                       // Unicasts out of retries
+  uint64_t  refused;                      // Sends refused by a full queue
+  uint64_t  busy_us[SIM_CHANNELS];        // Air time, ACKs included
+} SimStats;
+
+
+class SimTransport;
+
+
+// A discrete-event simulation of the 2.4 GHz air, for running many NowComm devices in one process,
+// faster than real time. Each SimTransport is a device's radio; the devices' loop()s are tasks, called
+// at the times they ask for.
+// reset() starts the clock at 0 and hands it to NowComm (see nowcomm_clock()), so everything NowComm
+// times, from discovery jitter to round trips, runs on simulated time. run_until() then takes events in
+// time order: a task's turn, a radio getting the air, a frame ending, a frame reaching a callback.
+// The air:
+//   - a frame takes preamble_us plus its bytes, with overhead_bytes, at kbps
+//   - a radio with frames queued senses its channel; if it is busy it backs off for DIFS and a random
+//     number of slots from the end of what is on the air, drawing afresh each time it finds it busy
+//   - two frames overlapping on channels within adjacent of each other are both lost, to everyone;
+//     carrier sense only hears the same channel, so neighbours collide without deferring
+//   - a station hears a frame if it is tuned to its channel when it ends, wasn't sending itself, and
+//     loss_pct spares it; the receive callback follows after up to jitter_us
+//   - a unicast the addressee heard is acknowledged; one it didn't is retried with a doubled contention
+//     window, up to retries times. Either way the send callback then says how it went
+// Each device has one session: the simulated radio delivers straight to it, without NowCommRouter, so
+// there can be as many devices as memory allows. Call reset() before making the transports. Host only.
+//
+class NowCommSim {
+  public:
+    typedef unsigned long (*Task)(void* context);   // Returns how long until it runs again; 0 to stop
+    static void             reset(const SimConfig& config = SimConfig());   // Empty the air, and the clock to 0
+    static void             stop()                      { nowcomm_clock() = nullptr; }   // micros() back to the steady clock
+    static unsigned long    now()                       { return (unsigned long)world().now; }
+    static void             start_task(Task task, void* context, unsigned long delay_us = 0);
+    static void             run_until(unsigned long us);
+    static void             get_stats(SimStats& stats)  { stats = world().stats; }
+    static uint32_t         airtime_us(int len);
+  private:
+    friend class SimTransport;
+    enum EventType : uint8_t { EVENT_TASK, EVENT_ACCESS, EVENT_END, EVENT_ACK, EVENT_DELIVER };
+    struct Event {
+      uint64_t              at;
+      uint64_t              order;                  // Events at one time run in the order scheduled
+      EventType             type;
+      uint32_t              radio;                  // Or the task
+      uint32_t              frame;
+      bool operator>(const Event& other) const      { return at != other.at ? at > other.at : order > other.order; }
+    };
+    struct Frame {
+      uint8_t               src[6];
+      uint8_t               dst[6];
+      uint8_t               data[SIM_MAX_FRAME];
+      uint16_t              len;
+      uint16_t              refs;                   // The sender's queue, and each delivery on its way
+    };
+    struct Air {                                    // A transmission on the air
+      uint64_t              start;
+      uint64_t              end;
+      uint32_t              radio;
+      uint32_t              frame;
+      uint8_t               channel;
+      bool                  collided;
+    };
+    struct World {
+      SimConfig             config;
+      SimStats              stats                   = {};
+      uint64_t              now                     = 0;
+      uint64_t              order                   = 0;
+      uint32_t              random                  = 1;
+      std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+      std::vector<std::pair<Task, void*>> tasks;
+      std::vector<SimTransport*> radios;            // nullptr once destroyed
+      std::vector<Frame>    frames;
+      std::vector<uint32_t> free_frames;
+      std::vector<Air>      on_air;
+      uint64_t              quiet_at[SIM_CHANNELS]  = { 0 };   // When the last ACK on each channel ends
+    };
+    static World&           world()                     { static World w; return w; }
+    static unsigned long    clock()                     { return (unsigned long)world().now; }
+    static uint32_t         next_random();
+    static void             schedule(uint64_t at, EventType type, uint32_t radio, uint32_t frame = 0);
+    static uint32_t         new_frame(const uint8_t* src, const uint8_t* dst, const uint8_t* data, int len);
+    static void             release(uint32_t frame);
+    static uint64_t         backoff(uint16_t cw);
+    static void             access(uint32_t radio);
+    static void             end(uint32_t radio);
+    static void             finish(SimTransport& radio, bool success);
+    static void             deliver(uint32_t radio, uint32_t frame);
+};
+
+
+// One device's radio on the simulated air. It has the transport interface NowComm expects (see NowComm.h).
+//
+class SimTransport {
+  public:
+    SimTransport();
+    ~SimTransport();
+    bool                  init(uint8_t chan, NowComm_Session& s)     { s.id = 0; session = s; channel = chan; initialized = true; return true; }
+    bool                  add_peer(const uint8_t* /*mac*/, uint8_t /*chan*/) { return true; }
+    bool                  del_peer(const uint8_t* /*mac*/)           { return true; }
+    bool                  set_channel(uint8_t chan)                  { channel = chan; return true; }   // Queued frames go on the new one
+    bool                  send(const uint8_t* mac, const uint8_t* data, int len);
+    void                  poll()                                     {}     // Frames arrive as the simulation runs
+    void                  get_mac_address(uint8_t* mac)              { memcpy(mac, own_mac, 6); }
+    void                  set_mac_address(const uint8_t* mac)        { memcpy(own_mac, mac, 6); }   // Before init()
+    uint8_t               get_channel()                              { return channel;         }
+    uint32_t              get_frames_sent()                          { return frames_sent;     }
+    uint32_t              get_frames_received()                      { return frames_received; }
+  private:
+    friend class NowCommSim;
+    NowComm_Session       session;
+    bool                  initialized         = false;
+    uint32_t              index               = 0;            // In the simulation's radios
+    uint8_t               channel             = 0;
+    uint8_t               own_mac[6]          = { 0 };
+    std::vector<uint32_t> queue;                              // Frames waiting, oldest first
+    bool                  contending          = false;        // An access or a transmission is under way
+    uint16_t              cw                  = 0;
+    uint8_t               attempt             = 0;
+    uint64_t              tx_start            = 0;            // The last transmission
+    uint64_t              tx_end              = 0;
+    uint32_t              frames_sent         = 0;
+    uint32_t              frames_received     = 0;
+};
+
+
+// Also empties the radio table, so only SimTransports made after this are on the air.
+//
+inline void NowCommSim::reset(const SimConfig& config) {
+  World& w = world();
+  for(SimTransport* radio : w.radios) if(radio) radio->index = UINT32_MAX;
+  w = World();
+  w.config = config;
+  w.random = config.seed | 1;
+  nowcomm_seed(config.seed * 2654435761UL);
+  nowcomm_clock() = clock;
+}
+
+
+inline void NowCommSim::start_task(Task task, void* context, unsigned long delay_us) {
+  World& w = world();
+  w.tasks.push_back({ task, context });
+  schedule(w.now + delay_us, EVENT_TASK, (uint32_t)(w.tasks.size() - 1));
+}
+
+
+inline void NowCommSim::run_until(unsigned long us) {
+  World& w = world();
+  while(!w.events.empty() && w.events.top().at <= us) {
+    Event event = w.events.top();
+    w.events.pop();
+    w.now = event.at;
+    w.stats.events++;
+    switch(event.type) {
+      case EVENT_TASK: {
+        unsigned long next = w.tasks[event.radio].first(w.tasks[event.radio].second);
+        if(next) schedule(w.now + next, EVENT_TASK, event.radio);
+        break;
+      }
+      case EVENT_ACCESS:  access(event.radio);                break;
+      case EVENT_END:     end(event.radio);                   break;
+      case EVENT_ACK:     if(w.radios[event.radio]) finish(*w.radios[event.radio], true);   break;
+      case EVENT_DELIVER: deliver(event.radio, event.frame);  break;
+    }
+  }
+  if(w.now < us) w.now = us;
+}
+
+
+inline uint32_t NowCommSim::airtime_us(int len) {
+  const SimConfig& c = world().config;
+  return c.preamble_us + ((len + c.overhead_bytes) * 8000UL + c.kbps - 1) / c.kbps;
+}
+
+
+inline uint32_t NowCommSim::next_random() {
+  uint32_t& state = world().random;
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+
+inline void NowCommSim::schedule(uint64_t at, EventType type, uint32_t radio, uint32_t frame) {
+  World& w = world();
+  w.events.push({ at, w.order++, type, radio, frame });
+}
+
+
+inline uint32_t NowCommSim::new_frame(const uint8_t* src, const uint8_t* dst, const uint8_t* data, int len) {
+  World&   w = world();
+  uint32_t f;
+  if(w.free_frames.empty()) {
+    f = (uint32_t)w.frames.size();
+    w.frames.emplace_back();
+  }
+  else {
+    f = w.free_frames.back();
+    w.free_frames.pop_back();
+  }
+  Frame& frame = w.frames[f];
+  memcpy(frame.src, src, 6);
+  memcpy(frame.dst, dst, 6);
+  memcpy(frame.data, data, len);
+  frame.len  = (uint16_t)len;
+  frame.refs = 1;
+  return f;
+}
+
+
+inline void NowCommSim::release(uint32_t frame) {
+  World& w = world();
+  if(0 == --w.frames[frame].refs) w.free_frames.push_back(frame);
+}
+
+
+inline uint64_t NowCommSim::backoff(uint16_t cw) {
+  const SimConfig& c = world().config;
+  return c.difs_us + (uint64_t)(next_random() % (cw + 1)) * c.slot_us;
+}
+
+
+// The radio wants the air for the frame at the head of its queue: take it if the channel is quiet, or
+// back off from when it will be.
+//
+inline void NowCommSim::access(uint32_t r) {
+  World&        w     = world();
+  SimTransport* radio = w.radios[r];
+  if(nullptr == radio || radio->queue.empty()) return;
+  uint64_t busy = w.quiet_at[radio->channel];
+  for(const Air& air : w.on_air) if(air.channel == radio->channel && air.end > busy) busy = air.end;
+  if(busy > w.now) {
+    schedule(busy + backoff(radio->cw), EVENT_ACCESS, r);
+    return;
+  }
+  uint32_t f   = radio->queue.front();
+  Air      air = { w.now, w.now + airtime_us(w.frames[f].len), r, f, radio->channel, false };
+  for(Air& other : w.on_air) {
+    int apart = other.channel > air.channel ? other.channel - air.channel : air.channel - other.channel;
+    if(apart > w.config.adjacent || other.end <= air.start) continue;
+    if(!other.collided) w.stats.collided++;
+    if(!air.collided)   w.stats.collided++;
+    other.collided = air.collided = true;
+  }
+  w.on_air.push_back(air);
+  w.stats.frames++;
+  w.stats.busy_us[air.channel] += air.end - air.start;
+  radio->tx_start = air.start;
+  radio->tx_end   = air.end;
+  schedule(air.end, EVENT_END, r);
+}
+
+
+// The radio's frame is off the air: hand a copy to every station that heard it, then see whether it was
+// acknowledged.
+//
+inline void NowCommSim::end(uint32_t r) {
+  static const uint8_t broadcast[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+  World&        w     = world();
+  SimTransport* radio = w.radios[r];
+  size_t        i     = 0;
+  while(i < w.on_air.size() && w.on_air[i].radio != r) i++;
+  if(i == w.on_air.size()) return;
+  Air air = w.on_air[i];
+  w.on_air.erase(w.on_air.begin() + i);
+  Frame&  frame     = w.frames[air.frame];
+  bool    unicast   = 0 != memcmp(frame.dst, broadcast, 6);
+  bool    acked     = false;
+  for(uint32_t s = 0; s < w.radios.size(); s++) {
+    SimTransport* station = w.radios[s];
+    if(s == r || nullptr == station || station->channel != air.channel) continue;
+    if(unicast && 0 != memcmp(frame.dst, station->own_mac, 6)) continue;
+    bool sending = station->tx_start < air.end && station->tx_end > air.start;
+    if(air.collided || sending || (w.config.loss_pct && next_random() % 100 < w.config.loss_pct)) {
+      w.stats.lost++;
+      continue;
+    }
+    acked = true;
+    frame.refs++;
+    schedule(air.end + (w.config.jitter_us ? next_random() % (w.config.jitter_us + 1) : 0), EVENT_DELIVER, s, air.frame);
+  }
+  if(nullptr == radio) return;
+  if(!unicast) {
+    finish(*radio, true);
+    return;
+  }
+  uint64_t ack_end = air.end + w.config.sifs_us + w.config.ack_us;
+  if(acked) {                                              // The send callback comes with the ACK
+    if(ack_end > w.quiet_at[air.channel]) w.quiet_at[air.channel] = ack_end;
+    w.stats.busy_us[air.channel] += w.config.ack_us;
+    schedule(ack_end, EVENT_ACK, r);
+    return;
+  }
+  if(radio->attempt < w.config.retries) {
+    radio->attempt++;
+    radio->cw = (uint16_t)(radio->cw * 2 + 1 < w.config.cw_max ? radio->cw * 2 + 1 : w.config.cw_max);
+    w.stats.retries++;
+    schedule(ack_end + backoff(radio->cw), EVENT_ACCESS, r);
+    return;
+  }
+  w.stats.failed++;
+  finish(*radio, false);
+}
+
+
+// Done with the frame at the head of the queue: tell NowComm, and start on the next.
+//
+inline void NowCommSim::finish(SimTransport& radio, bool success) {
+  World&   w = world();
+  uint32_t f = radio.queue.front();
+  uint8_t  dst[6];
+  memcpy(dst, w.frames[f].dst, 6);
+  radio.queue.erase(radio.queue.begin());
+  release(f);
+  radio.attempt = 0;
+  radio.cw      = w.config.cw_min;
+  if(radio.queue.empty()) radio.contending = false;
+  else                    schedule(w.now + backoff(radio.cw), EVENT_ACCESS, radio.index);
+  if(radio.initialized) radio.session.sent_cb(radio.session.context, dst, success);
+}
+
+
+// A copy goes to the callback, since what it sends can grow the frame pool under it.
+//
+inline void NowCommSim::deliver(uint32_t s, uint32_t f) {
+  World&        w       = world();
+  SimTransport* station = w.radios[s];
+  Frame         frame   = w.frames[f];
+  release(f);
+  if(nullptr == station || !station->initialized) return;
+  station->frames_received++;
+  w.stats.delivered++;
+  station->session.recv_cb(station->session.context, frame.src, frame.data, frame.len);
+}
+
+
+// Join the simulation with a locally administered MAC address, unique within it.
+//
+inline SimTransport::SimTransport() {
+  NowCommSim::World& w = NowCommSim::world();
+  index = (uint32_t)w.radios.size();
+  const uint8_t mac[6] = { 0x02, 0x53, 0x49, 0x4D, (uint8_t)(index >> 8), (uint8_t)index };
+  memcpy(own_mac, mac, 6);
+  cw = w.config.cw_min;
+  w.radios.push_back(this);
+}
+
+
+inline SimTransport::~SimTransport() {
+  NowCommSim::World& w = NowCommSim::world();
+  if(index < w.radios.size() && this == w.radios[index]) w.radios[index] = nullptr;
+}
+
+
+// Queue the frame for the air. It is refused, as esp_now_send() refuses it, when the queue is full.
+//
+inline bool SimTransport::send(const uint8_t* mac, const uint8_t* data, int len) {
+  NowCommSim::World& w = NowCommSim::world();
+  if(SIM_MAX_FRAME < len || UINT32_MAX == index) return false;
+  if(w.config.queue_depth <= queue.size()) {
+    w.stats.refused++;
+    return false;
+  }
+  queue.push_back(NowCommSim::new_frame(own_mac, mac, data, len));
+  frames_sent++;
+  if(!contending) {
+    contending = true;
+    NowCommSim::schedule(w.now, NowCommSim::EVENT_ACCESS, index);
+  }
+  return true;
+}
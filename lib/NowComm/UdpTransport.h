@@ -0,0 +1,139 @@
+#pragma once
+#include "NowCommPlatform.h"
+#include "NowCommRouter.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define UDP_TRANSPORT_GROUP     "239.78.67.1"
+#define UDP_TRANSPORT_BASE_PORT 47000         // Channel n is carried on port BASE + n
+#define UDP_TRANSPORT_MAX_FRAME 250
+
+
+// A POSIX UDP stand-in for the radio, for host builds.
+// Each channel is a multicast group on the loopback interface, so any number of processes on one
+// machine share the "air" the way sticks on one ESP-NOW channel do. Every datagram is
+//    dst[6] src[6] payload
+// and receivers drop anything that is neither addressed to them nor broadcast.
+//
+class UdpTransport {
+  public:
+    UdpTransport();
+    ~UdpTransport()                                                  { close_socket(); NowCommRouter::detach(slot); }
+    bool                  init(uint8_t chan, NowComm_Session& session);
+    bool                  add_peer(const uint8_t* /*mac*/, uint8_t /*chan*/) { return true; }
+    bool                  del_peer(const uint8_t* /*mac*/)           { return true; }
+    bool                  set_channel(uint8_t chan);                 // Frames still queued on the old channel are lost, as on the radio
+    bool                  send(const uint8_t* mac, const uint8_t* data, int len);
+    void                  poll();
+    void                  get_mac_address(uint8_t* mac)              { memcpy(mac, own_mac, 6); }
+    uint32_t              get_frames_sent()                          { return frames_sent;     }
+    uint32_t              get_frames_received()                      { return frames_received; }
+  private:
+    bool                  open_socket(uint8_t chan);
+    void                  close_socket();
+    NowComm_Session       session;
+    int8_t                slot                = -1;           // In NowCommRouter
+    int                   sock                = -1;
+    uint8_t               channel             = 0;
+    uint8_t               own_mac[6]          = { 0 };
+    uint32_t              frames_sent         = 0;
+    uint32_t              frames_received     = 0;
+};
+
+
+// Make up a locally administered MAC address that is unique across processes on this machine.
+//
+inline UdpTransport::UdpTransport() {
+  static uint8_t  next_id = 0;
+  pid_t           pid     = getpid();
+  const uint8_t   mac[6]  = { 0x02, 0x55, (uint8_t)(pid >> 16), (uint8_t)(pid >> 8), (uint8_t)pid, ++next_id };
+  memcpy(own_mac, mac, 6);
+}
+
+
+inline bool UdpTransport::init(uint8_t chan, NowComm_Session& s) {
+  NowCommRouter::detach(slot);
+  slot    = NowCommRouter::attach(own_mac, s);
+  session = s;
+  if(0 > slot) return false;
+  if(0 <= sock && chan == channel) return true;
+  close_socket();
+  return open_socket(chan);
+}
+
+
+inline bool UdpTransport::set_channel(uint8_t chan) {
+  if(0 <= sock && chan == channel) return true;
+  close_socket();
+  return open_socket(chan);
+}
+
+
+inline bool UdpTransport::open_socket(uint8_t chan) {
+  sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if(0 > sock) return false;
+  int       one  = 1;
+  in_addr   lo   = { htonl(INADDR_LOOPBACK) };
+  ip_mreq   mreq = { };
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, &lo, sizeof(lo));
+  setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, &one, sizeof(one));
+  sockaddr_in addr = { };
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = htons(UDP_TRANSPORT_BASE_PORT + chan);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  mreq.imr_multiaddr.s_addr = inet_addr(UDP_TRANSPORT_GROUP);
+  mreq.imr_interface        = lo;
+  if(0 != bind(sock, (sockaddr*)&addr, sizeof(addr)) ||
+     0 != setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq))) {
+    close_socket();
+    return false;
+  }
+  fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+  channel = chan;
+  return true;
+}
+
+
+inline void UdpTransport::close_socket() {
+  if(0 <= sock) close(sock);
+  sock = -1;
+}
+
+
+inline bool UdpTransport::send(const uint8_t* mac, const uint8_t* data, int len) {
+  uint8_t datagram[12 + UDP_TRANSPORT_MAX_FRAME];
+  if(0 > sock || UDP_TRANSPORT_MAX_FRAME < len) return false;
+  memcpy(datagram,     mac,     6);
+  memcpy(datagram + 6, own_mac, 6);
+  memcpy(datagram + 12, data, len);
+  sockaddr_in addr = { };
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = htons(UDP_TRANSPORT_BASE_PORT + channel);
+  addr.sin_addr.s_addr = inet_addr(UDP_TRANSPORT_GROUP);
+  bool ok = (ssize_t)(12 + len) == sendto(sock, datagram, 12 + len, 0, (sockaddr*)&addr, sizeof(addr));
+  frames_sent++;
+  if(0 <= slot) session.sent_cb(session.context, mac, ok);
+  return ok;
+}
+
+
+// Deliver every datagram waiting on the socket that is meant for us. Each transport is a device of its
+// own, with one session, but frames still go through the router so every transport filters alike.
+//
+inline void UdpTransport::poll() {
+  static const uint8_t  broadcast[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+  uint8_t               datagram[12 + UDP_TRANSPORT_MAX_FRAME];
+  if(0 > sock) return;
+  while(true) {
+    ssize_t len = recv(sock, datagram, sizeof(datagram), 0);
+    if(0 > len) break;
+    if(12 > len || 0 == memcmp(datagram + 6, own_mac, 6)) continue;     // Runt, or our own echo
+    if(0 != memcmp(datagram, own_mac, 6) && 0 != memcmp(datagram, broadcast, 6)) continue;  // Someone else's unicast
+    frames_received++;
+    NowCommRouter::receive(own_mac, datagram + 6, datagram + 12, (int)len - 12);
+  }
+}
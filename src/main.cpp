@@ -3,18 +3,15 @@
 // By Van Kichline
 // In the year of the plague
 //
-// Ver 2: Automatic discovery. Secrets file is eliminated.
-// Controller:
-// When turned on, select a channel: 1 - 14. Default is random.
-// Add a broadcast peer and broadcast a discovery packet until ACK received.
-// Remove broadcast peer.
-// Add the responder as a peer.
-// Go into controller mode.
-// Receiver:
-// When turned on, select a channel: 1 - 14. Choose the same one as the Controller.
-// Add a broadcast peer and listen for discovery packet until detected. Send ACK.
-// Remove broadcast peer.
-// Go into receiver mode.
+// The controller scans the channels for a BugC and pairs with it, then drives it from the joystick
+// hat. The last BugC is remembered and reconnects at power-on; hold B at power-on to forget it. Hold A
+// at power-on for competition mode: pick the channel by hand (the BugC must be on the same one), with no
+// scanning or channel hopping. Otherwise both sides move to a quieter channel when this one gets noisy.
+// Stick, mixer and radio run as a pipeline of tasks on one core and the display on the other, so a slow
+// LCD push never delays a frame. The display is a HUD whose bottom line shows the channel, the BugC's
+// battery (grey while stale, red when low) and the link.
+// With TRACE_LOG, radio events are logged in binary among the text on Serial, for tools/nowcomm_logdecode.
+// With CAPTURE_PACKETS, pressing B dumps the last frames for tools/nowcomm_replay.
 
 
 #include <esp_now.h>
@@ -22,17 +19,52 @@
 #include <Wire.h>
 #include <M5StickC.h>
 #include <BugComm.h>
+#include <JoySampler.h>
+#include <JoyHatSource.h>
+#include <BugPipeline.h>
+#include <Hud.h>
+#include <M5SpritePanel.h>
 
-#define JOY_ADDR    0x38
 #define BG_COLOR    NAVY
 #define FG_COLOR    LIGHTGREY
+#define LOOP_DELAY_MS       20            // loop() only minds the buttons and the stats; the pipeline does the rest
+#define STATS_PERIOD_MS     10000
+#define FLEET_SIZE          1             // BugCs to pair before driving; more than one share a multiplexed frame
+#define TRACE_LOG           true          // NowComm's event log, drained to Serial by a task of its own
+#define CAPTURE_PACKETS     true          // Keep the last NOWCOMM_CAPTURE_DEPTH frames, to dump with B
+#define LINK_TIMEOUT_MS     500           // No response for this long and the link shows as lost
+#define BATTERY_LOW_MV      3500          // The BugC's LiPo, under load
+#define COMMAND_COPIES      0             // Earlier commands in each frame, for the BugC to recover a lost one
 
 
 BugComm             bug_comm;                             // From NowComm template class
+NowCommBondStore    bond_store;                           // The last receiver paired, in NVS
+JoyHatSource        joy_hat;
+JoySampler<JoyHatSource>  joystick(joy_hat);              // Read by the pipeline's sampler task
+BugPipeline<BugComm, JoyHatSource>  pipeline(bug_comm, joystick);   // Owns bug_comm once started
+M5SpritePanel       hud_panel;
+Hud<M5SpritePanel>  hud(hud_panel);                       // Fields set by the functions below; drawn by hud.render()
+HudText*            title_field         = nullptr;
+HudText*            own_mac_field       = nullptr;
+HudText*            peer_mac_field      = nullptr;
+HudText*            channel_field       = nullptr;
+HudText*            battery_field       = nullptr;
+HudText*            link_field          = nullptr;
 bool                comp_mode           = false;          // Competition mode: manually select a channel
-int8_t              JoyX                = 0;
-int8_t              JoyY                = 0;
-bool                JoyB                = false;
+
+
+// Lay out the HUD. Its sprite is allocated here, once.
+//
+void setup_hud() {
+  hud.begin(TFT_BLACK);
+  title_field     = hud.add({   0,  0, 160, 16 }, 2, HUD_CENTRE, TFT_RED);
+  own_mac_field   = hud.add({   0, 18, 160, 16 }, 2, HUD_CENTRE, TFT_RED);
+  peer_mac_field  = hud.add({   0, 36, 160, 16 }, 2, HUD_CENTRE, TFT_RED);
+  channel_field   = hud.add({   0, 60,  52, 16 }, 2, HUD_LEFT,   FG_COLOR);
+  battery_field   = hud.add({  52, 60,  56, 16 }, 2, HUD_CENTRE, TFT_GREEN);
+  link_field      = hud.add({ 108, 60,  52, 16 }, 2, HUD_RIGHT,  TFT_RED);
+  title_field->set("BugNow Controller");
+}
 
 
 // Display the mac address of the device, and if connected, of its paired device.
@@ -40,32 +72,30 @@ bool                JoyB                = false;
 // Red indicates no ESP-Now connection, Green indicates connection established.
 //
 void print_mac_address(uint16_t color) {
-  M5.Lcd.setTextColor(color);
-  M5.Lcd.drawCentreString("BugNow Controller", 80, 0, 2);
-  String mac = WiFi.macAddress();
-  mac.replace(":", " ");
-  mac = String("C ") + mac;
-  M5.Lcd.drawCentreString(mac, 80, 22, 2);
-  String chan = "Chan " + String(bug_comm.get_channel());
-  M5.Lcd.drawCentreString(chan, 80, 60, 2);
+  uint8_t mac[6];
+  WiFi.macAddress(mac);
+  own_mac_field->printf("C %02X %02X %02X %02X %02X %02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
   if(bug_comm.is_connected()) {
-    char  buffer[32];
-    uint8_t*  pa = bug_comm.get_peer_address();
-    sprintf(buffer, "R %02X %02X %02X %02X %02X %02X", pa[0], pa[1], pa[2], pa[3], pa[4], pa[5]);
-    M5.Lcd.drawCentreString(buffer, 80, 40, 2);
+    uint8_t* pa = bug_comm.get_peer_address();
+    peer_mac_field->printf("R %02X %02X %02X %02X %02X %02X", pa[0], pa[1], pa[2], pa[3], pa[4], pa[5]);
   }
+  channel_field->printf("Chan %u", bug_comm.get_channel());
+  title_field->set_color(color);
+  own_mac_field->set_color(color);
+  peer_mac_field->set_color(color);
+  hud.render();
 }
 
 
-// If we're not in competition mode, simply return 1.
+// If we're not in competition mode, scan for the receiver: return NOWCOMM_CHANNEL_AUTO.
 // Else, select and return the channel that we're going to use for communications. This enables racing, etc.
 //
 uint8_t select_comm_channel() {
-  if(!comp_mode) return 1;
+  if(!comp_mode) return NOWCOMM_CHANNEL_AUTO;
 
-  uint8_t chan  = random(13) + 1;
+  uint8_t chan  = random(NOWCOMM_SCAN_LAST) + 1;
   M5.Lcd.drawString("CHAN",    8,  4, 2);
-  M5.Lcd.drawString("1 - 14",  8, 28, 1);
+  M5.Lcd.drawString("1 - " + String(NOWCOMM_SCAN_LAST), 8, 28, 1);
   M5.Lcd.drawString("A = +",   8, 46, 1);
   M5.Lcd.drawString("B = Set", 8, 64, 1);
   M5.Lcd.setTextDatum(TR_DATUM);
@@ -77,7 +107,7 @@ uint8_t select_comm_channel() {
     if(M5.BtnB.wasReleased()) break;  // EXIT THE LOOP BY PRESSING B
     if(M5.BtnA.wasReleased()) {
       chan++;
-      if(14 < chan) {
+      if(NOWCOMM_SCAN_LAST < chan) {
         chan = 1;
         M5.Lcd.fillRect(60, 2, 100, 80, BG_COLOR);
       }
@@ -89,57 +119,111 @@ uint8_t select_comm_channel() {
 }
 
 
-// Put X, Y and Button values in globals JoyX, JoyB, JoyB
-//
-void read_joystick() {
-  Wire.beginTransmission(JOY_ADDR);
-  Wire.write(0x02);
-  Wire.endTransmission();
-  Wire.requestFrom(JOY_ADDR, 3);
-  if (Wire.available()) {
-    JoyX = Wire.read();
-    JoyY = Wire.read();
-    JoyB = Wire.read() > 0 ? false : true;  // Button value is inverted
-  }
-}
-
-
-// Broadcast a BugComm_Discovery until someone responds with a valid packet
+// Broadcast a BugComm_Discovery until FLEET_SIZE receivers respond with valid packets
 //
 bool pair_with_receiver() {
   if(comp_mode) {
+    char chan[16];
+    snprintf(chan, sizeof(chan), "on channel %u", bug_comm.get_channel());
     M5.Lcd.fillScreen(BG_COLOR);
     M5.Lcd.drawCentreString("Waiting for Pairing", 80, 20, 2);
-    M5.Lcd.drawCentreString("on channel " + String(bug_comm.get_channel()), 80, 40, 2);
+    M5.Lcd.drawCentreString(chan, 80, 40, 2);
   }
   else {
-    M5.Lcd.fillScreen(TFT_BLACK);
     print_mac_address(TFT_RED);
   }
-  while(!bug_comm.is_connected()) {
-    bug_comm.send_discovery();
-    delay(500);
-    if(bug_comm.is_data_ready() && NOWCOMM_KIND_DISCOVERY == bug_comm.get_msg_kind()) {
-      Serial.println("Discovery response received.");
-      if(bug_comm.process_discovery_response()) {
-        print_mac_address(TFT_GREEN);
-      }
-    }
+  while(!bug_comm.service_pairing()) {
+    delay(1);                             // Plenty fine for 8 ms scan slots; service_pairing() keeps its own time
   }
+  Serial.printf("%s on channel %u in %lu ms: %u discovery frames, %u channel hops\n", bug_comm.is_resumed() ? "Reconnected" : "Paired",
+                bug_comm.get_channel(), bug_comm.get_time_to_pair() / 1000, bug_comm.get_discoveries_sent(), bug_comm.get_channel_hops());
+  hud.invalidate();                       // Competition mode drew over it
+  print_mac_address(TFT_GREEN);
   return true;
 }
 
 
-void process_joystick() {
-  read_joystick();
-  bug_comm.send_command(JoyX, JoyY, JoyB);
+// Every STATS_PERIOD_MS, print what the pipeline, the send scheduler and the link have been doing.
+// The radio task owns bug_comm, so the numbers come from it: ask, then pick the report up on a later loop.
+//
+void report_send_stats() {
+  static unsigned long  last_report = 0;
+  static bool           requested   = false;
+  static BugPipelineReport report;
+  if(!requested) {
+    if(millis() - last_report < STATS_PERIOD_MS) return;
+    last_report = millis();
+    pipeline.request_report();
+    requested = true;
+  }
+  if(!pipeline.get_report(report)) return;
+  requested = false;
+  for(uint8_t i = 0; i < BUG_STAGES; i++) {
+    const BugStageStats& stage = report.stages[i];
+    Serial.printf("Stage %-8s %5u: p50 %5u us, p99 %5u us, max %5u us; %u over %u us\n", bug_stage_names[i], stage.count,
+                  stage.p50_us, stage.p99_us, stage.max_us, stage.over_budget, stage.budget_us);
+  }
+  Serial.printf("Queued %u samples (%u overruns), %u commands (%u overruns); display %u frames, %u us max, %u late\n",
+                report.samples, report.sample_overruns, report.commands, report.command_overruns,
+                report.display_frames, report.display_max_us, report.display_over_budget);
+  SendStats& stats = report.send;
+  Serial.printf("Sent %u frames (%u keepalives), coalesced %u changes, %.1f frames/s\n",
+                stats.frames_sent, stats.keepalives, stats.frames_coalesced, stats.update_hz);
+  NowComm_LinkStats& link = report.link;
+  Serial.printf("Acked %u of %u, lost %u, duplicated %u, tx failed %u; RTT p50 %u us, p99 %u us, max %u us\n",
+                link.acked, link.sent, link.lost, link.duplicated, link.tx_failed, link.rtt_p50_us, link.rtt_p99_us, link.rtt_max_us);
+  NowComm_HopStats& hops = report.hop;
+  if(hops.hops) {
+    Serial.printf("Hopped %u times (%u aborted, %u reverted); last %u -> %u in %u ms, %u ms outage, %.1f%% loss after\n",
+                  hops.hops, hops.aborted, hops.reverted, hops.from_channel, hops.to_channel, hops.latency_us / 1000,
+                  hops.outage_us / 1000, hops.post_hop_loss_permille / 10.0);
+  }
 }
 
 
+// Every STATS_PERIOD_MS, print what the HUD has been drawing. Called from the display task, which owns it.
+//
+void report_display_stats() {
+  static unsigned long  last_report = 0;
+  HudStats              display;
+  if(millis() - last_report < STATS_PERIOD_MS) return;
+  last_report = millis();
+  hud.get_stats(display);
+  Serial.printf("Display drew %u of %u frames, %u fields, %u pixels; %u us average, %u us max\n", display.frames_drawn,
+                display.frames, display.fields_drawn, display.pixels_pushed,
+                display.frames_drawn ? display.render_us / display.frames_drawn : 0, display.render_max_us);
+  hud.reset_stats();
+}
+
+
+// The BugC's battery, from the telemetry on its responses. "--" until it has reported one.
+//
 void display_battery_voltage() {
-  M5.Lcd.setTextColor((0 <= JoyX) ? TFT_GREEN : TFT_RED);
-  M5.Lcd.fillRect(40, 64, 80, 16, TFT_BLACK);
-  M5.Lcd.drawCentreString(String(JoyX)+"/"+String(JoyY), 80, 64, 2);
+  BugTelemetry  telemetry;
+  unsigned long age_us;
+  if(!pipeline.get_telemetry(telemetry, age_us) || 0 == telemetry.millivolts) {
+    battery_field->set_color(FG_COLOR);
+    battery_field->set("--");
+    return;
+  }
+  battery_field->set_color(age_us >= LINK_TIMEOUT_MS * 1000UL ? FG_COLOR : telemetry.millivolts < BATTERY_LOW_MV ? TFT_RED : TFT_GREEN);
+  battery_field->printf("%u.%02uV", telemetry.millivolts / 1000, telemetry.millivolts % 1000 / 10);
+}
+
+
+// Bring the bottom line up to date and send the LCD whatever changed. Nothing is drawn or pushed for a
+// field that reads as it did last time, which is most of them, most of the time.
+// The pipeline's display task calls this, on the other core from the radio; what it shows of the link
+// is what the radio task publishes.
+//
+void update_display(void* context) {
+  bool linked = micros() - pipeline.get_peer_last_seen() < LINK_TIMEOUT_MS * 1000UL;
+  link_field->set(linked ? "LINK" : "LOST");
+  link_field->set_color(linked ? TFT_GREEN : TFT_RED);
+  channel_field->printf("Chan %u", pipeline.get_channel());
+  display_battery_voltage();
+  hud.render();
+  report_display_stats();
 }
 
 
@@ -147,21 +231,37 @@ void setup() {
   if(digitalRead(BUTTON_A_PIN) == 0) {
     comp_mode = true;
   }
+  if(digitalRead(BUTTON_B_PIN) == 0) {
+    bond_store.clear();                   // Pair from scratch
+  }
   M5.begin();
   Wire.begin(0, 26, 100000);
   M5.Lcd.setRotation(1);
   M5.Lcd.setTextColor(FG_COLOR, BG_COLOR);
   M5.Lcd.fillScreen(BG_COLOR);
+  setup_hud();
 
+  nowcomm_log().enable(TRACE_LOG);
+  if(TRACE_LOG) nowcomm_log().start();
+  nowcomm_capture().enable(CAPTURE_PACKETS);
+  bug_comm.set_discovery_limit(FLEET_SIZE);
+  bug_comm.set_bond_store(&bond_store);
   bug_comm.begin(NOWCOMM_MODE_CONTROLLER, select_comm_channel());
+  bug_comm.set_send_rate(SEND_RATE_HZ, SEND_KEEPALIVE_HZ);
+  bug_comm.set_hopping(!comp_mode);
+  bug_comm.set_redundancy(COMMAND_COPIES);
   pair_with_receiver();
-  M5.Lcd.fillScreen(BLACK);
-  print_mac_address(TFT_GREEN);
+  pipeline.set_display(update_display, nullptr);
+  pipeline.start(JOY_SAMPLE_HZ);
+  Serial.printf("Driving %lu ms after boot\n", millis());
 }
 
 
 void loop() {
   m5.update();
-  process_joystick();
-  delay(100);
+  if(CAPTURE_PACKETS && M5.BtnB.wasReleased()) {
+    Serial.printf("Capture: %u frames dumped\n", nowcomm_capture().dump(Serial));
+  }
+  report_send_stats();
+  delay(LOOP_DELAY_MS);
 }
@@ -0,0 +1,58 @@
+// Host tool: turn a NowComm binary log back into text.
+// Reads a capture of the M5StickC's Serial (or anything NowCommLog::drain() wrote) from the files named,
+// or from stdin, and writes it to stdout: each record as a line, and the text it was mixed with as it was.
+// A count of records, and of any the log had to drop, goes to stderr.
+//
+// pio run -e native_logdecode && .pio/build/native_logdecode/program capture.bin
+// pio device monitor --raw | .pio/build/native_logdecode/program
+
+#include <NowCommLog.h>
+
+
+static bool           line_open = false;      // Text written since the last newline
+static unsigned long  dropped   = 0;
+
+
+static void on_text(uint8_t c) {
+  putchar(c);
+  line_open = '\n' != c;
+}
+
+
+static void on_record(const NowComm_LogRecord& record) {
+  char text[128];
+  if(line_open) putchar('\n');
+  nowcomm_log_format(record, text, sizeof(text));
+  puts(text);
+  line_open = false;
+  if(NOWCOMM_LOG_DROPPED == record.event) dropped += record.c;
+}
+
+
+static void decode(FILE* in, NowCommLogDecoder& decoder) {
+  uint8_t buffer[4096];
+  size_t  got;
+  while(0 < (got = fread(buffer, 1, sizeof(buffer), in))) {
+    decoder.put(buffer, got, on_record, on_text);
+    fflush(stdout);                           // Keep up with a live monitor
+  }
+}
+
+
+int main(int argc, char** argv) {
+  NowCommLogDecoder decoder;
+  if(1 == argc) decode(stdin, decoder);
+  for(int i = 1; i < argc; i++) {
+    FILE* in = fopen(argv[i], "rb");
+    if(nullptr == in) {
+      fprintf(stderr, "%s: can't open %s\n", argv[0], argv[i]);
+      return 1;
+    }
+    decode(in, decoder);
+    fclose(in);
+  }
+  decoder.finish(on_text);
+  if(line_open) putchar('\n');
+  fprintf(stderr, "%u records, %lu dropped by the log\n", decoder.get_records(), dropped);
+  return 0;
+}
@@ -0,0 +1,133 @@
+// Host tool: run a NowComm packet capture back through the BugComm receiver in this tree.
+// Reads the traces named: a file NowCommCapture::open() wrote on a host, or a capture of the M5StickC's
+// Serial with a dump() in it (anything else in there is skipped). The commands in them are replayed
+// into a receiver as fast as it will take them, or at the speed they were recorded with -r, and the
+// frames per second decoded are reported on stderr.
+//   -r          replay at recorded speed
+//   -n PASSES   replay the trace this many times, for a steadier rate
+//   -a MAC      the receiver to replay as, aa:bb:cc:dd:ee:ff, for a controller's multiplexed frames
+//   -w FILE     write what the receiver decoded, a line per command: the golden values for later runs
+//   -g FILE     check what the receiver decodes against golden values, on every pass
+//   -v          print what the receiver decoded
+// Exits non-zero if a command differs from the golden values, or there were none to replay.
+//
+// pio run -e native_replay && .pio/build/native_replay/program -g golden.txt capture.bin
+
+#include <string>
+#include <vector>
+#include <BugComm.h>
+#include <BugReplay.h>
+
+
+static void usage(const char* name) {
+  fprintf(stderr, "usage: %s [-r] [-n passes] [-a mac] [-w golden | -g golden] [-v] trace...\n", name);
+}
+
+
+static void format_output(const BugReplayOutput& output, char* text, size_t size) {
+  snprintf(text, size, "seq %5u  speeds %4d %4d %4d %4d  lights %06lX %06lX  button %u", output.seq,
+           output.speeds[0], output.speeds[1], output.speeds[2], output.speeds[3],
+           (unsigned long)output.color_left, (unsigned long)output.color_right, output.button);
+}
+
+
+static bool read_trace(const char* path, NowCommCaptureReader& reader, BugReplay<>& replay) {
+  FILE* in = fopen(path, "rb");
+  if(nullptr == in) return false;
+  uint8_t buffer[4096];
+  size_t  got;
+  while(0 < (got = fread(buffer, 1, sizeof(buffer), in))) {
+    reader.put(buffer, got, [&](const NowComm_CaptureRecord& record) { replay.add(record); });
+  }
+  fclose(in);
+  return true;
+}
+
+
+static bool read_golden(const char* path, std::vector<std::string>& lines) {
+  FILE* in = fopen(path, "r");
+  if(nullptr == in) return false;
+  char line[128];
+  while(fgets(line, sizeof(line), in)) {
+    line[strcspn(line, "\r\n")] = 0;
+    if(line[0]) lines.push_back(line);
+  }
+  fclose(in);
+  return true;
+}
+
+
+int main(int argc, char** argv) {
+  BugReplay<>               replay;
+  NowCommCaptureReader      reader;
+  std::vector<std::string>  golden;
+  const char*               golden_path = nullptr;
+  FILE*                     write_to    = nullptr;
+  bool                      realtime    = false;
+  bool                      verbose     = false;
+  bool                      checking    = false;
+  uint32_t                  passes      = 1;
+  int                       traces      = 0;
+  for(int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool        has = i + 1 < argc;
+    if("-r" == arg) realtime = true;
+    else if("-v" == arg) verbose = true;
+    else if("-n" == arg && has) passes = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    else if("-a" == arg && has) {
+      unsigned m[6];
+      uint8_t  mac[6];
+      if(6 != sscanf(argv[++i], "%x:%x:%x:%x:%x:%x", &m[0], &m[1], &m[2], &m[3], &m[4], &m[5])) { usage(argv[0]); return 2; }
+      for(int j = 0; j < 6; j++) mac[j] = (uint8_t)m[j];
+      replay.set_receiver(mac);
+    }
+    else if("-w" == arg && has) {
+      golden_path = argv[++i];
+      write_to    = fopen(golden_path, "w");
+      if(nullptr == write_to) { fprintf(stderr, "%s: can't write %s\n", argv[0], golden_path); return 2; }
+    }
+    else if("-g" == arg && has) {
+      golden_path = argv[++i];
+      checking    = true;
+      if(!read_golden(golden_path, golden)) { fprintf(stderr, "%s: can't open %s\n", argv[0], golden_path); return 2; }
+    }
+    else if('-' == arg[0]) { usage(argv[0]); return 2; }
+    else if(read_trace(argv[i], reader, replay)) traces++;
+    else { fprintf(stderr, "%s: can't open %s\n", argv[0], argv[i]); return 2; }
+  }
+  if(0 == traces || 0 == passes) { usage(argv[0]); return 2; }
+
+  BugReplayStats  stats;
+  uint32_t        index       = 0;
+  uint32_t        mismatches  = 0;
+  if(write_to) passes = 1;                    // The golden values are one pass's
+  replay.run(realtime, passes, [&](const BugReplayOutput& output) {
+    char text[128];
+    format_output(output, text, sizeof(text));
+    if(verbose)  puts(text);
+    if(write_to) fprintf(write_to, "%s\n", text);
+    if(checking) {
+      const char* want = golden.empty() ? "(nothing)" : golden[index % golden.size()].c_str();
+      if(0 != strcmp(want, text)) {
+        if(10 > mismatches) fprintf(stderr, "command %u\n  got  %s\n  want %s\n", index, text, want);
+        mismatches++;
+      }
+    }
+    index++;
+  }, stats);
+  if(write_to) fclose(write_to);
+
+  double seconds = stats.us / 1e6;
+  fprintf(stderr, "%u records read (%u bytes skipped); %u frames replayed in %u pass%s, %u commands decoded, %u rejected, %u skipped\n",
+          reader.get_records(), reader.get_skipped(), stats.frames, passes, 1 == passes ? "" : "es",
+          stats.commands, stats.rejected, stats.skipped);
+  fprintf(stderr, "%.3f s: %.0f frames/s, %.0f commands/s decoded%s\n", seconds,
+          seconds > 0 ? stats.frames / seconds : 0.0, seconds > 0 ? stats.commands / seconds : 0.0, realtime ? " (recorded speed)" : "");
+  if(checking) {
+    if(stats.commands != golden.size() * passes) mismatches++;
+    fprintf(stderr, "%s: %u commands against %u golden values, %u mismatched\n", mismatches ? "FAILED" : "OK",
+            stats.commands, (uint32_t)golden.size(), mismatches);
+  }
+  if(write_to) fprintf(stderr, "wrote %u golden values to %s\n", stats.commands, golden_path);
+  return (0 == stats.frames || mismatches) ? 1 : 0;
+}